@@ -0,0 +1,540 @@
+#include "dtacan/Encoder.h"
+#include "dtacan/IsoTp.h"
+#include "dtacan/ParallelParser.h"
+#include "dtacan/Parser.h"
+#include "dtacan/SubmitQueue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace dtacan;
+
+namespace {
+
+// Small deterministic generator so traces are identical on every platform and release
+class Random {
+public:
+    explicit Random(uint64_t seed)
+        : _state(seed ? seed : 1)
+    {
+    }
+
+    uint32_t next()
+    {
+        _state ^= _state << 13;
+        _state ^= _state >> 7;
+        _state ^= _state << 17;
+        return (uint32_t)(_state >> 16);
+    }
+
+    uint32_t below(uint32_t n)
+    {
+        return next() % n;
+    }
+
+private:
+    uint64_t _state;
+};
+
+enum class FrameMix {
+    Std,
+    Ext,
+    Mixed,
+    // 64 byte CAN FD frames with bit rate switch
+    Fd,
+};
+
+struct Trace {
+    std::string data;
+    std::size_t frames;
+};
+
+void appendHex(std::string* dest, uint32_t value, std::size_t digits)
+{
+    while (digits != 0) {
+        digits--;
+        dest->push_back(nibbleToChar((value >> (digits * 4)) & 0xf));
+    }
+}
+
+// Junk lines replace frames with given probability, in permille
+Trace generateTrace(FrameMix mix, unsigned junkPermille, std::size_t frameNum, uint64_t seed)
+{
+    Random rnd(seed);
+    Trace trace;
+    trace.frames = 0;
+    for (std::size_t i = 0; i < frameNum; i++) {
+        if (rnd.below(1000) < junkPermille) {
+            std::size_t size = 1 + rnd.below(20);
+            for (std::size_t j = 0; j < size; j++) {
+                trace.data.push_back("xyz#!qwe"[rnd.below(8)]);
+            }
+            trace.data.push_back('\r');
+            continue;
+        }
+        bool ext = mix == FrameMix::Ext || (mix == FrameMix::Mixed && rnd.below(2));
+        std::size_t size = mix == FrameMix::Mixed ? rnd.below(9) : (mix == FrameMix::Fd ? 64 : 8);
+        if (mix == FrameMix::Fd) {
+            trace.data.push_back('b');
+            appendHex(&trace.data, rnd.next() & 0x7ff, 3);
+        } else if (ext) {
+            trace.data.push_back('T');
+            appendHex(&trace.data, rnd.next() & 0x1fffffff, 8);
+        } else {
+            trace.data.push_back('t');
+            appendHex(&trace.data, rnd.next() & 0x7ff, 3);
+        }
+        trace.data.push_back(nibbleToChar(fdSizeToDlc(size)));
+        for (std::size_t j = 0; j < size; j++) {
+            appendHex(&trace.data, rnd.below(256), 2);
+        }
+        trace.data.push_back('\r');
+        trace.frames++;
+    }
+    return trace;
+}
+
+class CountingParser : public Parser<CountingParser> {
+public:
+    void handleData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        frames++;
+        checksum += address + size + (size ? data[size - 1] : 0);
+    }
+
+    void handleFdData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        handleData(address, data, size);
+    }
+
+    void handleJunk(const uint8_t* junk, std::size_t size)
+    {
+        (void)junk;
+        junkBytes += size;
+    }
+
+    std::size_t frames = 0;
+    std::size_t junkBytes = 0;
+    uint64_t checksum = 0;
+};
+
+class CountingParallelParser : public ParallelParser<CountingParallelParser> {
+public:
+    void handleFrames(const Frame* frames, std::size_t count)
+    {
+        this->frames += count;
+        for (std::size_t i = 0; i < count; i++) {
+            checksum += frames[i].address + frames[i].size + (frames[i].size ? frames[i].data[frames[i].size - 1] : 0);
+        }
+    }
+
+    void handleFdData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        frames++;
+        checksum += address + size + (size ? data[size - 1] : 0);
+    }
+
+    std::size_t frames = 0;
+    uint64_t checksum = 0;
+};
+
+class CountingEncoder : public Encoder<CountingEncoder> {
+public:
+    void handleEncodedData(const char* str, std::size_t size)
+    {
+        bytes += size;
+        checksum += str[size - 2];
+    }
+
+    std::size_t bytes = 0;
+    uint64_t checksum = 0;
+};
+
+class CountingSubmitQueue : public SubmitQueue<CountingSubmitQueue> {
+public:
+    void handleEncodedData(const char* str, std::size_t size)
+    {
+        bytes += size;
+        checksum += str[size - 2];
+    }
+
+    std::size_t bytes = 0;
+    uint64_t checksum = 0;
+};
+
+class CountingIsoTp : public IsoTp<CountingIsoTp, 4, 8192> {
+public:
+    void handleEncodedData(const char* str, std::size_t size)
+    {
+        wire.append(str, size);
+    }
+
+    void handleMessage(const IsoTpAddress& address, const uint8_t* data, std::size_t size)
+    {
+        messages++;
+        checksum += address.rxAddress + size + data[size - 1];
+    }
+
+    std::string wire;
+    std::size_t messages = 0;
+    uint64_t checksum = 0;
+};
+
+// Feeds frames encoded by one ISO-TP node to the other one
+class IsoTpLink : public Parser<IsoTpLink> {
+public:
+    explicit IsoTpLink(CountingIsoTp* target)
+        : target(target)
+    {
+    }
+
+    void handleData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        frames++;
+        target->acceptFrame(address, isExtendedFrame(), data, size, 0);
+    }
+
+    std::size_t deliver(CountingIsoTp* from)
+    {
+        std::size_t size = from->wire.size();
+        _data.swap(from->wire);
+        from->wire.clear();
+        acceptData(_data.data(), _data.size());
+        _data.clear();
+        return size;
+    }
+
+    CountingIsoTp* target;
+    std::size_t frames = 0;
+
+private:
+    std::string _data;
+};
+
+struct Result {
+    std::string name;
+    double bytes;
+    double frames;
+    double seconds;
+    uint64_t checksum;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+struct Options {
+    double minTime = 0.5;
+    uint64_t seed = 0x5eed;
+    std::size_t frameNum = 100000;
+    const char* filter = nullptr;
+    const char* jsonPath = nullptr;
+};
+
+class Bench {
+public:
+    explicit Bench(const Options& options)
+        : _options(options)
+    {
+    }
+
+    bool selected(const std::string& name) const
+    {
+        return !_options.filter || name.find(_options.filter) != std::string::npos;
+    }
+
+    void parse(const std::string& name, const Trace& trace, std::size_t chunkSize)
+    {
+        if (!selected(name)) {
+            return;
+        }
+        CountingParser parser;
+        const char* data = trace.data.data();
+        std::size_t size = trace.data.size();
+        std::size_t rounds = 0;
+        Clock::time_point start = Clock::now();
+        double elapsed;
+        do {
+            for (std::size_t offset = 0; offset < size; offset += chunkSize) {
+                parser.acceptData(data + offset, std::min(chunkSize, size - offset));
+            }
+            rounds++;
+            elapsed = secondsSince(start);
+        } while (elapsed < _options.minTime);
+        if (parser.frames != trace.frames * rounds) {
+            std::fprintf(stderr, "%s: decoded %zu frames, expected %zu\n", name.c_str(), parser.frames,
+                         trace.frames * rounds);
+            std::exit(1);
+        }
+        report(name, double(size) * rounds, double(parser.frames), elapsed, parser.checksum);
+    }
+
+    // Trace is repeated to a buffer of several chunks per worker, so every worker has something to do
+    void parseParallel(const std::string& name, const Trace& trace, std::size_t workerCount)
+    {
+        if (!selected(name)) {
+            return;
+        }
+        const std::size_t chunkSize = 1024 * 1024;
+        std::size_t copies = (chunkSize * workerCount * 4) / trace.data.size() + 1;
+        std::string data;
+        for (std::size_t i = 0; i < copies; i++) {
+            data += trace.data;
+        }
+        CountingParallelParser parser;
+        parser.setChunkSize(chunkSize);
+        std::size_t rounds = 0;
+        Clock::time_point start = Clock::now();
+        double elapsed;
+        do {
+            parser.parse(data.data(), data.size(), workerCount);
+            rounds++;
+            elapsed = secondsSince(start);
+        } while (elapsed < _options.minTime);
+        if (parser.frames != trace.frames * copies * rounds) {
+            std::fprintf(stderr, "%s: decoded %zu frames, expected %zu\n", name.c_str(), parser.frames,
+                         trace.frames * copies * rounds);
+            std::exit(1);
+        }
+        report(name, double(data.size()) * rounds, double(parser.frames), elapsed, parser.checksum);
+    }
+
+    template <typename F>
+    void encode(const std::string& name, std::size_t framesPerCall, F&& transmit)
+    {
+        if (!selected(name)) {
+            return;
+        }
+        CountingEncoder encoder;
+        std::size_t calls = 0;
+        Clock::time_point start = Clock::now();
+        double elapsed;
+        do {
+            for (unsigned i = 0; i < 1024; i++) {
+                transmit(encoder, calls + i);
+            }
+            calls += 1024;
+            elapsed = secondsSince(start);
+        } while (elapsed < _options.minTime);
+        report(name, double(encoder.bytes), double(calls * framesPerCall), elapsed, encoder.checksum);
+    }
+
+    // Whole transfers between two nodes, encoding, parsing and reassembly included
+    void isoTp(const std::string& name, const uint8_t* payload, std::size_t size, uint8_t blockSize)
+    {
+        if (!selected(name)) {
+            return;
+        }
+        IsoTpAddress testerAddress = {0x7e0, 0x7e8, false};
+        IsoTpAddress ecuAddress = {0x7e8, 0x7e0, false};
+        std::unique_ptr<CountingIsoTp> tester(new CountingIsoTp);
+        std::unique_ptr<CountingIsoTp> ecu(new CountingIsoTp);
+        tester->openSession(testerAddress);
+        ecu->openSession(ecuAddress);
+        ecu->setFlowControl(blockSize, 0);
+        IsoTpLink toEcu(ecu.get());
+        IsoTpLink toTester(tester.get());
+        double bytes = 0;
+        Clock::time_point start = Clock::now();
+        double elapsed;
+        do {
+            for (unsigned i = 0; i < 64; i++) {
+                tester->send(testerAddress, payload, size, 0);
+                while (!tester->wire.empty()) {
+                    bytes += toEcu.deliver(tester.get());
+                    bytes += toTester.deliver(ecu.get());
+                }
+            }
+            elapsed = secondsSince(start);
+        } while (elapsed < _options.minTime);
+        report(name, bytes, double(toEcu.frames + toTester.frames), elapsed, ecu->checksum);
+    }
+
+    // Frames are sent from several threads either through one mutex guarded Encoder or through SubmitQueue
+    // drained by this thread
+    void submit(const std::string& name, std::size_t producerNum, bool useQueue)
+    {
+        if (!selected(name)) {
+            return;
+        }
+        const std::size_t framesPerProducer = 100000;
+        CountingEncoder encoder;
+        CountingSubmitQueue queue;
+        std::mutex mutex;
+        std::vector<std::thread> producers;
+        std::atomic<std::size_t> running(producerNum);
+        Clock::time_point start = Clock::now();
+        for (std::size_t p = 0; p < producerNum; p++) {
+            producers.emplace_back([&, p]() {
+                uint8_t data[8] = {uint8_t(p)};
+                for (std::size_t i = 0; i < framesPerProducer; i++) {
+                    data[1] = uint8_t(i);
+                    if (useQueue) {
+                        queue.submit(i & 0x7ff, data, 8, false);
+                    } else {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        encoder.transmitStdFrame(i & 0x7ff, data, 8);
+                    }
+                }
+                running--;
+            });
+        }
+        while (useQueue && running != 0) {
+            if (queue.drain() == 0) {
+                std::this_thread::yield();
+            }
+        }
+        for (std::thread& t : producers) {
+            t.join();
+        }
+        queue.drain();
+        double elapsed = secondsSince(start);
+        double frames = double(producerNum * framesPerProducer);
+        if (useQueue) {
+            report(name, double(queue.bytes), frames, elapsed, queue.checksum);
+        } else {
+            report(name, double(encoder.bytes), frames, elapsed, encoder.checksum);
+        }
+    }
+
+    bool writeJson() const
+    {
+        if (!_options.jsonPath) {
+            return true;
+        }
+        std::FILE* file = std::fopen(_options.jsonPath, "w");
+        if (!file) {
+            std::perror(_options.jsonPath);
+            return false;
+        }
+        std::fprintf(file, "{\n  \"seed\": %llu,\n  \"frames\": %zu,\n  \"results\": [\n",
+                     (unsigned long long)_options.seed, _options.frameNum);
+        for (std::size_t i = 0; i < _results.size(); i++) {
+            const Result& r = _results[i];
+            std::fprintf(file,
+                         "    {\"name\": \"%s\", \"mb_per_s\": %.3f, \"frames_per_s\": %.1f, \"ns_per_frame\": %.3f, "
+                         "\"seconds\": %.3f, \"checksum\": %llu}%s\n",
+                         r.name.c_str(), r.bytes / r.seconds / 1e6, r.frames / r.seconds, r.seconds * 1e9 / r.frames,
+                         r.seconds, (unsigned long long)r.checksum, i + 1 == _results.size() ? "" : ",");
+        }
+        std::fprintf(file, "  ]\n}\n");
+        return std::fclose(file) == 0;
+    }
+
+private:
+    void report(const std::string& name, double bytes, double frames, double seconds, uint64_t checksum)
+    {
+        Result r = {name, bytes, frames, seconds, checksum};
+        _results.push_back(r);
+        std::printf("%-32s %10.2f MB/s %12.0f frames/s %9.2f ns/frame\n", name.c_str(), bytes / seconds / 1e6,
+                    frames / seconds, seconds * 1e9 / frames);
+        std::fflush(stdout);
+    }
+
+    Options _options;
+    std::vector<Result> _results;
+};
+
+void usage(const char* name)
+{
+    std::printf("usage: %s [--json FILE] [--filter SUBSTR] [--min-time SEC] [--seed N] [--frames N]\n", name);
+}
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (!std::strcmp(arg, "--json") && hasValue) {
+            options.jsonPath = argv[++i];
+        } else if (!std::strcmp(arg, "--filter") && hasValue) {
+            options.filter = argv[++i];
+        } else if (!std::strcmp(arg, "--min-time") && hasValue) {
+            options.minTime = std::atof(argv[++i]);
+        } else if (!std::strcmp(arg, "--seed") && hasValue) {
+            options.seed = std::strtoull(argv[++i], nullptr, 0);
+        } else if (!std::strcmp(arg, "--frames") && hasValue) {
+            options.frameNum = std::strtoull(argv[++i], nullptr, 0);
+        } else {
+            usage(argv[0]);
+            return arg == std::string("--help") ? 0 : 1;
+        }
+    }
+
+    struct TraceKind {
+        const char* name;
+        FrameMix mix;
+        unsigned junkPermille;
+    };
+    const TraceKind kinds[] = {
+        {"std", FrameMix::Std, 0},
+        {"ext", FrameMix::Ext, 0},
+        {"mixed", FrameMix::Mixed, 0},
+        {"junk1", FrameMix::Mixed, 10},
+        {"junk10", FrameMix::Mixed, 100},
+        {"fd64", FrameMix::Fd, 0},
+    };
+    const std::size_t chunkSizes[] = {1, 64 * 1024};
+
+    Bench bench(options);
+    for (const TraceKind& kind : kinds) {
+        Trace trace = generateTrace(kind.mix, kind.junkPermille, options.frameNum, options.seed);
+        for (std::size_t chunkSize : chunkSizes) {
+            std::string name = std::string("parse/") + kind.name + "/chunk" + std::to_string(chunkSize);
+            bench.parse(name, trace, chunkSize);
+        }
+    }
+
+    Trace mixed = generateTrace(FrameMix::Mixed, 0, options.frameNum, options.seed);
+    std::size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t workers = 1; workers <= 16; workers *= 2) {
+        if (workers == 1 || workers <= cores) {
+            bench.parseParallel("parse/mixed/parallel" + std::to_string(workers), mixed, workers);
+        }
+    }
+
+    uint8_t payload[4096];
+    Random rnd(options.seed);
+    for (uint8_t& b : payload) {
+        b = rnd.below(256);
+    }
+    bench.encode("encode/transmitStdFrame", 1, [&payload](CountingEncoder& e, std::size_t i) {
+        e.transmitStdFrame(i & 0x7ff, payload + (i & 0xff), 8);
+    });
+    bench.encode("encode/transmitExtFrame", 1, [&payload](CountingEncoder& e, std::size_t i) {
+        e.transmitExtFrame(i & 0x1fffffff, payload + (i & 0xff), 8);
+    });
+    bench.encode("encode/transmitData/64", 8, [&payload](CountingEncoder& e, std::size_t i) {
+        e.transmitData(0x123, payload + (i & 0xff), 64);
+    });
+    bench.encode("encode/transmitData/4096", 512, [&payload](CountingEncoder& e, std::size_t) {
+        e.transmitData(0x123, payload, sizeof(payload));
+    });
+    bench.encode("encode/transmitFdData/4096", 64, [&payload](CountingEncoder& e, std::size_t) {
+        e.transmitFdData(0x123, payload, sizeof(payload), true);
+    });
+
+    bench.isoTp("isotp/4096/bs0", payload, sizeof(payload), 0);
+    bench.isoTp("isotp/4096/bs8", payload, sizeof(payload), 8);
+
+    for (std::size_t producerNum : {1, 4}) {
+        bench.submit("submit/mutex/" + std::to_string(producerNum), producerNum, false);
+        bench.submit("submit/queue/" + std::to_string(producerNum), producerNum, true);
+    }
+
+    return bench.writeJson() ? 0 : 1;
+}
@@ -0,0 +1,269 @@
+#include "dtacan/Hex.h"
+#include "dtacan/Parser.h"
+#include "dtacan/Encoder.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace dtacan;
+
+// charToNibble as it was before the lookup table, kept as the baseline
+static uint8_t switchCharToNibble(char c)
+{
+    switch (c) {
+    case '0':
+        return 0;
+    case '1':
+        return 1;
+    case '2':
+        return 2;
+    case '3':
+        return 3;
+    case '4':
+        return 4;
+    case '5':
+        return 5;
+    case '6':
+        return 6;
+    case '7':
+        return 7;
+    case '8':
+        return 8;
+    case '9':
+        return 9;
+    case 'A':
+        return 10;
+    case 'B':
+        return 11;
+    case 'C':
+        return 12;
+    case 'D':
+        return 13;
+    case 'E':
+        return 14;
+    case 'F':
+        return 15;
+    }
+    return 0xff;
+}
+
+// nibbleToChar and encodeHexStream as they were before the lookup tables
+static char switchNibbleToChar(uint8_t nibble)
+{
+    switch (nibble) {
+    case 0:
+        return '0';
+    case 1:
+        return '1';
+    case 2:
+        return '2';
+    case 3:
+        return '3';
+    case 4:
+        return '4';
+    case 5:
+        return '5';
+    case 6:
+        return '6';
+    case 7:
+        return '7';
+    case 8:
+        return '8';
+    case 9:
+        return '9';
+    case 10:
+        return 'A';
+    case 11:
+        return 'B';
+    case 12:
+        return 'C';
+    case 13:
+        return 'D';
+    case 14:
+        return 'E';
+    }
+    return 'F';
+}
+
+static void switchEncodeHexStream(const uint8_t* data, char* dest, std::size_t size)
+{
+    for (std::size_t i = 0; i < size; i++) {
+        dest[i * 2] = switchNibbleToChar((data[i] & 0xf0) >> 4);
+        dest[i * 2 + 1] = switchNibbleToChar(data[i] & 0x0f);
+    }
+}
+
+// Frame field decoding as done by Parser::acceptData before, nibble by nibble
+static bool switchDecodeFrameFields(const char* src, std::size_t available, std::size_t addrSize, std::size_t dataSize,
+                                    uint32_t* address, uint8_t* data)
+{
+    (void)available;
+    uint32_t value = 0;
+    for (std::size_t i = 0; i < addrSize; i++) {
+        uint8_t n = switchCharToNibble(src[i]);
+        if (n == 0xff) {
+            return false;
+        }
+        value = (value << 4) | n;
+    }
+    *address = value;
+    if (switchCharToNibble(src[addrSize]) == 0xff) {
+        return false;
+    }
+    src += addrSize + 1;
+    for (std::size_t i = 0; i < dataSize; i++) {
+        uint8_t l = switchCharToNibble(src[0]);
+        if (l == 0xff) {
+            return false;
+        }
+        uint8_t r = switchCharToNibble(src[1]);
+        if (r == 0xff) {
+            return false;
+        }
+        data[i] = (l << 4) | r;
+        src += 2;
+    }
+    return true;
+}
+
+struct FrameRef {
+    std::size_t offset;
+    std::size_t addrSize;
+    std::size_t dataSize;
+};
+
+class CountingParser : public Parser<CountingParser> {
+public:
+    void handleData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        frames++;
+        checksum += address + size + (size ? data[0] : 0);
+    }
+
+    std::size_t frames = 0;
+    uint64_t checksum = 0;
+};
+
+typedef bool (*FrameFieldsFunc)(const char*, std::size_t, std::size_t, std::size_t, uint32_t*, uint8_t*);
+
+static bool tableDecodeFrameFields(const char* src, std::size_t available, std::size_t addrSize, std::size_t dataSize,
+                                   uint32_t* address, uint8_t* data)
+{
+    (void)available;
+    return detail::decodeFrameFieldsScalar(src, addrSize, dataSize, address, data);
+}
+
+static double benchFields(const char* name, FrameFieldsFunc func, const std::string& trace,
+                          const std::vector<FrameRef>& frames, unsigned rounds)
+{
+    uint64_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned r = 0; r < rounds; r++) {
+        for (const FrameRef& f : frames) {
+            uint32_t address;
+            uint8_t data[8] = {0};
+            if (func(trace.data() + f.offset, trace.size() - f.offset, f.addrSize, f.dataSize, &address, data)) {
+                checksum += address + data[0];
+            }
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    double rate = frames.size() * rounds / elapsed.count();
+    std::printf("%-24s %10.2f Mframes/s %8.2f ns/frame (checksum %llu)\n", name, rate / 1e6, 1e9 / rate,
+                (unsigned long long)checksum);
+    return rate;
+}
+
+class CountingEncoder : public Encoder<CountingEncoder> {
+public:
+    void handleEncodedData(const char* str, std::size_t size)
+    {
+        bytes += size;
+        checksum += str[size / 2];
+    }
+
+    std::size_t bytes = 0;
+    uint64_t checksum = 0;
+};
+
+static double benchEncode(const char* name, detail::HexEncodeFunc func, const std::vector<uint8_t>& payload,
+                          unsigned rounds)
+{
+    std::string hex(payload.size() * 2, '\0');
+    uint64_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned r = 0; r < rounds; r++) {
+        // frame sized pieces, like the multi-frame loop of transmitData
+        for (std::size_t i = 0; i < payload.size(); i += 8) {
+            func(payload.data() + i, &hex[i * 2], 8);
+        }
+        checksum += hex[r % hex.size()];
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    double rate = payload.size() * rounds / elapsed.count();
+    std::printf("%-24s %10.2f MB/s (checksum %llu)\n", name, rate / 1e6, (unsigned long long)checksum);
+    return rate;
+}
+
+int main()
+{
+    const std::size_t frameNum = 1 << 16;
+    const unsigned rounds = 200;
+
+    std::srand(1);
+    std::string trace;
+    std::vector<FrameRef> frames;
+    frames.reserve(frameNum);
+    for (std::size_t i = 0; i < frameNum; i++) {
+        bool ext = std::rand() % 2;
+        std::size_t dataSize = std::rand() % 9;
+        trace.push_back(ext ? 'T' : 't');
+        FrameRef f = {trace.size(), std::size_t(ext ? 8 : 3), dataSize};
+        for (std::size_t j = 0; j < f.addrSize + 1 + dataSize * 2; j++) {
+            trace.push_back("0123456789ABCDEF"[std::rand() % 16]);
+        }
+        trace[f.offset] = ext ? '1' : '7';
+        trace[f.offset + f.addrSize] = '0' + dataSize;
+        trace.push_back('\r');
+        frames.push_back(f);
+    }
+
+    std::printf("%zu frames, %zu bytes, simd level %d\n", frameNum, trace.size(), (int)simdLevel());
+    double base = benchFields("switch fields", switchDecodeFrameFields, trace, frames, rounds);
+    benchFields("table fields", tableDecodeFrameFields, trace, frames, rounds);
+    double fast = benchFields("decodeFrameFields", decodeFrameFields, trace, frames, rounds);
+    std::printf("decodeFrameFields speedup over switch: %.2fx\n", fast / base);
+
+    CountingParser parser;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned r = 0; r < rounds; r++) {
+        parser.acceptData(trace.data(), trace.size());
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    double rate = parser.frames / elapsed.count();
+    std::printf("%-24s %10.2f Mframes/s %8.2f MB/s (checksum %llu)\n", "Parser::acceptData", rate / 1e6,
+                trace.size() * rounds / elapsed.count() / 1e6, (unsigned long long)parser.checksum);
+
+    std::vector<uint8_t> payload(4096);
+    for (uint8_t& b : payload) {
+        b = std::rand();
+    }
+    const unsigned encodeRounds = 20000;
+    double encodeBase = benchEncode("switch encode", switchEncodeHexStream, payload, encodeRounds);
+    benchEncode("table encode", detail::encodeHexStreamScalar, payload, encodeRounds);
+    double encodeFast = benchEncode("encodeHexStream", hexEncoder(simdLevel()), payload, encodeRounds);
+    std::printf("encodeHexStream speedup over switch: %.2fx\n", encodeFast / encodeBase);
+
+    CountingEncoder encoder;
+    start = std::chrono::steady_clock::now();
+    for (unsigned r = 0; r < encodeRounds; r++) {
+        encoder.transmitData(0x123, payload.data(), payload.size());
+    }
+    elapsed = std::chrono::steady_clock::now() - start;
+    std::printf("%-24s %10.2f MB/s payload (checksum %llu)\n", "Encoder::transmitData",
+                payload.size() * encodeRounds / elapsed.count() / 1e6, (unsigned long long)encoder.checksum);
+    return 0;
+}
@@ -0,0 +1,187 @@
+#include "dtacan/UringPort.h"
+
+#include <pty.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+using namespace dtacan;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+template <template <typename> class Port>
+class CountingPort : public Port<CountingPort<Port>> {
+public:
+    void handleData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        frames++;
+        checksum += address + size + (size ? data[size - 1] : 0);
+    }
+
+    std::size_t frames = 0;
+    uint64_t checksum = 0;
+};
+
+// template template arguments must match the parameter list exactly
+template <typename B>
+using DefaultReadWritePort = ReadWritePort<B>;
+
+#ifdef DTACAN_HAS_LIBURING
+template <typename B>
+using DefaultUringPort = UringPort<B>;
+#endif
+
+template <typename B>
+bool hasRoom(ReadWritePort<B>&)
+{
+    return true;
+}
+
+#ifdef DTACAN_HAS_LIBURING
+template <typename B>
+bool hasRoom(UringPort<B>& port)
+{
+    return port.outputFree() >= 27;
+}
+#endif
+
+void report(const char* name, std::size_t bytes, std::size_t frames, std::size_t polls, double seconds)
+{
+    std::printf("%-24s %8.2f MB/s %10.0f frames/s", name, bytes / seconds / 1e6, frames / seconds);
+    if (polls != 0) {
+        std::printf(" %8.2f frames/poll", double(frames) / polls);
+    }
+    std::printf("\n");
+}
+
+bool openPair(int* master, int* slave)
+{
+    if (openpty(master, slave, nullptr, nullptr, nullptr) != 0) {
+        std::perror("openpty");
+        return false;
+    }
+    return true;
+}
+
+// Adapter side writes frames into the pty master, the port parses them from the slave
+template <typename P>
+void benchReceive(const char* name, std::size_t frameNum)
+{
+    int master;
+    int slave;
+    if (!openPair(&master, &slave)) {
+        return;
+    }
+    P port;
+    if (!port.attach(slave, SerialOptions())) {
+        std::perror("attach");
+        close(master);
+        return;
+    }
+    std::string chunk;
+    for (int i = 0; i < 256; i++) {
+        char frame[32];
+        std::snprintf(frame, sizeof(frame), "t%03X8%016llX\r", i * 7 & 0x7ff, (unsigned long long)i * 0x0101010101ull);
+        chunk += frame;
+    }
+    std::size_t chunkNum = frameNum / 256;
+    Clock::time_point start = Clock::now();
+    std::thread adapter([master, &chunk, chunkNum]() {
+        for (std::size_t i = 0; i < chunkNum; i++) {
+            const char* data = chunk.data();
+            std::size_t size = chunk.size();
+            while (size != 0) {
+                ssize_t written = write(master, data, size);
+                if (written <= 0) {
+                    return;
+                }
+                data += written;
+                size -= written;
+            }
+        }
+    });
+    std::size_t polls = 0;
+    while (port.frames < chunkNum * 256 && port.poll(true)) {
+        polls++;
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    adapter.join();
+    report(name, chunk.size() * chunkNum, port.frames, polls, seconds);
+    port.close();
+    close(master);
+}
+
+// The port encodes frames into the pty slave, the adapter side drains the master
+template <typename P>
+void benchTransmit(const char* name, std::size_t frameNum)
+{
+    int master;
+    int slave;
+    if (!openPair(&master, &slave)) {
+        return;
+    }
+    P port;
+    if (!port.attach(slave, SerialOptions())) {
+        std::perror("attach");
+        close(master);
+        return;
+    }
+    std::size_t total = frameNum * 22;
+    std::atomic<std::size_t> received(0);
+    Clock::time_point start = Clock::now();
+    std::thread adapter([master, total, &received]() {
+        char buffer[65536];
+        std::size_t size = 0;
+        while (size < total) {
+            ssize_t n = read(master, buffer, sizeof(buffer));
+            if (n <= 0) {
+                break;
+            }
+            size += n;
+        }
+        received = size;
+    });
+    uint8_t data[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    std::size_t polls = 0;
+    for (std::size_t i = 0; i < frameNum; i++) {
+        while (!hasRoom(port)) {
+            port.poll(true);
+            polls++;
+        }
+        data[0] = i;
+        port.transmitStdFrame(i & 0x7ff, data, 8);
+        if ((i & 63) == 63) {
+            port.flush();
+        }
+    }
+    port.flush();
+    adapter.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    report(name, received, received / 22, polls, seconds);
+    port.close();
+    close(master);
+}
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t frameNum = argc > 1 ? std::strtoull(argv[1], nullptr, 0) : 200000;
+    benchReceive<CountingPort<DefaultReadWritePort>>("rx/read", frameNum);
+#ifdef DTACAN_HAS_LIBURING
+    benchReceive<CountingPort<DefaultUringPort>>("rx/io_uring", frameNum);
+#endif
+    benchTransmit<CountingPort<DefaultReadWritePort>>("tx/write", frameNum);
+#ifdef DTACAN_HAS_LIBURING
+    benchTransmit<CountingPort<DefaultUringPort>>("tx/io_uring", frameNum);
+#else
+    std::printf("liburing not found, io_uring transport is not built\n");
+#endif
+    return 0;
+}
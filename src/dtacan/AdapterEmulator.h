@@ -0,0 +1,423 @@
+#pragma once
+
+#include "dtacan/BaudRate.h"
+#include "dtacan/Config.h"
+#include "dtacan/Encoder.h"
+#include "dtacan/FixedQueue.h"
+#include "dtacan/Frame.h"
+#include "dtacan/Parser.h"
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+namespace dtacan {
+
+struct EmulatorOptions {
+    BaudRate baudRate = BaudRate::Baud1M;
+    // Share of bus time taken by generated traffic while the channel is open, from 0 to 1
+    double busLoad = 0;
+    // Share of generated frames with ext ids, in permille
+    unsigned extPermille = 500;
+    // Data size of generated frames, -1 for random sizes
+    int frameSize = -1;
+    // Share of generated frames passed to the host corrupted, in permille
+    unsigned junkPermille = 0;
+    // Delay of replies to host commands
+    uint64_t replyLatencyNs = 0;
+    uint64_t seed = 1;
+};
+
+struct EmulatorStats {
+    uint64_t hostFrames = 0;
+    uint64_t generatedFrames = 0;
+    uint64_t junkFrames = 0;
+    uint64_t nacks = 0;
+    // Replies lost to a full reply queue, the host gets fewer replies than it sent commands then
+    uint64_t droppedReplies = 0;
+    uint64_t busyNs = 0;
+};
+
+/// DTA adapter on the far side of a serial link, for load testing without hardware. Host commands are split into
+/// lines: 'S0'-'S8', 'O' and 'C' are handled directly, 't'/'T' lines are decoded by a Parser and queued for the
+/// bus, accepted frames are answered with "z\r"/"Z\r" and everything else with BELL. The bus is modelled from the
+/// configured BaudRate with worst case frame lengths: frames go one after another in id arbitration order, and
+/// generated traffic fills the requested share of bus time and is passed to the host through an Encoder.
+///
+/// Time is emulated, the caller passes host data with acceptData and moves time with advance. Output to the host
+/// goes to handleOutput of B, every frame that went over the bus to handleBusFrame
+template <typename B, std::size_t txQueueCapacity = 64>
+class AdapterEmulator {
+public:
+    void handleOutput(const char* data, std::size_t size);
+    void handleBusFrame(const Frame& frame, bool fromHost, uint64_t timeNs);
+
+    explicit AdapterEmulator(const EmulatorOptions& options = EmulatorOptions());
+
+    // Host data received at the current emulated time
+    void acceptData(const void* data, std::size_t size);
+    // Runs everything due until nowNs
+    void advance(uint64_t nowNs);
+    // Time of the next scheduled event, UINT64_MAX if there is none
+    uint64_t nextEventTime() const;
+
+    uint64_t now() const;
+    bool isOpen() const;
+    BaudRate baudRate() const;
+    const EmulatorStats& stats() const;
+
+private:
+    static const uint64_t never = UINT64_MAX;
+    static const std::size_t maxLineSize = 31;
+    static const std::size_t replyCapacity = 256;
+
+    struct Reply {
+        uint64_t time;
+        char code;
+    };
+
+    struct BusFrame {
+        Frame frame;
+        uint64_t readyTime;
+    };
+
+    class CommandParser : public Parser<CommandParser> {
+    public:
+        void handleData(uint32_t address, const uint8_t* data, std::size_t size)
+        {
+            accepted = owner->queueHostFrame(address, this->isExtendedFrame(), data, size);
+        }
+
+        AdapterEmulator* owner;
+        bool accepted;
+    };
+
+    class FrameEncoder : public Encoder<FrameEncoder, StaticConfig> {
+    public:
+        void handleEncodedData(const char* str, std::size_t size)
+        {
+            std::memcpy(encoded, str, size);
+            encodedSize = size;
+        }
+
+        char encoded[27];
+        std::size_t encodedSize;
+    };
+
+    B& base();
+    uint32_t random();
+    void handleLine();
+    void reply(char code);
+    bool queueHostFrame(uint32_t address, bool isExtended, const uint8_t* data, std::size_t size);
+    void generateFrame(uint64_t afterNs);
+    uint64_t nextBusStart() const;
+    void startBusFrame(uint64_t time);
+    void finishBusFrame();
+
+    EmulatorOptions _options;
+    EmulatorStats _stats;
+    uint64_t _now;
+    uint64_t _state;
+    bool _isOpen;
+
+    char _line[maxLineSize + 1];
+    std::size_t _lineSize;
+    bool _lineOverflow;
+    CommandParser _parser;
+    FrameEncoder _encoder;
+
+    FixedQueue<Reply, replyCapacity> _replies;
+    FixedQueue<BusFrame, txQueueCapacity> _txQueue;
+    BusFrame _generated;
+    BusFrame _current;
+    bool _currentFromHost;
+    bool _busBusy;
+    uint64_t _busFreeAt;
+};
+
+template <typename B, std::size_t txQueueCapacity>
+AdapterEmulator<B, txQueueCapacity>::AdapterEmulator(const EmulatorOptions& options)
+    : _options(options)
+    , _now(0)
+    , _state(options.seed ? options.seed : 1)
+    , _isOpen(false)
+    , _lineSize(0)
+    , _lineOverflow(false)
+    , _currentFromHost(false)
+    , _busBusy(false)
+    , _busFreeAt(0)
+{
+    _parser.owner = this;
+    _generated.readyTime = never;
+}
+
+template <typename B, std::size_t txQueueCapacity>
+inline B& AdapterEmulator<B, txQueueCapacity>::base()
+{
+    return *static_cast<B*>(this);
+}
+
+template <typename B, std::size_t txQueueCapacity>
+inline void AdapterEmulator<B, txQueueCapacity>::handleOutput(const char* data, std::size_t size)
+{
+    (void)data;
+    (void)size;
+}
+
+template <typename B, std::size_t txQueueCapacity>
+inline void AdapterEmulator<B, txQueueCapacity>::handleBusFrame(const Frame& frame, bool fromHost, uint64_t timeNs)
+{
+    (void)frame;
+    (void)fromHost;
+    (void)timeNs;
+}
+
+template <typename B, std::size_t txQueueCapacity>
+inline uint64_t AdapterEmulator<B, txQueueCapacity>::now() const
+{
+    return _now;
+}
+
+template <typename B, std::size_t txQueueCapacity>
+inline bool AdapterEmulator<B, txQueueCapacity>::isOpen() const
+{
+    return _isOpen;
+}
+
+template <typename B, std::size_t txQueueCapacity>
+inline BaudRate AdapterEmulator<B, txQueueCapacity>::baudRate() const
+{
+    return _options.baudRate;
+}
+
+template <typename B, std::size_t txQueueCapacity>
+inline const EmulatorStats& AdapterEmulator<B, txQueueCapacity>::stats() const
+{
+    return _stats;
+}
+
+template <typename B, std::size_t txQueueCapacity>
+inline uint32_t AdapterEmulator<B, txQueueCapacity>::random()
+{
+    _state ^= _state << 13;
+    _state ^= _state >> 7;
+    _state ^= _state << 17;
+    return (uint32_t)(_state >> 16);
+}
+
+template <typename B, std::size_t txQueueCapacity>
+void AdapterEmulator<B, txQueueCapacity>::acceptData(const void* data, std::size_t size)
+{
+    const char* it = (const char*)data;
+    const char* end = it + size;
+    for (; it != end; it++) {
+        if (*it != '\r') {
+            if (_lineSize == maxLineSize) {
+                _lineOverflow = true;
+            } else {
+                _line[_lineSize++] = *it;
+            }
+            continue;
+        }
+        handleLine();
+        _lineSize = 0;
+        _lineOverflow = false;
+    }
+}
+
+template <typename B, std::size_t txQueueCapacity>
+void AdapterEmulator<B, txQueueCapacity>::handleLine()
+{
+    if (_lineSize == 0 && !_lineOverflow) {
+        return;
+    }
+    BaudRate rate;
+    switch (_lineOverflow ? 0 : _line[0]) {
+    case 'S':
+        if (_lineSize == 2 && !_isOpen && baudRateFromChar(_line[1], &rate)) {
+            _options.baudRate = rate;
+            reply('\r');
+            return;
+        }
+        break;
+    case 'O':
+        if (_lineSize == 1 && !_isOpen) {
+            _isOpen = true;
+            if (_options.busLoad > 0) {
+                generateFrame(_now);
+            }
+            reply('\r');
+            return;
+        }
+        break;
+    case 'C':
+        if (_lineSize == 1 && _isOpen) {
+            _isOpen = false;
+            _txQueue.clear();
+            _generated.readyTime = never;
+            reply('\r');
+            return;
+        }
+        break;
+    case 't':
+    case 'T':
+        if (_isOpen) {
+            _parser.accepted = false;
+            _line[_lineSize] = '\r';
+            _parser.acceptData(_line, _lineSize + 1);
+            if (_parser.accepted) {
+                reply(_line[0] == 't' ? 'z' : 'Z');
+                return;
+            }
+        }
+        break;
+    }
+    _stats.nacks++;
+    reply('\a');
+}
+
+// Replies are sent in order, so a reply is never scheduled before the previous one
+template <typename B, std::size_t txQueueCapacity>
+void AdapterEmulator<B, txQueueCapacity>::reply(char code)
+{
+    Reply r;
+    r.time = _now + _options.replyLatencyNs;
+    r.code = code;
+    if (!_replies.push(r)) {
+        _stats.droppedReplies++;
+    }
+}
+
+template <typename B, std::size_t txQueueCapacity>
+bool AdapterEmulator<B, txQueueCapacity>::queueHostFrame(uint32_t address, bool isExtended, const uint8_t* data,
+                                                          std::size_t size)
+{
+    BusFrame entry;
+    entry.frame.address = address;
+    entry.frame.isExtended = isExtended;
+    entry.frame.size = size;
+    std::memset(entry.frame.data, 0, sizeof(entry.frame.data));
+    std::memcpy(entry.frame.data, data, size);
+    entry.readyTime = _now;
+    return _txQueue.push(entry);
+}
+
+// Schedules the next generated frame, the idle time before it keeps the share of busy bus time at busLoad
+template <typename B, std::size_t txQueueCapacity>
+void AdapterEmulator<B, txQueueCapacity>::generateFrame(uint64_t afterNs)
+{
+    Frame& frame = _generated.frame;
+    frame.isExtended = random() % 1000 < _options.extPermille;
+    frame.address = random() & (frame.isExtended ? 0x1fffffff : 0x7ff);
+    frame.size = _options.frameSize < 0 ? random() % 9 : (_options.frameSize > 8 ? 8 : _options.frameSize);
+    std::memset(frame.data, 0, sizeof(frame.data));
+    for (std::size_t i = 0; i < frame.size; i++) {
+        frame.data[i] = random();
+    }
+    double idle = 0;
+    if (_options.busLoad < 1) {
+        double duration = double(frameDurationNs(_options.baudRate, frame.size, frame.isExtended));
+        double jitter = 0.5 + (random() % 1024) / 1024.0;
+        idle = duration * (1 - _options.busLoad) / _options.busLoad * jitter;
+    }
+    _generated.readyTime = afterNs + uint64_t(idle);
+}
+
+template <typename B, std::size_t txQueueCapacity>
+inline uint64_t AdapterEmulator<B, txQueueCapacity>::nextBusStart() const
+{
+    uint64_t ready = _generated.readyTime;
+    if (!_txQueue.isEmpty() && _txQueue[0].readyTime < ready) {
+        ready = _txQueue[0].readyTime;
+    }
+    return ready == never || ready > _busFreeAt ? ready : _busFreeAt;
+}
+
+template <typename B, std::size_t txQueueCapacity>
+inline uint64_t AdapterEmulator<B, txQueueCapacity>::nextEventTime() const
+{
+    uint64_t time = _busBusy ? _busFreeAt : nextBusStart();
+    if (!_replies.isEmpty() && _replies[0].time < time) {
+        time = _replies[0].time;
+    }
+    return time;
+}
+
+template <typename B, std::size_t txQueueCapacity>
+void AdapterEmulator<B, txQueueCapacity>::startBusFrame(uint64_t time)
+{
+    _currentFromHost = !_txQueue.isEmpty() && _txQueue[0].readyTime <= time;
+    if (_currentFromHost && _generated.readyTime <= time) {
+        const Frame& host = _txQueue[0].frame;
+        const Frame& generated = _generated.frame;
+        _currentFromHost = arbitrationKey(host.address, host.isExtended)
+            <= arbitrationKey(generated.address, generated.isExtended);
+    }
+    if (_currentFromHost) {
+        _current = _txQueue.front();
+        _txQueue.pop();
+    } else {
+        _current = _generated;
+    }
+    uint64_t duration = frameDurationNs(_options.baudRate, _current.frame.size, _current.frame.isExtended);
+    _busBusy = true;
+    _busFreeAt = time + duration;
+    _stats.busyNs += duration;
+    if (!_currentFromHost) {
+        generateFrame(_busFreeAt);
+    }
+}
+
+template <typename B, std::size_t txQueueCapacity>
+void AdapterEmulator<B, txQueueCapacity>::finishBusFrame()
+{
+    _busBusy = false;
+    const Frame& frame = _current.frame;
+    if (_currentFromHost) {
+        _stats.hostFrames++;
+    } else {
+        _stats.generatedFrames++;
+        if (_isOpen) {
+            if (frame.isExtended) {
+                _encoder.transmitExtFrame(frame.address, frame.data, frame.size);
+            } else {
+                _encoder.transmitStdFrame(frame.address, frame.data, frame.size);
+            }
+            if (random() % 1000 < _options.junkPermille) {
+                // a bad dlc turns the whole line into junk for the host parser
+                _encoder.encoded[frame.isExtended ? 9 : 4] = 'x';
+                _stats.junkFrames++;
+            }
+            base().handleOutput(_encoder.encoded, _encoder.encodedSize);
+        }
+    }
+    base().handleBusFrame(frame, _currentFromHost, _busFreeAt);
+}
+
+template <typename B, std::size_t txQueueCapacity>
+void AdapterEmulator<B, txQueueCapacity>::advance(uint64_t nowNs)
+{
+    while (true) {
+        uint64_t time = nextEventTime();
+        if (time > nowNs) {
+            break;
+        }
+        if (time > _now) {
+            _now = time;
+        }
+        if (!_replies.isEmpty() && _replies[0].time <= time) {
+            // receipts are "z\r" and "Z\r", '\r' and BELL are a single char
+            char text[2] = {_replies.front().code, '\r'};
+            _replies.pop();
+            base().handleOutput(text, text[0] == 'z' || text[0] == 'Z' ? 2 : 1);
+        } else if (_busBusy) {
+            finishBusFrame();
+        } else {
+            startBusFrame(time);
+        }
+    }
+    if (nowNs > _now) {
+        _now = nowNs;
+    }
+}
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstddef>
+#include <stdint.h>
+
 namespace dtacan {
 
 enum class BaudRate {
@@ -13,4 +16,55 @@ enum class BaudRate {
     Baud800k,
     Baud1M,
 };
+
+// Data phase rate of CAN FD frames with bit rate switch, set with the 'Y' command
+enum class FdBaudRate {
+    Fd1M,
+    Fd2M,
+    Fd4M,
+    Fd5M,
+    Fd8M,
+};
+
+inline uint32_t bitsPerSecond(BaudRate rate)
+{
+    static const uint32_t rates[] = {10000, 20000, 50000, 100000, 125000, 250000, 500000, 800000, 1000000};
+    return rates[(int)rate];
+}
+
+inline uint32_t bitsPerSecond(FdBaudRate rate)
+{
+    static const uint32_t rates[] = {1000000, 2000000, 4000000, 5000000, 8000000};
+    return rates[(int)rate];
+}
+
+// Digit of the 'Y' command is the rate in Mbit/s
+inline char fdBaudRateToChar(FdBaudRate rate)
+{
+    return "12458"[(int)rate];
+}
+
+// Rate selected by the digit of an 'S' command, returns false if there is no such rate
+inline bool baudRateFromChar(char c, BaudRate* rate)
+{
+    if (c < '0' || c > '8') {
+        return false;
+    }
+    *rate = (BaudRate)(c - '0');
+    return true;
+}
+
+// Worst case bus time of a frame with size data bytes in bits including interframe space and stuff bits. Only the
+// 34 (std) or 54 (ext) header bits and the data up to the CRC delimiter are subject to stuffing, a stuff bit is
+// inserted after every 4 bits at worst
+inline uint32_t frameBits(std::size_t size, bool isExtended)
+{
+    uint32_t stuffed = (isExtended ? 54 : 34) + 8 * size;
+    return (isExtended ? 67 : 47) + 8 * size + (stuffed - 1) / 4;
+}
+
+inline uint64_t frameDurationNs(BaudRate rate, std::size_t size, bool isExtended)
+{
+    return uint64_t(frameBits(size, isExtended)) * 1000000000u / bitsPerSecond(rate);
+}
 }
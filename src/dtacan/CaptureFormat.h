@@ -0,0 +1,191 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+namespace dtacan {
+
+// Columnar capture files written by CaptureWriter and read by CaptureReader.
+//
+// A file is a CaptureFileHeader followed by blocks of up to blockCapacity frames. A block is a CaptureBlockHeader,
+// the columns and a CaptureBlockFooter, every part starting at a multiple of 8 bytes from the block start:
+//  - id dictionary, the distinct frame keys of the block as 32 bit words in order of first appearance
+//  - timestamps, zigzag encoded deltas to the previous frame bit packed in timeBits each
+//  - ids, indices into the dictionary bit packed in idBits each
+//  - sizes, payload sizes bit packed in sizeBits each
+//  - payloads of all frames back to back
+// Bit packed columns are 64 bit words filled from the least significant bit. Integers use host byte order, which
+// is little endian on every supported platform.
+//
+// A frame key is the address with flags in the top bits, see captureKey
+
+static const char captureFileMagic[8] = {'D', 'T', 'A', 'C', 'A', 'P', '0', '1'};
+static const uint32_t captureBlockMagic = 0x4b4c4244;
+static const uint32_t captureVersion = 1;
+
+static const uint32_t captureKeyExtended = 1u << 29;
+static const uint32_t captureKeyFd = 1u << 30;
+static const uint32_t captureKeyBitRateSwitch = 1u << 31;
+
+struct CaptureFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t blockCapacity;
+};
+
+struct CaptureBlockHeader {
+    uint32_t magic;
+    // whole block including header and footer
+    uint32_t size;
+};
+
+/// Index of a block, a reader skips blocks by time range and ids without touching their columns
+struct CaptureBlockFooter {
+    uint64_t minTimestampNs;
+    uint64_t maxTimestampNs;
+    uint64_t firstTimestampNs;
+    uint32_t frameCount;
+    uint32_t idCount;
+    uint32_t payloadSize;
+    uint8_t timeBits;
+    uint8_t idBits;
+    uint8_t sizeBits;
+    uint8_t reserved;
+    // bit per std id, exact
+    uint64_t stdIds[32];
+    // bloom filter of ext ids with two bits per id
+    uint64_t extBloom[16];
+};
+
+inline uint32_t captureKey(uint32_t address, bool isExtended, bool isFd = false, bool isBitRateSwitch = false)
+{
+    return address | (isExtended ? captureKeyExtended : 0) | (isFd ? captureKeyFd : 0)
+           | (isBitRateSwitch ? captureKeyBitRateSwitch : 0);
+}
+
+namespace detail {
+
+constexpr std::size_t alignCapture(std::size_t size)
+{
+    return (size + 7) & ~std::size_t(7);
+}
+
+inline unsigned bitWidth(uint64_t value)
+{
+    unsigned bits = 0;
+    while (value != 0) {
+        bits++;
+        value >>= 1;
+    }
+    return bits;
+}
+
+constexpr std::size_t packedSize(std::size_t count, unsigned bits)
+{
+    return (count * bits + 63) / 64 * 8;
+}
+
+inline uint64_t zigzag(int64_t value)
+{
+    return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value)
+{
+    return int64_t(value >> 1) ^ -int64_t(value & 1);
+}
+
+inline uint64_t loadWord(const char* p)
+{
+    uint64_t word;
+    std::memcpy(&word, p, 8);
+    return word;
+}
+
+// out must hold packedSize(count, bits) bytes
+template <typename T>
+void packBits(const T* values, std::size_t count, unsigned bits, char* out)
+{
+    if (bits == 0) {
+        return;
+    }
+    uint64_t word = 0;
+    unsigned used = 0;
+    for (std::size_t i = 0; i < count; i++) {
+        uint64_t value = uint64_t(values[i]);
+        word |= value << used;
+        used += bits;
+        if (used >= 64) {
+            std::memcpy(out, &word, 8);
+            out += 8;
+            used -= 64;
+            word = used == 0 ? 0 : value >> (bits - used);
+        }
+    }
+    if (used != 0) {
+        std::memcpy(out, &word, 8);
+    }
+}
+
+// Sequential reader of a bit packed column
+class BitReader {
+public:
+    BitReader(const char* data, unsigned bits)
+        : _data(data)
+        , _bits(bits)
+        , _mask(bits == 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1)
+        , _word(bits == 0 ? 0 : loadWord(data))
+        , _used(0)
+    {
+    }
+
+    uint64_t next()
+    {
+        if (_bits == 0) {
+            return 0;
+        }
+        uint64_t value = _word >> _used;
+        _used += _bits;
+        if (_used >= 64) {
+            _used -= 64;
+            _data += 8;
+            // reading past the last word of a column stays inside the block, the footer comes last
+            _word = loadWord(_data);
+            if (_used != 0) {
+                value |= _word << (_bits - _used);
+            }
+        }
+        return value & _mask;
+    }
+
+private:
+    const char* _data;
+    unsigned _bits;
+    uint64_t _mask;
+    uint64_t _word;
+    unsigned _used;
+};
+
+inline void extBloomBits(uint32_t address, unsigned* first, unsigned* second)
+{
+    uint64_t hash = uint64_t(address) * 0x9e3779b97f4a7c15ull;
+    *first = hash >> 54;
+    *second = (hash >> 44) & 1023;
+}
+}
+
+// Payload bytes of a block, the writer starts a new block when a payload doesn't fit
+constexpr std::size_t capturePayloadCapacity(std::size_t blockCapacity)
+{
+    return blockCapacity * 8 < 64 ? 64 : blockCapacity * 8;
+}
+
+// Upper bound of the size of a block written with the given capacity
+constexpr std::size_t captureMaxBlockSize(std::size_t blockCapacity)
+{
+    return sizeof(CaptureBlockHeader) + detail::alignCapture(blockCapacity * 4) + detail::packedSize(blockCapacity, 64)
+           + detail::packedSize(blockCapacity, 32) + detail::packedSize(blockCapacity, 7)
+           + capturePayloadCapacity(blockCapacity) + sizeof(CaptureBlockFooter);
+}
+}
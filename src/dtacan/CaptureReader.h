@@ -0,0 +1,491 @@
+#pragma once
+
+#include "dtacan/CaptureFormat.h"
+#include "dtacan/Config.h"
+#include "dtacan/MappedFile.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+namespace dtacan {
+
+/// Frames of a capture to read, the time range is inclusive
+struct CaptureQuery {
+    uint64_t fromNs = 0;
+    uint64_t toNs = ~uint64_t(0);
+    // Only frames of one id unless anyId is set
+    bool anyId = true;
+    uint32_t address = 0;
+    bool isExtended = false;
+
+    // Whether the block may hold matching frames, may be wrong in favor of reading for ext ids
+    bool matchesBlock(const CaptureBlockFooter& footer) const;
+    bool matchesFrame(uint32_t key, uint64_t timestampNs) const;
+};
+
+/// Capture file mapped into memory with the list of its blocks. A file cut in the middle of a block, like one of a
+/// writer that didn't stop cleanly, is read up to the last whole block
+class CaptureFile {
+public:
+    CaptureFile();
+
+    // Returns false with errno set if the file can't be mapped, EINVAL if it is not a capture
+    bool open(const char* path);
+    // Capture already in memory, data must stay valid until close
+    bool open(const char* data, std::size_t size);
+    void close();
+
+    uint32_t blockCapacity() const;
+    std::size_t blockCount() const;
+    const char* block(std::size_t index) const;
+    std::size_t blockSize(std::size_t index) const;
+    CaptureBlockFooter footer(std::size_t index) const;
+    // Bytes after the last whole block
+    std::size_t truncatedSize() const;
+
+private:
+    bool scan();
+
+    MappedFile _file;
+    const char* _data;
+    std::size_t _size;
+    uint32_t _blockCapacity;
+    std::vector<std::size_t> _blocks;
+    std::size_t _truncatedSize;
+};
+
+/// Decodes captures written by CaptureWriter and passes frames to B in the shape of Parser callbacks:
+/// handleData for classic frames and handleFdData for CAN FD frames, with isExtendedFrame, isBitRateSwitch and
+/// timestampNs describing the frame being passed.
+///
+/// replay reads the blocks of a CaptureFile matching a query and skips the others by their footers. acceptData
+/// decodes a capture streamed in chunks of any size, blocks that arrive whole in a chunk are decoded in place,
+/// the others are collected first. Bytes that don't form a valid block are passed to handleJunk and decoding goes
+/// on after them
+template <typename B>
+class CaptureReader {
+public:
+    void handleData(uint32_t address, const uint8_t* data, std::size_t size);
+    void handleFdData(uint32_t address, const uint8_t* data, std::size_t size);
+    void handleJunk(const uint8_t* junk, std::size_t size);
+
+    CaptureReader();
+
+    // Returns the number of frames passed on
+    uint64_t replay(const CaptureFile& file, const CaptureQuery& query = CaptureQuery());
+    void acceptData(const void* data, std::size_t size);
+
+    uint64_t frames() const;
+    uint64_t blocksDecoded() const;
+    uint64_t blocksSkipped() const;
+
+protected:
+    bool isExtendedFrame() const;
+    bool isBitRateSwitch() const;
+    uint64_t timestampNs() const;
+
+private:
+    B& base();
+    bool validHeader(const CaptureBlockHeader& header) const;
+    bool decodeBlock(const char* block, std::size_t size, const CaptureQuery* query);
+    void acceptBlock(const char* block, std::size_t size);
+    void junk(const char* data, std::size_t size);
+
+    HeapBuffer _pending;
+    std::size_t _pendingSize;
+    bool _headerSeen;
+    std::size_t _maxBlockSize;
+
+    bool _isExtendedFrame;
+    bool _isBitRateSwitch;
+    uint64_t _timestampNs;
+    uint64_t _frames;
+    uint64_t _blocksDecoded;
+    uint64_t _blocksSkipped;
+};
+
+inline bool CaptureQuery::matchesBlock(const CaptureBlockFooter& footer) const
+{
+    if (footer.maxTimestampNs < fromNs || footer.minTimestampNs > toNs) {
+        return false;
+    }
+    if (anyId) {
+        return true;
+    }
+    if (!isExtended) {
+        return address <= 0x7ff && (footer.stdIds[address / 64] >> (address % 64) & 1) != 0;
+    }
+    unsigned first;
+    unsigned second;
+    detail::extBloomBits(address, &first, &second);
+    return (footer.extBloom[first / 64] >> (first % 64) & 1) != 0
+           && (footer.extBloom[second / 64] >> (second % 64) & 1) != 0;
+}
+
+inline bool CaptureQuery::matchesFrame(uint32_t key, uint64_t timestampNs) const
+{
+    return timestampNs >= fromNs && timestampNs <= toNs
+           && (anyId || (key & (0x1fffffff | captureKeyExtended)) == captureKey(address, isExtended));
+}
+
+inline CaptureFile::CaptureFile()
+    : _data(nullptr)
+    , _size(0)
+    , _blockCapacity(0)
+    , _truncatedSize(0)
+{
+}
+
+inline bool CaptureFile::open(const char* path)
+{
+    close();
+    if (!_file.open(path)) {
+        return false;
+    }
+    _data = _file.data();
+    _size = _file.size();
+    if (!scan()) {
+        close();
+        errno = EINVAL;
+        return false;
+    }
+    return true;
+}
+
+inline bool CaptureFile::open(const char* data, std::size_t size)
+{
+    close();
+    _data = data;
+    _size = size;
+    if (!scan()) {
+        close();
+        errno = EINVAL;
+        return false;
+    }
+    return true;
+}
+
+inline void CaptureFile::close()
+{
+    _file.close();
+    _data = nullptr;
+    _size = 0;
+    _blockCapacity = 0;
+    _blocks.clear();
+    _truncatedSize = 0;
+}
+
+// Only block headers are read, footers and columns stay untouched until asked for
+inline bool CaptureFile::scan()
+{
+    CaptureFileHeader header;
+    if (_size < sizeof(header)) {
+        return false;
+    }
+    std::memcpy(&header, _data, sizeof(header));
+    if (std::memcmp(header.magic, captureFileMagic, sizeof(header.magic)) != 0 || header.version != captureVersion
+        || header.blockCapacity == 0) {
+        return false;
+    }
+    _blockCapacity = header.blockCapacity;
+    std::size_t maxBlockSize = captureMaxBlockSize(_blockCapacity);
+    std::size_t offset = sizeof(header);
+    while (_size - offset >= sizeof(CaptureBlockHeader)) {
+        CaptureBlockHeader block;
+        std::memcpy(&block, _data + offset, sizeof(block));
+        if (block.magic != captureBlockMagic || block.size % 8 != 0
+            || block.size < sizeof(CaptureBlockHeader) + sizeof(CaptureBlockFooter) || block.size > maxBlockSize
+            || block.size > _size - offset) {
+            break;
+        }
+        _blocks.push_back(offset);
+        offset += block.size;
+    }
+    _truncatedSize = _size - offset;
+    return true;
+}
+
+inline uint32_t CaptureFile::blockCapacity() const
+{
+    return _blockCapacity;
+}
+
+inline std::size_t CaptureFile::blockCount() const
+{
+    return _blocks.size();
+}
+
+inline const char* CaptureFile::block(std::size_t index) const
+{
+    return _data + _blocks[index];
+}
+
+inline std::size_t CaptureFile::blockSize(std::size_t index) const
+{
+    CaptureBlockHeader header;
+    std::memcpy(&header, block(index), sizeof(header));
+    return header.size;
+}
+
+inline CaptureBlockFooter CaptureFile::footer(std::size_t index) const
+{
+    CaptureBlockFooter footer;
+    std::memcpy(&footer, block(index) + blockSize(index) - sizeof(footer), sizeof(footer));
+    return footer;
+}
+
+inline std::size_t CaptureFile::truncatedSize() const
+{
+    return _truncatedSize;
+}
+
+template <typename B>
+inline void CaptureReader<B>::handleData(uint32_t address, const uint8_t* data, std::size_t size)
+{
+    (void)address;
+    (void)data;
+    (void)size;
+}
+
+template <typename B>
+inline void CaptureReader<B>::handleFdData(uint32_t address, const uint8_t* data, std::size_t size)
+{
+    (void)address;
+    (void)data;
+    (void)size;
+}
+
+template <typename B>
+inline void CaptureReader<B>::handleJunk(const uint8_t* junk, std::size_t size)
+{
+    (void)junk;
+    (void)size;
+}
+
+template <typename B>
+CaptureReader<B>::CaptureReader()
+    : _pendingSize(0)
+    , _headerSeen(false)
+    , _maxBlockSize(captureMaxBlockSize(4096))
+    , _isExtendedFrame(false)
+    , _isBitRateSwitch(false)
+    , _timestampNs(0)
+    , _frames(0)
+    , _blocksDecoded(0)
+    , _blocksSkipped(0)
+{
+}
+
+template <typename B>
+inline B& CaptureReader<B>::base()
+{
+    return *static_cast<B*>(this);
+}
+
+template <typename B>
+uint64_t CaptureReader<B>::replay(const CaptureFile& file, const CaptureQuery& query)
+{
+    uint64_t frames = _frames;
+    for (std::size_t i = 0; i < file.blockCount(); i++) {
+        if (!query.matchesBlock(file.footer(i))) {
+            _blocksSkipped++;
+            continue;
+        }
+        decodeBlock(file.block(i), file.blockSize(i), &query);
+    }
+    return _frames - frames;
+}
+
+template <typename B>
+inline bool CaptureReader<B>::validHeader(const CaptureBlockHeader& header) const
+{
+    return header.magic == captureBlockMagic && header.size % 8 == 0
+           && header.size >= sizeof(CaptureBlockHeader) + sizeof(CaptureBlockFooter) && header.size <= _maxBlockSize;
+}
+
+// The block is checked whole before the first frame is passed on, a damaged block yields no frames at all
+template <typename B>
+bool CaptureReader<B>::decodeBlock(const char* block, std::size_t size, const CaptureQuery* query)
+{
+    CaptureBlockFooter footer;
+    if (size < sizeof(CaptureBlockHeader) + sizeof(footer)) {
+        return false;
+    }
+    std::memcpy(&footer, block + size - sizeof(footer), sizeof(footer));
+    std::size_t count = footer.frameCount;
+    if (footer.timeBits > 64 || footer.idBits > 32 || footer.sizeBits > 7 || footer.idCount > count
+        || (count != 0 && footer.idCount == 0)) {
+        return false;
+    }
+    std::size_t dictOffset = sizeof(CaptureBlockHeader);
+    std::size_t timeOffset = dictOffset + detail::alignCapture(std::size_t(footer.idCount) * 4);
+    std::size_t idOffset = timeOffset + detail::packedSize(count, footer.timeBits);
+    std::size_t sizeOffset = idOffset + detail::packedSize(count, footer.idBits);
+    std::size_t payloadOffset = sizeOffset + detail::packedSize(count, footer.sizeBits);
+    std::size_t footerOffset = payloadOffset + detail::alignCapture(footer.payloadSize);
+    if (footerOffset + sizeof(footer) != size) {
+        return false;
+    }
+
+    std::size_t payloadSize = 0;
+    detail::BitReader ids(block + idOffset, footer.idBits);
+    detail::BitReader sizes(block + sizeOffset, footer.sizeBits);
+    for (std::size_t i = 0; i < count; i++) {
+        uint64_t frameSize = sizes.next();
+        if (ids.next() >= footer.idCount || frameSize > 64) {
+            return false;
+        }
+        payloadSize += frameSize;
+    }
+    if (payloadSize != footer.payloadSize) {
+        return false;
+    }
+
+    _blocksDecoded++;
+    detail::BitReader times(block + timeOffset, footer.timeBits);
+    ids = detail::BitReader(block + idOffset, footer.idBits);
+    sizes = detail::BitReader(block + sizeOffset, footer.sizeBits);
+    const uint8_t* payload = (const uint8_t*)block + payloadOffset;
+    uint64_t timestamp = footer.firstTimestampNs;
+    for (std::size_t i = 0; i < count; i++) {
+        timestamp += detail::unzigzag(times.next());
+        uint32_t key;
+        std::memcpy(&key, block + dictOffset + ids.next() * 4, 4);
+        std::size_t frameSize = sizes.next();
+        if (!query || query->matchesFrame(key, timestamp)) {
+            _isExtendedFrame = (key & captureKeyExtended) != 0;
+            _isBitRateSwitch = (key & captureKeyBitRateSwitch) != 0;
+            _timestampNs = timestamp;
+            _frames++;
+            if (key & captureKeyFd) {
+                base().handleFdData(key & 0x1fffffff, payload, frameSize);
+            } else {
+                base().handleData(key & 0x1fffffff, payload, frameSize);
+            }
+        }
+        payload += frameSize;
+    }
+    return true;
+}
+
+template <typename B>
+inline void CaptureReader<B>::junk(const char* data, std::size_t size)
+{
+    base().handleJunk((const uint8_t*)data, size);
+}
+
+template <typename B>
+inline void CaptureReader<B>::acceptBlock(const char* block, std::size_t size)
+{
+    if (!decodeBlock(block, size, nullptr)) {
+        junk(block, size);
+    }
+}
+
+template <typename B>
+void CaptureReader<B>::acceptData(const void* data, std::size_t size)
+{
+    const char* it = (const char*)data;
+    const char* end = it + size;
+    while (it != end) {
+        CaptureBlockHeader header;
+        if (_headerSeen && _pendingSize == 0 && std::size_t(end - it) >= sizeof(header)) {
+            std::memcpy(&header, it, sizeof(header));
+            if (!validHeader(header)) {
+                junk(it, sizeof(header));
+                it += sizeof(header);
+                continue;
+            }
+            if (std::size_t(end - it) >= header.size) {
+                acceptBlock(it, header.size);
+                it += header.size;
+                continue;
+            }
+        }
+
+        // a file header, a block header or a whole block is collected in _pending
+        std::size_t need = sizeof(CaptureFileHeader);
+        if (_headerSeen) {
+            need = sizeof(header);
+            if (_pendingSize >= sizeof(header)) {
+                std::memcpy(&header, _pending.data(), sizeof(header));
+                need = header.size;
+            }
+        }
+        if (!_pending.reserve(need)) {
+            junk(it, end - it);
+            return;
+        }
+        std::size_t copied = std::min(need - _pendingSize, std::size_t(end - it));
+        std::memcpy(_pending.data() + _pendingSize, it, copied);
+        _pendingSize += copied;
+        it += copied;
+        if (_pendingSize < need) {
+            break;
+        }
+
+        if (!_headerSeen) {
+            CaptureFileHeader fileHeader;
+            std::memcpy(&fileHeader, _pending.data(), sizeof(fileHeader));
+            if (std::memcmp(fileHeader.magic, captureFileMagic, sizeof(fileHeader.magic)) == 0
+                && fileHeader.version == captureVersion && fileHeader.blockCapacity != 0) {
+                _maxBlockSize = captureMaxBlockSize(fileHeader.blockCapacity);
+            } else {
+                junk(_pending.data(), _pendingSize);
+            }
+            _headerSeen = true;
+            _pendingSize = 0;
+        } else if (need == sizeof(header)) {
+            std::memcpy(&header, _pending.data(), sizeof(header));
+            if (!validHeader(header)) {
+                junk(_pending.data(), _pendingSize);
+                _pendingSize = 0;
+            }
+        } else {
+            acceptBlock(_pending.data(), _pendingSize);
+            _pendingSize = 0;
+        }
+    }
+}
+
+template <typename B>
+inline uint64_t CaptureReader<B>::frames() const
+{
+    return _frames;
+}
+
+template <typename B>
+inline uint64_t CaptureReader<B>::blocksDecoded() const
+{
+    return _blocksDecoded;
+}
+
+template <typename B>
+inline uint64_t CaptureReader<B>::blocksSkipped() const
+{
+    return _blocksSkipped;
+}
+
+template <typename B>
+inline bool CaptureReader<B>::isExtendedFrame() const
+{
+    return _isExtendedFrame;
+}
+
+template <typename B>
+inline bool CaptureReader<B>::isBitRateSwitch() const
+{
+    return _isBitRateSwitch;
+}
+
+template <typename B>
+inline uint64_t CaptureReader<B>::timestampNs() const
+{
+    return _timestampNs;
+}
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "dtacan/MappedFile.h"
+
+#include <cstddef>
+#include <stdint.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace dtacan {
+
+struct ReplayOptions {
+    // Bytes passed to Parser::acceptData at once, rounded up to whole pages. Messages split between windows are
+    // carried over by the parser, so windows need not end at '\r'
+    std::size_t windowSize = 16 * 1024 * 1024;
+    // Ask for transparent huge pages, only honored by kernels with read only THP for file mappings
+    bool hugePages = true;
+    // Unmap pages of replayed windows, keeps resident memory bounded on captures larger than RAM
+    bool dropBehind = true;
+};
+
+/// Feeds a raw SLCAN capture to a Parser straight from a read only mapping of the file, without copying it into
+/// an intermediate buffer. The mapping is advised as sequential and the window after the current one is prefetched
+/// while the current one is parsed
+class CaptureReplay {
+public:
+    CaptureReplay();
+    ~CaptureReplay();
+    CaptureReplay(const CaptureReplay&) = delete;
+    CaptureReplay& operator=(const CaptureReplay&) = delete;
+
+    // Returns false with errno set if the file can't be mapped
+    bool open(const char* path, const ReplayOptions& options = ReplayOptions());
+    void close();
+
+    // Passes the next window to parser.acceptData, returns false once the whole capture is replayed
+    template <typename P>
+    bool replayWindow(P& parser);
+    // Replays the rest of the capture
+    template <typename P>
+    void replay(P& parser);
+    // Starts over from the beginning of the capture
+    void rewind();
+
+    const char* data() const;
+    std::size_t size() const;
+    std::size_t offset() const;
+
+private:
+    MappedFile _file;
+    std::size_t _offset;
+    std::size_t _window;
+    bool _dropBehind;
+};
+
+inline CaptureReplay::CaptureReplay()
+    : _offset(0)
+    , _window(0)
+    , _dropBehind(false)
+{
+}
+
+inline CaptureReplay::~CaptureReplay()
+{
+    close();
+}
+
+inline bool CaptureReplay::open(const char* path, const ReplayOptions& options)
+{
+    close();
+    if (!_file.open(path)) {
+        return false;
+    }
+    std::size_t page = sysconf(_SC_PAGESIZE);
+    _window = options.windowSize < page ? page : (options.windowSize + page - 1) / page * page;
+    _dropBehind = options.dropBehind;
+
+    _file.advise(0, _file.size(), MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    if (options.hugePages) {
+        _file.advise(0, _file.size(), MADV_HUGEPAGE);
+    }
+#endif
+    _file.advise(0, _window, MADV_WILLNEED);
+    return true;
+}
+
+inline void CaptureReplay::close()
+{
+    _file.close();
+    _offset = 0;
+}
+
+template <typename P>
+bool CaptureReplay::replayWindow(P& parser)
+{
+    if (_offset >= _file.size()) {
+        return false;
+    }
+    std::size_t size = _file.size() - _offset < _window ? _file.size() - _offset : _window;
+    _file.advise(_offset + _window, _window, MADV_WILLNEED);
+    parser.acceptData(_file.data() + _offset, size);
+    if (_dropBehind) {
+        _file.advise(_offset, size, MADV_DONTNEED);
+    }
+    _offset += size;
+    return true;
+}
+
+template <typename P>
+void CaptureReplay::replay(P& parser)
+{
+    while (replayWindow(parser)) {
+    }
+}
+
+inline void CaptureReplay::rewind()
+{
+    _offset = 0;
+    _file.advise(0, _window, MADV_WILLNEED);
+}
+
+inline const char* CaptureReplay::data() const
+{
+    return _file.data();
+}
+
+inline std::size_t CaptureReplay::size() const
+{
+    return _file.size();
+}
+
+inline std::size_t CaptureReplay::offset() const
+{
+    return _offset;
+}
+}
@@ -0,0 +1,278 @@
+#pragma once
+
+#include "dtacan/CaptureFormat.h"
+#include "dtacan/Frame.h"
+#include "dtacan/IdFilter.h"
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+namespace dtacan {
+
+/// Encodes frames fed from Parser::handleData, handleFrames or handleFdData into the columnar capture format of
+/// CaptureFormat.h. Frames are collected until a block of blockCapacity frames is full, then the block is encoded
+/// and passed to handleOutput of B at once, the file header comes with the first block. Everything lives in
+/// fixed arrays, nothing is allocated while recording.
+///
+/// Frames still collected are lost unless flush is called before B is destroyed
+template <typename B, std::size_t blockCapacity = 4096>
+class CaptureWriter {
+public:
+    void handleOutput(const char* data, std::size_t size);
+
+    CaptureWriter();
+
+    void record(uint32_t address, bool isExtended, const uint8_t* data, std::size_t size, uint64_t timestampNs);
+    void record(const Frame* frames, std::size_t count, uint64_t timestampNs);
+    void recordFd(uint32_t address, bool isExtended, bool isBitRateSwitch, const uint8_t* data, std::size_t size,
+                  uint64_t timestampNs);
+    // Encodes the frames collected so far into a block of their own
+    void flush();
+
+    uint64_t frames() const;
+    uint64_t blocks() const;
+    // Bytes passed to handleOutput
+    uint64_t bytes() const;
+
+private:
+    static_assert(blockCapacity > 0 && blockCapacity < 0x10000000, "block capacity out of range");
+
+    static const std::size_t tableSize = detail::hashTableSize(blockCapacity);
+    static const std::size_t payloadCapacity = capturePayloadCapacity(blockCapacity);
+    static const std::size_t maxBlockSize = captureMaxBlockSize(blockCapacity);
+
+    B& base();
+    void add(uint32_t key, const uint8_t* data, std::size_t size, uint64_t timestampNs);
+    uint32_t keyIndex(uint32_t key);
+    std::size_t findKey(uint32_t key) const;
+    void output(const void* data, std::size_t size);
+    void writeBlock();
+
+    uint64_t _timestamps[blockCapacity];
+    uint32_t _ids[blockCapacity];
+    uint8_t _sizes[blockCapacity];
+    uint8_t _payload[payloadCapacity];
+    std::size_t _count;
+    std::size_t _payloadSize;
+
+    // dictionary of the keys of the block, the hash table holds index + 1 of every key, 0 marks an empty slot
+    uint32_t _dict[blockCapacity];
+    std::size_t _dictSize;
+    uint32_t _tableKey[tableSize];
+    uint32_t _tableIndex[tableSize];
+
+    uint64_t _block[maxBlockSize / 8];
+    bool _headerWritten;
+    uint64_t _frames;
+    uint64_t _blocks;
+    uint64_t _bytes;
+};
+
+template <typename B, std::size_t blockCapacity>
+inline void CaptureWriter<B, blockCapacity>::handleOutput(const char* data, std::size_t size)
+{
+    (void)data;
+    (void)size;
+}
+
+template <typename B, std::size_t blockCapacity>
+CaptureWriter<B, blockCapacity>::CaptureWriter()
+    : _count(0)
+    , _payloadSize(0)
+    , _dictSize(0)
+    , _headerWritten(false)
+    , _frames(0)
+    , _blocks(0)
+    , _bytes(0)
+{
+    std::memset(_tableIndex, 0, sizeof(_tableIndex));
+}
+
+template <typename B, std::size_t blockCapacity>
+inline B& CaptureWriter<B, blockCapacity>::base()
+{
+    return *static_cast<B*>(this);
+}
+
+template <typename B, std::size_t blockCapacity>
+inline void CaptureWriter<B, blockCapacity>::record(uint32_t address, bool isExtended, const uint8_t* data,
+                                                    std::size_t size, uint64_t timestampNs)
+{
+    add(captureKey(address, isExtended), data, size, timestampNs);
+}
+
+template <typename B, std::size_t blockCapacity>
+void CaptureWriter<B, blockCapacity>::record(const Frame* frames, std::size_t count, uint64_t timestampNs)
+{
+    for (std::size_t i = 0; i < count; i++) {
+        add(captureKey(frames[i].address, frames[i].isExtended), frames[i].data, frames[i].size, timestampNs);
+    }
+}
+
+template <typename B, std::size_t blockCapacity>
+inline void CaptureWriter<B, blockCapacity>::recordFd(uint32_t address, bool isExtended, bool isBitRateSwitch,
+                                                      const uint8_t* data, std::size_t size, uint64_t timestampNs)
+{
+    add(captureKey(address, isExtended, true, isBitRateSwitch), data, size, timestampNs);
+}
+
+template <typename B, std::size_t blockCapacity>
+inline std::size_t CaptureWriter<B, blockCapacity>::findKey(uint32_t key) const
+{
+    std::size_t i = detail::hashAddress(key, false, tableSize - 1);
+    while (_tableIndex[i] != 0 && _tableKey[i] != key) {
+        i = (i + 1) & (tableSize - 1);
+    }
+    return i;
+}
+
+template <typename B, std::size_t blockCapacity>
+inline uint32_t CaptureWriter<B, blockCapacity>::keyIndex(uint32_t key)
+{
+    std::size_t i = findKey(key);
+    if (_tableIndex[i] == 0) {
+        _tableKey[i] = key;
+        _dict[_dictSize] = key;
+        _dictSize++;
+        _tableIndex[i] = _dictSize;
+    }
+    return _tableIndex[i] - 1;
+}
+
+template <typename B, std::size_t blockCapacity>
+void CaptureWriter<B, blockCapacity>::add(uint32_t key, const uint8_t* data, std::size_t size, uint64_t timestampNs)
+{
+    if (size > 64) {
+        size = 64;
+    }
+    if (_count == blockCapacity || _payloadSize + size > payloadCapacity) {
+        writeBlock();
+    }
+    _timestamps[_count] = timestampNs;
+    _ids[_count] = keyIndex(key);
+    _sizes[_count] = size;
+    std::memcpy(_payload + _payloadSize, data, size);
+    _payloadSize += size;
+    _count++;
+    _frames++;
+}
+
+template <typename B, std::size_t blockCapacity>
+inline void CaptureWriter<B, blockCapacity>::flush()
+{
+    writeBlock();
+}
+
+template <typename B, std::size_t blockCapacity>
+inline void CaptureWriter<B, blockCapacity>::output(const void* data, std::size_t size)
+{
+    _bytes += size;
+    base().handleOutput((const char*)data, size);
+}
+
+template <typename B, std::size_t blockCapacity>
+void CaptureWriter<B, blockCapacity>::writeBlock()
+{
+    if (_count == 0) {
+        return;
+    }
+    if (!_headerWritten) {
+        CaptureFileHeader header;
+        std::memcpy(header.magic, captureFileMagic, sizeof(header.magic));
+        header.version = captureVersion;
+        header.blockCapacity = blockCapacity;
+        output(&header, sizeof(header));
+        _headerWritten = true;
+    }
+
+    CaptureBlockFooter footer;
+    std::memset(&footer, 0, sizeof(footer));
+    footer.firstTimestampNs = _timestamps[0];
+    footer.minTimestampNs = _timestamps[0];
+    footer.maxTimestampNs = _timestamps[0];
+    footer.frameCount = _count;
+    footer.idCount = _dictSize;
+    footer.payloadSize = _payloadSize;
+
+    // timestamps are replaced by deltas in place, back to front
+    uint64_t timeBits = 0;
+    for (std::size_t i = _count - 1; i > 0; i--) {
+        uint64_t timestamp = _timestamps[i];
+        footer.minTimestampNs = timestamp < footer.minTimestampNs ? timestamp : footer.minTimestampNs;
+        footer.maxTimestampNs = timestamp > footer.maxTimestampNs ? timestamp : footer.maxTimestampNs;
+        _timestamps[i] = detail::zigzag(int64_t(timestamp - _timestamps[i - 1]));
+        timeBits |= _timestamps[i];
+    }
+    _timestamps[0] = 0;
+    uint8_t sizeBits = 0;
+    for (std::size_t i = 0; i < _count; i++) {
+        sizeBits |= _sizes[i];
+    }
+    footer.timeBits = detail::bitWidth(timeBits);
+    footer.idBits = detail::bitWidth(_dictSize - 1);
+    footer.sizeBits = detail::bitWidth(sizeBits);
+
+    for (std::size_t i = 0; i < _dictSize; i++) {
+        uint32_t key = _dict[i];
+        uint32_t address = key & 0x1fffffff;
+        if (key & captureKeyExtended) {
+            unsigned first;
+            unsigned second;
+            detail::extBloomBits(address, &first, &second);
+            footer.extBloom[first / 64] |= uint64_t(1) << (first % 64);
+            footer.extBloom[second / 64] |= uint64_t(1) << (second % 64);
+        } else {
+            footer.stdIds[address / 64] |= uint64_t(1) << (address % 64);
+        }
+    }
+    // latest keys first, so probe sequences of the earlier ones stay intact until they are removed
+    for (std::size_t i = _dictSize; i > 0; i--) {
+        _tableIndex[findKey(_dict[i - 1])] = 0;
+    }
+
+    char* block = (char*)_block;
+    std::size_t dictOffset = sizeof(CaptureBlockHeader);
+    std::size_t timeOffset = dictOffset + detail::alignCapture(_dictSize * 4);
+    std::size_t idOffset = timeOffset + detail::packedSize(_count, footer.timeBits);
+    std::size_t sizeOffset = idOffset + detail::packedSize(_count, footer.idBits);
+    std::size_t payloadOffset = sizeOffset + detail::packedSize(_count, footer.sizeBits);
+    std::size_t footerOffset = payloadOffset + detail::alignCapture(_payloadSize);
+    std::size_t blockSize = footerOffset + sizeof(footer);
+
+    // padding is zeroed, so equal frames always encode to equal bytes
+    std::memset(block, 0, footerOffset);
+    CaptureBlockHeader header = {captureBlockMagic, uint32_t(blockSize)};
+    std::memcpy(block, &header, sizeof(header));
+    std::memcpy(block + dictOffset, _dict, _dictSize * 4);
+    detail::packBits(_timestamps, _count, footer.timeBits, block + timeOffset);
+    detail::packBits(_ids, _count, footer.idBits, block + idOffset);
+    detail::packBits(_sizes, _count, footer.sizeBits, block + sizeOffset);
+    std::memcpy(block + payloadOffset, _payload, _payloadSize);
+    std::memcpy(block + footerOffset, &footer, sizeof(footer));
+    output(block, blockSize);
+
+    _count = 0;
+    _payloadSize = 0;
+    _dictSize = 0;
+    _blocks++;
+}
+
+template <typename B, std::size_t blockCapacity>
+inline uint64_t CaptureWriter<B, blockCapacity>::frames() const
+{
+    return _frames;
+}
+
+template <typename B, std::size_t blockCapacity>
+inline uint64_t CaptureWriter<B, blockCapacity>::blocks() const
+{
+    return _blocks;
+}
+
+template <typename B, std::size_t blockCapacity>
+inline uint64_t CaptureWriter<B, blockCapacity>::bytes() const
+{
+    return _bytes;
+}
+}
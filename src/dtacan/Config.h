@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+
+namespace dtacan {
+
+/// Encoder scratch buffer grown with realloc when a longer stream is encoded. Copies start empty
+class HeapBuffer {
+public:
+    HeapBuffer()
+        : _data(nullptr)
+        , _size(0)
+    {
+    }
+
+    HeapBuffer(const HeapBuffer&)
+        : HeapBuffer()
+    {
+    }
+
+    ~HeapBuffer()
+    {
+        std::free(_data);
+    }
+
+    HeapBuffer& operator=(const HeapBuffer&)
+    {
+        return *this;
+    }
+
+    // Returns false if the buffer couldn't be grown to size, the old contents is kept then
+    bool reserve(std::size_t size)
+    {
+        if (size <= _size) {
+            return true;
+        }
+        char* data = (char*)std::realloc(_data, size);
+        if (!data) {
+            return false;
+        }
+        _data = data;
+        _size = size;
+        return true;
+    }
+
+    char* data()
+    {
+        return _data;
+    }
+
+    std::size_t size() const
+    {
+        return _size;
+    }
+
+private:
+    char* _data;
+    std::size_t _size;
+};
+
+/// Encoder scratch buffer owned by the caller and set with Encoder::setBuffer, never allocates. Streams longer
+/// than the buffer are passed to handleEncodedData in several pieces
+class ExternalBuffer {
+public:
+    ExternalBuffer()
+        : _data(nullptr)
+        , _size(0)
+    {
+    }
+
+    void setStorage(char* data, std::size_t size)
+    {
+        _data = data;
+        _size = size;
+    }
+
+    bool reserve(std::size_t size)
+    {
+        return size <= _size;
+    }
+
+    char* data()
+    {
+        return _data;
+    }
+
+    std::size_t size() const
+    {
+        return _size;
+    }
+
+private:
+    char* _data;
+    std::size_t _size;
+};
+
+/// Metrics policies of DefaultConfig and StaticConfig, every call is empty and inlined away
+class NullParserMetrics {
+public:
+    void chunkStarted() {}
+    void framesDelivered(std::size_t) {}
+    void frameDecoded(bool) {}
+    void frameFiltered() {}
+    void receipt(bool) {}
+    void nack() {}
+    void junk(std::size_t) {}
+    void carriedOver(std::size_t) {}
+};
+
+class NullEncoderMetrics {
+public:
+    void encoded(std::size_t, std::size_t) {}
+    void bufferReserved(std::size_t) {}
+    void bufferTooSmall() {}
+};
+
+/// Build policies passed to Parser and Encoder as the second template argument
+struct DefaultConfig {
+    typedef HeapBuffer EncoderBuffer;
+    typedef NullParserMetrics ParserInstrumentation;
+    typedef NullEncoderMetrics EncoderInstrumentation;
+};
+
+// No heap use at all, for targets where the data path must not allocate
+struct StaticConfig {
+    typedef ExternalBuffer EncoderBuffer;
+    typedef NullParserMetrics ParserInstrumentation;
+    typedef NullEncoderMetrics EncoderInstrumentation;
+};
+
+// InstrumentedConfig with counters and a latency histogram is in Metrics.h
+}
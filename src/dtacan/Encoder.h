@@ -1,17 +1,30 @@
 #pragma once
 
 #include "dtacan/Util.h"
+#include "dtacan/Hex.h"
 #include "dtacan/BaudRate.h"
+#include "dtacan/Config.h"
+#include "dtacan/Frame.h"
+
+#include <algorithm>
 
 #include <cstddef>
 #include <cassert>
 #include <cstring>
-#include <cstdlib>
 #include <stdint.h>
 
 namespace dtacan {
 
-template <typename B>
+/// Frame passed to Encoder::transmitBatch, data must stay valid until the call returns
+struct TransmitFrame {
+    uint32_t address;
+    const void* data;
+    std::size_t size;
+    bool isExtended;
+};
+
+// C selects build policies, see Config.h
+template <typename B, typename C = DefaultConfig>
 class Encoder {
 public:
     void handleEncodedData(const char* str, std::size_t size);
@@ -23,29 +36,73 @@ public:
     bool transmitStdFrame(uint32_t address, const void* data, std::size_t size);
     bool transmitExtFrame(uint32_t address, const void* data, std::size_t size);
 
+    // CAN FD data phase rate, sent as the 'Y' command
+    void setFdBaudrate(FdBaudRate rate);
+    // Sends a 'd'/'D' frame or a 'b'/'B' one if bitRateSwitch is set. Payloads of sizes between the FD lengths are
+    // padded with zeros up to the next one
+    bool transmitFdFrame(uint32_t address, const void* data, std::size_t size, bool isExtended, bool bitRateSwitch);
+    // Like transmitData but splits data into FD frames of up to 64 bytes, only the last one may be padded
+    bool transmitFdData(uint32_t address, const void* data, std::size_t size, bool bitRateSwitch);
+
+    // Encode leading frames into one stream and pass it to handleEncodedData at once. Return number of frames
+    // encoded, encoding stops at the first invalid frame or at the first frame that doesn't fit into the buffer
+    std::size_t transmitBatch(const TransmitFrame* frames, std::size_t count);
+    std::size_t transmitBatch(const TransmitFrame* frames, std::size_t count, char* buffer, std::size_t bufferSize);
+
+    // Sets storage of the ExternalBuffer policy, transmitData and transmitBatch without a buffer encode into it
+    void setBuffer(char* buffer, std::size_t size);
+
+    // Counters of the EncoderInstrumentation policy
+    const typename C::EncoderInstrumentation& encoderMetrics() const;
+
 private:
+    static bool isValidFrame(const TransmitFrame& frame);
+    static std::size_t encodedFrameSize(const TransmitFrame& frame);
+    static std::size_t writeStdFrame(char* dest, uint32_t address, const void* data, std::size_t size);
+    static std::size_t writeExtFrame(char* dest, uint32_t address, const void* data, std::size_t size);
+    static std::size_t writeFdFrame(char* dest, uint32_t address, bool isExtended, bool bitRateSwitch,
+                                    const void* data, std::size_t size);
+    static std::size_t fdFrameSize(bool isExtended, std::size_t size);
+
     void encodeStdFrame(uint32_t address, const void* data, std::size_t size);
     void encodeExtFrame(uint32_t address, const void* data, std::size_t size);
     char baudRateToChar(BaudRate baud);
+    void emitData(const char* str, std::size_t size, std::size_t frameNum);
 
     B& base();
+
+    typename C::EncoderBuffer _buffer;
+    typename C::EncoderInstrumentation _metrics;
 };
 
-template <typename B>
-inline B& Encoder<B>::base()
+template <typename B, typename C>
+inline B& Encoder<B, C>::base()
 {
     return *static_cast<B*>(this);
 }
 
-template <typename B>
-inline void Encoder<B>::handleEncodedData(const char* str, std::size_t size)
+template <typename B, typename C>
+inline void Encoder<B, C>::emitData(const char* str, std::size_t size, std::size_t frameNum)
+{
+    _metrics.encoded(frameNum, size);
+    base().handleEncodedData(str, size);
+}
+
+template <typename B, typename C>
+inline const typename C::EncoderInstrumentation& Encoder<B, C>::encoderMetrics() const
+{
+    return _metrics;
+}
+
+template <typename B, typename C>
+inline void Encoder<B, C>::handleEncodedData(const char* str, std::size_t size)
 {
     (void)str;
     (void)size;
 }
 
-template <typename B>
-char Encoder<B>::baudRateToChar(BaudRate rate)
+template <typename B, typename C>
+char Encoder<B, C>::baudRateToChar(BaudRate rate)
 {
     switch (rate) {
     case BaudRate::Baud10k:
@@ -70,54 +127,168 @@ char Encoder<B>::baudRateToChar(BaudRate rate)
     assert(false && "invalid baudrate");
 }
 
-template <typename B>
-void Encoder<B>::setBaudrate(BaudRate rate)
+template <typename B, typename C>
+void Encoder<B, C>::setBaudrate(BaudRate rate)
 {
     char data[3];
     data[0] = 'S';
     data[1] = baudRateToChar(rate);
     data[2] = '\r';
-    base().handleEncodedData(data, 3);
+    emitData(data, 3, 0);
+}
+
+template <typename B, typename C>
+void Encoder<B, C>::openCanChannel()
+{
+    emitData("O\r", 2, 0);
+}
+
+template <typename B, typename C>
+void Encoder<B, C>::closeCanChannel()
+{
+    emitData("C\r", 2, 0);
+}
+
+template <typename B, typename C>
+inline std::size_t Encoder<B, C>::writeStdFrame(char* dest, uint32_t address, const void* data, std::size_t size)
+{
+    dest[0] = 't';
+    encodeAddress(address, dest + 1);
+    dest[4] = '0' + size;
+    encodeHexStream((const uint8_t*)data, dest + 5, size);
+    dest[5 + size * 2] = '\r';
+    return 5 + size * 2 + 1;
+}
+
+template <typename B, typename C>
+inline std::size_t Encoder<B, C>::writeExtFrame(char* dest, uint32_t address, const void* data, std::size_t size)
+{
+    dest[0] = 'T';
+    encodeExtendedAddress(address, dest + 1);
+    dest[9] = '0' + size;
+    encodeHexStream((const uint8_t*)data, dest + 10, size);
+    dest[10 + size * 2] = '\r';
+    return 10 + size * 2 + 1;
+}
+
+// 'D' + 8 address chars + dlc + 128 data chars + '\r'
+template <typename B, typename C>
+inline std::size_t Encoder<B, C>::fdFrameSize(bool isExtended, std::size_t size)
+{
+    return (isExtended ? 11 : 6) + fdDlcToSize(fdSizeToDlc(size)) * 2;
+}
+
+template <typename B, typename C>
+std::size_t Encoder<B, C>::writeFdFrame(char* dest, uint32_t address, bool isExtended, bool bitRateSwitch,
+                                        const void* data, std::size_t size)
+{
+    std::size_t addrSize = isExtended ? 8 : 3;
+    if (isExtended) {
+        dest[0] = bitRateSwitch ? 'B' : 'D';
+        encodeExtendedAddress(address, dest + 1);
+    } else {
+        dest[0] = bitRateSwitch ? 'b' : 'd';
+        encodeAddress(address, dest + 1);
+    }
+    uint8_t dlc = fdSizeToDlc(size);
+    char* cur = dest + 1 + addrSize;
+    *cur++ = nibbleToChar(dlc);
+    encodeHexStream((const uint8_t*)data, cur, size);
+    cur += size * 2;
+    std::size_t padding = (fdDlcToSize(dlc) - size) * 2;
+    std::memset(cur, '0', padding);
+    cur += padding;
+    *cur++ = '\r';
+    return cur - dest;
+}
+
+template <typename B, typename C>
+void Encoder<B, C>::setFdBaudrate(FdBaudRate rate)
+{
+    char data[3];
+    data[0] = 'Y';
+    data[1] = fdBaudRateToChar(rate);
+    data[2] = '\r';
+    emitData(data, 3, 0);
 }
 
-template <typename B>
-void Encoder<B>::openCanChannel()
+template <typename B, typename C>
+bool Encoder<B, C>::transmitFdFrame(uint32_t address, const void* data, std::size_t size, bool isExtended,
+                                    bool bitRateSwitch)
 {
-    base().handleEncodedData("O\r", 2);
+    if (size > 64 || address > (isExtended ? 0x1fffffffu : 0x7ffu)) {
+        return false;
+    }
+    char msg[139];
+    emitData(msg, writeFdFrame(msg, address, isExtended, bitRateSwitch, data, size), 1);
+    return true;
 }
 
-template <typename B>
-void Encoder<B>::closeCanChannel()
+// Same buffering as transmitData: one handleEncodedData call unless the stream doesn't fit into the buffer
+template <typename B, typename C>
+bool Encoder<B, C>::transmitFdData(uint32_t address, const void* data, std::size_t size, bool bitRateSwitch)
 {
-    base().handleEncodedData("C\r", 2);
+    if (address > 0x1fffffff) {
+        return false;
+    }
+    bool isExtended = address > 0x7ff;
+    if (size <= 64) {
+        return transmitFdFrame(address, data, size, isExtended, bitRateSwitch);
+    }
+
+    std::size_t fullMsgSize = fdFrameSize(isExtended, 64);
+    std::size_t fullMsgNum = size / 64;
+    std::size_t lastMsgDataSize = size % 64;
+    std::size_t streamSize = fullMsgNum * fullMsgSize;
+    if (lastMsgDataSize) {
+        streamSize += fdFrameSize(isExtended, lastMsgDataSize);
+    }
+    _buffer.reserve(streamSize);
+    if (_buffer.size() < fullMsgSize) {
+        _metrics.bufferTooSmall();
+        return false;
+    }
+    _metrics.bufferReserved(std::min(streamSize, _buffer.size()));
+    char* begin = _buffer.data();
+    char* end = begin + _buffer.size();
+    char* cur = begin;
+    const uint8_t* ptr = (const uint8_t*)data;
+    std::size_t frameNum = 0;
+
+    for (std::size_t i = 0; i <= fullMsgNum; i++) {
+        std::size_t msgDataSize = i < fullMsgNum ? 64 : lastMsgDataSize;
+        if (msgDataSize == 0) {
+            break;
+        }
+        if (std::size_t(end - cur) < fdFrameSize(isExtended, msgDataSize)) {
+            emitData(begin, cur - begin, frameNum);
+            cur = begin;
+            frameNum = 0;
+        }
+        cur += writeFdFrame(cur, address, isExtended, bitRateSwitch, ptr, msgDataSize);
+        ptr += msgDataSize;
+        frameNum++;
+    }
+    emitData(begin, cur - begin, frameNum);
+    return true;
 }
 
-template <typename B>
-void Encoder<B>::encodeStdFrame(uint32_t address, const void* data, std::size_t size)
+template <typename B, typename C>
+void Encoder<B, C>::encodeStdFrame(uint32_t address, const void* data, std::size_t size)
 {
     char msg[22];
-    msg[0] = 't';
-    encodeAddress(address, msg + 1);
-    msg[4] = '0' + size;
-    encodeHexStream((const uint8_t*)data, msg + 5, size);
-    msg[5 + size * 2] = '\r';
-    base().handleEncodedData(msg, 5 + size * 2 + 1);
+    emitData(msg, writeStdFrame(msg, address, data, size), 1);
 }
 
-template <typename B>
-void Encoder<B>::encodeExtFrame(uint32_t address, const void* data, std::size_t size)
+template <typename B, typename C>
+void Encoder<B, C>::encodeExtFrame(uint32_t address, const void* data, std::size_t size)
 {
     char msg[27];
-    msg[0] = 'T';
-    encodeExtendedAddress(address, msg + 1);
-    msg[9] = '0' + size;
-    encodeHexStream((const uint8_t*)data, msg + 10, size);
-    msg[10 + size * 2] = '\r';
-    base().handleEncodedData(msg, 10 + size * 2 + 1);
+    emitData(msg, writeExtFrame(msg, address, data, size), 1);
 }
 
-template <typename B>
-bool Encoder<B>::transmitStdFrame(uint32_t address, const void* data, std::size_t size)
+template <typename B, typename C>
+bool Encoder<B, C>::transmitStdFrame(uint32_t address, const void* data, std::size_t size)
 {
     if (size > 8 || address > 0x7ff) {
         return false;
@@ -126,8 +297,8 @@ bool Encoder<B>::transmitStdFrame(uint32_t address, const void* data, std::size_
     return true;
 }
 
-template <typename B>
-bool Encoder<B>::transmitExtFrame(uint32_t address, const void* data, std::size_t size)
+template <typename B, typename C>
+bool Encoder<B, C>::transmitExtFrame(uint32_t address, const void* data, std::size_t size)
 {
     if (size > 8 || address > 0x1fffffff) {
         return false;
@@ -136,52 +307,59 @@ bool Encoder<B>::transmitExtFrame(uint32_t address, const void* data, std::size_
     return true;
 }
 
-template <typename B>
-bool Encoder<B>::transmitData(uint32_t address, const void* data, std::size_t size)
+// Data longer than 8 bytes is split into frames of the same address, the stream is passed to handleEncodedData at
+// once unless it doesn't fit into the buffer
+template <typename B, typename C>
+bool Encoder<B, C>::transmitData(uint32_t address, const void* data, std::size_t size)
 {
-    //TODO: refact
+    if (address > 0x1fffffff) {
+        return false;
+    }
+    bool isExtended = address > 0x7ff;
     if (size <= 8) {
-        if (address > 0x1fffffff) {
-            return false;
-        } else if (address > 0x7ff) {
+        if (isExtended) {
             encodeExtFrame(address, data, size);
-            return true;
+        } else {
+            encodeStdFrame(address, data, size);
         }
-        encodeStdFrame(address, data, size);
         return true;
     }
 
-    char prefix;
-    std::size_t streamSize;
+    char prefix = isExtended ? 'T' : 't';
+    std::size_t addressSize = isExtended ? 8 : 3;
+    std::size_t fullMsgSize = addressSize + 19;
     std::size_t fullMsgNum = size / 8;
     std::size_t lastMsgDataSize = size % 8;
-    std::size_t addressSize;
     char hexAddress[8];
-    if (address > 0x1fffffff) {
-        return false;
-    } else if (address > 0x7ff) {
-        prefix = 'T';
-        addressSize = 8;
+    if (isExtended) {
         encodeExtendedAddress(address, hexAddress);
-        streamSize = fullMsgNum * 27;
-        if (lastMsgDataSize) {
-            streamSize += 11 + lastMsgDataSize * 2;
-        }
     } else {
-        prefix = 't';
-        addressSize = 3;
         encodeAddress(address, hexAddress);
-        streamSize = fullMsgNum * 22;
-        if (lastMsgDataSize) {
-            streamSize += 6 + lastMsgDataSize * 2;
-        }
     }
 
-    char* msg = (char*)std::malloc(streamSize);
-    char* cur = msg;
+    std::size_t streamSize = fullMsgNum * fullMsgSize;
+    if (lastMsgDataSize) {
+        streamSize += addressSize + 3 + lastMsgDataSize * 2;
+    }
+    _buffer.reserve(streamSize);
+    if (_buffer.size() < fullMsgSize) {
+        _metrics.bufferTooSmall();
+        return false;
+    }
+    _metrics.bufferReserved(std::min(streamSize, _buffer.size()));
+    char* begin = _buffer.data();
+    char* end = begin + _buffer.size();
+    char* cur = begin;
     const uint8_t* ptr = (const uint8_t*)data;
+    std::size_t frameNum = 0;
 
     for (std::size_t i = 0; i < fullMsgNum; i++) {
+        if (std::size_t(end - cur) < fullMsgSize) {
+            emitData(begin, cur - begin, frameNum);
+            cur = begin;
+            frameNum = 0;
+        }
+        frameNum++;
         cur[0] = prefix;
         cur += 1;
 
@@ -199,6 +377,12 @@ bool Encoder<B>::transmitData(uint32_t address, const void* data, std::size_t si
     }
 
     if (lastMsgDataSize) {
+        if (std::size_t(end - cur) < addressSize + 3 + lastMsgDataSize * 2) {
+            emitData(begin, cur - begin, frameNum);
+            cur = begin;
+            frameNum = 0;
+        }
+        frameNum++;
         cur[0] = prefix;
         cur += 1;
 
@@ -210,10 +394,70 @@ bool Encoder<B>::transmitData(uint32_t address, const void* data, std::size_t si
 
         encodeHexStream(ptr, cur, lastMsgDataSize);
         cur[lastMsgDataSize * 2] = '\r';
+        cur += lastMsgDataSize * 2 + 1;
     }
 
-    base().handleEncodedData(msg, streamSize);
-    std::free(msg);
+    emitData(begin, cur - begin, frameNum);
     return true;
 }
+
+template <typename B, typename C>
+inline void Encoder<B, C>::setBuffer(char* buffer, std::size_t size)
+{
+    _buffer.setStorage(buffer, size);
+}
+
+template <typename B, typename C>
+inline bool Encoder<B, C>::isValidFrame(const TransmitFrame& frame)
+{
+    return frame.size <= 8 && frame.address <= (frame.isExtended ? 0x1fffffffu : 0x7ffu);
+}
+
+template <typename B, typename C>
+inline std::size_t Encoder<B, C>::encodedFrameSize(const TransmitFrame& frame)
+{
+    return (frame.isExtended ? 11 : 6) + frame.size * 2;
+}
+
+template <typename B, typename C>
+std::size_t Encoder<B, C>::transmitBatch(const TransmitFrame* frames, std::size_t count)
+{
+    std::size_t streamSize = 0;
+    std::size_t validNum = 0;
+    while (validNum < count && isValidFrame(frames[validNum])) {
+        streamSize += encodedFrameSize(frames[validNum]);
+        validNum++;
+    }
+    _buffer.reserve(streamSize);
+    _metrics.bufferReserved(std::min(streamSize, _buffer.size()));
+    return transmitBatch(frames, validNum, _buffer.data(), _buffer.size());
+}
+
+template <typename B, typename C>
+std::size_t Encoder<B, C>::transmitBatch(const TransmitFrame* frames, std::size_t count, char* buffer,
+                                      std::size_t bufferSize)
+{
+    char* cur = buffer;
+    char* end = buffer + bufferSize;
+    std::size_t i = 0;
+    for (; i < count; i++) {
+        const TransmitFrame& frame = frames[i];
+        if (!isValidFrame(frame)) {
+            break;
+        }
+        if (std::size_t(end - cur) < encodedFrameSize(frame)) {
+            _metrics.bufferTooSmall();
+            break;
+        }
+        if (frame.isExtended) {
+            cur += writeExtFrame(cur, frame.address, frame.data, frame.size);
+        } else {
+            cur += writeStdFrame(cur, frame.address, frame.data, frame.size);
+        }
+    }
+    if (cur != buffer) {
+        emitData(buffer, cur - buffer, i);
+    }
+    return i;
+}
 }
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+
+namespace dtacan {
+
+/// Fifo ring of up to capacity elements stored inline, elements are copied in and out
+template <typename T, std::size_t capacity>
+class FixedQueue {
+public:
+    FixedQueue()
+        : _head(0)
+        , _size(0)
+    {
+    }
+
+    bool push(const T& value)
+    {
+        if (_size == capacity) {
+            return false;
+        }
+        _items[(_head + _size) % capacity] = value;
+        _size++;
+        return true;
+    }
+
+    void pop()
+    {
+        assert(_size != 0);
+        _head = (_head + 1) % capacity;
+        _size--;
+    }
+
+    T& front()
+    {
+        assert(_size != 0);
+        return _items[_head];
+    }
+
+    const T& front() const
+    {
+        assert(_size != 0);
+        return _items[_head];
+    }
+
+    // i-th element counting from the front
+    T& operator[](std::size_t i)
+    {
+        assert(i < _size);
+        return _items[(_head + i) % capacity];
+    }
+
+    const T& operator[](std::size_t i) const
+    {
+        assert(i < _size);
+        return _items[(_head + i) % capacity];
+    }
+
+    void clear()
+    {
+        _head = 0;
+        _size = 0;
+    }
+
+    std::size_t size() const
+    {
+        return _size;
+    }
+
+    bool isEmpty() const
+    {
+        return _size == 0;
+    }
+
+    bool isFull() const
+    {
+        return _size == capacity;
+    }
+
+private:
+    static_assert(capacity > 0, "queue capacity must be positive");
+
+    T _items[capacity];
+    std::size_t _head;
+    std::size_t _size;
+};
+}
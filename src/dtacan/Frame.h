@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace dtacan {
+
+/// Decoded classic CAN frame, fixed size so frames can be stored and passed around in arrays
+struct Frame {
+    uint32_t address;
+    bool isExtended;
+    uint8_t size;
+    uint8_t data[8];
+};
+
+// Payload size of a CAN FD frame with dlc 0 to 15, sizes over 8 grow in steps up to 64
+inline uint8_t fdDlcToSize(uint8_t dlc)
+{
+    static const uint8_t sizes[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+    return sizes[dlc & 15];
+}
+
+// Smallest dlc of a CAN FD frame holding size bytes, size must not exceed 64
+inline uint8_t fdSizeToDlc(std::size_t size)
+{
+    uint8_t dlc = 0;
+    while (fdDlcToSize(dlc) < size) {
+        dlc++;
+    }
+    return dlc;
+}
+
+// Lower value wins bus arbitration: the 11 bit base id goes first, then a std frame wins over an ext one
+inline uint64_t arbitrationKey(uint32_t address, bool isExtended)
+{
+    return isExtended ? (uint64_t(address) << 1) | 1 : uint64_t(address) << 19;
+}
+}
@@ -0,0 +1,340 @@
+#pragma once
+
+#include "dtacan/Util.h"
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define DTACAN_HEX_X86
+#include <immintrin.h>
+#define DTACAN_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace dtacan {
+
+enum class SimdLevel {
+    Scalar,
+    Sse2,
+    Ssse3,
+    Avx2,
+};
+
+namespace detail {
+
+typedef bool (*HexDecodeFunc)(const char* src, uint8_t* dest, std::size_t size);
+typedef void (*HexEncodeFunc)(const uint8_t* data, char* dest, std::size_t size);
+
+inline void encodeHexStreamScalar(const uint8_t* data, char* dest, std::size_t size)
+{
+    for (std::size_t i = 0; i < size; i++) {
+        encodeHexByte(data[i], dest + i * 2);
+    }
+}
+
+// Invalid chars map to 0xff, so or-ing all nibbles and testing the high half validates the whole span
+inline bool decodeHexStreamScalar(const char* src, uint8_t* dest, std::size_t size)
+{
+    uint8_t acc = 0;
+    for (std::size_t i = 0; i < size; i++) {
+        uint8_t l = charToNibble(src[i * 2]);
+        uint8_t r = charToNibble(src[i * 2 + 1]);
+        acc |= l | r;
+        dest[i] = (l << 4) | r;
+    }
+    return (acc & 0xf0) == 0;
+}
+
+inline bool decodeFrameFieldsScalar(const char* src, std::size_t addrSize, std::size_t dataSize, uint32_t* address,
+                                    uint8_t* data)
+{
+    uint8_t acc = charToNibble(src[addrSize]);
+    uint32_t value = 0;
+    for (std::size_t i = 0; i < addrSize; i++) {
+        uint8_t n = charToNibble(src[i]);
+        acc |= n;
+        value = (value << 4) | n;
+    }
+    *address = value;
+    return decodeHexStreamScalar(src + addrSize + 1, data, dataSize) && (acc & 0xf0) == 0;
+}
+
+#ifdef DTACAN_HEX_X86
+
+// Converts 16 uppercase hex chars to nibbles, mask has a bit set for every valid char
+inline __m128i hexToNibbles(__m128i v, int* mask)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    __m128i a = _mm_sub_epi8(v, _mm_set1_epi8('A'));
+    __m128i isDigit = _mm_cmpeq_epi8(_mm_subs_epu8(d, _mm_set1_epi8(9)), zero);
+    __m128i isAlpha = _mm_cmpeq_epi8(_mm_subs_epu8(a, _mm_set1_epi8(5)), zero);
+    *mask = _mm_movemask_epi8(_mm_or_si128(isDigit, isAlpha));
+    return _mm_or_si128(_mm_and_si128(isDigit, d), _mm_and_si128(isAlpha, _mm_add_epi8(a, _mm_set1_epi8(10))));
+}
+
+// Packs nibble pairs into 8 bytes stored in the low half
+inline __m128i packNibblesSse2(__m128i n)
+{
+    __m128i hi = _mm_and_si128(_mm_slli_epi16(n, 4), _mm_set1_epi16(0x00f0));
+    __m128i lo = _mm_srli_epi16(n, 8);
+    return _mm_packus_epi16(_mm_or_si128(hi, lo), _mm_setzero_si128());
+}
+
+DTACAN_TARGET("ssse3") inline __m128i packNibblesSsse3(__m128i n)
+{
+    return _mm_packus_epi16(_mm_maddubs_epi16(n, _mm_set1_epi16(0x0110)), _mm_setzero_si128());
+}
+
+inline bool decodeHexStreamSse2(const char* src, uint8_t* dest, std::size_t size)
+{
+    while (size >= 8) {
+        int mask;
+        __m128i n = hexToNibbles(_mm_loadu_si128((const __m128i*)src), &mask);
+        if (mask != 0xffff) {
+            return false;
+        }
+        _mm_storel_epi64((__m128i*)dest, packNibblesSse2(n));
+        src += 16;
+        dest += 8;
+        size -= 8;
+    }
+    return decodeHexStreamScalar(src, dest, size);
+}
+
+DTACAN_TARGET("ssse3") inline bool decodeHexStreamSsse3(const char* src, uint8_t* dest, std::size_t size)
+{
+    while (size >= 8) {
+        int mask;
+        __m128i n = hexToNibbles(_mm_loadu_si128((const __m128i*)src), &mask);
+        if (mask != 0xffff) {
+            return false;
+        }
+        _mm_storel_epi64((__m128i*)dest, packNibblesSsse3(n));
+        src += 16;
+        dest += 8;
+        size -= 8;
+    }
+    return decodeHexStreamScalar(src, dest, size);
+}
+
+DTACAN_TARGET("avx2") inline bool decodeHexStreamAvx2(const char* src, uint8_t* dest, std::size_t size)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    while (size >= 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)src);
+        __m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+        __m256i a = _mm256_sub_epi8(v, _mm256_set1_epi8('A'));
+        __m256i isDigit = _mm256_cmpeq_epi8(_mm256_subs_epu8(d, _mm256_set1_epi8(9)), zero);
+        __m256i isAlpha = _mm256_cmpeq_epi8(_mm256_subs_epu8(a, _mm256_set1_epi8(5)), zero);
+        if (_mm256_movemask_epi8(_mm256_or_si256(isDigit, isAlpha)) != -1) {
+            return false;
+        }
+        __m256i n = _mm256_or_si256(_mm256_and_si256(isDigit, d),
+                                    _mm256_and_si256(isAlpha, _mm256_add_epi8(a, _mm256_set1_epi8(10))));
+        __m256i packed = _mm256_maddubs_epi16(n, _mm256_set1_epi16(0x0110));
+        packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(packed, zero), 0xd8);
+        _mm_storeu_si128((__m128i*)dest, _mm256_castsi256_si128(packed));
+        src += 32;
+        dest += 16;
+        size -= 16;
+    }
+    return decodeHexStreamSsse3(src, dest, size);
+}
+
+// Spreads 8 bytes into 16 nibbles in big endian order
+inline __m128i bytesToNibbles(const uint8_t* data)
+{
+    __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i v = _mm_loadl_epi64((const __m128i*)data);
+    return _mm_unpacklo_epi8(_mm_and_si128(_mm_srli_epi16(v, 4), mask), _mm_and_si128(v, mask));
+}
+
+inline void encodeHexStreamSse2(const uint8_t* data, char* dest, std::size_t size)
+{
+    while (size >= 8) {
+        __m128i n = bytesToNibbles(data);
+        __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)), _mm_set1_epi8('A' - '0' - 10));
+        _mm_storeu_si128((__m128i*)dest, _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), letters));
+        data += 8;
+        dest += 16;
+        size -= 8;
+    }
+    encodeHexStreamScalar(data, dest, size);
+}
+
+DTACAN_TARGET("ssse3") inline void encodeHexStreamSsse3(const uint8_t* data, char* dest, std::size_t size)
+{
+    const __m128i lut = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F');
+    while (size >= 8) {
+        _mm_storeu_si128((__m128i*)dest, _mm_shuffle_epi8(lut, bytesToNibbles(data)));
+        data += 8;
+        dest += 16;
+        size -= 8;
+    }
+    encodeHexStreamScalar(data, dest, size);
+}
+
+DTACAN_TARGET("avx2") inline void encodeHexStreamAvx2(const uint8_t* data, char* dest, std::size_t size)
+{
+    const __m256i lut = _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E',
+                                         'F', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D',
+                                         'E', 'F');
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    while (size >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)data);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+        __m128i lo = _mm_and_si128(v, mask);
+        __m256i n = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(hi, lo)),
+                                            _mm_unpackhi_epi8(hi, lo), 1);
+        _mm256_storeu_si256((__m256i*)dest, _mm256_shuffle_epi8(lut, n));
+        data += 16;
+        dest += 32;
+        size -= 16;
+    }
+    encodeHexStreamSsse3(data, dest, size);
+}
+
+inline uint32_t frameAddressSse2(__m128i headNibbles, std::size_t addrSize)
+{
+    uint64_t head = _mm_cvtsi128_si64(packNibblesSse2(headNibbles));
+    if (addrSize == 3) {
+        return ((head & 0xff) << 4) | ((head >> 12) & 0xf);
+    }
+    uint32_t be = (uint32_t)head;
+    return (be >> 24) | ((be >> 8) & 0xff00) | ((be << 8) & 0xff0000) | (be << 24);
+}
+
+// Writes 8 bytes to data, only first dataSize of them are meaningful. Spans up to 16 chars are decoded with a
+// single load if the buffer allows reading past them, longer ones with two overlapping loads
+inline bool decodeFrameFieldsSse2(const char* src, std::size_t available, std::size_t addrSize, std::size_t dataSize,
+                                  uint32_t* address, uint8_t* data)
+{
+    std::size_t fieldsSize = addrSize + 1 + dataSize * 2;
+    int headMask;
+    __m128i head = _mm_setzero_si128();
+    if (fieldsSize <= 16) {
+        if (available < 16) {
+            return decodeFrameFieldsScalar(src, addrSize, dataSize, address, data);
+        }
+        head = hexToNibbles(_mm_loadu_si128((const __m128i*)src), &headMask);
+        if (((headMask | (0xffff << fieldsSize)) & 0xffff) != 0xffff) {
+            return false;
+        }
+        *address = frameAddressSse2(head, addrSize);
+        // payload starts at nibble 4 for std frames and at nibble 9 for ext ones
+        __m128i payload;
+        if (addrSize == 3) {
+            payload = _mm_srli_si128(packNibblesSse2(head), 2);
+        } else {
+            payload = _mm_srli_si128(packNibblesSse2(_mm_srli_si128(head, 1)), 4);
+        }
+        _mm_storel_epi64((__m128i*)data, payload);
+        return true;
+    }
+
+    int tailMask;
+    head = hexToNibbles(_mm_loadu_si128((const __m128i*)src), &headMask);
+    __m128i tail = hexToNibbles(_mm_loadu_si128((const __m128i*)(src + fieldsSize - 16)), &tailMask);
+    if ((headMask & tailMask) != 0xffff) {
+        return false;
+    }
+    *address = frameAddressSse2(head, addrSize);
+    // payload occupies the last dataSize * 2 chars of the tail, which starts at an even offset
+    uint64_t payload = _mm_cvtsi128_si64(packNibblesSse2(tail)) >> ((8 - dataSize) * 8);
+    std::memcpy(data, &payload, 8);
+    return true;
+}
+
+#endif
+
+inline SimdLevel detectSimdLevel()
+{
+#ifdef DTACAN_HEX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::Avx2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return SimdLevel::Ssse3;
+    }
+    return SimdLevel::Sse2;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+}
+
+/// Highest instruction set usable on this cpu, detected once
+inline SimdLevel simdLevel()
+{
+    static const SimdLevel level = detail::detectSimdLevel();
+    return level;
+}
+
+/// Returns hex stream decoder for given instruction set, which must not exceed simdLevel()
+inline detail::HexDecodeFunc hexDecoder(SimdLevel level)
+{
+#ifdef DTACAN_HEX_X86
+    switch (level) {
+    case SimdLevel::Scalar:
+        return detail::decodeHexStreamScalar;
+    case SimdLevel::Sse2:
+        return detail::decodeHexStreamSse2;
+    case SimdLevel::Ssse3:
+        return detail::decodeHexStreamSsse3;
+    case SimdLevel::Avx2:
+        return detail::decodeHexStreamAvx2;
+    }
+#endif
+    (void)level;
+    return detail::decodeHexStreamScalar;
+}
+
+/// Returns hex stream encoder for given instruction set, which must not exceed simdLevel()
+inline detail::HexEncodeFunc hexEncoder(SimdLevel level)
+{
+#ifdef DTACAN_HEX_X86
+    switch (level) {
+    case SimdLevel::Scalar:
+        return detail::encodeHexStreamScalar;
+    case SimdLevel::Sse2:
+        return detail::encodeHexStreamSse2;
+    case SimdLevel::Ssse3:
+        return detail::encodeHexStreamSsse3;
+    case SimdLevel::Avx2:
+        return detail::encodeHexStreamAvx2;
+    }
+#endif
+    (void)level;
+    return detail::encodeHexStreamScalar;
+}
+
+/// Encodes size bytes as size * 2 uppercase hex chars
+inline void encodeHexStream(const uint8_t* data, char* dest, std::size_t size)
+{
+    static const detail::HexEncodeFunc func = hexEncoder(simdLevel());
+    func(data, dest, size);
+}
+
+/// Decodes size bytes from size * 2 uppercase hex chars, returns false if any char is not a hex digit
+inline bool decodeHexStream(const char* src, uint8_t* dest, std::size_t size)
+{
+    static const detail::HexDecodeFunc func = hexDecoder(simdLevel());
+    return func(src, dest, size);
+}
+
+/// Decodes address, dlc char and payload of a t/T frame in one pass, returns false if any char is not a hex digit.
+/// Up to available bytes starting from src may be read, data must have room for 8 bytes
+inline bool decodeFrameFields(const char* src, std::size_t available, std::size_t addrSize, std::size_t dataSize,
+                              uint32_t* address, uint8_t* data)
+{
+#ifdef DTACAN_HEX_X86
+    return detail::decodeFrameFieldsSse2(src, available, addrSize, dataSize, address, data);
+#else
+    (void)available;
+    return detail::decodeFrameFieldsScalar(src, addrSize, dataSize, address, data);
+#endif
+}
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+namespace dtacan {
+
+namespace detail {
+
+inline std::size_t hashAddress(uint32_t address, bool isExtended, std::size_t mask)
+{
+    return ((address ^ (isExtended ? 0x80000000u : 0)) * 0x9e3779b1u >> 7) & mask;
+}
+
+// Power of two of at least twice the capacity keeps probe sequences short
+constexpr std::size_t hashTableSize(std::size_t capacity, std::size_t size = 8)
+{
+    return size >= capacity * 2 ? size : hashTableSize(capacity, size * 2);
+}
+}
+
+/// Acceptance filter for Parser::acceptAddress. Std ids are kept in a 2048 bit bitmap, ext ids in an open
+/// addressing hash set with room for extCapacity ids and in a list of up to maskCapacity code/mask pairs.
+/// Rejects everything until ids are added
+template <std::size_t extCapacity = 128, std::size_t maskCapacity = 8>
+class IdFilter {
+public:
+    IdFilter()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        std::memset(_std, 0, sizeof(_std));
+        std::memset(_ext, 0xff, sizeof(_ext));
+        _extNum = 0;
+        _maskNum = 0;
+    }
+
+    bool addStd(uint32_t address)
+    {
+        if (address > 0x7ff) {
+            return false;
+        }
+        _std[address >> 6] |= uint64_t(1) << (address & 63);
+        return true;
+    }
+
+    bool addStdRange(uint32_t first, uint32_t last)
+    {
+        if (first > last || last > 0x7ff) {
+            return false;
+        }
+        for (uint32_t address = first; address <= last; address++) {
+            addStd(address);
+        }
+        return true;
+    }
+
+    /// Returns false if the id is invalid or the set is full
+    bool addExt(uint32_t address)
+    {
+        if (address > 0x1fffffff) {
+            return false;
+        }
+        std::size_t i = findExt(address);
+        if (_ext[i] == address) {
+            return true;
+        }
+        if (_extNum == extCapacity) {
+            return false;
+        }
+        _ext[i] = address;
+        _extNum++;
+        return true;
+    }
+
+    /// Accepts ext ids with (address & mask) == (code & mask)
+    bool addExtMask(uint32_t code, uint32_t mask)
+    {
+        if (_maskNum == maskCapacity) {
+            return false;
+        }
+        _masks[_maskNum].code = code & mask;
+        _masks[_maskNum].mask = mask;
+        _maskNum++;
+        return true;
+    }
+
+    bool accepts(uint32_t address, bool isExtended) const
+    {
+        if (!isExtended) {
+            return (_std[(address >> 6) & 31] >> (address & 63)) & 1;
+        }
+        if (_ext[findExt(address)] == address) {
+            return true;
+        }
+        for (std::size_t i = 0; i < _maskNum; i++) {
+            if ((address & _masks[i].mask) == _masks[i].code) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    static const std::size_t tableSize = detail::hashTableSize(extCapacity);
+    static const uint32_t emptySlot = 0xffffffff;
+
+    struct Mask {
+        uint32_t code;
+        uint32_t mask;
+    };
+
+    std::size_t findExt(uint32_t address) const
+    {
+        std::size_t i = detail::hashAddress(address, true, tableSize - 1);
+        while (_ext[i] != emptySlot && _ext[i] != address) {
+            i = (i + 1) & (tableSize - 1);
+        }
+        return i;
+    }
+
+    uint64_t _std[2048 / 64];
+    uint32_t _ext[tableSize];
+    std::size_t _extNum;
+    Mask _masks[maskCapacity == 0 ? 1 : maskCapacity];
+    std::size_t _maskNum;
+};
+
+/// Per-id handler table, so frames of hot ids go straight to their own callbacks. Std ids are indexed
+/// directly, ext ids through an open addressing table. Holds up to capacity handlers
+template <std::size_t capacity = 64>
+class IdDispatcher {
+public:
+    typedef void (*Handler)(void* context, uint32_t address, const uint8_t* data, std::size_t size);
+
+    IdDispatcher()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        std::memset(_stdIndex, 0, sizeof(_stdIndex));
+        std::memset(_extIndex, 0, sizeof(_extIndex));
+        _handlerNum = 0;
+    }
+
+    /// Returns false if the id is invalid or the table is full, replaces handler of already registered id
+    bool setHandler(uint32_t address, bool isExtended, Handler handler, void* context)
+    {
+        if (address > (isExtended ? 0x1fffffffu : 0x7ffu)) {
+            return false;
+        }
+        uint8_t* index;
+        if (isExtended) {
+            std::size_t i = findExt(address);
+            index = &_extIndex[i];
+            _extAddress[i] = address;
+        } else {
+            index = &_stdIndex[address];
+        }
+        if (*index == 0) {
+            if (_handlerNum == capacity) {
+                return false;
+            }
+            _handlerNum++;
+            *index = _handlerNum;
+        }
+        _handlers[*index - 1].handler = handler;
+        _handlers[*index - 1].context = context;
+        return true;
+    }
+
+    /// Calls handler registered for the id, returns false if there is none
+    bool dispatch(uint32_t address, bool isExtended, const uint8_t* data, std::size_t size) const
+    {
+        uint8_t index;
+        if (isExtended) {
+            index = _extIndex[findExt(address)];
+        } else {
+            index = _stdIndex[address & 0x7ff];
+        }
+        if (index == 0) {
+            return false;
+        }
+        const Entry& entry = _handlers[index - 1];
+        entry.handler(entry.context, address, data, size);
+        return true;
+    }
+
+private:
+    static_assert(capacity > 0 && capacity < 256, "handler index must fit into a byte");
+    static const std::size_t tableSize = detail::hashTableSize(capacity);
+
+    struct Entry {
+        Handler handler;
+        void* context;
+    };
+
+    std::size_t findExt(uint32_t address) const
+    {
+        std::size_t i = detail::hashAddress(address, true, tableSize - 1);
+        while (_extIndex[i] != 0 && _extAddress[i] != address) {
+            i = (i + 1) & (tableSize - 1);
+        }
+        return i;
+    }
+
+    uint8_t _stdIndex[2048];
+    uint8_t _extIndex[tableSize];
+    uint32_t _extAddress[tableSize];
+    Entry _handlers[capacity];
+    std::size_t _handlerNum;
+};
+}
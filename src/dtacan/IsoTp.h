@@ -0,0 +1,641 @@
+#pragma once
+
+#include "dtacan/Encoder.h"
+#include "dtacan/IdFilter.h"
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+namespace dtacan {
+
+/// Ids of an ISO-TP session, frames go out on txAddress and the peer answers on rxAddress
+struct IsoTpAddress {
+    uint32_t txAddress;
+    uint32_t rxAddress;
+    bool isExtended;
+};
+
+enum class IsoTpResult {
+    Ok,
+    // no flow control within N_Bs or no consecutive frame within N_Cr
+    Timeout,
+    // consecutive frame with an unexpected sequence number, the reception is dropped
+    WrongSequence,
+    // single or first frame in the middle of a reception, the old one is dropped
+    UnexpectedPdu,
+    // the peer refused the message with an overflow flow control
+    Overflow,
+    // no room in the pool for the message, the peer got an overflow flow control
+    BufferOverflow,
+    // flow control with a reserved flow status
+    InvalidFlowStatus,
+};
+
+// STmin byte of a flow control in nanoseconds, reserved values mean the longest time of 127 ms
+inline uint64_t isoTpSeparationTimeNs(uint8_t separationTime)
+{
+    if (separationTime <= 0x7f) {
+        return separationTime * 1000000ull;
+    }
+    if (separationTime >= 0xf1 && separationTime <= 0xf9) {
+        return (separationTime - 0xf0) * 100000ull;
+    }
+    return 127000000ull;
+}
+
+/// ISO 15765-2 transport over classic frames with normal addressing. Messages of up to 7 bytes go out as a single
+/// frame, longer ones as a first frame and consecutive frames paced by the flow control of the peer, messages over
+/// 4095 bytes use the 32 bit length of the first frame escape. Frames of the peer are fed from Parser::handleData
+/// to acceptFrame. Consecutive frames allowed at once are encoded in batches with one handleEncodedData call each.
+///
+/// Sessions are keyed by their pair of ids and run concurrently, in both directions at once. Messages are
+/// reassembled in a pool of poolSize bytes taken in runs of 64 byte blocks, a message that doesn't fit is refused
+/// with an overflow flow control. Nothing is allocated. Data passed to send must stay valid until handleSent
+/// reports the end of the transfer, for single frames that happens before send returns.
+///
+/// Time is passed by the caller in nanoseconds of any monotonic clock, poll sends paced consecutive frames and
+/// expires timeouts
+template <typename B, std::size_t sessionCapacity = 16, std::size_t poolSize = 65536>
+class IsoTp : public Encoder<B> {
+public:
+    void handleMessage(const IsoTpAddress& address, const uint8_t* data, std::size_t size);
+    void handleSent(const IsoTpAddress& address, IsoTpResult result);
+    void handleReceiveError(const IsoTpAddress& address, IsoTpResult result);
+
+    IsoTp();
+
+    // Returns false if ids are out of range, the table is full or rxAddress belongs to another session
+    bool openSession(const IsoTpAddress& address);
+    // Drops transfers of the session in progress without reporting them
+    bool closeSession(const IsoTpAddress& address);
+
+    // Block size and raw STmin byte of the flow control frames sent, 0 and 0 let the peer send at full speed
+    void setFlowControl(uint8_t blockSize, uint8_t separationTime);
+    // N_Bs, the wait for a flow control, and N_Cr, the wait for the next consecutive frame, 1 s each by default
+    void setTimeouts(uint64_t flowControlNs, uint64_t consecutiveNs);
+    // Frames are padded to 8 bytes with value unless disabled
+    void setPadding(bool enabled, uint8_t value = 0xcc);
+
+    // Starts a transfer, returns false if the session is unknown or sending, or size is 0 or over 0xffffffff
+    bool send(const IsoTpAddress& address, const void* data, std::size_t size, uint64_t nowNs);
+    // Returns false if the frame doesn't belong to any session
+    bool acceptFrame(uint32_t address, bool isExtended, const uint8_t* data, std::size_t size, uint64_t nowNs);
+
+    // Sends consecutive frames due and expires timeouts, returns number of frames sent
+    std::size_t poll(uint64_t nowNs);
+    // Time of the next consecutive frame or timeout, UINT64_MAX if nothing is in progress
+    uint64_t nextPollTime(uint64_t nowNs) const;
+
+    // Bytes of the pool taken by receptions in progress
+    std::size_t poolUsed() const;
+
+private:
+    static const uint64_t never = UINT64_MAX;
+    static const std::size_t npos = ~std::size_t(0);
+    static const std::size_t maxBatch = 32;
+    static const std::size_t tableSize = detail::hashTableSize(sessionCapacity);
+    static const std::size_t poolBlockSize = 64;
+    static const std::size_t poolBlocks = (poolSize + poolBlockSize - 1) / poolBlockSize;
+
+    static const uint8_t singleFrame = 0x00;
+    static const uint8_t firstFrame = 0x10;
+    static const uint8_t consecutiveFrame = 0x20;
+    static const uint8_t flowControl = 0x30;
+    static const uint8_t flowContinue = 0;
+    static const uint8_t flowWait = 1;
+    static const uint8_t flowOverflow = 2;
+
+    enum class TxState { Idle, WaitFlowControl, Sending };
+
+    struct Session {
+        IsoTpAddress address;
+        bool used;
+
+        TxState txState;
+        const uint8_t* txData;
+        std::size_t txSize;
+        std::size_t txOffset;
+        uint8_t txSequence;
+        uint8_t txBlockSize;
+        uint8_t txBlockLeft;
+        uint64_t txSeparationNs;
+        // next consecutive frame or flow control timeout
+        uint64_t txDeadline;
+
+        bool receiving;
+        std::size_t rxBlock;
+        std::size_t rxBlockNum;
+        std::size_t rxSize;
+        std::size_t rxOffset;
+        uint8_t rxSequence;
+        uint8_t rxBlockCount;
+        uint64_t rxDeadline;
+    };
+
+    B& base();
+    std::size_t findSlot(uint32_t rxAddress, bool isExtended) const;
+    Session* findSession(uint32_t rxAddress, bool isExtended);
+    void sendFrame(const Session& session, uint8_t* frame, std::size_t size);
+    void sendFlowControl(const Session& session, uint8_t status);
+    std::size_t sendConsecutive(Session& session, uint64_t nowNs);
+    void finishSend(Session& session, IsoTpResult result);
+    void dropReception(Session& session, IsoTpResult result);
+    void acceptFirstFrame(Session& session, const uint8_t* data, std::size_t size, uint64_t nowNs);
+    void acceptConsecutiveFrame(Session& session, const uint8_t* data, std::size_t size, uint64_t nowNs);
+    void acceptFlowControl(Session& session, const uint8_t* data, std::size_t size, uint64_t nowNs);
+    std::size_t allocate(std::size_t blockNum);
+    void release(std::size_t block, std::size_t blockNum);
+
+    Session _sessions[sessionCapacity];
+    // index + 1 of the session of an rx id, 0 marks an empty slot
+    std::size_t _table[tableSize];
+
+    uint8_t _blockSize;
+    uint8_t _separationTime;
+    uint64_t _flowControlTimeout;
+    uint64_t _consecutiveTimeout;
+    bool _padding;
+    uint8_t _padValue;
+
+    uint8_t _pool[poolBlocks * poolBlockSize];
+    uint64_t _poolMap[(poolBlocks + 63) / 64];
+    std::size_t _poolUsed;
+
+    TransmitFrame _batch[maxBatch];
+    uint8_t _batchData[maxBatch][8];
+    char _buffer[maxBatch * 27];
+};
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+inline void IsoTp<B, sessionCapacity, poolSize>::handleMessage(const IsoTpAddress& address, const uint8_t* data,
+                                                               std::size_t size)
+{
+    (void)address;
+    (void)data;
+    (void)size;
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+inline void IsoTp<B, sessionCapacity, poolSize>::handleSent(const IsoTpAddress& address, IsoTpResult result)
+{
+    (void)address;
+    (void)result;
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+inline void IsoTp<B, sessionCapacity, poolSize>::handleReceiveError(const IsoTpAddress& address, IsoTpResult result)
+{
+    (void)address;
+    (void)result;
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+IsoTp<B, sessionCapacity, poolSize>::IsoTp()
+    : _blockSize(0)
+    , _separationTime(0)
+    , _flowControlTimeout(1000000000)
+    , _consecutiveTimeout(1000000000)
+    , _padding(true)
+    , _padValue(0xcc)
+    , _poolUsed(0)
+{
+    std::memset(_sessions, 0, sizeof(_sessions));
+    std::memset(_table, 0, sizeof(_table));
+    std::memset(_poolMap, 0, sizeof(_poolMap));
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+inline B& IsoTp<B, sessionCapacity, poolSize>::base()
+{
+    return *static_cast<B*>(this);
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+inline void IsoTp<B, sessionCapacity, poolSize>::setFlowControl(uint8_t blockSize, uint8_t separationTime)
+{
+    _blockSize = blockSize;
+    _separationTime = separationTime;
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+inline void IsoTp<B, sessionCapacity, poolSize>::setTimeouts(uint64_t flowControlNs, uint64_t consecutiveNs)
+{
+    _flowControlTimeout = flowControlNs;
+    _consecutiveTimeout = consecutiveNs;
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+inline void IsoTp<B, sessionCapacity, poolSize>::setPadding(bool enabled, uint8_t value)
+{
+    _padding = enabled;
+    _padValue = value;
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+inline std::size_t IsoTp<B, sessionCapacity, poolSize>::findSlot(uint32_t rxAddress, bool isExtended) const
+{
+    std::size_t i = detail::hashAddress(rxAddress, isExtended, tableSize - 1);
+    while (_table[i] != 0) {
+        const IsoTpAddress& address = _sessions[_table[i] - 1].address;
+        if (address.rxAddress == rxAddress && address.isExtended == isExtended) {
+            break;
+        }
+        i = (i + 1) & (tableSize - 1);
+    }
+    return i;
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+inline typename IsoTp<B, sessionCapacity, poolSize>::Session*
+IsoTp<B, sessionCapacity, poolSize>::findSession(uint32_t rxAddress, bool isExtended)
+{
+    std::size_t slot = _table[findSlot(rxAddress, isExtended)];
+    return slot == 0 ? nullptr : &_sessions[slot - 1];
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+bool IsoTp<B, sessionCapacity, poolSize>::openSession(const IsoTpAddress& address)
+{
+    uint32_t maxAddress = address.isExtended ? 0x1fffffff : 0x7ff;
+    if (address.txAddress > maxAddress || address.rxAddress > maxAddress) {
+        return false;
+    }
+    std::size_t slot = findSlot(address.rxAddress, address.isExtended);
+    if (_table[slot] != 0) {
+        return false;
+    }
+    for (std::size_t i = 0; i < sessionCapacity; i++) {
+        if (!_sessions[i].used) {
+            std::memset(&_sessions[i], 0, sizeof(Session));
+            _sessions[i].address = address;
+            _sessions[i].used = true;
+            _table[slot] = i + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Sessions live as long as the connection, so the table is simply rebuilt without the closed one
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+bool IsoTp<B, sessionCapacity, poolSize>::closeSession(const IsoTpAddress& address)
+{
+    Session* session = findSession(address.rxAddress, address.isExtended);
+    if (!session || session->address.txAddress != address.txAddress) {
+        return false;
+    }
+    if (session->receiving) {
+        release(session->rxBlock, session->rxBlockNum);
+    }
+    session->used = false;
+    std::memset(_table, 0, sizeof(_table));
+    for (std::size_t i = 0; i < sessionCapacity; i++) {
+        if (_sessions[i].used) {
+            _table[findSlot(_sessions[i].address.rxAddress, _sessions[i].address.isExtended)] = i + 1;
+        }
+    }
+    return true;
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+std::size_t IsoTp<B, sessionCapacity, poolSize>::allocate(std::size_t blockNum)
+{
+    std::size_t run = 0;
+    for (std::size_t i = 0; i < poolBlocks; i++) {
+        if (_poolMap[i / 64] == ~uint64_t(0)) {
+            run = 0;
+            i += 63;
+            continue;
+        }
+        if (_poolMap[i / 64] & (uint64_t(1) << (i % 64))) {
+            run = 0;
+        } else if (++run == blockNum) {
+            std::size_t first = i + 1 - blockNum;
+            for (std::size_t j = first; j <= i; j++) {
+                _poolMap[j / 64] |= uint64_t(1) << (j % 64);
+            }
+            _poolUsed += blockNum * poolBlockSize;
+            return first;
+        }
+    }
+    return npos;
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+void IsoTp<B, sessionCapacity, poolSize>::release(std::size_t block, std::size_t blockNum)
+{
+    for (std::size_t j = block; j < block + blockNum; j++) {
+        _poolMap[j / 64] &= ~(uint64_t(1) << (j % 64));
+    }
+    _poolUsed -= blockNum * poolBlockSize;
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+inline std::size_t IsoTp<B, sessionCapacity, poolSize>::poolUsed() const
+{
+    return _poolUsed;
+}
+
+// frame must hold 8 bytes
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+inline void IsoTp<B, sessionCapacity, poolSize>::sendFrame(const Session& session, uint8_t* frame, std::size_t size)
+{
+    if (_padding) {
+        std::memset(frame + size, _padValue, 8 - size);
+        size = 8;
+    }
+    if (session.address.isExtended) {
+        Encoder<B>::transmitExtFrame(session.address.txAddress, frame, size);
+    } else {
+        Encoder<B>::transmitStdFrame(session.address.txAddress, frame, size);
+    }
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+inline void IsoTp<B, sessionCapacity, poolSize>::sendFlowControl(const Session& session, uint8_t status)
+{
+    uint8_t frame[8] = {uint8_t(flowControl | status), _blockSize, _separationTime};
+    sendFrame(session, frame, 3);
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+bool IsoTp<B, sessionCapacity, poolSize>::send(const IsoTpAddress& address, const void* data, std::size_t size,
+                                               uint64_t nowNs)
+{
+    Session* session = findSession(address.rxAddress, address.isExtended);
+    if (!session || session->address.txAddress != address.txAddress || session->txState != TxState::Idle
+        || size == 0 || uint64_t(size) > 0xffffffffu) {
+        return false;
+    }
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint8_t frame[8];
+    if (size <= 7) {
+        frame[0] = singleFrame | size;
+        std::memcpy(frame + 1, bytes, size);
+        sendFrame(*session, frame, size + 1);
+        base().handleSent(session->address, IsoTpResult::Ok);
+        return true;
+    }
+
+    std::size_t headerSize = 2;
+    if (size <= 0xfff) {
+        frame[0] = firstFrame | (size >> 8);
+        frame[1] = size & 0xff;
+    } else {
+        frame[0] = firstFrame;
+        frame[1] = 0;
+        frame[2] = size >> 24;
+        frame[3] = (size >> 16) & 0xff;
+        frame[4] = (size >> 8) & 0xff;
+        frame[5] = size & 0xff;
+        headerSize = 6;
+    }
+    std::memcpy(frame + headerSize, bytes, 8 - headerSize);
+    session->txState = TxState::WaitFlowControl;
+    session->txData = bytes;
+    session->txSize = size;
+    session->txOffset = 8 - headerSize;
+    session->txSequence = 1;
+    session->txDeadline = nowNs + _flowControlTimeout;
+    sendFrame(*session, frame, 8);
+    return true;
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+inline void IsoTp<B, sessionCapacity, poolSize>::finishSend(Session& session, IsoTpResult result)
+{
+    session.txState = TxState::Idle;
+    session.txData = nullptr;
+    base().handleSent(session.address, result);
+}
+
+// Frames allowed by the flow control go out in batches, with a separation time only one is due at a time
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+std::size_t IsoTp<B, sessionCapacity, poolSize>::sendConsecutive(Session& session, uint64_t nowNs)
+{
+    std::size_t sent = 0;
+    while (session.txState == TxState::Sending && session.txDeadline <= nowNs) {
+        std::size_t count = 0;
+        while (count < maxBatch && session.txState == TxState::Sending && session.txDeadline <= nowNs) {
+            uint8_t* frame = _batchData[count];
+            std::size_t chunk = session.txSize - session.txOffset < 7 ? session.txSize - session.txOffset : 7;
+            frame[0] = consecutiveFrame | session.txSequence;
+            std::memcpy(frame + 1, session.txData + session.txOffset, chunk);
+            std::size_t size = chunk + 1;
+            if (_padding) {
+                std::memset(frame + size, _padValue, 8 - size);
+                size = 8;
+            }
+            TransmitFrame& tx = _batch[count];
+            tx.address = session.address.txAddress;
+            tx.data = frame;
+            tx.size = size;
+            tx.isExtended = session.address.isExtended;
+            count++;
+
+            session.txOffset += chunk;
+            session.txSequence = (session.txSequence + 1) & 0xf;
+            if (session.txSeparationNs != 0) {
+                session.txDeadline = nowNs + session.txSeparationNs;
+            }
+            if (session.txOffset == session.txSize) {
+                session.txState = TxState::Idle;
+            } else if (session.txBlockSize != 0 && --session.txBlockLeft == 0) {
+                session.txState = TxState::WaitFlowControl;
+                session.txDeadline = nowNs + _flowControlTimeout;
+            }
+        }
+        Encoder<B>::transmitBatch(_batch, count, _buffer, sizeof(_buffer));
+        sent += count;
+    }
+    if (session.txState == TxState::Idle) {
+        finishSend(session, IsoTpResult::Ok);
+    }
+    return sent;
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+void IsoTp<B, sessionCapacity, poolSize>::dropReception(Session& session, IsoTpResult result)
+{
+    session.receiving = false;
+    release(session.rxBlock, session.rxBlockNum);
+    base().handleReceiveError(session.address, result);
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+bool IsoTp<B, sessionCapacity, poolSize>::acceptFrame(uint32_t address, bool isExtended, const uint8_t* data,
+                                                      std::size_t size, uint64_t nowNs)
+{
+    Session* session = findSession(address, isExtended);
+    if (!session) {
+        return false;
+    }
+    if (size == 0) {
+        return true;
+    }
+    switch (data[0] & 0xf0) {
+    case singleFrame: {
+        std::size_t messageSize = data[0] & 0x0f;
+        if (messageSize == 0 || messageSize > size - 1) {
+            break;
+        }
+        if (session->receiving) {
+            dropReception(*session, IsoTpResult::UnexpectedPdu);
+        }
+        base().handleMessage(session->address, data + 1, messageSize);
+        break;
+    }
+    case firstFrame:
+        acceptFirstFrame(*session, data, size, nowNs);
+        break;
+    case consecutiveFrame:
+        acceptConsecutiveFrame(*session, data, size, nowNs);
+        break;
+    case flowControl:
+        acceptFlowControl(*session, data, size, nowNs);
+        break;
+    }
+    return true;
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+void IsoTp<B, sessionCapacity, poolSize>::acceptFirstFrame(Session& session, const uint8_t* data, std::size_t size,
+                                                           uint64_t nowNs)
+{
+    if (size != 8) {
+        return;
+    }
+    std::size_t headerSize = 2;
+    uint64_t messageSize = (uint64_t(data[0] & 0x0f) << 8) | data[1];
+    if (messageSize == 0) {
+        messageSize = (uint64_t(data[2]) << 24) | (uint64_t(data[3]) << 16) | (uint64_t(data[4]) << 8) | data[5];
+        headerSize = 6;
+        if (messageSize <= 0xfff) {
+            return;
+        }
+    } else if (messageSize <= 7) {
+        return;
+    }
+    if (session.receiving) {
+        dropReception(session, IsoTpResult::UnexpectedPdu);
+    }
+
+    std::size_t blockNum = (messageSize + poolBlockSize - 1) / poolBlockSize;
+    std::size_t block = messageSize > poolBlocks * poolBlockSize ? npos : allocate(blockNum);
+    if (block == npos) {
+        sendFlowControl(session, flowOverflow);
+        base().handleReceiveError(session.address, IsoTpResult::BufferOverflow);
+        return;
+    }
+    session.receiving = true;
+    session.rxBlock = block;
+    session.rxBlockNum = blockNum;
+    session.rxSize = messageSize;
+    session.rxOffset = 8 - headerSize;
+    session.rxSequence = 1;
+    session.rxBlockCount = 0;
+    session.rxDeadline = nowNs + _consecutiveTimeout;
+    std::memcpy(_pool + block * poolBlockSize, data + headerSize, session.rxOffset);
+    sendFlowControl(session, flowContinue);
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+void IsoTp<B, sessionCapacity, poolSize>::acceptConsecutiveFrame(Session& session, const uint8_t* data,
+                                                                 std::size_t size, uint64_t nowNs)
+{
+    if (!session.receiving) {
+        return;
+    }
+    if ((data[0] & 0x0f) != session.rxSequence) {
+        dropReception(session, IsoTpResult::WrongSequence);
+        return;
+    }
+    uint8_t* message = _pool + session.rxBlock * poolBlockSize;
+    std::size_t chunk = session.rxSize - session.rxOffset < size - 1 ? session.rxSize - session.rxOffset : size - 1;
+    std::memcpy(message + session.rxOffset, data + 1, chunk);
+    session.rxOffset += chunk;
+    session.rxSequence = (session.rxSequence + 1) & 0xf;
+
+    if (session.rxOffset == session.rxSize) {
+        // the blocks stay taken while the handler reads them
+        session.receiving = false;
+        base().handleMessage(session.address, message, session.rxSize);
+        release(session.rxBlock, session.rxBlockNum);
+        return;
+    }
+    session.rxDeadline = nowNs + _consecutiveTimeout;
+    if (_blockSize != 0 && ++session.rxBlockCount == _blockSize) {
+        session.rxBlockCount = 0;
+        sendFlowControl(session, flowContinue);
+    }
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+void IsoTp<B, sessionCapacity, poolSize>::acceptFlowControl(Session& session, const uint8_t* data, std::size_t size,
+                                                            uint64_t nowNs)
+{
+    if (session.txState != TxState::WaitFlowControl || size < 3) {
+        return;
+    }
+    switch (data[0] & 0x0f) {
+    case flowContinue:
+        session.txState = TxState::Sending;
+        session.txBlockSize = data[1];
+        session.txBlockLeft = data[1];
+        session.txSeparationNs = isoTpSeparationTimeNs(data[2]);
+        session.txDeadline = nowNs;
+        sendConsecutive(session, nowNs);
+        break;
+    case flowWait:
+        session.txDeadline = nowNs + _flowControlTimeout;
+        break;
+    case flowOverflow:
+        finishSend(session, IsoTpResult::Overflow);
+        break;
+    default:
+        finishSend(session, IsoTpResult::InvalidFlowStatus);
+        break;
+    }
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+std::size_t IsoTp<B, sessionCapacity, poolSize>::poll(uint64_t nowNs)
+{
+    std::size_t sent = 0;
+    for (std::size_t i = 0; i < sessionCapacity; i++) {
+        Session& session = _sessions[i];
+        if (!session.used) {
+            continue;
+        }
+        if (session.txState == TxState::Sending) {
+            sent += sendConsecutive(session, nowNs);
+        } else if (session.txState == TxState::WaitFlowControl && session.txDeadline <= nowNs) {
+            finishSend(session, IsoTpResult::Timeout);
+        }
+        if (session.receiving && session.rxDeadline <= nowNs) {
+            dropReception(session, IsoTpResult::Timeout);
+        }
+    }
+    return sent;
+}
+
+template <typename B, std::size_t sessionCapacity, std::size_t poolSize>
+uint64_t IsoTp<B, sessionCapacity, poolSize>::nextPollTime(uint64_t nowNs) const
+{
+    uint64_t time = never;
+    for (std::size_t i = 0; i < sessionCapacity; i++) {
+        const Session& session = _sessions[i];
+        if (!session.used) {
+            continue;
+        }
+        if (session.txState != TxState::Idle && session.txDeadline < time) {
+            time = session.txDeadline;
+        }
+        if (session.receiving && session.rxDeadline < time) {
+            time = session.rxDeadline;
+        }
+    }
+    return time == never || time > nowNs ? time : nowNs;
+}
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+#include "dtacan/Frame.h"
+#include "dtacan/IdFilter.h"
+
+#include <atomic>
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+namespace dtacan {
+
+/// Latest payload of an id as read from LastValueCache. sequence counts updates of the id, so a poller can tell
+/// whether it has already seen the value
+struct LastValue {
+    uint8_t data[8];
+    uint8_t size;
+    uint64_t sequence;
+    uint64_t timestampNs;
+};
+
+/// Latest value of every std id and of up to extCapacity registered ext ids, fed from Parser::handleData or
+/// handleFrames of the parse thread. Std ids live in a dense array indexed by id, ext ids are looked up in an open
+/// addressing index filled by registerExt before parsing starts; frames of unregistered ext ids are ignored.
+///
+/// Every slot is a seqlock over atomic words: the single writer never waits and readers in any thread copy a
+/// consistent value without locking, retrying only if they overlap the update of that very slot. In change only
+/// mode the handler is called for changed payloads only, the slot is updated anyway
+template <std::size_t extCapacity = 128>
+class LastValueCache {
+public:
+    typedef void (*Handler)(void* context, uint32_t address, bool isExtended, const uint8_t* data, std::size_t size);
+
+    LastValueCache();
+
+    // Setup, not safe against concurrent use
+    bool registerExt(uint32_t address);
+    void setHandler(Handler handler, void* context);
+    void setChangeOnly(bool changeOnly);
+
+    // Writer side, only one thread at a time. Returns true if the payload differs from the previous one
+    bool update(uint32_t address, bool isExtended, const uint8_t* data, std::size_t size, uint64_t nowNs);
+    void update(const Frame* frames, std::size_t count, uint64_t nowNs);
+
+    // Reader side, safe from any thread. Returns false for ids never received or not registered
+    bool read(uint32_t address, bool isExtended, LastValue* value) const;
+    // Frames of ext ids that are not registered
+    uint64_t unregistered() const;
+
+private:
+    static const std::size_t tableSize = detail::hashTableSize(extCapacity);
+    static const uint32_t emptySlot = 0xffffffff;
+
+    struct Slot {
+        std::atomic<uint32_t> lock;
+        // payload size, 0xff until the first update
+        std::atomic<uint32_t> size;
+        std::atomic<uint64_t> data;
+        std::atomic<uint64_t> sequence;
+        std::atomic<uint64_t> timestampNs;
+    };
+
+    static uint64_t packData(const uint8_t* data, std::size_t size);
+    static void initSlot(Slot& slot);
+    Slot* findSlot(uint32_t address, bool isExtended);
+    const Slot* findSlot(uint32_t address, bool isExtended) const;
+
+    Slot _std[2048];
+    Slot _ext[extCapacity];
+    uint32_t _extAddress[tableSize];
+    uint16_t _extIndex[tableSize];
+    std::size_t _extNum;
+
+    Handler _handler;
+    void* _context;
+    bool _changeOnly;
+    std::atomic<uint64_t> _unregistered;
+};
+
+template <std::size_t extCapacity>
+LastValueCache<extCapacity>::LastValueCache()
+    : _extNum(0)
+    , _handler(nullptr)
+    , _context(nullptr)
+    , _changeOnly(false)
+    , _unregistered(0)
+{
+    static_assert(extCapacity < 0x10000, "ext slot index must fit into 16 bits");
+    for (std::size_t i = 0; i < 2048; i++) {
+        initSlot(_std[i]);
+    }
+    for (std::size_t i = 0; i < extCapacity; i++) {
+        initSlot(_ext[i]);
+    }
+    std::memset(_extAddress, 0xff, sizeof(_extAddress));
+}
+
+template <std::size_t extCapacity>
+inline void LastValueCache<extCapacity>::initSlot(Slot& slot)
+{
+    slot.lock.store(0, std::memory_order_relaxed);
+    slot.size.store(0xff, std::memory_order_relaxed);
+    slot.data.store(0, std::memory_order_relaxed);
+    slot.sequence.store(0, std::memory_order_relaxed);
+    slot.timestampNs.store(0, std::memory_order_relaxed);
+}
+
+// Returns false if the id is invalid or the index is full
+template <std::size_t extCapacity>
+bool LastValueCache<extCapacity>::registerExt(uint32_t address)
+{
+    if (address > 0x1fffffff) {
+        return false;
+    }
+    std::size_t i = detail::hashAddress(address, true, tableSize - 1);
+    while (_extAddress[i] != emptySlot && _extAddress[i] != address) {
+        i = (i + 1) & (tableSize - 1);
+    }
+    if (_extAddress[i] == address) {
+        return true;
+    }
+    if (_extNum == extCapacity) {
+        return false;
+    }
+    _extAddress[i] = address;
+    _extIndex[i] = _extNum;
+    _extNum++;
+    return true;
+}
+
+template <std::size_t extCapacity>
+inline void LastValueCache<extCapacity>::setHandler(Handler handler, void* context)
+{
+    _handler = handler;
+    _context = context;
+}
+
+template <std::size_t extCapacity>
+inline void LastValueCache<extCapacity>::setChangeOnly(bool changeOnly)
+{
+    _changeOnly = changeOnly;
+}
+
+template <std::size_t extCapacity>
+inline const typename LastValueCache<extCapacity>::Slot* LastValueCache<extCapacity>::findSlot(
+    uint32_t address, bool isExtended) const
+{
+    if (!isExtended) {
+        return address <= 0x7ff ? &_std[address] : nullptr;
+    }
+    std::size_t i = detail::hashAddress(address, true, tableSize - 1);
+    while (_extAddress[i] != emptySlot) {
+        if (_extAddress[i] == address) {
+            return &_ext[_extIndex[i]];
+        }
+        i = (i + 1) & (tableSize - 1);
+    }
+    return nullptr;
+}
+
+template <std::size_t extCapacity>
+inline typename LastValueCache<extCapacity>::Slot* LastValueCache<extCapacity>::findSlot(uint32_t address,
+                                                                                       bool isExtended)
+{
+    return const_cast<Slot*>(static_cast<const LastValueCache*>(this)->findSlot(address, isExtended));
+}
+
+// Unused bytes are zero, so payloads compare as whole words
+template <std::size_t extCapacity>
+inline uint64_t LastValueCache<extCapacity>::packData(const uint8_t* data, std::size_t size)
+{
+    uint64_t word = 0;
+    std::memcpy(&word, data, size);
+    return word;
+}
+
+template <std::size_t extCapacity>
+bool LastValueCache<extCapacity>::update(uint32_t address, bool isExtended, const uint8_t* data, std::size_t size,
+                                         uint64_t nowNs)
+{
+    Slot* slot = findSlot(address, isExtended);
+    if (!slot || size > 8) {
+        if (slot == nullptr && isExtended) {
+            _unregistered.store(_unregistered.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        return false;
+    }
+    uint64_t word = packData(data, size);
+    bool changed = slot->data.load(std::memory_order_relaxed) != word
+                   || slot->size.load(std::memory_order_relaxed) != size;
+
+    uint32_t lock = slot->lock.load(std::memory_order_relaxed);
+    slot->lock.store(lock + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->size.store(size, std::memory_order_relaxed);
+    slot->data.store(word, std::memory_order_relaxed);
+    slot->sequence.store(slot->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    slot->timestampNs.store(nowNs, std::memory_order_relaxed);
+    slot->lock.store(lock + 2, std::memory_order_release);
+
+    if (_handler && (changed || !_changeOnly)) {
+        _handler(_context, address, isExtended, data, size);
+    }
+    return changed;
+}
+
+template <std::size_t extCapacity>
+void LastValueCache<extCapacity>::update(const Frame* frames, std::size_t count, uint64_t nowNs)
+{
+    for (std::size_t i = 0; i < count; i++) {
+        update(frames[i].address, frames[i].isExtended, frames[i].data, frames[i].size, nowNs);
+    }
+}
+
+template <std::size_t extCapacity>
+bool LastValueCache<extCapacity>::read(uint32_t address, bool isExtended, LastValue* value) const
+{
+    const Slot* slot = findSlot(address, isExtended);
+    if (!slot) {
+        return false;
+    }
+    uint32_t before;
+    uint32_t after;
+    uint32_t size;
+    uint64_t word;
+    do {
+        before = slot->lock.load(std::memory_order_acquire);
+        size = slot->size.load(std::memory_order_relaxed);
+        word = slot->data.load(std::memory_order_relaxed);
+        value->sequence = slot->sequence.load(std::memory_order_relaxed);
+        value->timestampNs = slot->timestampNs.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = slot->lock.load(std::memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+
+    if (size > 8) {
+        return false;
+    }
+    value->size = size;
+    std::memcpy(value->data, &word, 8);
+    return true;
+}
+
+template <std::size_t extCapacity>
+inline uint64_t LastValueCache<extCapacity>::unregistered() const
+{
+    return _unregistered.load(std::memory_order_relaxed);
+}
+}
@@ -0,0 +1,316 @@
+#pragma once
+
+#include "dtacan/Frame.h"
+#include "dtacan/Hex.h"
+#include "dtacan/Util.h"
+
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <stdint.h>
+
+namespace dtacan {
+
+/// Frame of a text log line
+struct LogFrame {
+    uint64_t timestampUs;
+    uint32_t address;
+    bool isExtended;
+    bool isFd;
+    bool isBitRateSwitch;
+    uint8_t size;
+    uint8_t data[64];
+};
+
+// Longest line written by writeCandumpLine for an interface name of ifaceSize chars, '\n' included
+constexpr std::size_t maxCandumpLineSize(std::size_t ifaceSize)
+{
+    return 20 + ifaceSize + 13 + 128 + 1 + 16;
+}
+
+// Longest line written by writeAscLine, '\n' included
+static const std::size_t maxAscLineSize = 128 + 64 * 3 + 96;
+
+namespace detail {
+
+// Writes at least minDigits digits padded with zeros, returns the number of chars written
+inline std::size_t writeDecimal(char* dest, uint64_t value, std::size_t minDigits)
+{
+    char digits[20];
+    std::size_t size = 0;
+    do {
+        digits[size++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    while (size < minDigits) {
+        digits[size++] = '0';
+    }
+    for (std::size_t i = 0; i < size; i++) {
+        dest[i] = digits[size - 1 - i];
+    }
+    return size;
+}
+
+// Hex digits without leading zeros
+inline std::size_t writeHex(char* dest, uint32_t value)
+{
+    std::size_t size = 1;
+    while (size < 8 && (value >> (size * 4)) != 0) {
+        size++;
+    }
+    for (std::size_t i = 0; i < size; i++) {
+        dest[i] = nibbleToChar((value >> ((size - 1 - i) * 4)) & 0xf);
+    }
+    return size;
+}
+
+// Writes text right aligned in a field of width chars
+inline std::size_t writeAligned(char* dest, const char* text, std::size_t size, std::size_t width)
+{
+    std::size_t padding = size < width ? width - size : 0;
+    std::memset(dest, ' ', padding);
+    std::memcpy(dest + padding, text, size);
+    return padding + size;
+}
+
+inline std::size_t writeAlignedDecimal(char* dest, uint64_t value, std::size_t width)
+{
+    char text[20];
+    return writeAligned(dest, text, writeDecimal(text, value, 1), width);
+}
+
+inline bool parseHexValue(const char* it, std::size_t size, uint32_t* value)
+{
+    uint32_t result = 0;
+    uint8_t acc = 0;
+    for (std::size_t i = 0; i < size; i++) {
+        uint8_t nibble = charToNibble(it[i]);
+        acc |= nibble;
+        result = (result << 4) | nibble;
+    }
+    *value = result;
+    return (acc & 0xf0) == 0;
+}
+}
+
+/// candump -L line "(1436509052.249713) can0 123#DEADBEEF", CAN FD frames as "123##1DEADBEEF" with the flags
+/// nibble after "##", bit 0 is the bit rate switch. Std ids take 3 hex digits, ext ids 8. Returns the line size
+inline std::size_t writeCandumpLine(char* dest, const LogFrame& frame, const char* iface, std::size_t ifaceSize)
+{
+    char* cur = dest;
+    *cur++ = '(';
+    cur += detail::writeDecimal(cur, frame.timestampUs / 1000000, 10);
+    *cur++ = '.';
+    cur += detail::writeDecimal(cur, frame.timestampUs % 1000000, 6);
+    *cur++ = ')';
+    *cur++ = ' ';
+    std::memcpy(cur, iface, ifaceSize);
+    cur += ifaceSize;
+    *cur++ = ' ';
+    if (frame.isExtended) {
+        encodeExtendedAddress(frame.address, cur);
+        cur += 8;
+    } else {
+        encodeAddress(frame.address, cur);
+        cur += 3;
+    }
+    *cur++ = '#';
+    if (frame.isFd) {
+        *cur++ = '#';
+        *cur++ = frame.isBitRateSwitch ? '1' : '0';
+    }
+    encodeHexStream(frame.data, cur, frame.size);
+    cur += frame.size * 2;
+    *cur++ = '\n';
+    return cur - dest;
+}
+
+// Parses a candump -L line without its '\n'. Remote frames, lowercase hex and malformed lines are rejected
+inline bool parseCandumpLine(const char* line, std::size_t size, LogFrame* frame)
+{
+    const char* it = line;
+    const char* end = line + size;
+    while (end != it && (end[-1] == '\r' || end[-1] == ' ')) {
+        end--;
+    }
+    if (it == end || *it != '(') {
+        return false;
+    }
+    it++;
+    uint64_t seconds = 0;
+    const char* start = it;
+    while (it != end && *it >= '0' && *it <= '9' && it - start < 19) {
+        seconds = seconds * 10 + (*it - '0');
+        it++;
+    }
+    if (it == start || it == end || *it != '.') {
+        return false;
+    }
+    it++;
+    uint64_t micros = 0;
+    std::size_t fractionDigits = 0;
+    while (it != end && *it >= '0' && *it <= '9') {
+        if (fractionDigits < 6) {
+            micros = micros * 10 + (*it - '0');
+        }
+        fractionDigits++;
+        it++;
+    }
+    for (std::size_t i = fractionDigits; i < 6; i++) {
+        micros *= 10;
+    }
+    if (fractionDigits == 0 || it == end || *it != ')') {
+        return false;
+    }
+    it++;
+
+    // interface name between spaces
+    while (it != end && *it == ' ') {
+        it++;
+    }
+    start = it;
+    while (it != end && *it != ' ') {
+        it++;
+    }
+    if (it == start) {
+        return false;
+    }
+    while (it != end && *it == ' ') {
+        it++;
+    }
+
+    const char* hash = (const char*)std::memchr(it, '#', end - it);
+    if (!hash || (hash - it != 3 && hash - it != 8)) {
+        return false;
+    }
+    frame->isExtended = hash - it == 8;
+    if (!detail::parseHexValue(it, hash - it, &frame->address)
+        || frame->address > (frame->isExtended ? 0x1fffffffu : 0x7ffu)) {
+        return false;
+    }
+    it = hash + 1;
+    frame->isFd = it != end && *it == '#';
+    frame->isBitRateSwitch = false;
+    if (frame->isFd) {
+        it++;
+        uint8_t flags = it == end ? 0xff : charToNibble(*it);
+        if (flags > 0xf) {
+            return false;
+        }
+        frame->isBitRateSwitch = (flags & 1) != 0;
+        it++;
+    }
+    std::size_t dataChars = end - it;
+    if (dataChars % 2 != 0 || dataChars / 2 > (frame->isFd ? 64u : 8u)) {
+        return false;
+    }
+    frame->size = dataChars / 2;
+    frame->timestampUs = seconds * 1000000 + micros;
+    return decodeHexStream(it, frame->data, frame->size);
+}
+
+/// Vector ASC line of a received frame on channel, timestamps are seconds since startUs. Classic frames:
+///     "   0.000100 1  123             Rx   d 2 DE AD"
+/// CAN FD frames use the CANFD line with the EDL and BRS flags and zeros for fields SLCAN doesn't carry
+inline std::size_t writeAscLine(char* dest, const LogFrame& frame, uint64_t startUs, unsigned channel)
+{
+    char* cur = dest;
+    uint64_t time = frame.timestampUs >= startUs ? frame.timestampUs - startUs : 0;
+    char text[40];
+    std::size_t size = detail::writeDecimal(text, time / 1000000, 1);
+    text[size++] = '.';
+    size += detail::writeDecimal(text + size, time % 1000000, 6);
+    cur += detail::writeAligned(cur, text, size, 11);
+    *cur++ = ' ';
+
+    char id[9];
+    std::size_t idSize = detail::writeHex(id, frame.address);
+    if (frame.isExtended) {
+        id[idSize++] = 'x';
+    }
+
+    if (!frame.isFd) {
+        cur += detail::writeDecimal(cur, channel, 1);
+        *cur++ = ' ';
+        *cur++ = ' ';
+        std::memcpy(cur, id, idSize);
+        std::memset(cur + idSize, ' ', 16 - idSize);
+        cur += 16;
+        std::memcpy(cur, "Rx   d ", 7);
+        cur += 7;
+        *cur++ = nibbleToChar(frame.size);
+    } else {
+        std::memcpy(cur, "CANFD ", 6);
+        cur += 6;
+        cur += detail::writeAlignedDecimal(cur, channel, 3);
+        std::memcpy(cur, " Rx   ", 6);
+        cur += 6;
+        cur += detail::writeAligned(cur, id, idSize, 8);
+        // empty symbolic name
+        std::memset(cur, ' ', 34);
+        cur += 34;
+        *cur++ = frame.isBitRateSwitch ? '1' : '0';
+        std::memcpy(cur, " 0 ", 3);
+        cur += 3;
+        uint8_t dlc = fdSizeToDlc(frame.size);
+        *cur++ = "0123456789abcdef"[dlc];
+        *cur++ = ' ';
+        cur += detail::writeAlignedDecimal(cur, fdDlcToSize(dlc), 2);
+    }
+    for (std::size_t i = 0; i < frame.size; i++) {
+        *cur++ = ' ';
+        encodeHexByte(frame.data[i], cur);
+        cur += 2;
+    }
+    if (frame.isFd) {
+        // padding up to the length of the dlc as on the bus
+        for (std::size_t i = frame.size; i < fdDlcToSize(fdSizeToDlc(frame.size)); i++) {
+            std::memcpy(cur, " 00", 3);
+            cur += 3;
+        }
+        // duration and length, flags with EDL 0x1000 and BRS 0x2000, then crc and four bit timing words
+        static const char fields[] = "        0    0 ";
+        std::memcpy(cur, fields, sizeof(fields) - 1);
+        cur += sizeof(fields) - 1;
+        cur += detail::writeAligned(cur, frame.isBitRateSwitch ? "3000" : "1000", 4, 8);
+        static const char zeros[] = "        0        0        0        0        0";
+        std::memcpy(cur, zeros, sizeof(zeros) - 1);
+        cur += sizeof(zeros) - 1;
+    }
+    *cur++ = '\n';
+    return cur - dest;
+}
+
+// Header of an ASC file measured from start, returns its size. dest must hold 256 chars
+inline std::size_t writeAscHeader(char* dest, std::time_t start)
+{
+    char date[64];
+    std::tm tm = *std::gmtime(&start);
+    std::size_t dateSize = std::strftime(date, sizeof(date), "%a %b %d %I:%M:%S.000 %p %Y", &tm);
+    // ASC writes am and pm in lowercase
+    for (std::size_t i = 0; i < dateSize; i++) {
+        if (date[i] == 'A' && date[i + 1] == 'M') {
+            std::memcpy(date + i, "am", 2);
+        } else if (date[i] == 'P' && date[i + 1] == 'M') {
+            std::memcpy(date + i, "pm", 2);
+        }
+    }
+    char* cur = dest;
+    std::memcpy(cur, "date ", 5);
+    cur += 5;
+    std::memcpy(cur, date, dateSize);
+    cur += dateSize;
+    static const char lines[] = "\nbase hex  timestamps absolute\ninternal events logged\n// version 9.0.0\n"
+                                "Begin Triggerblock ";
+    std::memcpy(cur, lines, sizeof(lines) - 1);
+    cur += sizeof(lines) - 1;
+    std::memcpy(cur, date, dateSize);
+    cur += dateSize;
+    static const char startLine[] = "\n   0.000000 Start of measurement\n";
+    std::memcpy(cur, startLine, sizeof(startLine) - 1);
+    cur += sizeof(startLine) - 1;
+    return cur - dest;
+}
+
+static const char ascFooter[] = "End TriggerBlock\n";
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dtacan {
+
+/// Read only private mapping of a whole file
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Returns false with errno set if the file can't be mapped. An empty file maps to no data
+    bool open(const char* path);
+    void close();
+
+    // madvise on the part of the range inside the mapping, offset must be page aligned. Advice is a hint, failures
+    // only cost speed and are ignored
+    void advise(std::size_t offset, std::size_t size, int advice);
+
+    const char* data() const;
+    std::size_t size() const;
+
+private:
+    char* _data;
+    std::size_t _size;
+};
+
+inline MappedFile::MappedFile()
+    : _data(nullptr)
+    , _size(0)
+{
+}
+
+inline MappedFile::~MappedFile()
+{
+    close();
+}
+
+inline bool MappedFile::open(const char* path)
+{
+    close();
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int error = errno;
+        ::close(fd);
+        errno = error;
+        return false;
+    }
+    // mmap rejects empty mappings
+    void* data = nullptr;
+    if (st.st_size > 0) {
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    int error = errno;
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        errno = error;
+        return false;
+    }
+    _data = (char*)data;
+    _size = st.st_size;
+    return true;
+}
+
+inline void MappedFile::close()
+{
+    if (_data) {
+        munmap(_data, _size);
+    }
+    _data = nullptr;
+    _size = 0;
+}
+
+inline void MappedFile::advise(std::size_t offset, std::size_t size, int advice)
+{
+    if (offset >= _size) {
+        return;
+    }
+    if (size > _size - offset) {
+        size = _size - offset;
+    }
+    madvise(_data + offset, size, advice);
+}
+
+inline const char* MappedFile::data() const
+{
+    return _data;
+}
+
+inline std::size_t MappedFile::size() const
+{
+    return _size;
+}
+}
@@ -0,0 +1,389 @@
+#pragma once
+
+#include "dtacan/Config.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include <cstddef>
+#include <cstdio>
+#include <stdint.h>
+
+namespace dtacan {
+
+/// Log-linear histogram of nanosecond values in the spirit of HdrHistogram: every power of two is split into
+/// subBuckets linear buckets, so any value is recorded with at most 1/subBuckets relative error in fixed memory.
+/// Written by one thread, may be read from any
+class LatencyHistogram {
+public:
+    static const unsigned subBucketBits = 3;
+    static const std::size_t subBuckets = 1 << subBucketBits;
+    static const std::size_t bucketCount = (64 - subBucketBits + 1) * subBuckets;
+
+    LatencyHistogram()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        for (std::size_t i = 0; i < bucketCount; i++) {
+            _counts[i].store(0, std::memory_order_relaxed);
+        }
+        _count.store(0, std::memory_order_relaxed);
+        _sum.store(0, std::memory_order_relaxed);
+        _max.store(0, std::memory_order_relaxed);
+    }
+
+    void record(uint64_t value, uint64_t times = 1)
+    {
+        std::atomic<uint64_t>& bucket = _counts[bucketIndex(value)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + times, std::memory_order_relaxed);
+        _count.store(_count.load(std::memory_order_relaxed) + times, std::memory_order_relaxed);
+        _sum.store(_sum.load(std::memory_order_relaxed) + value * times, std::memory_order_relaxed);
+        if (value > _max.load(std::memory_order_relaxed)) {
+            _max.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    static std::size_t bucketIndex(uint64_t value)
+    {
+        if (value < subBuckets) {
+            return value;
+        }
+        unsigned msb = highestBit(value);
+        return (msb - subBucketBits + 1) * subBuckets + ((value >> (msb - subBucketBits)) & (subBuckets - 1));
+    }
+
+    // Largest value recorded into the bucket
+    static uint64_t bucketUpperBound(std::size_t index)
+    {
+        if (index < subBuckets) {
+            return index;
+        }
+        unsigned msb = index / subBuckets + subBucketBits - 1;
+        uint64_t low = uint64_t(subBuckets + index % subBuckets) << (msb - subBucketBits);
+        return low + (uint64_t(1) << (msb - subBucketBits)) - 1;
+    }
+
+    uint64_t bucket(std::size_t index) const
+    {
+        return _counts[index].load(std::memory_order_relaxed);
+    }
+
+    uint64_t count() const
+    {
+        return _count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t sum() const
+    {
+        return _sum.load(std::memory_order_relaxed);
+    }
+
+    uint64_t max() const
+    {
+        return _max.load(std::memory_order_relaxed);
+    }
+
+    // Upper bound of the bucket holding the quantile, q from 0 to 1
+    uint64_t quantile(double q) const
+    {
+        uint64_t total = count();
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = uint64_t(q * total + 0.5);
+        rank = rank == 0 ? 1 : (rank > total ? total : rank);
+        uint64_t seen = 0;
+        for (std::size_t i = 0; i < bucketCount; i++) {
+            seen += bucket(i);
+            if (seen >= rank) {
+                return bucketUpperBound(i);
+            }
+        }
+        return max();
+    }
+
+private:
+    static unsigned highestBit(uint64_t value)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return 63 - __builtin_clzll(value);
+#else
+        unsigned bit = 0;
+        while (value >>= 1) {
+            bit++;
+        }
+        return bit;
+#endif
+    }
+
+    std::atomic<uint64_t> _counts[bucketCount];
+    std::atomic<uint64_t> _count;
+    std::atomic<uint64_t> _sum;
+    std::atomic<uint64_t> _max;
+};
+
+namespace detail {
+
+// Counter with a single writer, readers in other threads see whole values
+class Counter {
+public:
+    Counter()
+        : _value(0)
+    {
+    }
+
+    void add(uint64_t n = 1)
+    {
+        _value.store(_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void raise(uint64_t n)
+    {
+        if (n > _value.load(std::memory_order_relaxed)) {
+            _value.store(n, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t get() const
+    {
+        return _value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> _value;
+};
+
+inline void appendMetric(std::string* out, const char* name, const char* type, const char* help)
+{
+    out->append("# HELP ").append(name).append(" ").append(help).append("\n");
+    out->append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+inline void appendSample(std::string* out, const char* name, const char* suffix, const char* labels,
+                         const char* extraLabel, uint64_t value)
+{
+    out->append(name).append(suffix);
+    bool hasLabels = labels[0] != '\0';
+    if (hasLabels || extraLabel) {
+        out->append("{").append(labels);
+        if (hasLabels && extraLabel) {
+            out->append(",");
+        }
+        if (extraLabel) {
+            out->append(extraLabel);
+        }
+        out->append("}");
+    }
+    char number[24];
+    std::snprintf(number, sizeof(number), " %llu\n", (unsigned long long)value);
+    out->append(number);
+}
+
+inline void appendCounter(std::string* out, const char* name, const char* help, const char* labels, uint64_t value)
+{
+    appendMetric(out, name, "counter", help);
+    appendSample(out, name, "", labels, nullptr, value);
+}
+
+// Exported with a bucket per power of two over the whole range, so every scrape has the same le series. The full
+// resolution stays available through quantile()
+inline void appendHistogram(std::string* out, const char* name, const char* help, const char* labels,
+                            const LatencyHistogram& histogram)
+{
+    appendMetric(out, name, "histogram", help);
+    uint64_t total = histogram.count();
+    uint64_t seen = 0;
+    std::size_t i = 0;
+    for (unsigned bit = 0; bit < 64; bit++) {
+        uint64_t le = uint64_t(1) << bit;
+        while (i < LatencyHistogram::bucketCount && LatencyHistogram::bucketUpperBound(i) < le) {
+            seen += histogram.bucket(i);
+            i++;
+        }
+        char label[32];
+        std::snprintf(label, sizeof(label), "le=\"%llu\"", (unsigned long long)le - 1);
+        appendSample(out, name, "_bucket", labels, label, seen);
+    }
+    appendSample(out, name, "_bucket", labels, "le=\"+Inf\"", total);
+    appendSample(out, name, "_sum", labels, nullptr, histogram.sum());
+    appendSample(out, name, "_count", labels, nullptr, total);
+}
+}
+
+/// Parser counters of InstrumentedConfig. Updated by the parse thread only, may be exported from any thread
+class ParserMetrics {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    void chunkStarted()
+    {
+        _chunkStart = Clock::now();
+        _chunks.add();
+    }
+
+    void framesDelivered(std::size_t count)
+    {
+        uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - _chunkStart).count();
+        _latency.record(ns, count);
+    }
+
+    void frameDecoded(bool isExtended)
+    {
+        (isExtended ? _extFrames : _stdFrames).add();
+    }
+
+    void frameFiltered()
+    {
+        _filteredFrames.add();
+    }
+
+    void receipt(bool isExtended)
+    {
+        (isExtended ? _extReceipts : _stdReceipts).add();
+    }
+
+    void nack()
+    {
+        _nacks.add();
+    }
+
+    void junk(std::size_t size)
+    {
+        _resyncs.add();
+        _junkBytes.add(size);
+    }
+
+    void carriedOver(std::size_t size)
+    {
+        _carryOvers.add();
+        _carryHighWater.raise(size);
+    }
+
+    uint64_t stdFrames() const { return _stdFrames.get(); }
+    uint64_t extFrames() const { return _extFrames.get(); }
+    uint64_t filteredFrames() const { return _filteredFrames.get(); }
+    uint64_t stdReceipts() const { return _stdReceipts.get(); }
+    uint64_t extReceipts() const { return _extReceipts.get(); }
+    uint64_t nacks() const { return _nacks.get(); }
+    uint64_t junkBytes() const { return _junkBytes.get(); }
+    uint64_t resyncs() const { return _resyncs.get(); }
+    uint64_t chunks() const { return _chunks.get(); }
+    uint64_t carryOvers() const { return _carryOvers.get(); }
+    uint64_t carryHighWater() const { return _carryHighWater.get(); }
+    const LatencyHistogram& latency() const { return _latency; }
+
+    // Appends the metrics in Prometheus text format, labels like "port=\"can0\"" are added to every sample
+    void appendPrometheus(std::string* out, const char* labels = "") const
+    {
+        using namespace detail;
+        appendMetric(out, "dtacan_parser_frames_total", "counter", "Frames decoded by type");
+        appendSample(out, "dtacan_parser_frames_total", "", labels, "type=\"std\"", stdFrames());
+        appendSample(out, "dtacan_parser_frames_total", "", labels, "type=\"ext\"", extFrames());
+        appendCounter(out, "dtacan_parser_filtered_frames_total", "Frames rejected by acceptAddress", labels,
+                      filteredFrames());
+        appendMetric(out, "dtacan_parser_receipts_total", "counter", "Transmit receipts by type");
+        appendSample(out, "dtacan_parser_receipts_total", "", labels, "type=\"std\"", stdReceipts());
+        appendSample(out, "dtacan_parser_receipts_total", "", labels, "type=\"ext\"", extReceipts());
+        appendCounter(out, "dtacan_parser_nacks_total", "BELL replies", labels, nacks());
+        appendCounter(out, "dtacan_parser_junk_bytes_total", "Bytes reported as junk", labels, junkBytes());
+        appendCounter(out, "dtacan_parser_resyncs_total", "Times the parser skipped junk to the next message",
+                      labels, resyncs());
+        appendCounter(out, "dtacan_parser_chunks_total", "acceptData calls", labels, chunks());
+        appendCounter(out, "dtacan_parser_carry_overs_total", "Chunks ending in the middle of a message", labels,
+                      carryOvers());
+        appendMetric(out, "dtacan_parser_carry_high_water_bytes", "gauge", "Longest partial message carried over");
+        appendSample(out, "dtacan_parser_carry_high_water_bytes", "", labels, nullptr, carryHighWater());
+        appendHistogram(out, "dtacan_parser_delivery_latency_ns",
+                        "Time from acceptData call to delivery of a decoded frame", labels, _latency);
+    }
+
+private:
+    Clock::time_point _chunkStart;
+    detail::Counter _stdFrames;
+    detail::Counter _extFrames;
+    detail::Counter _filteredFrames;
+    detail::Counter _stdReceipts;
+    detail::Counter _extReceipts;
+    detail::Counter _nacks;
+    detail::Counter _junkBytes;
+    detail::Counter _resyncs;
+    detail::Counter _chunks;
+    detail::Counter _carryOvers;
+    detail::Counter _carryHighWater;
+    LatencyHistogram _latency;
+};
+
+/// Encoder counters of InstrumentedConfig. Updated by the encoding thread only, may be exported from any thread
+class EncoderMetrics {
+public:
+    void encoded(std::size_t frames, std::size_t bytes)
+    {
+        _frames.add(frames);
+        _bytes.add(bytes);
+        _writes.add();
+    }
+
+    void bufferReserved(std::size_t size)
+    {
+        _bufferHighWater.raise(size);
+    }
+
+    void bufferTooSmall()
+    {
+        _bufferFailures.add();
+    }
+
+    uint64_t frames() const { return _frames.get(); }
+    uint64_t bytes() const { return _bytes.get(); }
+    uint64_t writes() const { return _writes.get(); }
+    uint64_t bufferHighWater() const { return _bufferHighWater.get(); }
+    uint64_t bufferFailures() const { return _bufferFailures.get(); }
+
+    void appendPrometheus(std::string* out, const char* labels = "") const
+    {
+        using namespace detail;
+        appendCounter(out, "dtacan_encoder_frames_total", "Frames encoded", labels, frames());
+        appendCounter(out, "dtacan_encoder_bytes_total", "Bytes passed to handleEncodedData", labels, bytes());
+        appendCounter(out, "dtacan_encoder_writes_total", "handleEncodedData calls", labels, writes());
+        appendMetric(out, "dtacan_encoder_buffer_high_water_bytes", "gauge", "Largest encoder buffer use");
+        appendSample(out, "dtacan_encoder_buffer_high_water_bytes", "", labels, nullptr, bufferHighWater());
+        appendCounter(out, "dtacan_encoder_buffer_failures_total", "Frames refused for lack of buffer space",
+                      labels, bufferFailures());
+    }
+
+private:
+    detail::Counter _frames;
+    detail::Counter _bytes;
+    detail::Counter _writes;
+    detail::Counter _bufferHighWater;
+    detail::Counter _bufferFailures;
+};
+
+// Replaces the file through a temporary one, so a scraper never reads it half written
+inline bool writePrometheusFile(const char* path, const std::string& text)
+{
+    std::string tmpPath = std::string(path) + ".tmp";
+    std::FILE* file = std::fopen(tmpPath.c_str(), "w");
+    if (!file) {
+        return false;
+    }
+    bool ok = std::fwrite(text.data(), 1, text.size(), file) == text.size();
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok || std::rename(tmpPath.c_str(), path) != 0) {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Counters and latency histogram read with Parser::parserMetrics and Encoder::encoderMetrics
+struct InstrumentedConfig {
+    typedef HeapBuffer EncoderBuffer;
+    typedef ParserMetrics ParserInstrumentation;
+    typedef EncoderMetrics EncoderInstrumentation;
+};
+}
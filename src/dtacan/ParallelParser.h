@@ -0,0 +1,435 @@
+#pragma once
+
+#include "dtacan/Config.h"
+#include "dtacan/Frame.h"
+#include "dtacan/Parser.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+namespace dtacan {
+
+/// CAN FD frame as collected by ParallelParser
+struct FdFrame {
+    uint32_t address;
+    bool isExtended;
+    bool isBitRateSwitch;
+    uint8_t size;
+    uint8_t data[64];
+};
+
+/// Anything but a classic frame, placed among the frames of its chunk by frameIndex
+struct ParseEvent {
+    enum Type : uint8_t {
+        Junk,
+        Receipt,
+        ExtReceipt,
+        Nack,
+        Fd,
+    };
+
+    Type type;
+    // Number of classic frames of the chunk decoded before the event
+    std::size_t frameIndex;
+    // Junk points into the parsed buffer, Fd holds an index into fdFrames
+    const uint8_t* junk;
+    std::size_t size;
+};
+
+/// Everything decoded from one chunk of the input, in the order of the input
+struct ParsedChunk {
+    // Position of the chunk among the chunks of the input
+    std::size_t index;
+    const char* data;
+    std::size_t size;
+    std::vector<Frame> frames;
+    std::vector<FdFrame> fdFrames;
+    std::vector<ParseEvent> events;
+};
+
+/// Decodes a large buffer of SLCAN messages, like a mapped capture, on several worker threads. The buffer is cut into
+/// chunks of about chunkSize bytes right after a '\r', where the parser is always idle and no junk can continue,
+/// so every chunk is decoded by its own Parser into exactly the events a single Parser would report for it. A run
+/// of junk without '\r' longer than a chunk only makes its chunk longer.
+///
+/// By default chunks are merged back in input order and the Parser like hooks are called in the thread of parse:
+/// frames come in batches of any size through handleFrames, everything else is reported one by one in between.
+/// Up to two chunks per worker are decoded ahead of the merge, so memory stays bounded on captures of any size.
+///
+/// Consumers that don't need the order hide ordered with false and get every chunk passed to handleChunk in the
+/// worker that decoded it, chunks of different workers concurrently and in any order
+template <typename B, typename C = DefaultConfig>
+class ParallelParser {
+public:
+    void handleFrames(const Frame* frames, std::size_t count);
+    // See Parser::handleFdData, isExtendedFrame and isBitRateSwitch describe the frame being passed
+    void handleFdData(uint32_t address, const uint8_t* data, std::size_t size);
+    void handleJunk(const uint8_t* junk, std::size_t size);
+    void handleReceipt();
+    void handleExtReceipt();
+    void handleNack();
+
+    static const bool ordered = true;
+    void handleChunk(std::size_t worker, const ParsedChunk& chunk);
+
+    // See Parser::filterAddresses, acceptAddress is called in worker threads
+    static const bool filterAddresses = false;
+    bool acceptAddress(uint32_t address, bool isExtended);
+
+    ParallelParser();
+
+    void setChunkSize(std::size_t size);
+    // Decodes the whole buffer and returns once every chunk is delivered. workerCount 0 uses one worker per core
+    void parse(const void* data, std::size_t size, std::size_t workerCount = 0);
+    // Chunks the last buffer was cut into
+    std::size_t chunkCount() const;
+
+protected:
+    bool isExtendedFrame() const;
+    bool isBitRateSwitch() const;
+
+private:
+    class ChunkParser : public Parser<ChunkParser, C> {
+    public:
+        static const std::size_t frameBatchSize = 256;
+        static const bool filterAddresses = B::filterAddresses;
+
+        explicit ChunkParser(ParallelParser* owner)
+            : _owner(owner)
+            , _chunk(nullptr)
+        {
+        }
+
+        void parse(ParsedChunk* chunk)
+        {
+            _chunk = chunk;
+            chunk->frames.clear();
+            chunk->fdFrames.clear();
+            chunk->events.clear();
+            this->acceptData(chunk->data, chunk->size);
+        }
+
+        void handleFrames(const Frame* frames, std::size_t count)
+        {
+            _chunk->frames.insert(_chunk->frames.end(), frames, frames + count);
+        }
+
+        void handleFdData(uint32_t address, const uint8_t* data, std::size_t size)
+        {
+            FdFrame frame;
+            frame.address = address;
+            frame.isExtended = this->isExtendedFrame();
+            frame.isBitRateSwitch = this->isBitRateSwitch();
+            frame.size = size;
+            std::memcpy(frame.data, data, size);
+            addEvent(ParseEvent::Fd, nullptr, _chunk->fdFrames.size());
+            _chunk->fdFrames.push_back(frame);
+        }
+
+        void handleJunk(const uint8_t* junk, std::size_t size)
+        {
+            addEvent(ParseEvent::Junk, junk, size);
+        }
+
+        void handleReceipt()
+        {
+            addEvent(ParseEvent::Receipt, nullptr, 0);
+        }
+
+        void handleExtReceipt()
+        {
+            addEvent(ParseEvent::ExtReceipt, nullptr, 0);
+        }
+
+        void handleNack()
+        {
+            addEvent(ParseEvent::Nack, nullptr, 0);
+        }
+
+        bool acceptAddress(uint32_t address, bool isExtended)
+        {
+            return _owner->base().acceptAddress(address, isExtended);
+        }
+
+    private:
+        void addEvent(ParseEvent::Type type, const uint8_t* junk, std::size_t size)
+        {
+            ParseEvent event = {type, _chunk->frames.size(), junk, size};
+            _chunk->events.push_back(event);
+        }
+
+        ParallelParser* _owner;
+        ParsedChunk* _chunk;
+    };
+
+    struct Slot {
+        ParsedChunk chunk;
+        bool ready;
+    };
+
+    B& base();
+    void work(std::size_t worker);
+    bool claimChunk(ParsedChunk* chunk);
+    void deliver(const ParsedChunk& chunk);
+
+    std::size_t _chunkSize;
+    bool _isExtendedFrame;
+    bool _isBitRateSwitch;
+
+    std::mutex _mutex;
+    std::condition_variable _chunkReady;
+    std::condition_variable _slotFree;
+    std::vector<Slot> _slots;
+    const char* _next;
+    const char* _end;
+    std::size_t _claimed;
+    std::size_t _delivered;
+    std::size_t _chunkCount;
+};
+
+template <typename B, typename C>
+inline void ParallelParser<B, C>::handleFrames(const Frame* frames, std::size_t count)
+{
+    (void)frames;
+    (void)count;
+}
+
+template <typename B, typename C>
+inline void ParallelParser<B, C>::handleFdData(uint32_t address, const uint8_t* data, std::size_t size)
+{
+    (void)address;
+    (void)data;
+    (void)size;
+}
+
+template <typename B, typename C>
+inline void ParallelParser<B, C>::handleJunk(const uint8_t* junk, std::size_t size)
+{
+    (void)junk;
+    (void)size;
+}
+
+template <typename B, typename C>
+inline void ParallelParser<B, C>::handleReceipt()
+{
+}
+
+template <typename B, typename C>
+inline void ParallelParser<B, C>::handleExtReceipt()
+{
+    base().handleReceipt();
+}
+
+template <typename B, typename C>
+inline void ParallelParser<B, C>::handleNack()
+{
+}
+
+template <typename B, typename C>
+inline void ParallelParser<B, C>::handleChunk(std::size_t worker, const ParsedChunk& chunk)
+{
+    (void)worker;
+    (void)chunk;
+}
+
+template <typename B, typename C>
+inline bool ParallelParser<B, C>::acceptAddress(uint32_t address, bool isExtended)
+{
+    (void)address;
+    (void)isExtended;
+    return true;
+}
+
+template <typename B, typename C>
+inline ParallelParser<B, C>::ParallelParser()
+    : _chunkSize(1024 * 1024)
+    , _isExtendedFrame(false)
+    , _isBitRateSwitch(false)
+    , _next(nullptr)
+    , _end(nullptr)
+    , _claimed(0)
+    , _delivered(0)
+    , _chunkCount(0)
+{
+}
+
+template <typename B, typename C>
+inline B& ParallelParser<B, C>::base()
+{
+    return *static_cast<B*>(this);
+}
+
+template <typename B, typename C>
+inline void ParallelParser<B, C>::setChunkSize(std::size_t size)
+{
+    _chunkSize = size == 0 ? 1 : size;
+}
+
+template <typename B, typename C>
+inline std::size_t ParallelParser<B, C>::chunkCount() const
+{
+    return _chunkCount;
+}
+
+template <typename B, typename C>
+inline bool ParallelParser<B, C>::isExtendedFrame() const
+{
+    return _isExtendedFrame;
+}
+
+template <typename B, typename C>
+inline bool ParallelParser<B, C>::isBitRateSwitch() const
+{
+    return _isBitRateSwitch;
+}
+
+template <typename B, typename C>
+void ParallelParser<B, C>::parse(const void* data, std::size_t size, std::size_t workerCount)
+{
+    if (workerCount == 0) {
+        workerCount = std::thread::hardware_concurrency();
+    }
+    std::size_t maxChunks = size / _chunkSize + 1;
+    if (workerCount > maxChunks) {
+        workerCount = maxChunks;
+    }
+    if (workerCount == 0) {
+        workerCount = 1;
+    }
+
+    _next = (const char*)data;
+    _end = _next + size;
+    _claimed = 0;
+    _delivered = 0;
+    _chunkCount = size == 0 ? 0 : std::size_t(-1);
+    if (B::ordered) {
+        _slots.resize(workerCount * 2);
+        for (Slot& slot : _slots) {
+            slot.ready = false;
+        }
+    }
+
+    std::vector<std::thread> workers;
+    for (std::size_t i = 0; i < workerCount; i++) {
+        workers.emplace_back(&ParallelParser::work, this, i);
+    }
+
+    if (B::ordered) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (_delivered != _chunkCount) {
+            Slot& slot = _slots[_delivered % _slots.size()];
+            if (!slot.ready) {
+                _chunkReady.wait(lock);
+                continue;
+            }
+            lock.unlock();
+            deliver(slot.chunk);
+            lock.lock();
+            slot.ready = false;
+            _delivered++;
+            _slotFree.notify_all();
+        }
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+// Called with the lock held. The chunk ends right after the first '\r' at or past chunkSize bytes
+template <typename B, typename C>
+bool ParallelParser<B, C>::claimChunk(ParsedChunk* chunk)
+{
+    if (_next == _end) {
+        return false;
+    }
+    const char* end = _end;
+    if (std::size_t(_end - _next) > _chunkSize) {
+        const void* cr = std::memchr(_next + _chunkSize - 1, '\r', _end - _next - _chunkSize + 1);
+        if (cr) {
+            end = (const char*)cr + 1;
+        }
+    }
+    chunk->index = _claimed++;
+    chunk->data = _next;
+    chunk->size = end - _next;
+    _next = end;
+    if (_next == _end) {
+        _chunkCount = _claimed;
+    }
+    return true;
+}
+
+template <typename B, typename C>
+void ParallelParser<B, C>::work(std::size_t worker)
+{
+    ChunkParser parser(this);
+    ParsedChunk local;
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        ParsedChunk* chunk = &local;
+        if (B::ordered) {
+            while (_next != _end && _claimed >= _delivered + _slots.size()) {
+                _slotFree.wait(lock);
+            }
+            chunk = &_slots[_claimed % _slots.size()].chunk;
+        }
+        if (!claimChunk(chunk)) {
+            break;
+        }
+        lock.unlock();
+        parser.parse(chunk);
+        if (!B::ordered) {
+            base().handleChunk(worker, *chunk);
+        }
+        lock.lock();
+        if (B::ordered) {
+            _slots[chunk->index % _slots.size()].ready = true;
+            _chunkReady.notify_one();
+        }
+    }
+    // the merge may be waiting for the chunk count which is only known once the last chunk is claimed
+    _chunkReady.notify_one();
+}
+
+template <typename B, typename C>
+void ParallelParser<B, C>::deliver(const ParsedChunk& chunk)
+{
+    std::size_t sent = 0;
+    for (const ParseEvent& event : chunk.events) {
+        if (event.frameIndex != sent) {
+            base().handleFrames(chunk.frames.data() + sent, event.frameIndex - sent);
+            sent = event.frameIndex;
+        }
+        switch (event.type) {
+        case ParseEvent::Junk:
+            base().handleJunk(event.junk, event.size);
+            break;
+        case ParseEvent::Receipt:
+            base().handleReceipt();
+            break;
+        case ParseEvent::ExtReceipt:
+            base().handleExtReceipt();
+            break;
+        case ParseEvent::Nack:
+            base().handleNack();
+            break;
+        case ParseEvent::Fd: {
+            const FdFrame& frame = chunk.fdFrames[event.size];
+            _isExtendedFrame = frame.isExtended;
+            _isBitRateSwitch = frame.isBitRateSwitch;
+            base().handleFdData(frame.address, frame.data, frame.size);
+            break;
+        }
+        }
+    }
+    if (chunk.frames.size() != sent) {
+        base().handleFrames(chunk.frames.data() + sent, chunk.frames.size() - sent);
+    }
+}
+}
@@ -1,41 +1,239 @@
 #pragma once
 
 #include "dtacan/Util.h"
+#include "dtacan/Hex.h"
 #include "dtacan/BaudRate.h"
+#include "dtacan/Frame.h"
+#include "dtacan/Config.h"
 
 #include <algorithm>
-#include <string>
 
+#include <cassert>
 #include <cstddef>
+#include <cstring>
 #include <stdint.h>
 
 namespace dtacan {
 
-template <typename B>
+// C selects build policies, see Config.h
+template <typename B, typename C = DefaultConfig>
 class Parser {
 public:
     void handleData(uint32_t address, const uint8_t* data, std::size_t size);
     void handleJunk(const uint8_t* junk, std::size_t size);
     void handleReceipt();
+    // 'Z' receipt of an ext frame, passed to handleReceipt unless hidden
+    void handleExtReceipt();
+    // BELL, the adapter failed to execute a command
+    void handleNack();
+    // CAN FD frame ('d', 'D', 'b' or 'B') with up to 64 bytes, dropped unless hidden. Never batched, a pending batch
+    // is flushed before it
+    void handleFdData(uint32_t address, const uint8_t* data, std::size_t size);
+
+    // Frames are passed to handleData one by one unless derived class hides frameBatchSize with a non zero value,
+    // then they are collected and passed to handleFrames in batches of up to frameBatchSize frames. A batch is
+    // flushed before any junk or receipt is reported and at the end of every acceptData call
+    static const std::size_t frameBatchSize = 0;
+    void handleFrames(const Frame* frames, std::size_t count);
+
+    // If derived class hides filterAddresses with true, acceptAddress is asked for every well formed frame before it
+    // is passed on. Rejected frames are dropped silently, malformed ones are reported as junk whatever their address
+    static const bool filterAddresses = false;
+    bool acceptAddress(uint32_t address, bool isExtended);
+
+    Parser();
 
     void acceptData(const void* data, std::size_t size);
 
+    // Counters of the ParserInstrumentation policy
+    const typename C::ParserInstrumentation& parserMetrics() const;
+
+protected:
+    // Type of the frame being passed to handleData or handleFdData
+    bool isExtendedFrame() const;
+    // Whether the FD frame being passed to handleFdData uses the data phase rate ('b' or 'B')
+    bool isBitRateSwitch() const;
+
 private:
+    // 'T' + 8 address chars + dlc + 16 data chars + '\r'
+    static const std::size_t maxClassicFrameSize = 27;
+    // 'D' + 8 address chars + dlc + 128 data chars + '\r'
+    static const std::size_t maxFrameSize = 139;
+
+    // Message being decoded when a chunk ends in the middle of it
+    enum State : uint8_t {
+        StateIdle,
+        StateReceipt,
+        StateExtReceipt,
+        StateAddress,
+        StateDlc,
+        StatePayload,
+        StateTerminator,
+        // skipping junk up to the next '\r' or BELL, the receipt states report the receipt once the junk ends
+        StateJunk,
+        StateReceiptJunk,
+        StateExtReceiptJunk,
+    };
+
+    enum CharClass : uint8_t {
+        ClassHex,
+        ClassCr,
+        ClassStd,
+        ClassExt,
+        ClassReceipt,
+        ClassExtReceipt,
+        ClassBell,
+        ClassOther,
+        // 'd' and 'b'
+        ClassFdStd,
+        // 'D' and 'B', hex digits anywhere but at the start of a message
+        ClassFdExt,
+    };
+
+    enum Action : uint8_t {
+        ActionSkip,
+        ActionJunk,
+        ActionStartReceipt,
+        ActionStartExtReceipt,
+        ActionNack,
+        ActionStartStd,
+        ActionStartExt,
+        ActionStartFdStd,
+        ActionStartFdExt,
+        ActionAddAddress,
+        ActionSetDlc,
+        ActionAddPayload,
+        ActionFinishReceipt,
+        ActionFinishExtReceipt,
+        ActionFinishFrame,
+        ActionReceiptJunk,
+        ActionExtReceiptJunk,
+        ActionFail,
+        ActionContinueJunk,
+        ActionEndJunk,
+        ActionEndReceiptJunk,
+        ActionEndExtReceiptJunk,
+    };
+
+    static CharClass charClass(char c);
+    static Action transition(State state, CharClass cls);
+
     B& base();
     const char* skipJunk(const char* start, const char* it, const char* end);
+    const char* parseFrames(const char* it, const char* end);
     uint32_t parseAddress(const char* it, std::size_t size);
+    const char* feedStateMachine(const char* it, const char* end, bool untilIdle);
+    const char* failMessage(const char* it, const char* end);
+    const char* parseFdFrame(const char* it, const char* end);
+    void startFrame(const char* it, std::size_t addrSize, bool isFd, bool isBitRateSwitch);
+    void emitFrame(uint32_t address, bool isExtended, const uint8_t* data, std::size_t size);
+    void emitFdFrame(uint32_t address, bool isExtended, bool isBitRateSwitch, const uint8_t* data, std::size_t size);
+    void flushFrames();
+    void finishReceipt(bool isExtended);
+    void finishReceiptAfterJunk(bool isExtended);
+
+    Frame* _batch;
+    std::size_t _batchNum;
 
-    std::string _buffer;
+    // raw chars of a message started in previous calls, only needed to report it as junk
+    char _raw[maxFrameSize];
+    std::size_t _rawSize;
+    const char* _msgStart;
+
+    State _state;
+    uint8_t _addrSize;
+    uint8_t _dataSize;
+    uint8_t _remaining;
+    uint32_t _address;
+    uint8_t _data[64];
+    bool _isFd;
+    bool _isBrs;
+    bool _isExtendedFrame;
+    bool _isBitRateSwitch;
+
+    typename C::ParserInstrumentation _metrics;
 };
 
-template <typename B>
-inline B& Parser<B>::base()
+template <typename B, typename C>
+inline Parser<B, C>::Parser()
+    : _batch(nullptr)
+    , _batchNum(0)
+    , _rawSize(0)
+    , _msgStart(nullptr)
+    , _state(StateIdle)
+    , _addrSize(0)
+    , _dataSize(0)
+    , _remaining(0)
+    , _address(0)
+    , _isFd(false)
+    , _isBrs(false)
+    , _isExtendedFrame(false)
+    , _isBitRateSwitch(false)
+{
+}
+
+template <typename B, typename C>
+inline typename Parser<B, C>::CharClass Parser<B, C>::charClass(char c)
+{
+    static const uint8_t classes[256] = {
+        7, 7, 7, 7, 7, 7, 7, 6, 7, 7, 7, 7, 7, 1, 7, 7,
+        7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+        7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 7, 7, 7, 7, 7, 7,
+        7, 0, 9, 0, 9, 0, 0, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+        7, 7, 7, 7, 3, 7, 7, 7, 7, 7, 5, 7, 7, 7, 7, 7,
+        7, 7, 8, 7, 8, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+        7, 7, 7, 7, 2, 7, 7, 7, 7, 7, 4, 7, 7, 7, 7, 7,
+        7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+        7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+        7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+        7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+        7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+        7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+        7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+        7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    };
+    return (CharClass)classes[(uint8_t)c];
+}
+
+template <typename B, typename C>
+inline typename Parser<B, C>::Action Parser<B, C>::transition(State state, CharClass cls)
+{
+    static const uint8_t actions[10][10] = {
+        // hex, '\r', 't', 'T', 'z', 'Z', '\a', other, 'd' 'b', 'D' 'B'
+        {ActionJunk, ActionSkip, ActionStartStd, ActionStartExt, ActionStartReceipt, ActionStartExtReceipt,
+         ActionNack, ActionJunk, ActionStartFdStd, ActionStartFdExt},
+        {ActionReceiptJunk, ActionFinishReceipt, ActionReceiptJunk, ActionReceiptJunk, ActionReceiptJunk,
+         ActionReceiptJunk, ActionReceiptJunk, ActionReceiptJunk, ActionReceiptJunk, ActionReceiptJunk},
+        {ActionExtReceiptJunk, ActionFinishExtReceipt, ActionExtReceiptJunk, ActionExtReceiptJunk,
+         ActionExtReceiptJunk, ActionExtReceiptJunk, ActionExtReceiptJunk, ActionExtReceiptJunk,
+         ActionExtReceiptJunk, ActionExtReceiptJunk},
+        {ActionAddAddress, ActionFail, ActionFail, ActionFail, ActionFail, ActionFail, ActionFail, ActionFail,
+         ActionFail, ActionAddAddress},
+        {ActionSetDlc, ActionFail, ActionFail, ActionFail, ActionFail, ActionFail, ActionFail, ActionFail,
+         ActionFail, ActionSetDlc},
+        {ActionAddPayload, ActionFail, ActionFail, ActionFail, ActionFail, ActionFail, ActionFail, ActionFail,
+         ActionFail, ActionAddPayload},
+        {ActionFail, ActionFinishFrame, ActionFail, ActionFail, ActionFail, ActionFail, ActionFail, ActionFail,
+         ActionFail, ActionFail},
+        {ActionContinueJunk, ActionEndJunk, ActionContinueJunk, ActionContinueJunk, ActionContinueJunk,
+         ActionContinueJunk, ActionEndJunk, ActionContinueJunk, ActionContinueJunk, ActionContinueJunk},
+        {ActionContinueJunk, ActionEndReceiptJunk, ActionContinueJunk, ActionContinueJunk, ActionContinueJunk,
+         ActionContinueJunk, ActionEndReceiptJunk, ActionContinueJunk, ActionContinueJunk, ActionContinueJunk},
+        {ActionContinueJunk, ActionEndExtReceiptJunk, ActionContinueJunk, ActionContinueJunk, ActionContinueJunk,
+         ActionContinueJunk, ActionEndExtReceiptJunk, ActionContinueJunk, ActionContinueJunk, ActionContinueJunk},
+    };
+    return (Action)actions[state][cls];
+}
+
+template <typename B, typename C>
+inline B& Parser<B, C>::base()
 {
     return *static_cast<B*>(this);
 }
 
-template <typename B>
-inline void Parser<B>::handleData(uint32_t address, const uint8_t* data, std::size_t size)
+template <typename B, typename C>
+inline void Parser<B, C>::handleData(uint32_t address, const uint8_t* data, std::size_t size)
 {
     (void)address;
     (void)data;
@@ -43,30 +241,72 @@ inline void Parser<B>::handleData(uint32_t address, const uint8_t* data, std::si
 }
 
 
-template <typename B>
-inline void Parser<B>::handleJunk(const uint8_t* junk, std::size_t size)
+template <typename B, typename C>
+inline void Parser<B, C>::handleJunk(const uint8_t* junk, std::size_t size)
 {
     (void)junk;
     (void)size;
 }
 
-template <typename B>
-inline void Parser<B>::handleReceipt()
+template <typename B, typename C>
+inline void Parser<B, C>::handleReceipt()
 {
 }
 
-template <typename B>
-inline const char* Parser<B>::skipJunk(const char* start, const char* it, const char* end)
+template <typename B, typename C>
+inline void Parser<B, C>::handleExtReceipt()
 {
-    it = std::find_if(it, end, [](char c) {
-        return c == '\r';
-    });
-    base().handleJunk((const uint8_t*)start, it - start);
-    return it;
+    base().handleReceipt();
+}
+
+template <typename B, typename C>
+inline void Parser<B, C>::handleNack()
+{
+}
+
+template <typename B, typename C>
+inline void Parser<B, C>::handleFdData(uint32_t address, const uint8_t* data, std::size_t size)
+{
+    (void)address;
+    (void)data;
+    (void)size;
+}
+
+template <typename B, typename C>
+inline void Parser<B, C>::handleFrames(const Frame* frames, std::size_t count)
+{
+    (void)frames;
+    (void)count;
+}
+
+template <typename B, typename C>
+inline bool Parser<B, C>::acceptAddress(uint32_t address, bool isExtended)
+{
+    (void)address;
+    (void)isExtended;
+    return true;
+}
+
+template <typename B, typename C>
+inline const typename C::ParserInstrumentation& Parser<B, C>::parserMetrics() const
+{
+    return _metrics;
+}
+
+template <typename B, typename C>
+inline bool Parser<B, C>::isExtendedFrame() const
+{
+    return _isExtendedFrame;
 }
 
-template <typename B>
-uint32_t Parser<B>::parseAddress(const char* it, std::size_t size)
+template <typename B, typename C>
+inline bool Parser<B, C>::isBitRateSwitch() const
+{
+    return _isBitRateSwitch;
+}
+
+template <typename B, typename C>
+uint32_t Parser<B, C>::parseAddress(const char* it, std::size_t size)
 {
     uint32_t address = 0;
     unsigned shift = size * 4;
@@ -82,39 +322,149 @@ uint32_t Parser<B>::parseAddress(const char* it, std::size_t size)
     return address;
 }
 
-template <typename B>
-void Parser<B>::acceptData(const void* data, std::size_t size)
+template <typename B, typename C>
+inline void Parser<B, C>::emitFrame(uint32_t address, bool isExtended, const uint8_t* data, std::size_t size)
+{
+    _metrics.frameDecoded(isExtended);
+    if (B::frameBatchSize == 0) {
+        _isExtendedFrame = isExtended;
+        _metrics.framesDelivered(1);
+        base().handleData(address, data, size);
+        return;
+    }
+    Frame& frame = _batch[_batchNum];
+    frame.address = address;
+    frame.isExtended = isExtended;
+    frame.size = size;
+    std::memcpy(frame.data, data, 8);
+    _batchNum++;
+    if (_batchNum == B::frameBatchSize) {
+        flushFrames();
+    }
+}
+
+template <typename B, typename C>
+inline void Parser<B, C>::emitFdFrame(uint32_t address, bool isExtended, bool isBitRateSwitch, const uint8_t* data,
+                                      std::size_t size)
+{
+    flushFrames();
+    _metrics.frameDecoded(isExtended);
+    _metrics.framesDelivered(1);
+    _isExtendedFrame = isExtended;
+    _isBitRateSwitch = isBitRateSwitch;
+    base().handleFdData(address, data, size);
+}
+
+template <typename B, typename C>
+inline void Parser<B, C>::finishReceipt(bool isExtended)
+{
+    flushFrames();
+    _metrics.receipt(isExtended);
+    if (isExtended) {
+        base().handleExtReceipt();
+    } else {
+        base().handleReceipt();
+    }
+}
+
+// A receipt followed by junk is reported after the junk, which may end in a later call
+template <typename B, typename C>
+inline void Parser<B, C>::finishReceiptAfterJunk(bool isExtended)
+{
+    if (_state == StateJunk) {
+        _state = isExtended ? StateExtReceiptJunk : StateReceiptJunk;
+    } else {
+        finishReceipt(isExtended);
+    }
+}
+
+template <typename B, typename C>
+inline void Parser<B, C>::flushFrames()
+{
+    if (B::frameBatchSize != 0 && _batchNum != 0) {
+        _metrics.framesDelivered(_batchNum);
+        base().handleFrames(_batch, _batchNum);
+        _batchNum = 0;
+    }
+}
+
+template <typename B, typename C>
+inline const char* Parser<B, C>::skipJunk(const char* start, const char* it, const char* end)
+{
+    it = std::find_if(it, end, [](char c) {
+        return c == '\r' || c == '\a';
+    });
+    flushFrames();
+    _metrics.junk(it - start);
+    base().handleJunk((const uint8_t*)start, it - start);
+    if (it == end && _state == StateIdle) {
+        // no terminator in this chunk, the junk goes on in the next one
+        _state = StateJunk;
+    }
+    return it;
+}
+
+template <typename B, typename C>
+void Parser<B, C>::acceptData(const void* data, std::size_t size)
 {
     if (size == 0) {
         return;
     }
 
-    _buffer.append((const char*)data, size);
+    _metrics.chunkStarted();
+    const char* it = (const char*)data;
+    const char* end = it + size;
+    Frame batch[B::frameBatchSize == 0 ? 1 : B::frameBatchSize];
+    _batch = batch;
+    _msgStart = it;
+
+    if (_state != StateIdle) {
+        it = feedStateMachine(it, end, true);
+    }
+    it = parseFrames(it, end);
+    it = feedStateMachine(it, end, false);
+
+    // junk is reported as it goes, only a partially decoded message is kept
+    if (_state != StateIdle && _state < StateJunk) {
+        std::size_t tailSize = end - _msgStart;
+        assert(_rawSize + tailSize < maxFrameSize);
+        std::memcpy(_raw + _rawSize, _msgStart, tailSize);
+        _rawSize += tailSize;
+        _metrics.carriedOver(_rawSize);
+    }
+    flushFrames();
+}
 
-    const char* it = _buffer.data();
-    const char* end = it + _buffer.size();
+// Decodes whole messages while a complete frame is guaranteed to fit into the rest of the buffer, the shorter
+// tail is left to the state machine
+template <typename B, typename C>
+const char* Parser<B, C>::parseFrames(const char* it, const char* end)
+{
     std::size_t addrSize;
     uint32_t maxAddress;
 
-    while (true) {
+    while (std::size_t(end - it) >= maxClassicFrameSize) {
         const char* currentMsg = it;
         switch (*it) {
         case '\r':
             it++;
             break;
         case 'z':
+        case 'Z':
             it++;
-            if (it == end) {
-                _buffer.resize(1);
-                _buffer[0] = 'z';
-                return;
-            }
             if (*it != '\r') {
                 it = skipJunk(currentMsg, it, end);
+                finishReceiptAfterJunk(*currentMsg == 'Z');
             } else {
                 it++;
+                finishReceipt(*currentMsg == 'Z');
             }
-            base().handleReceipt();
+            break;
+        case '\a':
+            it++;
+            flushFrames();
+            _metrics.nack();
+            base().handleNack();
             break;
         case 't':
             addrSize = 3;
@@ -124,60 +474,245 @@ void Parser<B>::acceptData(const void* data, std::size_t size)
             addrSize = 8;
             maxAddress = 0x1fffffff;
 parseFrame: {
-            assert(end >= it);
-            if (std::size_t(end - it) < addrSize + 2) {
-                _buffer.erase(0, currentMsg - _buffer.data());
-                return;
-            }
             it++;
-            uint32_t address = parseAddress(it, addrSize);
-            if (address > maxAddress) {
+            uint8_t dataSize = charToNibble(it[addrSize]);
+            if (dataSize > 8) {
                 it = skipJunk(currentMsg, it, end);
                 break;
             }
-            it += addrSize;
-            uint8_t dataSize = charToNibble(*it);
-            if (dataSize > 8) {
+            std::size_t fieldsSize = addrSize + 1 + dataSize * 2;
+            // any bad char makes the whole frame junk up to the next '\r', so the span is validated at once
+            uint32_t address;
+            uint8_t data[8];
+            if (!decodeFrameFields(it, end - it, addrSize, dataSize, &address, data) || address > maxAddress
+                || it[fieldsSize] != '\r') {
                 it = skipJunk(currentMsg, it, end);
                 break;
             }
-            it++;
-            if ((end - it) < (dataSize * 2 + 1)) {
-                _buffer.erase(0, currentMsg - _buffer.data());
-                return;
+            it += fieldsSize + 1;
+            if (B::filterAddresses && !base().acceptAddress(address, addrSize == 8)) {
+                _metrics.frameFiltered();
+                break;
             }
-            uint8_t data[8];
-            for (std::size_t i = 0; i < dataSize; i++) {
-                uint8_t l = charToNibble(it[0]);
-                if (l == 0xff) {
-                    it = skipJunk(currentMsg, it, end);
-                    goto checkEos;
-                }
-                uint8_t r = charToNibble(it[1]);
-                if (r == 0xff) {
-                    it = skipJunk(currentMsg, it, end);
-                    goto checkEos;
+            emitFrame(address, addrSize == 8, data, dataSize);
+            break;
+        }
+        case 'd':
+        case 'D':
+        case 'b':
+        case 'B': {
+            const char* next = parseFdFrame(it, end);
+            if (!next) {
+                // the frame may be longer than the rest of the buffer, the state machine takes it from here
+                return it;
+            }
+            it = next;
+            break;
+        }
+        default:
+            it = skipJunk(currentMsg, it, end);
+        }
+    }
+    return it;
+}
+
+// Returns nullptr if the whole frame is not in the buffer yet. The payload goes through the vectorized hex decoder,
+// so 64 byte frames cost about as much per char as classic ones
+template <typename B, typename C>
+const char* Parser<B, C>::parseFdFrame(const char* it, const char* end)
+{
+    const char* currentMsg = it;
+    bool isExtended = *it == 'D' || *it == 'B';
+    bool isBitRateSwitch = *it == 'b' || *it == 'B';
+    std::size_t addrSize = isExtended ? 8 : 3;
+    it++;
+    uint8_t dlc = charToNibble(it[addrSize]);
+    if (dlc == 0xff) {
+        return skipJunk(currentMsg, it, end);
+    }
+    std::size_t dataSize = fdDlcToSize(dlc);
+    std::size_t fieldsSize = addrSize + 1 + dataSize * 2;
+    if (std::size_t(end - it) <= fieldsSize) {
+        return nullptr;
+    }
+    uint32_t address = parseAddress(it, addrSize);
+    if (address > (isExtended ? 0x1fffffffu : 0x7ffu) || it[fieldsSize] != '\r') {
+        return skipJunk(currentMsg, it, end);
+    }
+    uint8_t data[64];
+    if (!decodeHexStream(it + addrSize + 1, data, dataSize)) {
+        return skipJunk(currentMsg, it, end);
+    }
+    if (B::filterAddresses && !base().acceptAddress(address, isExtended)) {
+        _metrics.frameFiltered();
+        return it + fieldsSize + 1;
+    }
+    emitFdFrame(address, isExtended, isBitRateSwitch, data, dataSize);
+    return it + fieldsSize + 1;
+}
+
+template <typename B, typename C>
+inline void Parser<B, C>::startFrame(const char* it, std::size_t addrSize, bool isFd, bool isBitRateSwitch)
+{
+    _msgStart = it;
+    _state = StateAddress;
+    _addrSize = addrSize;
+    _remaining = addrSize;
+    _address = 0;
+    _isFd = isFd;
+    _isBrs = isBitRateSwitch;
+}
+
+// Reports message started at _msgStart (and in previous calls) as junk up to the next '\r' or BELL, in a later call
+// if this one has none
+template <typename B, typename C>
+const char* Parser<B, C>::failMessage(const char* it, const char* end)
+{
+    _state = StateIdle;
+    if (_rawSize != 0) {
+        flushFrames();
+        _metrics.junk(_rawSize);
+        base().handleJunk((const uint8_t*)_raw, _rawSize);
+        _rawSize = 0;
+        if (it == _msgStart && it != end && (*it == '\r' || *it == '\a')) {
+            return it;
+        }
+    }
+    return skipJunk(_msgStart, it, end);
+}
+
+// Consumes bytes one at a time keeping partially decoded message in members, so a message split between calls
+// is never rescanned. Stops after the first completed message if untilIdle is set
+template <typename B, typename C>
+const char* Parser<B, C>::feedStateMachine(const char* it, const char* end, bool untilIdle)
+{
+    while (it != end) {
+        char c = *it;
+        switch (transition(_state, charClass(c))) {
+        case ActionSkip:
+            it++;
+            break;
+        case ActionJunk:
+            it = skipJunk(it, it, end);
+            break;
+        case ActionStartReceipt:
+            _msgStart = it;
+            _state = StateReceipt;
+            it++;
+            break;
+        case ActionStartExtReceipt:
+            _msgStart = it;
+            _state = StateExtReceipt;
+            it++;
+            break;
+        case ActionNack:
+            it++;
+            flushFrames();
+            _metrics.nack();
+            base().handleNack();
+            break;
+        case ActionStartStd:
+            startFrame(it, 3, false, false);
+            it++;
+            break;
+        case ActionStartExt:
+            startFrame(it, 8, false, false);
+            it++;
+            break;
+        case ActionStartFdStd:
+            startFrame(it, 3, true, c == 'b');
+            it++;
+            break;
+        case ActionStartFdExt:
+            startFrame(it, 8, true, c == 'B');
+            it++;
+            break;
+        case ActionAddAddress:
+            _address = (_address << 4) | charToNibble(c);
+            it++;
+            _remaining--;
+            if (_remaining == 0) {
+                if (_address > (_addrSize == 8 ? 0x1fffffffu : 0x7ffu)) {
+                    it = failMessage(it, end);
+                    break;
                 }
-                data[i] = (l << 4) | r;
-                it += 2;
+                _state = StateDlc;
             }
-            if (*it != '\r') {
-                it = skipJunk(currentMsg, it, end);
+            break;
+        case ActionSetDlc:
+            _dataSize = _isFd ? fdDlcToSize(charToNibble(c)) : charToNibble(c);
+            if (_dataSize > 8 && !_isFd) {
+                it = failMessage(it, end);
                 break;
+            }
+            it++;
+            _remaining = _dataSize * 2;
+            _state = _remaining == 0 ? StateTerminator : StatePayload;
+            break;
+        case ActionAddPayload: {
+            std::size_t index = _dataSize * 2 - _remaining;
+            if (index & 1) {
+                _data[index / 2] |= charToNibble(c);
             } else {
-                it++;
+                _data[index / 2] = charToNibble(c) << 4;
+            }
+            it++;
+            _remaining--;
+            if (_remaining == 0) {
+                _state = StateTerminator;
             }
-            base().handleData(address, data, dataSize);
             break;
         }
-        default:
-            it = skipJunk(currentMsg, it, end);
+        case ActionFinishFrame:
+            it++;
+            _state = StateIdle;
+            _rawSize = 0;
+            if (B::filterAddresses && !base().acceptAddress(_address, _addrSize == 8)) {
+                _metrics.frameFiltered();
+            } else if (_isFd) {
+                emitFdFrame(_address, _addrSize == 8, _isBrs, _data, _dataSize);
+            } else {
+                emitFrame(_address, _addrSize == 8, _data, _dataSize);
+            }
+            break;
+        case ActionFinishReceipt:
+        case ActionFinishExtReceipt: {
+            bool isExtended = _state == StateExtReceipt;
+            it++;
+            _state = StateIdle;
+            _rawSize = 0;
+            finishReceipt(isExtended);
+            break;
+        }
+        case ActionReceiptJunk:
+        case ActionExtReceiptJunk: {
+            bool isExtended = _state == StateExtReceipt;
+            it = failMessage(it, end);
+            finishReceiptAfterJunk(isExtended);
+            break;
+        }
+        case ActionFail:
+            it = failMessage(it, end);
+            break;
+        case ActionContinueJunk:
+            it = skipJunk(it, it, end);
+            break;
+        case ActionEndJunk:
+            // the terminator is handled as a new message
+            _state = StateIdle;
+            break;
+        case ActionEndReceiptJunk:
+        case ActionEndExtReceiptJunk: {
+            bool isExtended = _state == StateExtReceiptJunk;
+            _state = StateIdle;
+            finishReceipt(isExtended);
+            break;
         }
-checkEos:
-        if (it == end) {
-            _buffer.clear();
-            return;
+        }
+        if (untilIdle && _state == StateIdle) {
+            break;
         }
     }
+    return it;
 }
 }
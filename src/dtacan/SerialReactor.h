@@ -0,0 +1,381 @@
+#pragma once
+
+#include "dtacan/Encoder.h"
+#include "dtacan/Parser.h"
+#include "dtacan/Tty.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace dtacan {
+
+/// Single threaded epoll loop serving any number of descriptors. Linux only
+class SerialReactor {
+public:
+    // Registered with a descriptor and called with epoll event flags when it is ready
+    struct Handler {
+        void (*handle)(void* context, uint32_t events);
+        void* context;
+    };
+
+    SerialReactor()
+        : _epollFd(epoll_create1(EPOLL_CLOEXEC))
+        , _running(false)
+    {
+    }
+
+    ~SerialReactor()
+    {
+        if (_epollFd >= 0) {
+            ::close(_epollFd);
+        }
+    }
+
+    SerialReactor(const SerialReactor&) = delete;
+    SerialReactor& operator=(const SerialReactor&) = delete;
+
+    bool isValid() const
+    {
+        return _epollFd >= 0;
+    }
+
+    bool add(int fd, Handler* handler, uint32_t events)
+    {
+        return control(EPOLL_CTL_ADD, fd, handler, events);
+    }
+
+    bool modify(int fd, Handler* handler, uint32_t events)
+    {
+        return control(EPOLL_CTL_MOD, fd, handler, events);
+    }
+
+    bool remove(int fd)
+    {
+        return epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, nullptr) == 0;
+    }
+
+    // Waits up to timeoutMs for ready descriptors and handles them. Returns number of events handled, -1 on error
+    int poll(int timeoutMs)
+    {
+        epoll_event events[maxEvents];
+        int count = epoll_wait(_epollFd, events, maxEvents, timeoutMs);
+        if (count < 0) {
+            return errno == EINTR ? 0 : -1;
+        }
+        for (int i = 0; i < count; i++) {
+            Handler* handler = (Handler*)events[i].data.ptr;
+            handler->handle(handler->context, events[i].events);
+        }
+        return count;
+    }
+
+    // Polls until stop is called from a handler or an error occurs
+    bool run()
+    {
+        _running = true;
+        while (_running) {
+            if (poll(-1) < 0) {
+                _running = false;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void stop()
+    {
+        _running = false;
+    }
+
+private:
+    static const int maxEvents = 32;
+
+    bool control(int op, int fd, Handler* handler, uint32_t events)
+    {
+        epoll_event event;
+        std::memset(&event, 0, sizeof(event));
+        event.events = events;
+        event.data.ptr = handler;
+        return epoll_ctl(_epollFd, op, fd, &event) == 0;
+    }
+
+    int _epollFd;
+    bool _running;
+};
+
+/// Adapter on a serial port driven by SerialReactor. Received data goes to the Parser hooks of B, encoded data is
+/// written without blocking: what the tty doesn't take at once is kept in a buffer of outputCapacity bytes and
+/// written when the port becomes writable. Encoded streams that don't fit into the buffer are dropped whole and
+/// counted in droppedBytes, so callers should check outputFree before sending bulk data.
+///
+/// B must not hide handleEncodedData
+template <typename B, std::size_t outputCapacity = 64 * 1024, std::size_t inputSize = 4096>
+class SerialPort : public Parser<B>, public Encoder<B> {
+public:
+    // Port hung up or failed with errno error, it is closed already
+    void handleClosed(int error);
+    // Output buffer became empty after data had to wait for the port
+    void handleOutputDrained();
+
+    SerialPort();
+    ~SerialPort();
+
+    SerialPort(const SerialPort&) = delete;
+    SerialPort& operator=(const SerialPort&) = delete;
+
+    bool open(SerialReactor* reactor, const char* path, const SerialOptions& options);
+    // Takes ownership of fd
+    bool attach(SerialReactor* reactor, int fd, const SerialOptions& options);
+    void close();
+
+    bool isOpen() const;
+    int fd() const;
+
+    std::size_t outputSize() const;
+    std::size_t outputFree() const;
+    std::size_t droppedBytes() const;
+
+    void handleEncodedData(const char* str, std::size_t size);
+
+private:
+    static void handleEvents(void* context, uint32_t events);
+
+    B& base();
+    void readInput();
+    void writeOutput();
+    void setWriteWait(bool wait);
+    void fail(int error);
+
+    SerialReactor* _reactor;
+    SerialReactor::Handler _handler;
+    int _fd;
+    bool _writeWait;
+    std::size_t _outputBegin;
+    std::size_t _outputEnd;
+    std::size_t _droppedBytes;
+    char _output[outputCapacity];
+    char _input[inputSize];
+};
+
+template <typename B, std::size_t outputCapacity, std::size_t inputSize>
+inline SerialPort<B, outputCapacity, inputSize>::SerialPort()
+    : _reactor(nullptr)
+    , _fd(-1)
+    , _writeWait(false)
+    , _outputBegin(0)
+    , _outputEnd(0)
+    , _droppedBytes(0)
+{
+    _handler.handle = &SerialPort::handleEvents;
+    _handler.context = this;
+}
+
+template <typename B, std::size_t outputCapacity, std::size_t inputSize>
+inline SerialPort<B, outputCapacity, inputSize>::~SerialPort()
+{
+    close();
+}
+
+template <typename B, std::size_t outputCapacity, std::size_t inputSize>
+inline B& SerialPort<B, outputCapacity, inputSize>::base()
+{
+    return *static_cast<B*>(this);
+}
+
+template <typename B, std::size_t outputCapacity, std::size_t inputSize>
+inline void SerialPort<B, outputCapacity, inputSize>::handleClosed(int error)
+{
+    (void)error;
+}
+
+template <typename B, std::size_t outputCapacity, std::size_t inputSize>
+inline void SerialPort<B, outputCapacity, inputSize>::handleOutputDrained()
+{
+}
+
+template <typename B, std::size_t outputCapacity, std::size_t inputSize>
+bool SerialPort<B, outputCapacity, inputSize>::open(SerialReactor* reactor, const char* path,
+                                                     const SerialOptions& options)
+{
+    int fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    return attach(reactor, fd, options);
+}
+
+template <typename B, std::size_t outputCapacity, std::size_t inputSize>
+bool SerialPort<B, outputCapacity, inputSize>::attach(SerialReactor* reactor, int fd, const SerialOptions& options)
+{
+    close();
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0 || !configureSerialPort(fd, options)
+        || !reactor->add(fd, &_handler, EPOLLIN)) {
+        int error = errno;
+        ::close(fd);
+        errno = error;
+        return false;
+    }
+    _reactor = reactor;
+    _fd = fd;
+    _writeWait = false;
+    _outputBegin = 0;
+    _outputEnd = 0;
+    return true;
+}
+
+template <typename B, std::size_t outputCapacity, std::size_t inputSize>
+void SerialPort<B, outputCapacity, inputSize>::close()
+{
+    if (_fd < 0) {
+        return;
+    }
+    _reactor->remove(_fd);
+    ::close(_fd);
+    _fd = -1;
+    _reactor = nullptr;
+}
+
+template <typename B, std::size_t outputCapacity, std::size_t inputSize>
+inline bool SerialPort<B, outputCapacity, inputSize>::isOpen() const
+{
+    return _fd >= 0;
+}
+
+template <typename B, std::size_t outputCapacity, std::size_t inputSize>
+inline int SerialPort<B, outputCapacity, inputSize>::fd() const
+{
+    return _fd;
+}
+
+template <typename B, std::size_t outputCapacity, std::size_t inputSize>
+inline std::size_t SerialPort<B, outputCapacity, inputSize>::outputSize() const
+{
+    return _outputEnd - _outputBegin;
+}
+
+template <typename B, std::size_t outputCapacity, std::size_t inputSize>
+inline std::size_t SerialPort<B, outputCapacity, inputSize>::outputFree() const
+{
+    return outputCapacity - outputSize();
+}
+
+template <typename B, std::size_t outputCapacity, std::size_t inputSize>
+inline std::size_t SerialPort<B, outputCapacity, inputSize>::droppedBytes() const
+{
+    return _droppedBytes;
+}
+
+template <typename B, std::size_t outputCapacity, std::size_t inputSize>
+void SerialPort<B, outputCapacity, inputSize>::handleEncodedData(const char* str, std::size_t size)
+{
+    if (_fd < 0 || size > outputFree()) {
+        _droppedBytes += size;
+        return;
+    }
+    // write straight away while nothing is waiting, it saves a copy and a poll round trip
+    if (_outputBegin == _outputEnd) {
+        ssize_t written = ::write(_fd, str, size);
+        if (written < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                fail(errno);
+                _droppedBytes += size;
+                return;
+            }
+            written = 0;
+        }
+        str += written;
+        size -= written;
+        _outputBegin = 0;
+        _outputEnd = 0;
+        if (size == 0) {
+            return;
+        }
+    }
+    if (outputCapacity - _outputEnd < size) {
+        std::memmove(_output, _output + _outputBegin, outputSize());
+        _outputEnd -= _outputBegin;
+        _outputBegin = 0;
+    }
+    std::memcpy(_output + _outputEnd, str, size);
+    _outputEnd += size;
+    setWriteWait(true);
+}
+
+template <typename B, std::size_t outputCapacity, std::size_t inputSize>
+void SerialPort<B, outputCapacity, inputSize>::handleEvents(void* context, uint32_t events)
+{
+    SerialPort* port = (SerialPort*)context;
+    if (events & EPOLLIN) {
+        port->readInput();
+    }
+    if (port->isOpen() && (events & EPOLLOUT)) {
+        port->writeOutput();
+    }
+    // hangup is handled after the data that came before it has been read
+    if (port->isOpen() && (events & (EPOLLHUP | EPOLLERR)) && !(events & EPOLLIN)) {
+        port->fail(events & EPOLLERR ? EIO : 0);
+    }
+}
+
+// One read per wakeup keeps a busy port from starving the others, the rest is picked up on the next poll
+template <typename B, std::size_t outputCapacity, std::size_t inputSize>
+void SerialPort<B, outputCapacity, inputSize>::readInput()
+{
+    ssize_t size = ::read(_fd, _input, inputSize);
+    if (size > 0) {
+        Parser<B>::acceptData(_input, size);
+    } else if (size == 0) {
+        fail(0);
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        fail(errno);
+    }
+}
+
+template <typename B, std::size_t outputCapacity, std::size_t inputSize>
+void SerialPort<B, outputCapacity, inputSize>::writeOutput()
+{
+    while (_outputBegin != _outputEnd) {
+        ssize_t written = ::write(_fd, _output + _outputBegin, outputSize());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                fail(errno);
+            }
+            return;
+        }
+        _outputBegin += written;
+    }
+    _outputBegin = 0;
+    _outputEnd = 0;
+    setWriteWait(false);
+    base().handleOutputDrained();
+}
+
+template <typename B, std::size_t outputCapacity, std::size_t inputSize>
+inline void SerialPort<B, outputCapacity, inputSize>::setWriteWait(bool wait)
+{
+    if (_writeWait != wait) {
+        _writeWait = wait;
+        _reactor->modify(_fd, &_handler, wait ? EPOLLIN | EPOLLOUT : EPOLLIN);
+    }
+}
+
+template <typename B, std::size_t outputCapacity, std::size_t inputSize>
+void SerialPort<B, outputCapacity, inputSize>::fail(int error)
+{
+    close();
+    _droppedBytes += outputSize();
+    _outputBegin = 0;
+    _outputEnd = 0;
+    base().handleClosed(error);
+}
+}
@@ -0,0 +1,388 @@
+#pragma once
+
+#include "dtacan/Frame.h"
+#include "dtacan/IdFilter.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <cassert>
+#include <cstddef>
+#include <stdint.h>
+
+namespace dtacan {
+
+/// Hands decoded frames over to up to maxWorkers worker threads, so heavy per-frame work runs on several cores.
+/// Ids are hashed into shardCount shards and every shard belongs to one worker at a time, so frames of an id are
+/// handled in arrival order. The parse thread is the only producer, it passes frames to worker threads over
+/// single producer single consumer rings of ringCapacity frames and calls handleFrame of the derived class there.
+///
+/// Shards move between workers whole: when a worker has nothing to do and the owner of a shard has more than the
+/// steal threshold frames queued, the producer hands the shard to the idle worker once no frame of the shard is
+/// queued or being handled. Order within an id is kept because the old owner has nothing left of it.
+///
+/// A worker with an empty ring and a producer facing a full one spin for a while and then sleep on a condition
+/// variable of the worker until the other side wakes them up, so idle workers take no CPU time.
+///
+/// Workers call into the derived class, so it has to call stop in its destructor
+template <typename B, std::size_t shardCount = 64, std::size_t ringCapacity = 1024, std::size_t maxWorkers = 16>
+class ShardedDispatcher {
+public:
+    // Called in a worker thread
+    void handleFrame(std::size_t worker, const Frame& frame);
+
+    ShardedDispatcher();
+    ~ShardedDispatcher();
+
+    // Spawns worker threads, shards are spread over them round robin. Returns false if already running
+    bool start(std::size_t workerCount);
+    // Waits until queued frames are handled and joins the workers
+    void stop();
+
+    // Producer side, the parse thread only. Waits while the ring of the owner is full
+    void dispatch(const Frame& frame);
+    void dispatch(const Frame* frames, std::size_t count);
+    // Returns false instead of waiting
+    bool tryDispatch(const Frame& frame);
+
+    // Queue depth at which idle workers may take shards of the worker, 0 disables stealing
+    void setStealThreshold(std::size_t depth);
+
+    // Safe from any thread, approximate while frames are flowing
+    std::size_t workerCount() const;
+    std::size_t depth(std::size_t worker) const;
+    uint64_t handled(std::size_t worker) const;
+    std::size_t shardOwner(std::size_t shard) const;
+    static std::size_t shardOf(uint32_t address, bool isExtended);
+    uint64_t migrations() const;
+
+private:
+    static_assert(shardCount > 0 && (shardCount & (shardCount - 1)) == 0, "shard count must be a power of two");
+    static_assert(ringCapacity >= 2 && (ringCapacity & (ringCapacity - 1)) == 0,
+                  "ring capacity must be a power of two");
+    static_assert(shardCount < 0x10000, "shard index must fit into 16 bits");
+
+    // Checks of the ring before a worker or the producer goes to sleep
+    static const unsigned spinCount = 64;
+
+    struct Entry {
+        Frame frame;
+        uint16_t shard;
+    };
+
+    // positions written by different threads are kept on separate cache lines with padding, alignas would
+    // need aligned new for the heap allocated dispatchers
+    struct Worker {
+        std::atomic<std::size_t> head;
+        char pad0[64 - sizeof(std::atomic<std::size_t>)];
+        std::atomic<std::size_t> tail;
+        std::atomic<uint64_t> handled;
+        std::atomic<bool> idle;
+        char pad1[64];
+        Entry ring[ringCapacity];
+        std::thread thread;
+
+        // sleeping and producerWaiting are set under mutex right before the ring is checked the last time, the
+        // other side clears them and notifies after its own ring update, so no wakeup is lost
+        std::mutex mutex;
+        std::condition_variable framesQueued;
+        std::condition_variable spaceFreed;
+        std::atomic<bool> sleeping;
+        std::atomic<bool> producerWaiting;
+    };
+
+    struct Shard {
+        // frames queued or being handled, incremented by the producer and decremented by the owner
+        std::atomic<std::size_t> inFlight;
+        std::atomic<std::size_t> owner;
+    };
+
+    B& base();
+    void run(std::size_t index);
+    void sleep(Worker& worker, std::size_t tail);
+    void waitForSpace(Worker& worker);
+    bool push(std::size_t worker, const Frame& frame, std::size_t shard);
+    std::size_t route(std::size_t shard);
+
+    Worker _workers[maxWorkers];
+    Shard _shards[shardCount];
+    std::size_t _workerCount;
+    std::size_t _stealThreshold;
+    std::atomic<uint64_t> _migrations;
+    std::atomic<bool> _stopping;
+};
+
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::ShardedDispatcher()
+    : _workerCount(0)
+    , _stealThreshold(ringCapacity / 4)
+    , _migrations(0)
+    , _stopping(false)
+{
+    for (std::size_t i = 0; i < maxWorkers; i++) {
+        _workers[i].head.store(0, std::memory_order_relaxed);
+        _workers[i].tail.store(0, std::memory_order_relaxed);
+        _workers[i].handled.store(0, std::memory_order_relaxed);
+        _workers[i].idle.store(false, std::memory_order_relaxed);
+        _workers[i].sleeping.store(false, std::memory_order_relaxed);
+        _workers[i].producerWaiting.store(false, std::memory_order_relaxed);
+    }
+    for (std::size_t i = 0; i < shardCount; i++) {
+        _shards[i].inFlight.store(0, std::memory_order_relaxed);
+        _shards[i].owner.store(0, std::memory_order_relaxed);
+    }
+}
+
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::~ShardedDispatcher()
+{
+    stop();
+}
+
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+inline B& ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::base()
+{
+    return *static_cast<B*>(this);
+}
+
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+inline void ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::handleFrame(std::size_t worker,
+                                                                                    const Frame& frame)
+{
+    (void)worker;
+    (void)frame;
+}
+
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+bool ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::start(std::size_t workerCount)
+{
+    if (_workerCount != 0 || workerCount == 0 || workerCount > maxWorkers) {
+        return false;
+    }
+    _stopping.store(false, std::memory_order_relaxed);
+    _workerCount = workerCount;
+    for (std::size_t i = 0; i < shardCount; i++) {
+        _shards[i].owner.store(i % workerCount, std::memory_order_relaxed);
+    }
+    for (std::size_t i = 0; i < workerCount; i++) {
+        _workers[i].thread = std::thread(&ShardedDispatcher::run, this, i);
+    }
+    return true;
+}
+
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+void ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::stop()
+{
+    if (_workerCount == 0) {
+        return;
+    }
+    _stopping.store(true, std::memory_order_seq_cst);
+    for (std::size_t i = 0; i < _workerCount; i++) {
+        {
+            std::lock_guard<std::mutex> lock(_workers[i].mutex);
+            _workers[i].framesQueued.notify_one();
+        }
+        _workers[i].thread.join();
+    }
+    _workerCount = 0;
+}
+
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+void ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::run(std::size_t index)
+{
+    Worker& worker = _workers[index];
+    std::size_t tail = worker.tail.load(std::memory_order_relaxed);
+    unsigned spins = 0;
+    while (true) {
+        std::size_t head = worker.head.load(std::memory_order_acquire);
+        if (head == tail) {
+            // frames queued before stop are handled first
+            if (_stopping.load(std::memory_order_acquire)) {
+                if (worker.head.load(std::memory_order_acquire) == tail) {
+                    break;
+                }
+                continue;
+            }
+            worker.idle.store(true, std::memory_order_relaxed);
+            if (++spins < spinCount) {
+                std::this_thread::yield();
+            } else {
+                sleep(worker, tail);
+                spins = 0;
+            }
+            continue;
+        }
+        spins = 0;
+        worker.idle.store(false, std::memory_order_relaxed);
+        for (; tail != head; tail++) {
+            const Entry& entry = worker.ring[tail & (ringCapacity - 1)];
+            base().handleFrame(index, entry.frame);
+            // the shard may move once this drops to zero, so it is released after the frame is handled
+            _shards[entry.shard].inFlight.fetch_sub(1, std::memory_order_release);
+            worker.handled.store(worker.handled.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            worker.tail.store(tail + 1, std::memory_order_release);
+        }
+        // pairs with the store of producerWaiting in waitForSpace
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (worker.producerWaiting.load(std::memory_order_relaxed)
+            && worker.producerWaiting.exchange(false, std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.spaceFreed.notify_one();
+        }
+    }
+    worker.idle.store(false, std::memory_order_relaxed);
+}
+
+// Waits until push queues a frame after tail or stop is called
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+void ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::sleep(Worker& worker, std::size_t tail)
+{
+    std::unique_lock<std::mutex> lock(worker.mutex);
+    while (true) {
+        worker.sleeping.store(true, std::memory_order_seq_cst);
+        if (worker.head.load(std::memory_order_seq_cst) != tail || _stopping.load(std::memory_order_seq_cst)) {
+            break;
+        }
+        worker.framesQueued.wait(lock);
+    }
+    worker.sleeping.store(false, std::memory_order_relaxed);
+}
+
+// Waits until the worker frees a slot of its full ring
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+void ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::waitForSpace(Worker& worker)
+{
+    std::unique_lock<std::mutex> lock(worker.mutex);
+    while (true) {
+        worker.producerWaiting.store(true, std::memory_order_seq_cst);
+        std::size_t head = worker.head.load(std::memory_order_relaxed);
+        if (head - worker.tail.load(std::memory_order_seq_cst) != ringCapacity) {
+            break;
+        }
+        worker.spaceFreed.wait(lock);
+    }
+    worker.producerWaiting.store(false, std::memory_order_relaxed);
+}
+
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+inline std::size_t ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::shardOf(uint32_t address,
+                                                                                       bool isExtended)
+{
+    return detail::hashAddress(address, isExtended, shardCount - 1);
+}
+
+// Moves an empty shard of an overloaded owner to an idle worker, only the producer changes owners
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+inline std::size_t ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::route(std::size_t shard)
+{
+    std::size_t owner = _shards[shard].owner.load(std::memory_order_relaxed);
+    if (_stealThreshold == 0 || depth(owner) <= _stealThreshold
+        || _shards[shard].inFlight.load(std::memory_order_acquire) != 0) {
+        return owner;
+    }
+    for (std::size_t i = 0; i < _workerCount; i++) {
+        if (i != owner && _workers[i].idle.load(std::memory_order_relaxed)) {
+            _workers[i].idle.store(false, std::memory_order_relaxed);
+            _shards[shard].owner.store(i, std::memory_order_relaxed);
+            _migrations.store(_migrations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return i;
+        }
+    }
+    return owner;
+}
+
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+inline bool ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::push(std::size_t index, const Frame& frame,
+                                                                            std::size_t shard)
+{
+    Worker& worker = _workers[index];
+    std::size_t head = worker.head.load(std::memory_order_relaxed);
+    if (head - worker.tail.load(std::memory_order_acquire) == ringCapacity) {
+        return false;
+    }
+    Entry& entry = worker.ring[head & (ringCapacity - 1)];
+    entry.frame = frame;
+    entry.shard = shard;
+    _shards[shard].inFlight.fetch_add(1, std::memory_order_relaxed);
+    worker.head.store(head + 1, std::memory_order_seq_cst);
+    // a worker only sleeps on an empty ring, so this is set at most once per transition to non empty
+    if (worker.sleeping.load(std::memory_order_seq_cst) && worker.sleeping.exchange(false, std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.framesQueued.notify_one();
+    }
+    return true;
+}
+
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+bool ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::tryDispatch(const Frame& frame)
+{
+    assert(_workerCount != 0 && "dispatcher is not started");
+    std::size_t shard = shardOf(frame.address, frame.isExtended);
+    return push(route(shard), frame, shard);
+}
+
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+void ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::dispatch(const Frame& frame)
+{
+    assert(_workerCount != 0 && "dispatcher is not started");
+    std::size_t shard = shardOf(frame.address, frame.isExtended);
+    std::size_t worker = route(shard);
+    unsigned spins = 0;
+    while (!push(worker, frame, shard)) {
+        if (++spins < spinCount) {
+            std::this_thread::yield();
+        } else {
+            waitForSpace(_workers[worker]);
+            spins = 0;
+        }
+    }
+}
+
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+void ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::dispatch(const Frame* frames, std::size_t count)
+{
+    for (std::size_t i = 0; i < count; i++) {
+        dispatch(frames[i]);
+    }
+}
+
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+inline void ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::setStealThreshold(std::size_t depth)
+{
+    _stealThreshold = depth;
+}
+
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+inline std::size_t ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::workerCount() const
+{
+    return _workerCount;
+}
+
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+inline std::size_t ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::depth(std::size_t worker) const
+{
+    std::size_t head = _workers[worker].head.load(std::memory_order_acquire);
+    std::size_t tail = _workers[worker].tail.load(std::memory_order_acquire);
+    return head > tail ? head - tail : 0;
+}
+
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+inline uint64_t ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::handled(std::size_t worker) const
+{
+    return _workers[worker].handled.load(std::memory_order_relaxed);
+}
+
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+inline std::size_t ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::shardOwner(std::size_t shard) const
+{
+    return _shards[shard].owner.load(std::memory_order_relaxed);
+}
+
+template <typename B, std::size_t shardCount, std::size_t ringCapacity, std::size_t maxWorkers>
+inline uint64_t ShardedDispatcher<B, shardCount, ringCapacity, maxWorkers>::migrations() const
+{
+    return _migrations.load(std::memory_order_relaxed);
+}
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include "dtacan/Encoder.h"
+#include "dtacan/Frame.h"
+
+#include <atomic>
+#include <thread>
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+namespace dtacan {
+
+/// Encoder with a bounded lock-free queue in front of it. Any number of threads submit frames without locks or
+/// allocation, a single writer thread calls drain to encode queued frames in batches of up to batchSize frames,
+/// every batch is passed to handleEncodedData at once. Encoder methods must only be called by the writer thread.
+///
+/// Every cell has a sequence number telling whether it is free for the producer owning the position or filled for
+/// the consumer, so producers only contend on the enqueue position
+template <typename B, std::size_t capacity = 1024, std::size_t batchSize = 64>
+class SubmitQueue : public Encoder<B> {
+public:
+    SubmitQueue();
+
+    // Returns false if the frame is invalid or the queue is full
+    bool trySubmit(uint32_t address, const void* data, std::size_t size, bool isExtended);
+    // Waits for free space, returns false only if the frame is invalid
+    bool submit(uint32_t address, const void* data, std::size_t size, bool isExtended);
+
+    // Writer thread only. Encodes everything queued so far, returns number of frames encoded
+    std::size_t drain();
+
+    // Number of queued frames, approximate while other threads are submitting or draining
+    std::size_t depth() const;
+
+private:
+    static_assert(capacity >= 2 && (capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+    static_assert(batchSize > 0, "batch size must be positive");
+
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        Frame frame;
+    };
+
+    static bool isValidFrame(uint32_t address, std::size_t size, bool isExtended);
+    bool tryDequeue(Frame* frame);
+
+    Cell _cells[capacity];
+    // producers and the consumer write different positions, keep them on separate cache lines
+    alignas(64) std::atomic<std::size_t> _enqueuePos;
+    alignas(64) std::atomic<std::size_t> _dequeuePos;
+    Frame _frames[batchSize];
+    TransmitFrame _batch[batchSize];
+    char _buffer[batchSize * 27];
+};
+
+template <typename B, std::size_t capacity, std::size_t batchSize>
+SubmitQueue<B, capacity, batchSize>::SubmitQueue()
+    : _enqueuePos(0)
+    , _dequeuePos(0)
+{
+    for (std::size_t i = 0; i < capacity; i++) {
+        _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+template <typename B, std::size_t capacity, std::size_t batchSize>
+inline bool SubmitQueue<B, capacity, batchSize>::isValidFrame(uint32_t address, std::size_t size, bool isExtended)
+{
+    return size <= 8 && address <= (isExtended ? 0x1fffffffu : 0x7ffu);
+}
+
+template <typename B, std::size_t capacity, std::size_t batchSize>
+bool SubmitQueue<B, capacity, batchSize>::trySubmit(uint32_t address, const void* data, std::size_t size,
+                                                    bool isExtended)
+{
+    if (!isValidFrame(address, size, isExtended)) {
+        return false;
+    }
+    std::size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+        cell = &_cells[pos & (capacity - 1)];
+        std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+        if (diff == 0) {
+            if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // the cell still holds a frame from the previous lap
+            return false;
+        } else {
+            pos = _enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+    cell->frame.address = address;
+    cell->frame.isExtended = isExtended;
+    cell->frame.size = size;
+    if (size != 0) {
+        std::memcpy(cell->frame.data, data, size);
+    }
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename B, std::size_t capacity, std::size_t batchSize>
+bool SubmitQueue<B, capacity, batchSize>::submit(uint32_t address, const void* data, std::size_t size,
+                                                 bool isExtended)
+{
+    if (!isValidFrame(address, size, isExtended)) {
+        return false;
+    }
+    while (!trySubmit(address, data, size, isExtended)) {
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+template <typename B, std::size_t capacity, std::size_t batchSize>
+inline bool SubmitQueue<B, capacity, batchSize>::tryDequeue(Frame* frame)
+{
+    std::size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+    Cell& cell = _cells[pos & (capacity - 1)];
+    if (cell.sequence.load(std::memory_order_acquire) != pos + 1) {
+        return false;
+    }
+    *frame = cell.frame;
+    cell.sequence.store(pos + capacity, std::memory_order_release);
+    _dequeuePos.store(pos + 1, std::memory_order_relaxed);
+    return true;
+}
+
+template <typename B, std::size_t capacity, std::size_t batchSize>
+std::size_t SubmitQueue<B, capacity, batchSize>::drain()
+{
+    std::size_t total = 0;
+    while (true) {
+        std::size_t count = 0;
+        while (count < batchSize && tryDequeue(&_frames[count])) {
+            const Frame& frame = _frames[count];
+            TransmitFrame& tx = _batch[count];
+            tx.address = frame.address;
+            tx.data = frame.data;
+            tx.size = frame.size;
+            tx.isExtended = frame.isExtended;
+            count++;
+        }
+        if (count == 0) {
+            return total;
+        }
+        Encoder<B>::transmitBatch(_batch, count, _buffer, sizeof(_buffer));
+        total += count;
+    }
+}
+
+template <typename B, std::size_t capacity, std::size_t batchSize>
+inline std::size_t SubmitQueue<B, capacity, batchSize>::depth() const
+{
+    std::size_t enqueued = _enqueuePos.load(std::memory_order_relaxed);
+    std::size_t dequeued = _dequeuePos.load(std::memory_order_relaxed);
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+}
+}
@@ -0,0 +1,320 @@
+#pragma once
+
+#include "dtacan/BaudRate.h"
+#include "dtacan/Frame.h"
+#include "dtacan/IdFilter.h"
+
+#include <atomic>
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace dtacan {
+
+/// Counters of one id as seen by TrafficStats readers. Gaps are times between consecutive frames of the id, jitter
+/// is the RFC 3550 smoothed deviation of a gap from the previous one
+struct IdStats {
+    uint32_t address;
+    bool isExtended;
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t lastNs;
+    uint64_t minGapNs;
+    uint64_t maxGapNs;
+    uint64_t meanGapNs;
+    uint64_t jitterNs;
+};
+
+struct BusStats {
+    uint64_t frames;
+    uint64_t bits;
+    // frames of ids the table had no room for, counted in frames and bits only
+    uint64_t untracked;
+    // share of bus time taken by frames during the last complete window, from 0 to 1
+    double load;
+};
+
+/// Per-id and whole bus traffic counters, fed from Parser::handleData or handleFrames of the parse thread. Ids are
+/// kept in an open addressing table with room for capacity ids, nothing is allocated after construction. Bus load is
+/// the worst case bus time of decoded frames at the configured BaudRate over windows of windowNs.
+///
+/// Any number of threads may read while the parse thread records, every table slot is guarded by a seqlock so a
+/// reader retries instead of blocking the writer
+template <std::size_t capacity = 256>
+class TrafficStats {
+public:
+    TrafficStats();
+
+    // Writer side, only one thread at a time
+    void setBaudRate(BaudRate rate);
+    void setWindow(uint64_t windowNs);
+    void record(uint32_t address, bool isExtended, std::size_t size, uint64_t nowNs);
+    void record(const Frame* frames, std::size_t count, uint64_t nowNs);
+    // Closes the load window if it is over, so load drops to zero on a silent bus
+    void tick(uint64_t nowNs);
+    void clear();
+
+    // Reader side, safe from any thread
+    bool find(uint32_t address, bool isExtended, IdStats* stats) const;
+    // Copies up to maxCount entries in table order, returns number copied
+    std::size_t snapshot(IdStats* stats, std::size_t maxCount) const;
+    BusStats busStats() const;
+    std::size_t size() const;
+
+private:
+    static const std::size_t tableSize = detail::hashTableSize(capacity);
+    static const uint32_t emptySlot = 0xffffffff;
+    static const uint32_t extFlag = 0x80000000;
+
+    // Fields are atomics only so concurrent reads are well defined, they are accessed relaxed inside the seqlock
+    struct Slot {
+        std::atomic<uint32_t> key;
+        std::atomic<uint32_t> sequence;
+        std::atomic<uint64_t> frames;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> lastNs;
+        std::atomic<uint64_t> minGapNs;
+        std::atomic<uint64_t> maxGapNs;
+        std::atomic<uint64_t> gapSumNs;
+        // jitter scaled by 16 to keep the smoothing in integers
+        std::atomic<uint64_t> jitter16;
+        // writer only, previous gap for the jitter
+        uint64_t lastGapNs;
+    };
+
+    static uint32_t makeKey(uint32_t address, bool isExtended);
+    std::size_t findSlot(uint32_t key) const;
+    bool readSlot(const Slot& slot, IdStats* stats) const;
+    void update(Slot& slot, std::size_t size, uint64_t nowNs);
+
+    Slot _slots[tableSize];
+    std::atomic<std::size_t> _size;
+
+    BaudRate _rate;
+    uint64_t _windowNs;
+    uint64_t _windowStart;
+    uint64_t _windowBits;
+    bool _windowStarted;
+
+    std::atomic<uint64_t> _frames;
+    std::atomic<uint64_t> _bits;
+    std::atomic<uint64_t> _untracked;
+    // load of the last window in parts per million
+    std::atomic<uint32_t> _loadPpm;
+};
+
+template <std::size_t capacity>
+TrafficStats<capacity>::TrafficStats()
+    : _rate(BaudRate::Baud1M)
+    , _windowNs(1000000000)
+{
+    clear();
+}
+
+template <std::size_t capacity>
+inline void TrafficStats<capacity>::setBaudRate(BaudRate rate)
+{
+    _rate = rate;
+}
+
+template <std::size_t capacity>
+inline void TrafficStats<capacity>::setWindow(uint64_t windowNs)
+{
+    _windowNs = windowNs;
+}
+
+// Not safe against concurrent readers, unlike the rest of the writer side
+template <std::size_t capacity>
+void TrafficStats<capacity>::clear()
+{
+    for (std::size_t i = 0; i < tableSize; i++) {
+        _slots[i].key.store(emptySlot, std::memory_order_relaxed);
+        _slots[i].sequence.store(0, std::memory_order_relaxed);
+    }
+    _size.store(0, std::memory_order_relaxed);
+    _windowStart = 0;
+    _windowBits = 0;
+    _windowStarted = false;
+    _frames.store(0, std::memory_order_relaxed);
+    _bits.store(0, std::memory_order_relaxed);
+    _untracked.store(0, std::memory_order_relaxed);
+    _loadPpm.store(0, std::memory_order_release);
+}
+
+template <std::size_t capacity>
+inline uint32_t TrafficStats<capacity>::makeKey(uint32_t address, bool isExtended)
+{
+    return isExtended ? address | extFlag : address;
+}
+
+template <std::size_t capacity>
+inline std::size_t TrafficStats<capacity>::findSlot(uint32_t key) const
+{
+    std::size_t i = detail::hashAddress(key & ~extFlag, (key & extFlag) != 0, tableSize - 1);
+    for (;;) {
+        uint32_t slotKey = _slots[i].key.load(std::memory_order_acquire);
+        if (slotKey == emptySlot || slotKey == key) {
+            return i;
+        }
+        i = (i + 1) & (tableSize - 1);
+    }
+}
+
+template <std::size_t capacity>
+void TrafficStats<capacity>::tick(uint64_t nowNs)
+{
+    if (!_windowStarted) {
+        _windowStarted = true;
+        _windowStart = nowNs;
+        return;
+    }
+    uint64_t elapsed = nowNs - _windowStart;
+    if (nowNs < _windowStart || elapsed < _windowNs) {
+        return;
+    }
+    double busy = double(_windowBits) * 1e9 / bitsPerSecond(_rate);
+    double load = busy / double(elapsed);
+    _loadPpm.store(uint32_t((load > 1 ? 1 : load) * 1e6 + 0.5), std::memory_order_release);
+    _windowStart = nowNs;
+    _windowBits = 0;
+}
+
+template <std::size_t capacity>
+void TrafficStats<capacity>::record(uint32_t address, bool isExtended, std::size_t size, uint64_t nowNs)
+{
+    tick(nowNs);
+    uint32_t bits = frameBits(size, isExtended);
+    _windowBits += bits;
+    _frames.store(_frames.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    _bits.store(_bits.load(std::memory_order_relaxed) + bits, std::memory_order_relaxed);
+
+    uint32_t key = makeKey(address, isExtended);
+    Slot& slot = _slots[findSlot(key)];
+    if (slot.key.load(std::memory_order_relaxed) == key) {
+        update(slot, size, nowNs);
+        return;
+    }
+    std::size_t used = _size.load(std::memory_order_relaxed);
+    if (used == capacity) {
+        _untracked.store(_untracked.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+    // the slot is filled before its key is published, so readers never see it half initialized
+    slot.frames.store(1, std::memory_order_relaxed);
+    slot.bytes.store(size, std::memory_order_relaxed);
+    slot.lastNs.store(nowNs, std::memory_order_relaxed);
+    slot.minGapNs.store(UINT64_MAX, std::memory_order_relaxed);
+    slot.maxGapNs.store(0, std::memory_order_relaxed);
+    slot.gapSumNs.store(0, std::memory_order_relaxed);
+    slot.jitter16.store(0, std::memory_order_relaxed);
+    slot.lastGapNs = 0;
+    slot.key.store(key, std::memory_order_release);
+    _size.store(used + 1, std::memory_order_release);
+}
+
+template <std::size_t capacity>
+void TrafficStats<capacity>::record(const Frame* frames, std::size_t count, uint64_t nowNs)
+{
+    for (std::size_t i = 0; i < count; i++) {
+        record(frames[i].address, frames[i].isExtended, frames[i].size, nowNs);
+    }
+}
+
+template <std::size_t capacity>
+void TrafficStats<capacity>::update(Slot& slot, std::size_t size, uint64_t nowNs)
+{
+    uint64_t frames = slot.frames.load(std::memory_order_relaxed);
+    uint64_t lastNs = slot.lastNs.load(std::memory_order_relaxed);
+    uint64_t gap = nowNs > lastNs ? nowNs - lastNs : 0;
+    uint64_t jitter16 = slot.jitter16.load(std::memory_order_relaxed);
+    if (frames > 1) {
+        uint64_t deviation = gap > slot.lastGapNs ? gap - slot.lastGapNs : slot.lastGapNs - gap;
+        jitter16 = jitter16 + deviation - ((jitter16 + 8) >> 4);
+    }
+    slot.lastGapNs = gap;
+
+    uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.frames.store(frames + 1, std::memory_order_relaxed);
+    slot.bytes.store(slot.bytes.load(std::memory_order_relaxed) + size, std::memory_order_relaxed);
+    slot.lastNs.store(nowNs, std::memory_order_relaxed);
+    if (gap < slot.minGapNs.load(std::memory_order_relaxed)) {
+        slot.minGapNs.store(gap, std::memory_order_relaxed);
+    }
+    if (gap > slot.maxGapNs.load(std::memory_order_relaxed)) {
+        slot.maxGapNs.store(gap, std::memory_order_relaxed);
+    }
+    slot.gapSumNs.store(slot.gapSumNs.load(std::memory_order_relaxed) + gap, std::memory_order_relaxed);
+    slot.jitter16.store(jitter16, std::memory_order_relaxed);
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+template <std::size_t capacity>
+bool TrafficStats<capacity>::readSlot(const Slot& slot, IdStats* stats) const
+{
+    uint32_t key = slot.key.load(std::memory_order_acquire);
+    if (key == emptySlot) {
+        return false;
+    }
+    uint32_t before;
+    uint32_t after;
+    do {
+        before = slot.sequence.load(std::memory_order_acquire);
+        stats->frames = slot.frames.load(std::memory_order_relaxed);
+        stats->bytes = slot.bytes.load(std::memory_order_relaxed);
+        stats->lastNs = slot.lastNs.load(std::memory_order_relaxed);
+        stats->minGapNs = slot.minGapNs.load(std::memory_order_relaxed);
+        stats->maxGapNs = slot.maxGapNs.load(std::memory_order_relaxed);
+        stats->meanGapNs = slot.gapSumNs.load(std::memory_order_relaxed);
+        stats->jitterNs = slot.jitter16.load(std::memory_order_relaxed) >> 4;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = slot.sequence.load(std::memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+
+    stats->address = key & ~extFlag;
+    stats->isExtended = (key & extFlag) != 0;
+    if (stats->frames > 1) {
+        stats->meanGapNs /= stats->frames - 1;
+    } else {
+        stats->minGapNs = 0;
+    }
+    return true;
+}
+
+template <std::size_t capacity>
+bool TrafficStats<capacity>::find(uint32_t address, bool isExtended, IdStats* stats) const
+{
+    return readSlot(_slots[findSlot(makeKey(address, isExtended))], stats);
+}
+
+template <std::size_t capacity>
+std::size_t TrafficStats<capacity>::snapshot(IdStats* stats, std::size_t maxCount) const
+{
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < tableSize && count < maxCount; i++) {
+        if (readSlot(_slots[i], &stats[count])) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Totals are read one by one, they may be off by the frames recorded meanwhile
+template <std::size_t capacity>
+BusStats TrafficStats<capacity>::busStats() const
+{
+    BusStats stats;
+    stats.frames = _frames.load(std::memory_order_relaxed);
+    stats.bits = _bits.load(std::memory_order_relaxed);
+    stats.untracked = _untracked.load(std::memory_order_relaxed);
+    stats.load = _loadPpm.load(std::memory_order_acquire) / 1e6;
+    return stats;
+}
+
+template <std::size_t capacity>
+inline std::size_t TrafficStats<capacity>::size() const
+{
+    return _size.load(std::memory_order_acquire);
+}
+}
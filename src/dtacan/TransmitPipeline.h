@@ -0,0 +1,249 @@
+#pragma once
+
+#include "dtacan/Encoder.h"
+#include "dtacan/FixedQueue.h"
+#include "dtacan/Frame.h"
+#include "dtacan/Parser.h"
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+namespace dtacan {
+
+/// Encoder and Parser of one adapter that keeps up to windowSize frames unacknowledged instead of waiting for a
+/// reply to every frame. Replies are matched to in-flight frames in order: 'z'/'Z' acknowledges the oldest one,
+/// BELL rejects it and it is retransmitted up to maxRetries times. A receipt of the wrong type for the oldest frame
+/// means replies are out of step, every frame on the wire is reported as failed then. Frames waiting for the window
+/// are coalesced into a single handleEncodedData call.
+///
+/// Derived class gets the outcome of every submitted frame through handleTransmitted and handleTransmitFailed, it
+/// must not hide handleReceipt, handleExtReceipt and handleNack. Other commands must not be sent while frames are in
+/// flight as their BELL replies can't be told apart
+template <typename B, std::size_t windowCapacity = 32, std::size_t queueCapacity = 256>
+class TransmitPipeline : public Parser<B>, public Encoder<B> {
+public:
+    void handleTransmitted(const Frame& frame);
+    void handleTransmitFailed(const Frame& frame);
+
+    TransmitPipeline();
+
+    // Returns false if size is not in [1, windowCapacity]
+    bool setWindowSize(std::size_t size);
+    void setMaxRetries(std::size_t retries);
+
+    // Queues a frame and returns false if the frame is invalid or the queue is full. Nothing is sent until flush
+    bool submit(uint32_t address, const void* data, std::size_t size, bool isExtended);
+    // Sends retransmissions and queued frames while the window is open
+    void flush();
+    // Reports all unacknowledged frames as failed, e.g. when the adapter stopped replying
+    void abortInFlight();
+
+    // Parses replies and sends frames the window has been opened for
+    void acceptData(const void* data, std::size_t size);
+
+    std::size_t inFlight() const;
+    std::size_t pending() const;
+    // 'z' received for an ext frame or 'Z' for a std one
+    uint64_t receiptMismatches() const;
+
+    void handleReceipt();
+    void handleExtReceipt();
+    void handleNack();
+
+private:
+    struct Entry {
+        Frame frame;
+        std::size_t retries;
+    };
+
+    B& base();
+    void acknowledge(bool isExtended);
+
+    FixedQueue<Entry, windowCapacity> _inFlight;
+    FixedQueue<Entry, windowCapacity> _retries;
+    FixedQueue<Entry, queueCapacity> _queue;
+    std::size_t _windowSize;
+    std::size_t _maxRetries;
+    uint64_t _receiptMismatches;
+    TransmitFrame _batch[windowCapacity];
+    char _buffer[windowCapacity * 27];
+};
+
+template <typename B, std::size_t windowCapacity, std::size_t queueCapacity>
+inline TransmitPipeline<B, windowCapacity, queueCapacity>::TransmitPipeline()
+    : _windowSize(windowCapacity)
+    , _maxRetries(0)
+    , _receiptMismatches(0)
+{
+}
+
+template <typename B, std::size_t windowCapacity, std::size_t queueCapacity>
+inline B& TransmitPipeline<B, windowCapacity, queueCapacity>::base()
+{
+    return *static_cast<B*>(this);
+}
+
+template <typename B, std::size_t windowCapacity, std::size_t queueCapacity>
+inline void TransmitPipeline<B, windowCapacity, queueCapacity>::handleTransmitted(const Frame& frame)
+{
+    (void)frame;
+}
+
+template <typename B, std::size_t windowCapacity, std::size_t queueCapacity>
+inline void TransmitPipeline<B, windowCapacity, queueCapacity>::handleTransmitFailed(const Frame& frame)
+{
+    (void)frame;
+}
+
+template <typename B, std::size_t windowCapacity, std::size_t queueCapacity>
+inline bool TransmitPipeline<B, windowCapacity, queueCapacity>::setWindowSize(std::size_t size)
+{
+    if (size == 0 || size > windowCapacity) {
+        return false;
+    }
+    _windowSize = size;
+    return true;
+}
+
+template <typename B, std::size_t windowCapacity, std::size_t queueCapacity>
+inline void TransmitPipeline<B, windowCapacity, queueCapacity>::setMaxRetries(std::size_t retries)
+{
+    _maxRetries = retries;
+}
+
+template <typename B, std::size_t windowCapacity, std::size_t queueCapacity>
+bool TransmitPipeline<B, windowCapacity, queueCapacity>::submit(uint32_t address, const void* data,
+                                                                std::size_t size, bool isExtended)
+{
+    if (size > 8 || address > (isExtended ? 0x1fffffffu : 0x7ffu) || _queue.isFull()) {
+        return false;
+    }
+    Entry entry;
+    entry.frame.address = address;
+    entry.frame.isExtended = isExtended;
+    entry.frame.size = size;
+    std::memset(entry.frame.data, 0, sizeof(entry.frame.data));
+    if (size != 0) {
+        std::memcpy(entry.frame.data, data, size);
+    }
+    entry.retries = 0;
+    return _queue.push(entry);
+}
+
+template <typename B, std::size_t windowCapacity, std::size_t queueCapacity>
+void TransmitPipeline<B, windowCapacity, queueCapacity>::flush()
+{
+    std::size_t count = 0;
+    while (_inFlight.size() < _windowSize && (!_retries.isEmpty() || !_queue.isEmpty())) {
+        Entry& entry = _retries.isEmpty() ? _queue.front() : _retries.front();
+        _inFlight.push(entry);
+        if (_retries.isEmpty()) {
+            _queue.pop();
+        } else {
+            _retries.pop();
+        }
+        const Frame& frame = _inFlight[_inFlight.size() - 1].frame;
+        TransmitFrame& tx = _batch[count++];
+        tx.address = frame.address;
+        tx.data = frame.data;
+        tx.size = frame.size;
+        tx.isExtended = frame.isExtended;
+    }
+    if (count != 0) {
+        std::size_t encoded = Encoder<B>::transmitBatch(_batch, count, _buffer, sizeof(_buffer));
+        assert(encoded == count);
+        (void)encoded;
+    }
+}
+
+template <typename B, std::size_t windowCapacity, std::size_t queueCapacity>
+void TransmitPipeline<B, windowCapacity, queueCapacity>::abortInFlight()
+{
+    while (!_inFlight.isEmpty()) {
+        Frame frame = _inFlight.front().frame;
+        _inFlight.pop();
+        base().handleTransmitFailed(frame);
+    }
+    while (!_retries.isEmpty()) {
+        Frame frame = _retries.front().frame;
+        _retries.pop();
+        base().handleTransmitFailed(frame);
+    }
+}
+
+template <typename B, std::size_t windowCapacity, std::size_t queueCapacity>
+void TransmitPipeline<B, windowCapacity, queueCapacity>::acceptData(const void* data, std::size_t size)
+{
+    Parser<B>::acceptData(data, size);
+    flush();
+}
+
+template <typename B, std::size_t windowCapacity, std::size_t queueCapacity>
+inline std::size_t TransmitPipeline<B, windowCapacity, queueCapacity>::inFlight() const
+{
+    return _inFlight.size() + _retries.size();
+}
+
+template <typename B, std::size_t windowCapacity, std::size_t queueCapacity>
+inline std::size_t TransmitPipeline<B, windowCapacity, queueCapacity>::pending() const
+{
+    return _queue.size();
+}
+
+template <typename B, std::size_t windowCapacity, std::size_t queueCapacity>
+inline uint64_t TransmitPipeline<B, windowCapacity, queueCapacity>::receiptMismatches() const
+{
+    return _receiptMismatches;
+}
+
+template <typename B, std::size_t windowCapacity, std::size_t queueCapacity>
+void TransmitPipeline<B, windowCapacity, queueCapacity>::acknowledge(bool isExtended)
+{
+    // a reply without a frame in flight belongs to some other command
+    if (_inFlight.isEmpty()) {
+        return;
+    }
+    if (_inFlight.front().frame.isExtended != isExtended) {
+        // a reply was lost or doesn't belong to us, which frames went out can't be told anymore
+        _receiptMismatches++;
+        while (!_inFlight.isEmpty()) {
+            Frame frame = _inFlight.front().frame;
+            _inFlight.pop();
+            base().handleTransmitFailed(frame);
+        }
+        return;
+    }
+    Frame frame = _inFlight.front().frame;
+    _inFlight.pop();
+    base().handleTransmitted(frame);
+}
+
+template <typename B, std::size_t windowCapacity, std::size_t queueCapacity>
+inline void TransmitPipeline<B, windowCapacity, queueCapacity>::handleReceipt()
+{
+    acknowledge(false);
+}
+
+template <typename B, std::size_t windowCapacity, std::size_t queueCapacity>
+inline void TransmitPipeline<B, windowCapacity, queueCapacity>::handleExtReceipt()
+{
+    acknowledge(true);
+}
+
+template <typename B, std::size_t windowCapacity, std::size_t queueCapacity>
+void TransmitPipeline<B, windowCapacity, queueCapacity>::handleNack()
+{
+    if (_inFlight.isEmpty()) {
+        return;
+    }
+    Entry entry = _inFlight.front();
+    _inFlight.pop();
+    if (entry.retries < _maxRetries) {
+        entry.retries++;
+        _retries.push(entry);
+    } else {
+        base().handleTransmitFailed(entry.frame);
+    }
+}
+}
@@ -0,0 +1,303 @@
+#pragma once
+
+#include "dtacan/BaudRate.h"
+#include "dtacan/Encoder.h"
+#include "dtacan/Frame.h"
+#include "dtacan/IdFilter.h"
+
+#include <algorithm>
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+namespace dtacan {
+
+/// Encoder that holds frames back so the adapter's TX FIFO is never overrun. Every frame costs its worst case bus
+/// time at the configured BaudRate (stuff bits included), a token bucket refilled at utilization share of real time
+/// lets frames out, so the output never exceeds that share of the bus in the long run. Pending frames leave in CAN
+/// arbitration order, lowest id first and in submission order within an id, so bulk data never delays more urgent
+/// ids. Ids with a rate limit are released no more often than once per their interval.
+///
+/// Time is passed by the caller in nanoseconds of any monotonic clock
+template <typename B, std::size_t capacity = 256, std::size_t rateLimitCapacity = 64>
+class TransmitScheduler : public Encoder<B> {
+public:
+    TransmitScheduler();
+
+    // Sends the 'S' command and uses the rate for frame timing
+    void setBaudrate(BaudRate rate);
+    // Uses the rate for frame timing only, if the adapter is configured elsewhere
+    void setBusRate(BaudRate rate);
+    // Share of bus time frames are paced to, from 0 to 1
+    void setUtilization(double share);
+    // Bus time that may be sent at once after idling, at least the longest frame
+    void setBurst(uint64_t ns);
+    // Frames of the id are released at most once per intervalNs, returns false if the table is full
+    bool setRateLimit(uint32_t address, bool isExtended, uint64_t intervalNs);
+
+    // Returns false if the frame is invalid or the queue is full
+    bool schedule(uint32_t address, const void* data, std::size_t size, bool isExtended, uint64_t nowNs);
+    // Splits data longer than 8 bytes into frames like Encoder::transmitData, all of them or nothing is queued
+    bool scheduleData(uint32_t address, const void* data, std::size_t size, uint64_t nowNs);
+
+    // Encodes frames the bucket has tokens for at once, returns number of frames sent
+    std::size_t poll(uint64_t nowNs);
+    // Time when the next frame can be sent, UINT64_MAX if nothing is pending
+    uint64_t nextPollTime(uint64_t nowNs) const;
+
+    std::size_t pending() const;
+
+private:
+    static const uint64_t never = UINT64_MAX;
+    static const std::size_t maxBatch = 32;
+
+    struct Entry {
+        uint64_t key;
+        uint64_t sequence;
+        uint64_t releaseTime;
+        Frame frame;
+    };
+
+    struct RateLimit {
+        uint32_t address;
+        bool isExtended;
+        bool used;
+        bool hasRelease;
+        uint64_t intervalNs;
+        uint64_t lastRelease;
+    };
+
+    // std heap functions keep the largest element on top, so these compare in reverse
+    static bool laterInArbitration(const Entry& a, const Entry& b)
+    {
+        return a.key != b.key ? a.key > b.key : a.sequence > b.sequence;
+    }
+
+    static bool laterRelease(const Entry& a, const Entry& b)
+    {
+        return a.releaseTime > b.releaseTime;
+    }
+
+    uint64_t frameCost(const Frame& frame) const;
+    void refill(uint64_t nowNs);
+    RateLimit* findRateLimit(uint32_t address, bool isExtended);
+
+    BaudRate _rate;
+    double _utilization;
+    double _burst;
+    double _tokens;
+    uint64_t _lastRefill;
+    uint64_t _sequence;
+
+    Entry _ready[capacity];
+    std::size_t _readyNum;
+    Entry _delayed[capacity];
+    std::size_t _delayedNum;
+    RateLimit _rateLimits[detail::hashTableSize(rateLimitCapacity)];
+    std::size_t _rateLimitNum;
+
+    TransmitFrame _batch[maxBatch];
+    char _buffer[maxBatch * 27];
+};
+
+template <typename B, std::size_t capacity, std::size_t rateLimitCapacity>
+TransmitScheduler<B, capacity, rateLimitCapacity>::TransmitScheduler()
+    : _rate(BaudRate::Baud1M)
+    , _utilization(0.9)
+    , _burst(0)
+    , _tokens(0)
+    , _lastRefill(0)
+    , _sequence(0)
+    , _readyNum(0)
+    , _delayedNum(0)
+    , _rateLimitNum(0)
+{
+    std::memset(_rateLimits, 0, sizeof(_rateLimits));
+    setBusRate(_rate);
+}
+
+template <typename B, std::size_t capacity, std::size_t rateLimitCapacity>
+void TransmitScheduler<B, capacity, rateLimitCapacity>::setBaudrate(BaudRate rate)
+{
+    Encoder<B>::setBaudrate(rate);
+    setBusRate(rate);
+}
+
+// The default burst lets four of the longest frames out back to back, the bucket starts full at the new rate
+template <typename B, std::size_t capacity, std::size_t rateLimitCapacity>
+void TransmitScheduler<B, capacity, rateLimitCapacity>::setBusRate(BaudRate rate)
+{
+    _rate = rate;
+    _burst = 4.0 * frameDurationNs(rate, 8, true);
+    _tokens = _burst;
+}
+
+template <typename B, std::size_t capacity, std::size_t rateLimitCapacity>
+inline void TransmitScheduler<B, capacity, rateLimitCapacity>::setUtilization(double share)
+{
+    _utilization = share <= 0 ? 0.01 : (share > 1 ? 1 : share);
+}
+
+template <typename B, std::size_t capacity, std::size_t rateLimitCapacity>
+inline void TransmitScheduler<B, capacity, rateLimitCapacity>::setBurst(uint64_t ns)
+{
+    _burst = std::max(double(ns), double(frameDurationNs(_rate, 8, true)));
+    _tokens = std::min(_tokens, _burst);
+}
+
+template <typename B, std::size_t capacity, std::size_t rateLimitCapacity>
+typename TransmitScheduler<B, capacity, rateLimitCapacity>::RateLimit*
+TransmitScheduler<B, capacity, rateLimitCapacity>::findRateLimit(uint32_t address, bool isExtended)
+{
+    const std::size_t mask = detail::hashTableSize(rateLimitCapacity) - 1;
+    std::size_t i = detail::hashAddress(address, isExtended, mask);
+    while (_rateLimits[i].used && (_rateLimits[i].address != address || _rateLimits[i].isExtended != isExtended)) {
+        i = (i + 1) & mask;
+    }
+    return &_rateLimits[i];
+}
+
+template <typename B, std::size_t capacity, std::size_t rateLimitCapacity>
+bool TransmitScheduler<B, capacity, rateLimitCapacity>::setRateLimit(uint32_t address, bool isExtended,
+                                                                     uint64_t intervalNs)
+{
+    RateLimit* limit = findRateLimit(address, isExtended);
+    if (!limit->used) {
+        if (_rateLimitNum == rateLimitCapacity) {
+            return false;
+        }
+        _rateLimitNum++;
+        limit->used = true;
+        limit->address = address;
+        limit->isExtended = isExtended;
+        limit->hasRelease = false;
+    }
+    limit->intervalNs = intervalNs;
+    return true;
+}
+
+template <typename B, std::size_t capacity, std::size_t rateLimitCapacity>
+bool TransmitScheduler<B, capacity, rateLimitCapacity>::schedule(uint32_t address, const void* data,
+                                                                 std::size_t size, bool isExtended, uint64_t nowNs)
+{
+    if (size > 8 || address > (isExtended ? 0x1fffffffu : 0x7ffu) || pending() == capacity) {
+        return false;
+    }
+    Entry entry;
+    entry.key = arbitrationKey(address, isExtended);
+    entry.sequence = _sequence++;
+    entry.releaseTime = nowNs;
+    entry.frame.address = address;
+    entry.frame.isExtended = isExtended;
+    entry.frame.size = size;
+    std::memcpy(entry.frame.data, data, size);
+
+    if (_rateLimitNum != 0) {
+        RateLimit* limit = findRateLimit(address, isExtended);
+        if (limit->used) {
+            if (limit->hasRelease && limit->lastRelease + limit->intervalNs > nowNs) {
+                entry.releaseTime = limit->lastRelease + limit->intervalNs;
+            }
+            limit->lastRelease = entry.releaseTime;
+            limit->hasRelease = true;
+        }
+    }
+    if (entry.releaseTime > nowNs) {
+        _delayed[_delayedNum++] = entry;
+        std::push_heap(_delayed, _delayed + _delayedNum, laterRelease);
+    } else {
+        _ready[_readyNum++] = entry;
+        std::push_heap(_ready, _ready + _readyNum, laterInArbitration);
+    }
+    return true;
+}
+
+template <typename B, std::size_t capacity, std::size_t rateLimitCapacity>
+bool TransmitScheduler<B, capacity, rateLimitCapacity>::scheduleData(uint32_t address, const void* data,
+                                                                     std::size_t size, uint64_t nowNs)
+{
+    bool isExtended = address > 0x7ff;
+    std::size_t frameNum = size == 0 ? 1 : (size + 7) / 8;
+    if (address > 0x1fffffff || capacity - pending() < frameNum) {
+        return false;
+    }
+    const uint8_t* ptr = (const uint8_t*)data;
+    for (std::size_t i = 0; i < frameNum; i++) {
+        std::size_t frameSize = size - i * 8 < 8 ? size - i * 8 : 8;
+        schedule(address, ptr + i * 8, frameSize, isExtended, nowNs);
+    }
+    return true;
+}
+
+template <typename B, std::size_t capacity, std::size_t rateLimitCapacity>
+inline uint64_t TransmitScheduler<B, capacity, rateLimitCapacity>::frameCost(const Frame& frame) const
+{
+    return frameDurationNs(_rate, frame.size, frame.isExtended);
+}
+
+template <typename B, std::size_t capacity, std::size_t rateLimitCapacity>
+inline void TransmitScheduler<B, capacity, rateLimitCapacity>::refill(uint64_t nowNs)
+{
+    if (nowNs > _lastRefill) {
+        _tokens = std::min(_burst, _tokens + double(nowNs - _lastRefill) * _utilization);
+        _lastRefill = nowNs;
+    }
+}
+
+template <typename B, std::size_t capacity, std::size_t rateLimitCapacity>
+std::size_t TransmitScheduler<B, capacity, rateLimitCapacity>::poll(uint64_t nowNs)
+{
+    refill(nowNs);
+    while (_delayedNum != 0 && _delayed[0].releaseTime <= nowNs) {
+        std::pop_heap(_delayed, _delayed + _delayedNum, laterRelease);
+        _delayedNum--;
+        _ready[_readyNum++] = _delayed[_delayedNum];
+        std::push_heap(_ready, _ready + _readyNum, laterInArbitration);
+    }
+
+    // frames leave the heap in order, the batch keeps them alive until encoded
+    Frame frames[maxBatch];
+    std::size_t count = 0;
+    while (count < maxBatch && _readyNum != 0) {
+        double cost = double(frameCost(_ready[0].frame));
+        if (_tokens < cost) {
+            break;
+        }
+        _tokens -= cost;
+        std::pop_heap(_ready, _ready + _readyNum, laterInArbitration);
+        _readyNum--;
+        frames[count] = _ready[_readyNum].frame;
+        TransmitFrame& tx = _batch[count];
+        tx.address = frames[count].address;
+        tx.data = frames[count].data;
+        tx.size = frames[count].size;
+        tx.isExtended = frames[count].isExtended;
+        count++;
+    }
+    if (count != 0) {
+        Encoder<B>::transmitBatch(_batch, count, _buffer, sizeof(_buffer));
+    }
+    return count;
+}
+
+template <typename B, std::size_t capacity, std::size_t rateLimitCapacity>
+uint64_t TransmitScheduler<B, capacity, rateLimitCapacity>::nextPollTime(uint64_t nowNs) const
+{
+    uint64_t time = never;
+    if (_readyNum != 0) {
+        double missing = double(frameCost(_ready[0].frame)) - _tokens;
+        time = missing <= 0 ? _lastRefill : _lastRefill + uint64_t(missing / _utilization) + 1;
+    }
+    if (_delayedNum != 0 && _delayed[0].releaseTime < time) {
+        time = _delayed[0].releaseTime;
+    }
+    return time == never || time > nowNs ? time : nowNs;
+}
+
+template <typename B, std::size_t capacity, std::size_t rateLimitCapacity>
+inline std::size_t TransmitScheduler<B, capacity, rateLimitCapacity>::pending() const
+{
+    return _readyNum + _delayedNum;
+}
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <termios.h>
+
+namespace dtacan {
+
+struct SerialOptions {
+    // termios VMIN and VTIME. With vtime 0 the tty becomes readable only after vmin bytes arrived, so a larger vmin
+    // means fewer wakeups on busy ports but a short reply may be held back until more data comes
+    uint8_t vmin = 1;
+    uint8_t vtime = 0;
+    // termios speed like B115200, B0 keeps the current one
+    speed_t speed = B0;
+};
+
+/// Switches tty to raw non-canonical mode, so '\r' reaches the Parser as is and nothing is echoed
+inline bool configureSerialPort(int fd, const SerialOptions& options)
+{
+    termios tio;
+    if (tcgetattr(fd, &tio) != 0) {
+        return false;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = options.vmin;
+    tio.c_cc[VTIME] = options.vtime;
+    if (options.speed != B0 && cfsetspeed(&tio, options.speed) != 0) {
+        return false;
+    }
+    return tcsetattr(fd, TCSANOW, &tio) == 0;
+}
+}
@@ -0,0 +1,561 @@
+#pragma once
+
+#include "dtacan/Encoder.h"
+#include "dtacan/Parser.h"
+#include "dtacan/Tty.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifdef DTACAN_HAS_LIBURING
+#include <liburing.h>
+#endif
+
+namespace dtacan {
+
+/// Adapter on a serial port served by plain blocking read() and write() calls, one read per poll. It is the
+/// fallback of HighRatePort when liburing is unavailable and the baseline UringPort is measured against.
+///
+/// B must not hide handleEncodedData
+template <typename B, std::size_t inputSize = 4096>
+class ReadWritePort : public Parser<B>, public Encoder<B> {
+public:
+    // Port hung up or failed with errno error, it is closed already
+    void handleClosed(int error);
+
+    ReadWritePort();
+    ~ReadWritePort();
+
+    ReadWritePort(const ReadWritePort&) = delete;
+    ReadWritePort& operator=(const ReadWritePort&) = delete;
+
+    // Takes ownership of fd
+    bool attach(int fd, const SerialOptions& options);
+    void close();
+    bool isOpen() const;
+
+    // Reads once and passes data to the Parser, without wait only if data is ready. Returns false once closed
+    bool poll(bool wait);
+    // Output is written synchronously, kept for the same interface as UringPort
+    void flush();
+
+    void handleEncodedData(const char* str, std::size_t size);
+
+private:
+    B& base();
+    void fail(int error);
+
+    int _fd;
+    char _input[inputSize];
+};
+
+template <typename B, std::size_t inputSize>
+inline ReadWritePort<B, inputSize>::ReadWritePort()
+    : _fd(-1)
+{
+}
+
+template <typename B, std::size_t inputSize>
+inline ReadWritePort<B, inputSize>::~ReadWritePort()
+{
+    close();
+}
+
+template <typename B, std::size_t inputSize>
+inline B& ReadWritePort<B, inputSize>::base()
+{
+    return *static_cast<B*>(this);
+}
+
+template <typename B, std::size_t inputSize>
+inline void ReadWritePort<B, inputSize>::handleClosed(int error)
+{
+    (void)error;
+}
+
+template <typename B, std::size_t inputSize>
+bool ReadWritePort<B, inputSize>::attach(int fd, const SerialOptions& options)
+{
+    close();
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) != 0 || !configureSerialPort(fd, options)) {
+        int error = errno;
+        ::close(fd);
+        errno = error;
+        return false;
+    }
+    _fd = fd;
+    return true;
+}
+
+template <typename B, std::size_t inputSize>
+void ReadWritePort<B, inputSize>::close()
+{
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+template <typename B, std::size_t inputSize>
+inline bool ReadWritePort<B, inputSize>::isOpen() const
+{
+    return _fd >= 0;
+}
+
+template <typename B, std::size_t inputSize>
+bool ReadWritePort<B, inputSize>::poll(bool wait)
+{
+    if (_fd < 0) {
+        return false;
+    }
+    if (!wait) {
+        pollfd pfd = {_fd, POLLIN, 0};
+        if (::poll(&pfd, 1, 0) <= 0) {
+            return true;
+        }
+    }
+    ssize_t size = ::read(_fd, _input, inputSize);
+    if (size > 0) {
+        Parser<B>::acceptData(_input, size);
+    } else if (size == 0 || errno != EINTR) {
+        fail(size == 0 ? 0 : errno);
+    }
+    return _fd >= 0;
+}
+
+template <typename B, std::size_t inputSize>
+inline void ReadWritePort<B, inputSize>::flush()
+{
+}
+
+template <typename B, std::size_t inputSize>
+void ReadWritePort<B, inputSize>::handleEncodedData(const char* str, std::size_t size)
+{
+    while (_fd >= 0 && size != 0) {
+        ssize_t written = ::write(_fd, str, size);
+        if (written < 0) {
+            if (errno != EINTR) {
+                fail(errno);
+            }
+            continue;
+        }
+        str += written;
+        size -= written;
+    }
+}
+
+template <typename B, std::size_t inputSize>
+void ReadWritePort<B, inputSize>::fail(int error)
+{
+    close();
+    base().handleClosed(error);
+}
+
+#ifdef DTACAN_HAS_LIBURING
+
+/// Adapter on a serial port served by io_uring. A multishot read stays in flight and picks buffers from a ring of
+/// bufferCount provided buffers of bufferSize bytes, every completion goes to Parser::acceptData and the buffer is
+/// handed back to the kernel right away. Kernels without multishot reads get a single read with buffer selection
+/// re-armed after every completion.
+///
+/// Encoded data is collected in a registered output ring of outputCapacity bytes and submitted by flush, or at the
+/// end of poll, as fixed writes. When the pending data wraps around the end of the ring it goes as two linked
+/// writes, so they reach the tty in order. A new chain is only submitted after the previous one completed. Encoded
+/// streams that don't fit into the output ring are dropped whole and counted in droppedBytes.
+///
+/// B must not hide handleEncodedData
+template <typename B, std::size_t bufferCount = 16, std::size_t bufferSize = 4096,
+          std::size_t outputCapacity = 64 * 1024>
+class UringPort : public Parser<B>, public Encoder<B> {
+public:
+    // Port hung up or failed with errno error, it is closed already
+    void handleClosed(int error);
+    // Output ring became empty after data had been submitted
+    void handleOutputDrained();
+
+    UringPort();
+    ~UringPort();
+
+    UringPort(const UringPort&) = delete;
+    UringPort& operator=(const UringPort&) = delete;
+
+    // Takes ownership of fd
+    bool attach(int fd, const SerialOptions& options);
+    void close();
+    bool isOpen() const;
+
+    // Submits pending output and handles completions, waiting for at least one if wait is set. Returns false
+    // once the port is closed
+    bool poll(bool wait);
+    void flush();
+
+    std::size_t outputSize() const;
+    std::size_t outputFree() const;
+    std::size_t droppedBytes() const;
+
+    void handleEncodedData(const char* str, std::size_t size);
+
+private:
+    static_assert(bufferCount != 0 && (bufferCount & (bufferCount - 1)) == 0 && bufferCount <= 32768,
+                  "buffer count must be a power of two");
+    static const int bufferGroup = 0;
+    static const unsigned maxCompletions = 64;
+
+    enum Tag : uint64_t {
+        TagRead = 1,
+        TagWrite = 2,
+    };
+
+    struct Completion {
+        uint64_t tag;
+        int res;
+        unsigned flags;
+    };
+
+    B& base();
+    void armRead();
+    void prepareWrites();
+    void handleRead(int res, unsigned flags);
+    void handleWrite(int res);
+    void fail(int error);
+
+    io_uring _ring;
+    io_uring_buf_ring* _bufRing;
+    int _fd;
+    bool _readArmed;
+    bool _multishot;
+    bool _fixedWrites;
+    std::size_t _outputBegin;
+    std::size_t _outputSize;
+    unsigned _writesInFlight;
+    int _writeError;
+    std::size_t _droppedBytes;
+    char _buffers[bufferCount][bufferSize];
+    char _output[outputCapacity];
+};
+
+template <typename B, std::size_t bufferCount, std::size_t bufferSize, std::size_t outputCapacity>
+inline UringPort<B, bufferCount, bufferSize, outputCapacity>::UringPort()
+    : _bufRing(nullptr)
+    , _fd(-1)
+    , _readArmed(false)
+    , _multishot(true)
+    , _fixedWrites(false)
+    , _outputBegin(0)
+    , _outputSize(0)
+    , _writesInFlight(0)
+    , _writeError(0)
+    , _droppedBytes(0)
+{
+}
+
+template <typename B, std::size_t bufferCount, std::size_t bufferSize, std::size_t outputCapacity>
+inline UringPort<B, bufferCount, bufferSize, outputCapacity>::~UringPort()
+{
+    close();
+}
+
+template <typename B, std::size_t bufferCount, std::size_t bufferSize, std::size_t outputCapacity>
+inline B& UringPort<B, bufferCount, bufferSize, outputCapacity>::base()
+{
+    return *static_cast<B*>(this);
+}
+
+template <typename B, std::size_t bufferCount, std::size_t bufferSize, std::size_t outputCapacity>
+inline void UringPort<B, bufferCount, bufferSize, outputCapacity>::handleClosed(int error)
+{
+    (void)error;
+}
+
+template <typename B, std::size_t bufferCount, std::size_t bufferSize, std::size_t outputCapacity>
+inline void UringPort<B, bufferCount, bufferSize, outputCapacity>::handleOutputDrained()
+{
+}
+
+template <typename B, std::size_t bufferCount, std::size_t bufferSize, std::size_t outputCapacity>
+bool UringPort<B, bufferCount, bufferSize, outputCapacity>::attach(int fd, const SerialOptions& options)
+{
+    close();
+    // io_uring waits for readiness itself, a non blocking tty would only add -EAGAIN completions
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) != 0 || !configureSerialPort(fd, options)) {
+        int error = errno;
+        ::close(fd);
+        errno = error;
+        return false;
+    }
+    int ret = io_uring_queue_init(2 * maxCompletions, &_ring, 0);
+    if (ret < 0) {
+        ::close(fd);
+        errno = -ret;
+        return false;
+    }
+    _bufRing = io_uring_setup_buf_ring(&_ring, bufferCount, bufferGroup, 0, &ret);
+    if (!_bufRing) {
+        io_uring_queue_exit(&_ring);
+        ::close(fd);
+        errno = -ret;
+        return false;
+    }
+    for (std::size_t i = 0; i < bufferCount; i++) {
+        io_uring_buf_ring_add(_bufRing, _buffers[i], bufferSize, i, io_uring_buf_ring_mask(bufferCount), i);
+    }
+    io_uring_buf_ring_advance(_bufRing, bufferCount);
+
+    // pinning the output ring may exceed RLIMIT_MEMLOCK on older kernels, plain writes work as well then
+    iovec iov = {_output, outputCapacity};
+    _fixedWrites = io_uring_register_buffers(&_ring, &iov, 1) == 0;
+
+    _fd = fd;
+    _readArmed = false;
+    _multishot = true;
+    _outputBegin = 0;
+    _outputSize = 0;
+    _writesInFlight = 0;
+    _writeError = 0;
+    armRead();
+    io_uring_submit(&_ring);
+    return true;
+}
+
+// Requests still in flight are cancelled when the ring is torn down
+template <typename B, std::size_t bufferCount, std::size_t bufferSize, std::size_t outputCapacity>
+void UringPort<B, bufferCount, bufferSize, outputCapacity>::close()
+{
+    if (_fd < 0) {
+        return;
+    }
+    io_uring_free_buf_ring(&_ring, _bufRing, bufferCount, bufferGroup);
+    _bufRing = nullptr;
+    io_uring_queue_exit(&_ring);
+    ::close(_fd);
+    _fd = -1;
+}
+
+template <typename B, std::size_t bufferCount, std::size_t bufferSize, std::size_t outputCapacity>
+inline bool UringPort<B, bufferCount, bufferSize, outputCapacity>::isOpen() const
+{
+    return _fd >= 0;
+}
+
+template <typename B, std::size_t bufferCount, std::size_t bufferSize, std::size_t outputCapacity>
+inline std::size_t UringPort<B, bufferCount, bufferSize, outputCapacity>::outputSize() const
+{
+    return _outputSize;
+}
+
+template <typename B, std::size_t bufferCount, std::size_t bufferSize, std::size_t outputCapacity>
+inline std::size_t UringPort<B, bufferCount, bufferSize, outputCapacity>::outputFree() const
+{
+    return outputCapacity - _outputSize;
+}
+
+template <typename B, std::size_t bufferCount, std::size_t bufferSize, std::size_t outputCapacity>
+inline std::size_t UringPort<B, bufferCount, bufferSize, outputCapacity>::droppedBytes() const
+{
+    return _droppedBytes;
+}
+
+template <typename B, std::size_t bufferCount, std::size_t bufferSize, std::size_t outputCapacity>
+void UringPort<B, bufferCount, bufferSize, outputCapacity>::handleEncodedData(const char* str, std::size_t size)
+{
+    if (_fd < 0 || size > outputFree()) {
+        _droppedBytes += size;
+        return;
+    }
+    std::size_t end = (_outputBegin + _outputSize) % outputCapacity;
+    std::size_t first = outputCapacity - end < size ? outputCapacity - end : size;
+    std::memcpy(_output + end, str, first);
+    std::memcpy(_output, str + first, size - first);
+    _outputSize += size;
+}
+
+template <typename B, std::size_t bufferCount, std::size_t bufferSize, std::size_t outputCapacity>
+void UringPort<B, bufferCount, bufferSize, outputCapacity>::armRead()
+{
+    io_uring_sqe* sqe = io_uring_get_sqe(&_ring);
+    if (!sqe) {
+        return;
+    }
+    if (_multishot) {
+        io_uring_prep_read_multishot(sqe, _fd, 0, 0, bufferGroup);
+    } else {
+        io_uring_prep_read(sqe, _fd, nullptr, bufferSize, 0);
+        sqe->flags |= IOSQE_BUFFER_SELECT;
+        sqe->buf_group = bufferGroup;
+    }
+    io_uring_sqe_set_data64(sqe, TagRead);
+    _readArmed = true;
+}
+
+template <typename B, std::size_t bufferCount, std::size_t bufferSize, std::size_t outputCapacity>
+void UringPort<B, bufferCount, bufferSize, outputCapacity>::prepareWrites()
+{
+    if (_writesInFlight != 0 || _outputSize == 0 || io_uring_sq_space_left(&_ring) < 2) {
+        return;
+    }
+    std::size_t first = outputCapacity - _outputBegin;
+    if (first > _outputSize) {
+        first = _outputSize;
+    }
+    std::size_t parts[2][2] = {{_outputBegin, first}, {0, _outputSize - first}};
+    unsigned count = parts[1][1] == 0 ? 1 : 2;
+    for (unsigned i = 0; i < count; i++) {
+        io_uring_sqe* sqe = io_uring_get_sqe(&_ring);
+        if (_fixedWrites) {
+            io_uring_prep_write_fixed(sqe, _fd, _output + parts[i][0], parts[i][1], 0, 0);
+        } else {
+            io_uring_prep_write(sqe, _fd, _output + parts[i][0], parts[i][1], 0);
+        }
+        if (i + 1 != count) {
+            sqe->flags |= IOSQE_IO_LINK;
+        }
+        io_uring_sqe_set_data64(sqe, TagWrite);
+    }
+    _writesInFlight = count;
+    _writeError = 0;
+}
+
+template <typename B, std::size_t bufferCount, std::size_t bufferSize, std::size_t outputCapacity>
+inline void UringPort<B, bufferCount, bufferSize, outputCapacity>::flush()
+{
+    if (_fd < 0) {
+        return;
+    }
+    prepareWrites();
+    io_uring_submit(&_ring);
+}
+
+template <typename B, std::size_t bufferCount, std::size_t bufferSize, std::size_t outputCapacity>
+bool UringPort<B, bufferCount, bufferSize, outputCapacity>::poll(bool wait)
+{
+    if (_fd < 0) {
+        return false;
+    }
+    if (!_readArmed) {
+        armRead();
+    }
+    prepareWrites();
+    int ret = wait ? io_uring_submit_and_wait(&_ring, 1) : io_uring_submit(&_ring);
+    if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY) {
+        fail(-ret);
+        return false;
+    }
+
+    // completions are copied out first, handlers may close the port and tear the ring down
+    Completion completions[maxCompletions];
+    unsigned count = 0;
+    unsigned head;
+    io_uring_cqe* cqe;
+    io_uring_for_each_cqe(&_ring, head, cqe)
+    {
+        if (count == maxCompletions) {
+            break;
+        }
+        completions[count].tag = io_uring_cqe_get_data64(cqe);
+        completions[count].res = cqe->res;
+        completions[count].flags = cqe->flags;
+        count++;
+    }
+    io_uring_cq_advance(&_ring, count);
+
+    for (unsigned i = 0; i < count && _fd >= 0; i++) {
+        if (completions[i].tag == TagRead) {
+            handleRead(completions[i].res, completions[i].flags);
+        } else {
+            handleWrite(completions[i].res);
+        }
+    }
+    if (_fd < 0) {
+        return false;
+    }
+    if (!_readArmed) {
+        armRead();
+    }
+    prepareWrites();
+    io_uring_submit(&_ring);
+    return true;
+}
+
+template <typename B, std::size_t bufferCount, std::size_t bufferSize, std::size_t outputCapacity>
+void UringPort<B, bufferCount, bufferSize, outputCapacity>::handleRead(int res, unsigned flags)
+{
+    if (!(flags & IORING_CQE_F_MORE)) {
+        _readArmed = false;
+    }
+    if (res == -EINVAL && _multishot) {
+        _multishot = false;
+        return;
+    }
+    // all buffers are handed back right after parsing, running out of them only delays the next read
+    if (res == -ENOBUFS || res == -EINTR || res == -EAGAIN || res == -ECANCELED) {
+        return;
+    }
+    if (res <= 0) {
+        fail(-res);
+        return;
+    }
+    unsigned bufferId = flags >> IORING_CQE_BUFFER_SHIFT;
+    Parser<B>::acceptData(_buffers[bufferId], res);
+    if (_fd < 0) {
+        return;
+    }
+    io_uring_buf_ring_add(_bufRing, _buffers[bufferId], bufferSize, bufferId, io_uring_buf_ring_mask(bufferCount), 0);
+    io_uring_buf_ring_advance(_bufRing, 1);
+}
+
+// Writes of a chain complete in order, a short write cancels the rest of the chain and the unwritten tail is
+// submitted again with the next chain
+template <typename B, std::size_t bufferCount, std::size_t bufferSize, std::size_t outputCapacity>
+void UringPort<B, bufferCount, bufferSize, outputCapacity>::handleWrite(int res)
+{
+    _writesInFlight--;
+    if (res > 0) {
+        _outputBegin = (_outputBegin + res) % outputCapacity;
+        _outputSize -= res;
+    } else if (res < 0 && res != -ECANCELED && res != -EINTR && res != -EAGAIN) {
+        _writeError = -res;
+    }
+    if (_writesInFlight != 0) {
+        return;
+    }
+    if (_writeError != 0) {
+        fail(_writeError);
+        return;
+    }
+    if (_outputSize == 0) {
+        _outputBegin = 0;
+        base().handleOutputDrained();
+    }
+}
+
+template <typename B, std::size_t bufferCount, std::size_t bufferSize, std::size_t outputCapacity>
+void UringPort<B, bufferCount, bufferSize, outputCapacity>::fail(int error)
+{
+    close();
+    _droppedBytes += _outputSize;
+    _outputBegin = 0;
+    _outputSize = 0;
+    _writesInFlight = 0;
+    base().handleClosed(error);
+}
+
+// Port for the highest rate links, io_uring based if liburing is available
+template <typename B>
+using HighRatePort = UringPort<B>;
+
+#else
+
+template <typename B>
+using HighRatePort = ReadWritePort<B>;
+
+#endif
+}
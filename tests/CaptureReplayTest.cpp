@@ -0,0 +1,116 @@
+#include "dtacan/CaptureReplay.h"
+#include "dtacan/Parser.h"
+
+#include "DtaCanTest.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <string>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace dtacan;
+
+class RecordingParser : public Parser<RecordingParser> {
+public:
+    void handleData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        char header[16];
+        std::snprintf(header, sizeof(header), "%c%x:", isExtendedFrame() ? 'X' : 'S', address);
+        events.append(header);
+        events.append((const char*)data, size);
+        events.push_back(';');
+    }
+
+    void handleJunk(const uint8_t* junk, std::size_t size)
+    {
+        events.append("J:");
+        events.append((const char*)junk, size);
+        events.push_back(';');
+    }
+
+    void handleReceipt()
+    {
+        events.append("R;");
+    }
+
+    std::string events;
+};
+
+class TempCapture {
+public:
+    explicit TempCapture(const std::string& content)
+    {
+        char name[] = "/tmp/dtacan_replay_XXXXXX";
+        int fd = mkstemp(name);
+        path = name;
+        if (fd >= 0) {
+            EXPECT_EQ(ssize_t(content.size()), write(fd, content.data(), content.size()));
+            close(fd);
+        }
+    }
+
+    ~TempCapture()
+    {
+        unlink(path.c_str());
+    }
+
+    std::string path;
+};
+
+static std::string makeCapture(std::size_t size)
+{
+    const char* messages[] = {"t1232AABB\r", "T012345671CC\r", "z\r", "xx\r", "t7FF0\r", "T1FFFFFFF8ABCDEF0123456789\r"};
+    std::string capture;
+    for (std::size_t i = 0; capture.size() < size; i++) {
+        capture.append(messages[i % 6]);
+    }
+    return capture;
+}
+
+TEST(CaptureReplayTest, sameEventsAsOneChunk)
+{
+    std::string content = makeCapture(100000);
+    TempCapture file(content);
+
+    RecordingParser expected;
+    expected.acceptData(content.data(), content.size());
+
+    ReplayOptions options;
+    // a page, so messages are split between windows
+    options.windowSize = 1;
+    CaptureReplay capture;
+    ASSERT_TRUE(capture.open(file.path.c_str(), options));
+    EXPECT_EQ(content.size(), capture.size());
+
+    RecordingParser actual;
+    std::size_t windows = 0;
+    while (capture.replayWindow(actual)) {
+        windows++;
+    }
+    EXPECT_EQ(std::size_t((content.size() + getpagesize() - 1) / getpagesize()), windows);
+    EXPECT_EQ(content.size(), capture.offset());
+    EXPECT_EQ(expected.events, actual.events);
+
+    // pages dropped behind are read again from the file
+    capture.rewind();
+    RecordingParser again;
+    capture.replay(again);
+    EXPECT_EQ(expected.events, again.events);
+}
+
+TEST(CaptureReplayTest, emptyAndMissingFiles)
+{
+    TempCapture file("");
+    CaptureReplay capture;
+    ASSERT_TRUE(capture.open(file.path.c_str()));
+    EXPECT_EQ(0u, capture.size());
+    RecordingParser parser;
+    EXPECT_FALSE(capture.replayWindow(parser));
+    EXPECT_TRUE(parser.events.empty());
+
+    EXPECT_FALSE(capture.open("/nonexistent/capture"));
+    EXPECT_EQ(ENOENT, errno);
+    EXPECT_EQ(0u, capture.size());
+}
@@ -0,0 +1,279 @@
+#include "dtacan/CaptureReader.h"
+#include "dtacan/CaptureWriter.h"
+#include "dtacan/Parser.h"
+
+#include "DtaCanTest.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace dtacan;
+
+static std::string frameEvent(const char* kind, uint32_t address, uint64_t timestampNs, const uint8_t* data,
+                              std::size_t size)
+{
+    return kind + std::to_string(address) + "@" + std::to_string(timestampNs) + ":"
+           + std::string((const char*)data, size) + ";";
+}
+
+// Records parsed frames into a capture, timestamps come from now
+class Recorder : public Parser<Recorder>, public CaptureWriter<Recorder, 64> {
+public:
+    void handleData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        record(address, isExtendedFrame(), data, size, now);
+        events += frameEvent(isExtendedFrame() ? "X" : "S", address, now, data, size);
+    }
+
+    void handleFdData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        recordFd(address, isExtendedFrame(), isBitRateSwitch(), data, size, now);
+        events += frameEvent(isExtendedFrame() ? (isBitRateSwitch() ? "BX" : "FX") : (isBitRateSwitch() ? "BS" : "FS"),
+                             address, now, data, size);
+    }
+
+    void handleOutput(const char* data, std::size_t size)
+    {
+        capture.append(data, size);
+    }
+
+    uint64_t now = 0;
+    std::string events;
+    std::string capture;
+};
+
+class Player : public CaptureReader<Player> {
+public:
+    void handleData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        events += frameEvent(isExtendedFrame() ? "X" : "S", address, timestampNs(), data, size);
+    }
+
+    void handleFdData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        events += frameEvent(isExtendedFrame() ? (isBitRateSwitch() ? "BX" : "FX") : (isBitRateSwitch() ? "BS" : "FS"),
+                             address, timestampNs(), data, size);
+    }
+
+    void handleJunk(const uint8_t* junk, std::size_t size)
+    {
+        (void)junk;
+        junkBytes += size;
+    }
+
+    std::string events;
+    std::size_t junkBytes = 0;
+};
+
+static void recordStream(Recorder* recorder, unsigned seed, std::size_t count)
+{
+    std::string fd64 = "B1FFFFFFFF" + std::string(126, 'B') + "0D\r";
+    const char* pieces[] = {"t1111AA\r", "T0987654381234567890ABCDEF\r", "t7FF0\r", "t0018AABBCCDDEEFF0011\r",
+                            "T1FFFFFFF0\r", "t2223010203\r", "d1230\r", "b7FFA0102030405060708090A0B0C0D0E0F10\r",
+                            fd64.c_str()};
+    std::srand(seed);
+    for (std::size_t i = 0; i < count; i++) {
+        recorder->now += std::rand() % 1000;
+        const char* piece = pieces[std::rand() % (sizeof(pieces) / sizeof(pieces[0]))];
+        recorder->acceptData(piece, std::strlen(piece));
+    }
+    recorder->flush();
+}
+
+TEST(CaptureTest, roundTrip)
+{
+    Recorder recorder;
+    recorder.now = 1000000000000ull;
+    recordStream(&recorder, 1, 1000);
+    EXPECT_EQ(1000u, recorder.frames());
+    // FD payloads fill blocks before they reach 64 frames
+    EXPECT_GT(recorder.blocks(), 16u);
+    EXPECT_EQ(recorder.capture.size(), recorder.bytes());
+
+    CaptureFile file;
+    ASSERT_TRUE(file.open(recorder.capture.data(), recorder.capture.size()));
+    EXPECT_EQ(64u, file.blockCapacity());
+    EXPECT_EQ(recorder.blocks(), file.blockCount());
+    EXPECT_EQ(0u, file.truncatedSize());
+
+    Player player;
+    EXPECT_EQ(1000u, player.replay(file));
+    EXPECT_EQ(recorder.events, player.events);
+    EXPECT_EQ(recorder.blocks(), player.blocksDecoded());
+}
+
+TEST(CaptureTest, streamedInAnyChunks)
+{
+    Recorder recorder;
+    recordStream(&recorder, 2, 500);
+
+    for (std::size_t maxChunk : {1, 7, 100, 5000, 1 << 20}) {
+        Player player;
+        std::size_t offset = 0;
+        while (offset < recorder.capture.size()) {
+            std::size_t chunk = std::min(recorder.capture.size() - offset, 1 + std::rand() % maxChunk);
+            player.acceptData(recorder.capture.data() + offset, chunk);
+            offset += chunk;
+        }
+        EXPECT_EQ(recorder.events, player.events) << "max chunk " << maxChunk;
+        EXPECT_EQ(0u, player.junkBytes);
+    }
+}
+
+class StringWriter : public CaptureWriter<StringWriter> {
+public:
+    void handleOutput(const char* data, std::size_t size)
+    {
+        capture.append(data, size);
+    }
+
+    std::string capture;
+};
+
+class StringRecorder : public Parser<StringRecorder> {
+public:
+    void handleData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        writer.record(address, isExtendedFrame(), data, size, now);
+    }
+
+    StringWriter writer;
+    uint64_t now = 0;
+};
+
+TEST(CaptureTest, smallerThanSlcan)
+{
+    std::unique_ptr<StringRecorder> recorder(new StringRecorder);
+    std::string slcan;
+    for (int i = 0; i < 3 * 4096; i++) {
+        char frame[32];
+        std::snprintf(frame, sizeof(frame), "t%03X8%016llX\r", 0x100 + i % 32, (unsigned long long)i * 0x01010101);
+        slcan += frame;
+        recorder->now += 500000 + i % 7;
+        recorder->acceptData(frame, std::strlen(frame));
+    }
+    recorder->writer.flush();
+    // 8 payload bytes and about 4 bytes of timestamp, id and size against 22 chars
+    EXPECT_LT(recorder->writer.capture.size() * 10, slcan.size() * 6);
+}
+
+TEST(CaptureTest, queriesSkipBlocks)
+{
+    Recorder recorder;
+    char frame[32];
+    for (int i = 0; i < 640; i++) {
+        // ids 0x100 to 0x10F in the first half, 0x200 to 0x20F in the second, ext id 0x1234567 in block 3 only
+        std::snprintf(frame, sizeof(frame), "t%03X1%02X\r", (i < 320 ? 0x100 : 0x200) + i % 16, i & 0xff);
+        recorder.now = i * 1000;
+        recorder.acceptData(frame, std::strlen(frame));
+        if (i / 64 == 3 && i % 16 == 0) {
+            recorder.acceptData("T01234567100\r", 13);
+        }
+    }
+    recorder.flush();
+    CaptureFile file;
+    ASSERT_TRUE(file.open(recorder.capture.data(), recorder.capture.size()));
+
+    CaptureQuery byId;
+    byId.anyId = false;
+    byId.address = 0x205;
+    Player player;
+    EXPECT_EQ(20u, player.replay(file, byId));
+    EXPECT_LE(player.blocksDecoded(), 6u);
+    EXPECT_GE(player.blocksSkipped(), 5u);
+    EXPECT_EQ(0u, player.events.find("S517@325000:"));
+
+    CaptureQuery byExt;
+    byExt.anyId = false;
+    byExt.address = 0x1234567;
+    byExt.isExtended = true;
+    Player ext;
+    EXPECT_EQ(4u, ext.replay(file, byExt));
+    EXPECT_EQ(1u, ext.blocksDecoded());
+
+    CaptureQuery byTime;
+    byTime.fromNs = 100000;
+    byTime.toNs = 149000;
+    Player window;
+    EXPECT_EQ(50u, window.replay(file, byTime));
+    EXPECT_LE(window.blocksDecoded(), 2u);
+    EXPECT_EQ(0u, window.events.find("S260@100000:"));
+}
+
+TEST(CaptureTest, timestampsOfAnyOrder)
+{
+    Recorder recorder;
+    const uint64_t timestamps[] = {5, 3, ~uint64_t(0), 0, 1ull << 63, 7};
+    for (uint64_t timestamp : timestamps) {
+        recorder.now = timestamp;
+        recorder.acceptData("t1230\r", 6);
+    }
+    recorder.flush();
+    Player player;
+    player.acceptData(recorder.capture.data(), recorder.capture.size());
+    EXPECT_EQ(recorder.events, player.events);
+
+    CaptureFile file;
+    ASSERT_TRUE(file.open(recorder.capture.data(), recorder.capture.size()));
+    CaptureBlockFooter footer = file.footer(0);
+    EXPECT_EQ(0u, footer.minTimestampNs);
+    EXPECT_EQ(~uint64_t(0), footer.maxTimestampNs);
+    EXPECT_EQ(64u, footer.timeBits);
+}
+
+TEST(CaptureTest, damagedCaptures)
+{
+    Recorder recorder;
+    recordStream(&recorder, 3, 200);
+    CaptureFile file;
+    ASSERT_TRUE(file.open(recorder.capture.data(), recorder.capture.size()));
+    ASSERT_GE(file.blockCount(), 4u);
+    std::size_t last = file.blockCount() - 1;
+
+    // cut in the middle of the last block
+    std::string cut = recorder.capture.substr(0, recorder.capture.size() - 100);
+    CaptureFile truncated;
+    ASSERT_TRUE(truncated.open(cut.data(), cut.size()));
+    EXPECT_EQ(last, truncated.blockCount());
+    EXPECT_EQ(file.blockSize(last) - 100, truncated.truncatedSize());
+
+    // a damaged size column makes the second block junk, the others are still read
+    std::string damaged = recorder.capture;
+    std::size_t second = file.block(1) - recorder.capture.data();
+    CaptureBlockFooter footer = file.footer(1);
+    footer.payloadSize += 8;
+    std::memcpy(&damaged[second + file.blockSize(1) - sizeof(footer)], &footer, sizeof(footer));
+    Player player;
+    player.acceptData(damaged.data(), damaged.size());
+    EXPECT_EQ(file.blockSize(1), player.junkBytes);
+    EXPECT_EQ(last, player.blocksDecoded());
+    EXPECT_EQ(200u - file.footer(1).frameCount, player.frames());
+
+    // not a capture at all
+    CaptureFile text;
+    EXPECT_FALSE(text.open("t1230\rt1230\rt1230\r", 18));
+    EXPECT_EQ(EINVAL, errno);
+}
+
+TEST(CaptureTest, mappedFile)
+{
+    Recorder recorder;
+    recordStream(&recorder, 4, 300);
+    char name[] = "/tmp/dtacan_capture_XXXXXX";
+    int fd = mkstemp(name);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(ssize_t(recorder.capture.size()), write(fd, recorder.capture.data(), recorder.capture.size()));
+    close(fd);
+
+    CaptureFile file;
+    EXPECT_TRUE(file.open(name));
+    Player player;
+    EXPECT_EQ(300u, player.replay(file));
+    EXPECT_EQ(recorder.events, player.events);
+    unlink(name);
+}
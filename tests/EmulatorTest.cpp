@@ -0,0 +1,210 @@
+#include "dtacan/AdapterEmulator.h"
+#include "dtacan/Parser.h"
+
+#include "DtaCanTest.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace dtacan;
+
+TEST(BaudRateTest, frameBits)
+{
+    EXPECT_EQ(47u + 8u, frameBits(0, false));
+    EXPECT_EQ(47u + 64u + 24u, frameBits(8, false));
+    EXPECT_EQ(67u + 13u, frameBits(0, true));
+    EXPECT_EQ(67u + 64u + 29u, frameBits(8, true));
+    EXPECT_EQ(135000u, frameDurationNs(BaudRate::Baud1M, 8, false));
+    EXPECT_EQ(1600000u, frameDurationNs(BaudRate::Baud100k, 8, true));
+    BaudRate rate;
+    EXPECT_TRUE(baudRateFromChar('4', &rate));
+    EXPECT_EQ(BaudRate::Baud125k, rate);
+    EXPECT_FALSE(baudRateFromChar('9', &rate));
+}
+
+class TestEmulator : public AdapterEmulator<TestEmulator, 4> {
+public:
+    explicit TestEmulator(const EmulatorOptions& options = EmulatorOptions())
+        : AdapterEmulator<TestEmulator, 4>(options)
+    {
+    }
+
+    void handleOutput(const char* data, std::size_t size)
+    {
+        output.append(data, size);
+    }
+
+    void handleBusFrame(const Frame& frame, bool fromHost, uint64_t timeNs)
+    {
+        if (fromHost) {
+            bus += std::to_string(frame.address) + "@" + std::to_string(timeNs) + ";";
+        }
+    }
+
+    void send(const char* str)
+    {
+        acceptData(str, std::strlen(str));
+    }
+
+    std::string output;
+    std::string bus;
+};
+
+TEST(EmulatorTest, commands)
+{
+    TestEmulator emulator;
+    emulator.send("t1230\rS4\rO\rS5\rO\rC\rC\rX\r");
+    emulator.advance(0);
+    EXPECT_EQ("\a\r\r\a\a\r\a\a", emulator.output);
+    EXPECT_EQ(BaudRate::Baud125k, emulator.baudRate());
+    EXPECT_FALSE(emulator.isOpen());
+    EXPECT_EQ(5u, emulator.stats().nacks);
+}
+
+TEST(EmulatorTest, transmitReplies)
+{
+    TestEmulator emulator;
+    emulator.send("O\rt1231AA\rT123456780\rt12\rt1239AA\rt80000\r");
+    emulator.advance(0);
+    EXPECT_EQ("\rz\rZ\r\a\a\a", emulator.output);
+}
+
+TEST(EmulatorTest, replyLatency)
+{
+    EmulatorOptions options;
+    options.replyLatencyNs = 1000;
+    TestEmulator emulator(options);
+    emulator.send("O\r");
+    EXPECT_EQ(1000u, emulator.nextEventTime());
+    emulator.advance(500);
+    emulator.send("t1230\r");
+    EXPECT_EQ("", emulator.output);
+    emulator.advance(1000);
+    EXPECT_EQ("\r", emulator.output);
+    emulator.advance(1500);
+    EXPECT_EQ("\rz\r", emulator.output);
+}
+
+TEST(EmulatorTest, droppedReplies)
+{
+    EmulatorOptions options;
+    options.replyLatencyNs = 1000;
+    TestEmulator emulator(options);
+    emulator.send("O\r");
+    for (int i = 0; i < 300; i++) {
+        emulator.send("X\r");
+    }
+    EXPECT_EQ(300u, emulator.stats().nacks);
+    EXPECT_EQ(45u, emulator.stats().droppedReplies);
+    emulator.advance(1000);
+    EXPECT_EQ("\r" + std::string(255, '\a'), emulator.output);
+
+    // the queue takes replies again once drained
+    emulator.send("X\r");
+    emulator.advance(2000);
+    EXPECT_EQ(257u, emulator.output.size());
+    EXPECT_EQ(45u, emulator.stats().droppedReplies);
+}
+
+TEST(EmulatorTest, busTiming)
+{
+    TestEmulator emulator;
+    emulator.send("O\rt1008AABBCCDDEEFF0011\rt0018AABBCCDDEEFF0011\r");
+    emulator.advance(1000000);
+    // the first frame takes the idle bus, the lower id wins when the bus frees up
+    EXPECT_EQ("256@135000;1@270000;", emulator.bus);
+    EXPECT_EQ(2u, emulator.stats().hostFrames);
+    EXPECT_EQ(270000u, emulator.stats().busyNs);
+
+    // the tx queue holds 4 frames, closing the channel drops queued frames but not the one on the bus
+    emulator.send("t0010\rt0020\rt0030\rt0040\rt0050\r");
+    emulator.advance(1000000);
+    EXPECT_EQ("\rz\rz\r" "z\rz\rz\rz\r\a", emulator.output);
+    emulator.send("C\rS0\rO\rt0050\r");
+    emulator.advance(10000000);
+    EXPECT_EQ("256@135000;1@270000;1@1055000;5@6555000;", emulator.bus);
+}
+
+class CountingParser : public Parser<CountingParser> {
+public:
+    void handleData(uint32_t, const uint8_t*, std::size_t)
+    {
+        frames++;
+    }
+
+    void handleJunk(const uint8_t*, std::size_t)
+    {
+        junk++;
+    }
+
+    void handleReceipt()
+    {
+        receipts++;
+    }
+    std::size_t frames = 0;
+    std::size_t junk = 0;
+    std::size_t receipts = 0;
+};
+
+class TrafficEmulator : public AdapterEmulator<TrafficEmulator> {
+public:
+    explicit TrafficEmulator(const EmulatorOptions& options)
+        : AdapterEmulator<TrafficEmulator>(options)
+    {
+    }
+
+    void handleOutput(const char* data, std::size_t size)
+    {
+        parser.acceptData(data, size);
+    }
+
+    CountingParser parser;
+};
+
+TEST(EmulatorTest, generatedTraffic)
+{
+    EmulatorOptions options;
+    options.busLoad = 0.4;
+    options.junkPermille = 50;
+    options.baudRate = BaudRate::Baud500k;
+    TrafficEmulator emulator(options);
+    emulator.acceptData("O\r", 2);
+    const uint64_t second = 1000000000;
+    emulator.advance(second);
+
+    const EmulatorStats& stats = emulator.stats();
+    double load = double(stats.busyNs) / second;
+    EXPECT_NEAR(0.4, load, 0.02);
+    EXPECT_EQ(stats.generatedFrames - stats.junkFrames, emulator.parser.frames);
+    EXPECT_EQ(stats.junkFrames, emulator.parser.junk);
+    EXPECT_NEAR(50.0, 1000.0 * stats.junkFrames / stats.generatedFrames, 10);
+
+    emulator.acceptData("C\r", 2);
+    uint64_t generated = stats.generatedFrames;
+    emulator.advance(2 * second);
+    EXPECT_LE(stats.generatedFrames, generated + 1);
+}
+
+TEST(EmulatorTest, outputParsesWithoutJunk)
+{
+    EmulatorOptions options;
+    options.busLoad = 0.5;
+    options.replyLatencyNs = 20000;
+    TrafficEmulator emulator(options);
+    emulator.acceptData("O\r", 2);
+    // host frames interleave their receipts with the generated traffic
+    for (uint64_t now = 0; now < 100000000; now += 1000000) {
+        emulator.acceptData("t1232AABB\rT123456780\r", 21);
+        emulator.advance(now);
+    }
+    emulator.advance(200000000);
+
+    const EmulatorStats& stats = emulator.stats();
+    EXPECT_GT(stats.generatedFrames, 100u);
+    EXPECT_EQ(200u, stats.hostFrames);
+    EXPECT_EQ(0u, stats.nacks);
+    EXPECT_EQ(stats.generatedFrames, emulator.parser.frames);
+    EXPECT_EQ(0u, emulator.parser.junk);
+    EXPECT_EQ(stats.hostFrames, emulator.parser.receipts);
+}
@@ -191,3 +191,89 @@ TEST_F(EncoderTest, close)
     _encoder.closeCanChannel();
     expectData("C\r");
 }
+
+TEST_F(EncoderTest, batch)
+{
+    uint8_t data1[] = {0xaa, 0xbb};
+    uint8_t data2[] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88};
+    TransmitFrame frames[] = {
+        {0x123, data1, sizeof(data1), false},
+        {0x10203040, data2, sizeof(data2), true},
+        {0x7ff, nullptr, 0, false},
+    };
+    EXPECT_EQ(3u, _encoder.transmitBatch(frames, 3));
+    expectData("t1232AABB\rT1020304081122334455667788\rt7FF0\r");
+}
+
+TEST_F(EncoderTest, batchStopsAtInvalidFrame)
+{
+    uint8_t data[] = {0xaa};
+    TransmitFrame frames[] = {
+        {0x001, data, sizeof(data), false},
+        {0x800, data, sizeof(data), false},
+        {0x002, data, sizeof(data), false},
+    };
+    EXPECT_EQ(1u, _encoder.transmitBatch(frames, 3));
+    expectData("t0011AA\r");
+}
+
+TEST_F(EncoderTest, batchCallerBufferTooSmall)
+{
+    uint8_t data[] = {0xaa, 0xbb};
+    TransmitFrame frames[] = {
+        {0x001, data, sizeof(data), false},
+        {0x002, data, sizeof(data), false},
+        {0x003, data, sizeof(data), false},
+    };
+    char buffer[25];
+    EXPECT_EQ(2u, _encoder.transmitBatch(frames, 3, buffer, sizeof(buffer)));
+    expectData("t0012AABB\rt0022AABB\r");
+    clear();
+    EXPECT_EQ(0u, _encoder.transmitBatch(frames, 3, buffer, 9));
+    expectData("");
+}
+
+TEST_F(EncoderTest, fdBaudRate)
+{
+    _encoder.setFdBaudrate(FdBaudRate::Fd2M);
+    _encoder.setFdBaudrate(FdBaudRate::Fd8M);
+    expectData("Y2\rY8\r");
+}
+
+TEST_F(EncoderTest, fdFrames)
+{
+    uint8_t data[64];
+    for (int i = 0; i < 64; i++) {
+        data[i] = i;
+    }
+    EXPECT_TRUE(_encoder.transmitFdFrame(0x123, data, 2, false, false));
+    EXPECT_TRUE(_encoder.transmitFdFrame(0x12345678, data, 0, true, true));
+    // 10 bytes are padded to 12
+    EXPECT_TRUE(_encoder.transmitFdFrame(0x7ff, data, 10, false, true));
+    EXPECT_FALSE(_encoder.transmitFdFrame(0x800, data, 1, false, false));
+    EXPECT_FALSE(_encoder.transmitFdFrame(0x1, data, 65, true, false));
+    expectData("d12320001\rB123456780\rb7FF900010203040506070809" "0000\r");
+
+    clear();
+    EXPECT_TRUE(_encoder.transmitFdFrame(0x1, data, 64, true, false));
+    std::string expected = "D00000001F";
+    for (int i = 0; i < 64; i++) {
+        expected += "0123456789ABCDEF"[i >> 4];
+        expected += "0123456789ABCDEF"[i & 15];
+    }
+    expectData((expected + "\r").c_str());
+}
+
+TEST_F(EncoderTest, fdData)
+{
+    uint8_t data[150] = {};
+    data[149] = 0xff;
+    EXPECT_TRUE(_encoder.transmitFdData(0x10, data, 150, true));
+    // 64 + 64 + 22 padded to 24
+    std::string zeros(128, '0');
+    expectData(("b010F" + zeros + "\rb010F" + zeros + "\rb010C" + std::string(42, '0') + "FF0000\r").c_str());
+    clear();
+    EXPECT_TRUE(_encoder.transmitFdData(0x10, data, 3, false));
+    expectData("d0103000000\r");
+    EXPECT_FALSE(_encoder.transmitFdData(0x20000000, data, 3, false));
+}
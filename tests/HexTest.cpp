@@ -0,0 +1,134 @@
+#include "dtacan/Hex.h"
+
+#include "DtaCanTest.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace dtacan;
+
+class HexTest : public ::testing::Test {
+protected:
+    std::vector<SimdLevel> levels()
+    {
+        std::vector<SimdLevel> levels;
+        for (SimdLevel l : {SimdLevel::Scalar, SimdLevel::Sse2, SimdLevel::Ssse3, SimdLevel::Avx2}) {
+            if (l <= simdLevel()) {
+                levels.push_back(l);
+            }
+        }
+        return levels;
+    }
+
+    std::string randomHex(std::size_t size)
+    {
+        std::string hex;
+        for (std::size_t i = 0; i < size; i++) {
+            hex.push_back("0123456789ABCDEF"[std::rand() % 16]);
+        }
+        return hex;
+    }
+};
+
+TEST_F(HexTest, charToNibble)
+{
+    for (unsigned c = 0; c < 256; c++) {
+        uint8_t expected = 0xff;
+        if (c >= '0' && c <= '9') {
+            expected = c - '0';
+        } else if (c >= 'A' && c <= 'F') {
+            expected = c - 'A' + 10;
+        }
+        EXPECT_EQ(expected, charToNibble((char)c));
+    }
+}
+
+TEST_F(HexTest, decodeStream)
+{
+    const char* hex = "00112233445566778899AABBCCDDEEFF0123456789ABCDEFFEDCBA9876543210";
+    uint8_t expected[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa,
+                          0xbb, 0xcc, 0xdd, 0xee, 0xff, 0x01, 0x23, 0x45, 0x67, 0x89, 0xab,
+                          0xcd, 0xef, 0xfe, 0xdc, 0xba, 0x98, 0x76, 0x54, 0x32, 0x10};
+    for (SimdLevel level : levels()) {
+        for (std::size_t size = 0; size <= sizeof(expected); size++) {
+            uint8_t actual[sizeof(expected)];
+            ASSERT_TRUE(hexDecoder(level)(hex, actual, size));
+            EXPECT_EQ_MEM(expected, actual, size);
+        }
+    }
+}
+
+TEST_F(HexTest, decodeStreamRejectsBadCharAtEveryPosition)
+{
+    const char bad[] = {'a', 'G', '\r', '/', ':', '@', 'z', '\0', (char)0xb0};
+    for (SimdLevel level : levels()) {
+        for (std::size_t size = 1; size <= 40; size++) {
+            for (std::size_t pos = 0; pos < size * 2; pos++) {
+                std::string hex = randomHex(size * 2);
+                hex[pos] = bad[pos % sizeof(bad)];
+                uint8_t dest[40];
+                EXPECT_FALSE(hexDecoder(level)(hex.data(), dest, size)) << hex;
+            }
+        }
+    }
+}
+
+TEST_F(HexTest, decodeFrameFields)
+{
+    for (std::size_t addrSize : {3, 8}) {
+        for (std::size_t dataSize = 0; dataSize <= 8; dataSize++) {
+            std::string fields = randomHex(addrSize) + "012345678"[dataSize] + randomHex(dataSize * 2);
+            uint32_t expectedAddress = std::strtoul(fields.substr(0, addrSize).c_str(), nullptr, 16);
+            uint8_t expectedData[16];
+            ASSERT_TRUE(decodeHexStream(fields.data() + addrSize + 1, expectedData, dataSize));
+
+            // with and without room to read past the fields
+            for (std::size_t available : {fields.size(), fields.size() + 16}) {
+                std::string buffer = fields + std::string(16, 'x');
+                uint32_t address;
+                uint8_t data[16];
+                ASSERT_TRUE(decodeFrameFields(buffer.data(), available, addrSize, dataSize, &address, data));
+                EXPECT_EQ(expectedAddress, address);
+                EXPECT_EQ_MEM(expectedData, data, dataSize);
+
+                for (std::size_t pos = 0; pos < fields.size(); pos++) {
+                    std::string broken = buffer;
+                    broken[pos] = 'x';
+                    EXPECT_FALSE(decodeFrameFields(broken.data(), available, addrSize, dataSize, &address, data))
+                        << broken;
+                }
+            }
+        }
+    }
+}
+
+TEST_F(HexTest, encodeStream)
+{
+    uint8_t data[40];
+    for (std::size_t i = 0; i < sizeof(data); i++) {
+        data[i] = std::rand();
+    }
+    for (SimdLevel level : levels()) {
+        for (std::size_t size = 0; size <= sizeof(data); size++) {
+            std::string expected(size * 2 + 1, '|');
+            std::string actual(size * 2 + 1, '|');
+            detail::encodeHexStreamScalar(data, &expected[0], size);
+            hexEncoder(level)(data, &actual[0], size);
+            EXPECT_EQ(expected, actual);
+            uint8_t decoded[sizeof(data)];
+            ASSERT_TRUE(decodeHexStream(actual.data(), decoded, size));
+            EXPECT_EQ_MEM(data, decoded, size);
+        }
+    }
+}
+
+TEST_F(HexTest, encodeAllBytes)
+{
+    for (unsigned b = 0; b < 256; b++) {
+        char hex[2];
+        encodeHexByte(b, hex);
+        EXPECT_EQ("0123456789ABCDEF"[b >> 4], hex[0]);
+        EXPECT_EQ("0123456789ABCDEF"[b & 0xf], hex[1]);
+    }
+}
@@ -0,0 +1,164 @@
+#include "dtacan/IdFilter.h"
+#include "dtacan/Parser.h"
+
+#include "DtaCanTest.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace dtacan;
+
+TEST(IdFilterTest, rejectsEverythingByDefault)
+{
+    IdFilter<> filter;
+    EXPECT_FALSE(filter.accepts(0x000, false));
+    EXPECT_FALSE(filter.accepts(0x7ff, false));
+    EXPECT_FALSE(filter.accepts(0x00000000, true));
+    EXPECT_FALSE(filter.accepts(0x1fffffff, true));
+}
+
+TEST(IdFilterTest, std)
+{
+    IdFilter<> filter;
+    EXPECT_TRUE(filter.addStd(0x123));
+    EXPECT_TRUE(filter.addStdRange(0x700, 0x7ff));
+    EXPECT_FALSE(filter.addStd(0x800));
+    EXPECT_FALSE(filter.addStdRange(0x10, 0x800));
+    EXPECT_TRUE(filter.accepts(0x123, false));
+    EXPECT_FALSE(filter.accepts(0x122, false));
+    EXPECT_FALSE(filter.accepts(0x123, true));
+    for (uint32_t address = 0x700; address <= 0x7ff; address++) {
+        EXPECT_TRUE(filter.accepts(address, false));
+    }
+    EXPECT_FALSE(filter.accepts(0x6ff, false));
+}
+
+TEST(IdFilterTest, extSet)
+{
+    IdFilter<16, 1> filter;
+    for (uint32_t i = 0; i < 16; i++) {
+        EXPECT_TRUE(filter.addExt(0x18da0000 + i * 0x100));
+    }
+    EXPECT_TRUE(filter.addExt(0x18da0000));
+    EXPECT_FALSE(filter.addExt(0x1));
+    EXPECT_FALSE(filter.addExt(0x20000000));
+    for (uint32_t i = 0; i < 16; i++) {
+        EXPECT_TRUE(filter.accepts(0x18da0000 + i * 0x100, true));
+        EXPECT_FALSE(filter.accepts(0x18da0001 + i * 0x100, true));
+    }
+    EXPECT_FALSE(filter.accepts(0x000, false));
+}
+
+TEST(IdFilterTest, extMask)
+{
+    IdFilter<4, 1> filter;
+    EXPECT_TRUE(filter.addExtMask(0x18daf100, 0x1fffff00));
+    EXPECT_FALSE(filter.addExtMask(0, 0));
+    EXPECT_TRUE(filter.accepts(0x18daf100, true));
+    EXPECT_TRUE(filter.accepts(0x18daf1ff, true));
+    EXPECT_FALSE(filter.accepts(0x18daf200, true));
+}
+
+struct Call {
+    int handler;
+    uint32_t address;
+    std::size_t size;
+};
+
+static std::vector<Call> calls;
+
+template <int n>
+static void recordCall(void* context, uint32_t address, const uint8_t*, std::size_t size)
+{
+    EXPECT_EQ(&calls, context);
+    Call call = {n, address, size};
+    calls.push_back(call);
+}
+
+TEST(IdDispatcherTest, dispatch)
+{
+    calls.clear();
+    IdDispatcher<2> dispatcher;
+    EXPECT_TRUE(dispatcher.setHandler(0x123, false, recordCall<1>, &calls));
+    EXPECT_TRUE(dispatcher.setHandler(0x123, true, recordCall<2>, &calls));
+    EXPECT_TRUE(dispatcher.setHandler(0x123, true, recordCall<3>, &calls));
+    EXPECT_FALSE(dispatcher.setHandler(0x124, false, recordCall<1>, &calls));
+    EXPECT_FALSE(dispatcher.setHandler(0x800, false, recordCall<1>, &calls));
+
+    uint8_t data[] = {1, 2};
+    EXPECT_TRUE(dispatcher.dispatch(0x123, false, data, 2));
+    EXPECT_TRUE(dispatcher.dispatch(0x123, true, data, 1));
+    EXPECT_FALSE(dispatcher.dispatch(0x124, false, data, 1));
+    EXPECT_FALSE(dispatcher.dispatch(0x124, true, data, 1));
+    ASSERT_EQ(2u, calls.size());
+    EXPECT_EQ(1, calls[0].handler);
+    EXPECT_EQ(2u, calls[0].size);
+    EXPECT_EQ(3, calls[1].handler);
+    EXPECT_EQ(0x123u, calls[1].address);
+}
+
+class FilteringParser : public Parser<FilteringParser> {
+public:
+    static const bool filterAddresses = true;
+
+    FilteringParser()
+    {
+        filter.addStd(0x111);
+        filter.addExt(0x111);
+    }
+
+    bool acceptAddress(uint32_t address, bool isExtended)
+    {
+        asked++;
+        return filter.accepts(address, isExtended);
+    }
+
+    void handleData(uint32_t address, const uint8_t*, std::size_t size)
+    {
+        frames.push_back(std::to_string(address) + (isExtendedFrame() ? "x" : "") + "/" + std::to_string(size));
+    }
+
+    void handleJunk(const uint8_t* data, std::size_t size)
+    {
+        junk.append((const char*)data, size);
+    }
+
+    IdFilter<> filter;
+    std::vector<std::string> frames;
+    std::string junk;
+    std::size_t asked = 0;
+};
+
+TEST(FilteringParserTest, dropsRejectedFrames)
+{
+    const char* stream = "t1111AA\rt1121AA\rT000001111BB\rT000001121BB\rt8FF0\rt1111AA\r";
+    for (std::size_t chunk : {std::strlen(stream), std::size_t(1)}) {
+        FilteringParser parser;
+        for (std::size_t offset = 0; offset < std::strlen(stream); offset += chunk) {
+            parser.acceptData(stream + offset, std::min(chunk, std::strlen(stream) - offset));
+        }
+        ASSERT_EQ(3u, parser.frames.size());
+        EXPECT_EQ("273/1", parser.frames[0]);
+        EXPECT_EQ("273x/1", parser.frames[1]);
+        EXPECT_EQ("273/1", parser.frames[2]);
+        EXPECT_EQ(5u, parser.asked);
+        EXPECT_EQ("t8FF0", parser.junk);
+    }
+}
+
+TEST(FilteringParserTest, rejectedPayloadIsValidated)
+{
+    const char* stream = "t1121XX\rt1111XX\rd1121XX\rB00000112100\rt1121AA\rt1111AA\r";
+    for (std::size_t chunk : {std::strlen(stream), std::size_t(1)}) {
+        FilteringParser parser;
+        for (std::size_t offset = 0; offset < std::strlen(stream); offset += chunk) {
+            parser.acceptData(stream + offset, std::min(chunk, std::strlen(stream) - offset));
+        }
+        ASSERT_EQ(1u, parser.frames.size());
+        EXPECT_EQ("273/1", parser.frames[0]);
+        EXPECT_EQ(3u, parser.asked);
+        EXPECT_EQ("t1121XXt1111XXd1121XX", parser.junk);
+    }
+}
@@ -0,0 +1,327 @@
+#include "dtacan/IsoTp.h"
+#include "dtacan/Parser.h"
+
+#include "DtaCanTest.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace dtacan;
+
+static const IsoTpAddress tester = {0x7e0, 0x7e8, false};
+static const IsoTpAddress ecu = {0x7e8, 0x7e0, false};
+
+template <std::size_t poolSize>
+class Node : public IsoTp<Node<poolSize>, 8, poolSize> {
+public:
+    void handleEncodedData(const char* str, std::size_t size)
+    {
+        wire.append(str, size);
+        writes++;
+    }
+
+    void handleMessage(const IsoTpAddress& address, const uint8_t* data, std::size_t size)
+    {
+        messages.push_back(std::to_string(address.rxAddress) + ":" + std::string((const char*)data, size));
+    }
+
+    void handleSent(const IsoTpAddress& address, IsoTpResult result)
+    {
+        sent.push_back(std::to_string(address.txAddress) + ":" + std::to_string(int(result)));
+    }
+
+    void handleReceiveError(const IsoTpAddress& address, IsoTpResult result)
+    {
+        errors.push_back(std::to_string(address.rxAddress) + ":" + std::to_string(int(result)));
+    }
+
+    std::string wire;
+    std::size_t writes = 0;
+    std::vector<std::string> messages;
+    std::vector<std::string> sent;
+    std::vector<std::string> errors;
+};
+
+typedef Node<16384> TestNode;
+typedef Node<256> SmallNode;
+
+static std::string result(uint32_t address, IsoTpResult result)
+{
+    return std::to_string(address) + ":" + std::to_string(int(result));
+}
+
+// Moves frames written by one node into another one through a Parser
+template <typename N>
+class Link : public Parser<Link<N>> {
+public:
+    explicit Link(N* target)
+        : target(target)
+    {
+    }
+
+    void handleData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        frames++;
+        EXPECT_TRUE(target->acceptFrame(address, this->isExtendedFrame(), data, size, now));
+    }
+
+    std::size_t deliver(std::string* wire)
+    {
+        std::size_t before = frames;
+        std::string data;
+        data.swap(*wire);
+        this->acceptData(data.data(), data.size());
+        return frames - before;
+    }
+
+    N* target;
+    uint64_t now = 0;
+    std::size_t frames = 0;
+};
+
+template <typename A, typename B>
+static void exchange(A* a, B* b, uint64_t now = 0)
+{
+    Link<B> toB(b);
+    Link<A> toA(a);
+    toB.now = now;
+    toA.now = now;
+    while (!a->wire.empty() || !b->wire.empty()) {
+        toB.deliver(&a->wire);
+        toA.deliver(&b->wire);
+    }
+}
+
+static std::string pattern(std::size_t size)
+{
+    std::string data(size, '\0');
+    for (std::size_t i = 0; i < size; i++) {
+        data[i] = char(i * 7 + i / 251);
+    }
+    return data;
+}
+
+TEST(IsoTpTest, singleFrame)
+{
+    TestNode a;
+    TestNode b;
+    ASSERT_TRUE(a.openSession(tester));
+    ASSERT_TRUE(b.openSession(ecu));
+    EXPECT_TRUE(a.send(tester, "\x01\x02\x03\x04\x05", 5, 0));
+    EXPECT_EQ("t7E0805" "0102030405" "CCCC\r", a.wire);
+    EXPECT_EQ(std::vector<std::string>{result(0x7e0, IsoTpResult::Ok)}, a.sent);
+    exchange(&a, &b);
+    EXPECT_EQ(std::vector<std::string>{"2016:\x01\x02\x03\x04\x05"}, b.messages);
+
+    a.setPadding(false);
+    EXPECT_TRUE(a.send(tester, "\x10", 1, 0));
+    EXPECT_EQ("t7E0201" "10\r", a.wire);
+    EXPECT_FALSE(a.send(tester, "", 0, 0));
+    EXPECT_FALSE(a.send(ecu, "\x01", 1, 0));
+}
+
+TEST(IsoTpTest, multiFrameWithBlockSize)
+{
+    TestNode a;
+    TestNode b;
+    a.openSession(tester);
+    b.openSession(ecu);
+    b.setFlowControl(4, 0);
+    std::string message = pattern(100);
+    EXPECT_TRUE(a.send(tester, message.data(), message.size(), 0));
+    EXPECT_EQ(0u, a.wire.find("t7E081064"));
+    EXPECT_FALSE(a.send(tester, message.data(), message.size(), 0));
+    EXPECT_TRUE(a.sent.empty());
+
+    exchange(&a, &b);
+    ASSERT_EQ(1u, b.messages.size());
+    EXPECT_EQ("2016:" + message, b.messages[0]);
+    EXPECT_EQ(std::vector<std::string>{result(0x7e0, IsoTpResult::Ok)}, a.sent);
+    // 14 consecutive frames need a flow control after the first frame and after every 4 of them
+    EXPECT_EQ(4u, b.writes);
+    EXPECT_EQ(0u, b.poolUsed());
+    EXPECT_EQ(UINT64_MAX, a.nextPollTime(0));
+    EXPECT_EQ(UINT64_MAX, b.nextPollTime(0));
+}
+
+TEST(IsoTpTest, consecutiveFramesInBatches)
+{
+    TestNode a;
+    TestNode b;
+    a.openSession(tester);
+    b.openSession(ecu);
+    std::string message = pattern(4095);
+    a.send(tester, message.data(), message.size(), 0);
+    Link<TestNode> toB(&b);
+    Link<TestNode> toA(&a);
+    EXPECT_EQ(1u, toB.deliver(&a.wire));
+    EXPECT_EQ("t7E88300000CCCCCCCCCC\r", b.wire);
+    std::size_t writes = a.writes;
+    EXPECT_EQ(1u, toA.deliver(&b.wire));
+    // 585 consecutive frames without a block size leave at once, 32 frames per write
+    EXPECT_EQ(writes + 19, a.writes);
+    EXPECT_EQ(585u, toB.deliver(&a.wire));
+    ASSERT_EQ(1u, b.messages.size());
+    EXPECT_EQ("2016:" + message, b.messages[0]);
+}
+
+TEST(IsoTpTest, escapedLength)
+{
+    TestNode a;
+    TestNode b;
+    a.openSession(tester);
+    b.openSession(ecu);
+    std::string message = pattern(10000);
+    a.send(tester, message.data(), message.size(), 0);
+    EXPECT_EQ(0u, a.wire.find("t7E0810000000271000"));
+    exchange(&a, &b);
+    ASSERT_EQ(1u, b.messages.size());
+    EXPECT_EQ("2016:" + message, b.messages[0]);
+    EXPECT_EQ(0u, b.poolUsed());
+}
+
+TEST(IsoTpTest, separationTime)
+{
+    TestNode a;
+    TestNode b;
+    a.openSession(tester);
+    b.openSession(ecu);
+    b.setFlowControl(0, 10);
+    std::string message = pattern(20);
+    a.send(tester, message.data(), message.size(), 0);
+    Link<TestNode> toB(&b);
+    Link<TestNode> toA(&a);
+    toB.deliver(&a.wire);
+    toA.now = 1000;
+    toA.deliver(&b.wire);
+    // first of 2 consecutive frames goes out on the flow control, the next one 10 ms later
+    EXPECT_EQ(1u, toB.deliver(&a.wire));
+    EXPECT_EQ(10001000u, a.nextPollTime(1000));
+    EXPECT_EQ(0u, a.poll(10000999));
+    EXPECT_EQ(1u, a.poll(10001000));
+    toB.deliver(&a.wire);
+    ASSERT_EQ(1u, b.messages.size());
+    EXPECT_EQ("2016:" + message, b.messages[0]);
+    EXPECT_EQ(std::vector<std::string>{result(0x7e0, IsoTpResult::Ok)}, a.sent);
+
+    EXPECT_EQ(100000u, isoTpSeparationTimeNs(0xf1));
+    EXPECT_EQ(900000u, isoTpSeparationTimeNs(0xf9));
+    EXPECT_EQ(127000000u, isoTpSeparationTimeNs(0x80));
+}
+
+TEST(IsoTpTest, poolOverflow)
+{
+    TestNode a;
+    SmallNode b;
+    a.openSession(tester);
+    b.openSession(ecu);
+    std::string message = pattern(1000);
+    a.send(tester, message.data(), message.size(), 0);
+    exchange(&a, &b);
+    EXPECT_TRUE(b.messages.empty());
+    EXPECT_EQ(std::vector<std::string>{result(0x7e0, IsoTpResult::BufferOverflow)}, b.errors);
+    EXPECT_EQ(std::vector<std::string>{result(0x7e0, IsoTpResult::Overflow)}, a.sent);
+
+    // messages that fit still arrive
+    message = pattern(256);
+    a.send(tester, message.data(), message.size(), 0);
+    exchange(&a, &b);
+    ASSERT_EQ(1u, b.messages.size());
+    EXPECT_EQ(0u, b.poolUsed());
+}
+
+TEST(IsoTpTest, timeouts)
+{
+    TestNode a;
+    TestNode b;
+    a.openSession(tester);
+    b.openSession(ecu);
+    std::string message = pattern(30);
+    a.send(tester, message.data(), message.size(), 0);
+    EXPECT_EQ(1000000000u, a.nextPollTime(0));
+    a.poll(999999999);
+    EXPECT_TRUE(a.sent.empty());
+    a.poll(1000000000);
+    EXPECT_EQ(std::vector<std::string>{result(0x7e0, IsoTpResult::Timeout)}, a.sent);
+
+    // the first frame still reaches the receiver, which waits for consecutive frames in vain
+    b.setTimeouts(1000000, 2000000);
+    Link<TestNode> toB(&b);
+    toB.now = 5;
+    toB.deliver(&a.wire);
+    EXPECT_EQ(64u, b.poolUsed());
+    EXPECT_EQ(2000005u, b.nextPollTime(0));
+    b.poll(2000005);
+    EXPECT_EQ(std::vector<std::string>{result(0x7e0, IsoTpResult::Timeout)}, b.errors);
+    EXPECT_EQ(0u, b.poolUsed());
+}
+
+TEST(IsoTpTest, brokenSequences)
+{
+    TestNode b;
+    b.openSession(ecu);
+    const uint8_t first[8] = {0x10, 0x14, 1, 2, 3, 4, 5, 6};
+    const uint8_t second[8] = {0x22, 7, 8, 9, 10, 11, 12, 13};
+    const uint8_t single[8] = {0x02, 0xaa, 0xbb};
+    EXPECT_TRUE(b.acceptFrame(0x7e0, false, first, 8, 0));
+    EXPECT_TRUE(b.acceptFrame(0x7e0, false, second, 8, 0));
+    EXPECT_EQ(std::vector<std::string>{result(0x7e0, IsoTpResult::WrongSequence)}, b.errors);
+    EXPECT_EQ(0u, b.poolUsed());
+
+    EXPECT_TRUE(b.acceptFrame(0x7e0, false, first, 8, 0));
+    EXPECT_TRUE(b.acceptFrame(0x7e0, false, single, 8, 0));
+    EXPECT_EQ(result(0x7e0, IsoTpResult::UnexpectedPdu), b.errors.back());
+    EXPECT_EQ(std::vector<std::string>{"2016:\xaa\xbb"}, b.messages);
+
+    // consecutive frames without a first frame and frames of other ids are ignored
+    EXPECT_TRUE(b.acceptFrame(0x7e0, false, second, 8, 0));
+    EXPECT_FALSE(b.acceptFrame(0x7e1, false, single, 8, 0));
+    EXPECT_FALSE(b.acceptFrame(0x7e0, true, single, 8, 0));
+    EXPECT_EQ(2u, b.errors.size());
+    EXPECT_EQ(1u, b.messages.size());
+}
+
+TEST(IsoTpTest, concurrentSessions)
+{
+    TestNode a;
+    TestNode b;
+    b.setFlowControl(3, 0);
+    a.setFlowControl(2, 0);
+    std::vector<std::string> toB;
+    std::vector<std::string> toA;
+    for (uint32_t i = 0; i < 4; i++) {
+        IsoTpAddress address = {0x18da0000u + i, 0x18db0000u + i, true};
+        IsoTpAddress peer = {address.rxAddress, address.txAddress, true};
+        ASSERT_TRUE(a.openSession(address));
+        ASSERT_TRUE(b.openSession(peer));
+        toB.push_back(pattern(100 + 500 * i));
+        toA.push_back(pattern(3000 - 700 * i));
+        EXPECT_TRUE(a.send(address, toB[i].data(), toB[i].size(), 0));
+        EXPECT_TRUE(b.send(peer, toA[i].data(), toA[i].size(), 0));
+    }
+    IsoTpAddress taken = {0x100, 0x18db0000u, true};
+    EXPECT_FALSE(a.openSession(taken));
+    exchange(&a, &b);
+    std::vector<std::string> expectedA;
+    std::vector<std::string> expectedB;
+    for (uint32_t i = 0; i < 4; i++) {
+        expectedA.push_back(std::to_string(0x18db0000u + i) + ":" + toA[i]);
+        expectedB.push_back(std::to_string(0x18da0000u + i) + ":" + toB[i]);
+    }
+    std::sort(a.messages.begin(), a.messages.end());
+    std::sort(b.messages.begin(), b.messages.end());
+    EXPECT_EQ(expectedA, a.messages);
+    EXPECT_EQ(expectedB, b.messages);
+    EXPECT_EQ(4u, a.sent.size());
+    EXPECT_EQ(4u, b.sent.size());
+    EXPECT_TRUE(a.errors.empty());
+    EXPECT_TRUE(b.errors.empty());
+    EXPECT_EQ(0u, a.poolUsed());
+    EXPECT_EQ(0u, b.poolUsed());
+
+    EXPECT_TRUE(a.closeSession({0x18da0001u, 0x18db0001u, true}));
+    EXPECT_FALSE(a.closeSession({0x18da0001u, 0x18db0001u, true}));
+    EXPECT_TRUE(a.send({0x18da0002u, 0x18db0002u, true}, "\x01", 1, 0));
+    EXPECT_TRUE(a.openSession({0x18da0001u, 0x18db0001u, true}));
+}
@@ -0,0 +1,136 @@
+#include "dtacan/LastValueCache.h"
+#include "dtacan/Parser.h"
+
+#include "DtaCanTest.h"
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace dtacan;
+
+class CachingParser : public Parser<CachingParser> {
+public:
+    void handleData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        cache.update(address, isExtendedFrame(), data, size, now);
+    }
+
+    LastValueCache<4> cache;
+    uint64_t now = 0;
+};
+
+static void countCall(void* context, uint32_t address, bool isExtended, const uint8_t* data, std::size_t size)
+{
+    (void)address;
+    (void)isExtended;
+    (void)data;
+    (void)size;
+    (*(int*)context)++;
+}
+
+TEST(LastValueCacheTest, latestValue)
+{
+    CachingParser parser;
+    EXPECT_TRUE(parser.cache.registerExt(0x1234567));
+    LastValue value;
+    EXPECT_FALSE(parser.cache.read(0x123, false, &value));
+    EXPECT_FALSE(parser.cache.read(0x1234567, true, &value));
+
+    parser.now = 100;
+    parser.acceptData("t1232AABB\rT012345671CC\rT000000010\r", 34);
+    parser.now = 200;
+    parser.acceptData("t1231DD\r", 8);
+
+    ASSERT_TRUE(parser.cache.read(0x123, false, &value));
+    EXPECT_EQ(1u, value.size);
+    EXPECT_EQ(0xDD, value.data[0]);
+    EXPECT_EQ(2u, value.sequence);
+    EXPECT_EQ(200u, value.timestampNs);
+
+    ASSERT_TRUE(parser.cache.read(0x1234567, true, &value));
+    EXPECT_EQ(1u, value.size);
+    EXPECT_EQ(0xCC, value.data[0]);
+    EXPECT_EQ(1u, value.sequence);
+    EXPECT_EQ(100u, value.timestampNs);
+
+    EXPECT_FALSE(parser.cache.read(0x1, true, &value));
+    EXPECT_FALSE(parser.cache.read(0x800, false, &value));
+    EXPECT_EQ(1u, parser.cache.unregistered());
+}
+
+TEST(LastValueCacheTest, registerExt)
+{
+    LastValueCache<2> cache;
+    EXPECT_FALSE(cache.registerExt(0x20000000));
+    EXPECT_TRUE(cache.registerExt(0x1));
+    EXPECT_TRUE(cache.registerExt(0x1));
+    EXPECT_TRUE(cache.registerExt(0x2));
+    EXPECT_FALSE(cache.registerExt(0x3));
+}
+
+TEST(LastValueCacheTest, changeOnly)
+{
+    LastValueCache<> cache;
+    int calls = 0;
+    cache.setHandler(countCall, &calls);
+    uint8_t a[2] = {1, 2};
+    uint8_t b[2] = {1, 3};
+
+    EXPECT_TRUE(cache.update(0x10, false, a, 2, 0));
+    EXPECT_FALSE(cache.update(0x10, false, a, 2, 1));
+    EXPECT_EQ(2, calls);
+
+    cache.setChangeOnly(true);
+    EXPECT_FALSE(cache.update(0x10, false, a, 2, 2));
+    EXPECT_EQ(2, calls);
+    EXPECT_TRUE(cache.update(0x10, false, b, 2, 3));
+    EXPECT_EQ(3, calls);
+    // a shorter payload is a change even if the remaining bytes match
+    EXPECT_TRUE(cache.update(0x10, false, b, 1, 4));
+    EXPECT_EQ(4, calls);
+
+    // suppressed updates still refresh the slot
+    LastValue value;
+    ASSERT_TRUE(cache.read(0x10, false, &value));
+    EXPECT_EQ(5u, value.sequence);
+    EXPECT_EQ(4u, value.timestampNs);
+}
+
+// The writer stores 8 copies of one byte with that byte as the size, a torn read would mix them
+TEST(LastValueCacheTest, concurrentReaders)
+{
+    LastValueCache<> cache;
+    cache.registerExt(0x100);
+    std::atomic<bool> done(false);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 2; i++) {
+        readers.emplace_back([&] {
+            LastValue value;
+            uint64_t lastSequence = 0;
+            while (!done.load()) {
+                if (!cache.read(0x100, true, &value)) {
+                    continue;
+                }
+                ASSERT_GE(value.sequence, lastSequence);
+                lastSequence = value.sequence;
+                ASSERT_EQ(value.size, value.data[0] % 9);
+                for (int j = 1; j < value.size; j++) {
+                    ASSERT_EQ(value.data[0], value.data[j]);
+                }
+                ASSERT_EQ(value.sequence, value.timestampNs);
+            }
+        });
+    }
+    uint8_t data[8];
+    for (uint64_t i = 1; i <= 1000000; i++) {
+        uint8_t byte = i;
+        std::memset(data, byte, 8);
+        cache.update(0x100, true, data, byte % 9, i);
+    }
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+}
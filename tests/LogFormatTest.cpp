@@ -0,0 +1,132 @@
+#include "dtacan/LogFormat.h"
+
+#include "DtaCanTest.h"
+
+#include <cstring>
+#include <string>
+
+using namespace dtacan;
+
+static LogFrame makeFrame(uint64_t timestampUs, uint32_t address, bool isExtended, const char* data, std::size_t size)
+{
+    LogFrame frame;
+    frame.timestampUs = timestampUs;
+    frame.address = address;
+    frame.isExtended = isExtended;
+    frame.isFd = false;
+    frame.isBitRateSwitch = false;
+    frame.size = size;
+    std::memcpy(frame.data, data, size);
+    return frame;
+}
+
+static std::string candumpLine(const LogFrame& frame)
+{
+    char line[maxCandumpLineSize(4)];
+    return std::string(line, writeCandumpLine(line, frame, "can0", 4));
+}
+
+static std::string ascLine(const LogFrame& frame, uint64_t startUs)
+{
+    char line[maxAscLineSize];
+    return std::string(line, writeAscLine(line, frame, startUs, 1));
+}
+
+TEST(LogFormatTest, writeCandump)
+{
+    EXPECT_EQ("(1436509052.249713) can0 123#DEADBEEF\n",
+              candumpLine(makeFrame(1436509052249713ull, 0x123, false, "\xDE\xAD\xBE\xEF", 4)));
+    EXPECT_EQ("(0000000000.000005) can0 00000ABC#\n", candumpLine(makeFrame(5, 0xabc, true, "", 0)));
+
+    LogFrame fd = makeFrame(1000000, 0x7ff, false, "\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0A\x0B\x0C", 12);
+    fd.isFd = true;
+    fd.isBitRateSwitch = true;
+    EXPECT_EQ("(0000000001.000000) can0 7FF##10102030405060708090A0B0C\n", candumpLine(fd));
+}
+
+TEST(LogFormatTest, parseCandump)
+{
+    const char* lines[] = {"(1436509052.249713) can0 123#DEADBEEF", "(0000000000.000005) vcan12 1FFFFFFF#",
+                           "(1.5) can0 7FF##10102030405060708090A0B0C\r", "(2.0000019)  can1  000#0011223344556677  "};
+    LogFrame frame;
+    ASSERT_TRUE(parseCandumpLine(lines[0], std::strlen(lines[0]), &frame));
+    EXPECT_EQ(1436509052249713ull, frame.timestampUs);
+    EXPECT_EQ(0x123u, frame.address);
+    EXPECT_FALSE(frame.isExtended);
+    EXPECT_FALSE(frame.isFd);
+    EXPECT_EQ(std::string("\xDE\xAD\xBE\xEF"), std::string((const char*)frame.data, frame.size));
+
+    ASSERT_TRUE(parseCandumpLine(lines[1], std::strlen(lines[1]), &frame));
+    EXPECT_EQ(5u, frame.timestampUs);
+    EXPECT_EQ(0x1fffffffu, frame.address);
+    EXPECT_TRUE(frame.isExtended);
+    EXPECT_EQ(0u, frame.size);
+
+    ASSERT_TRUE(parseCandumpLine(lines[2], std::strlen(lines[2]), &frame));
+    EXPECT_EQ(1500000u, frame.timestampUs);
+    EXPECT_TRUE(frame.isFd);
+    EXPECT_TRUE(frame.isBitRateSwitch);
+    EXPECT_EQ(12u, frame.size);
+    EXPECT_EQ(0x0cu, frame.data[11]);
+
+    ASSERT_TRUE(parseCandumpLine(lines[3], std::strlen(lines[3]), &frame));
+    EXPECT_EQ(2000001u, frame.timestampUs);
+    EXPECT_EQ(0u, frame.address);
+    EXPECT_EQ(8u, frame.size);
+
+    // round trip of what was written
+    LogFrame written = makeFrame(42000017, 0x1234567, true, "\x00\xFF\x10", 3);
+    std::string line = candumpLine(written);
+    ASSERT_TRUE(parseCandumpLine(line.data(), line.size() - 1, &frame));
+    EXPECT_EQ(line, candumpLine(frame));
+}
+
+TEST(LogFormatTest, rejectMalformedCandump)
+{
+    const char* lines[] = {"",
+                           "1.0 can0 123#00",
+                           "(1.0) can0 123#0",
+                           "(1.0) can0 123#R",
+                           "(1.0) can0 12#00",
+                           "(1.0) can0 800#00",
+                           "(1.0) can0 3FFFFFFF#00",
+                           "(1.0) can0 123#de",
+                           "(1.0) can0 123#000102030405060708",
+                           "(1.0) can0 123##",
+                           "(1.0) can0 123##X00",
+                           "(1.0) 123#00",
+                           "(.5) can0 123#00",
+                           "(1.) can0 123#00"};
+    for (const char* line : lines) {
+        LogFrame frame;
+        EXPECT_FALSE(parseCandumpLine(line, std::strlen(line), &frame)) << line;
+    }
+}
+
+TEST(LogFormatTest, writeAsc)
+{
+    EXPECT_EQ("   0.000100 1  123             Rx   d 2 DE AD\n",
+              ascLine(makeFrame(1000100, 0x123, false, "\xDE\xAD", 2), 1000000));
+    EXPECT_EQ("  12.500000 1  1FFFFFFFx       Rx   d 0\n",
+              ascLine(makeFrame(12500000, 0x1fffffff, true, "", 0), 0));
+
+    LogFrame fd = makeFrame(0, 0x12, false, "\x01\x02\x03\x04\x05\x06\x07\x08\x09", 9);
+    fd.isFd = true;
+    std::string line = ascLine(fd, 0);
+    EXPECT_EQ(0u, line.find("   0.000000 CANFD   1 Rx         12"));
+    EXPECT_NE(std::string::npos, line.find(" 0 0 9 12 01 02 03 04 05 06 07 08 09 00 00 00        0    0     1000 "));
+    EXPECT_EQ('\n', line.back());
+}
+
+TEST(LogFormatTest, ascHeader)
+{
+    char header[256];
+    std::string text(header, writeAscHeader(header, 1436509052));
+    EXPECT_EQ("date Fri Jul 10 06:17:32.000 am 2015\n"
+              "base hex  timestamps absolute\n"
+              "internal events logged\n"
+              "// version 9.0.0\n"
+              "Begin Triggerblock Fri Jul 10 06:17:32.000 am 2015\n"
+              "   0.000000 Start of measurement\n",
+              text);
+}
@@ -0,0 +1,158 @@
+#include "dtacan/Encoder.h"
+#include "dtacan/Metrics.h"
+#include "dtacan/Parser.h"
+
+#include "DtaCanTest.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace dtacan;
+
+class CountedParser : public Parser<CountedParser, InstrumentedConfig> {
+public:
+    static const bool filterAddresses = true;
+
+    bool acceptAddress(uint32_t address, bool isExtended)
+    {
+        (void)isExtended;
+        return address != 0x7ff;
+    }
+};
+
+class CountedEncoder : public Encoder<CountedEncoder, InstrumentedConfig> {
+};
+
+TEST(MetricsTest, parserCounters)
+{
+    CountedParser parser;
+    std::string stream = "t1231AA\rT000000010\rz\rZ\r\aXY\rt7FF0\rt1";
+    parser.acceptData(stream.data(), stream.size());
+    parser.acceptData("2", 1);
+    parser.acceptData("30\r", 3);
+
+    const ParserMetrics& metrics = parser.parserMetrics();
+    EXPECT_EQ(2u, metrics.stdFrames());
+    EXPECT_EQ(1u, metrics.extFrames());
+    EXPECT_EQ(1u, metrics.filteredFrames());
+    EXPECT_EQ(1u, metrics.stdReceipts());
+    EXPECT_EQ(1u, metrics.extReceipts());
+    EXPECT_EQ(1u, metrics.nacks());
+    EXPECT_EQ(1u, metrics.resyncs());
+    EXPECT_EQ(2u, metrics.junkBytes());
+    EXPECT_EQ(3u, metrics.chunks());
+    EXPECT_EQ(2u, metrics.carryOvers());
+    EXPECT_EQ(3u, metrics.carryHighWater());
+    EXPECT_EQ(3u, metrics.latency().count());
+}
+
+TEST(MetricsTest, encoderCounters)
+{
+    CountedEncoder encoder;
+    uint8_t data[20] = {};
+    encoder.openCanChannel();
+    encoder.transmitStdFrame(0x123, data, 2);
+    encoder.transmitData(0x456, data, 20);
+    TransmitFrame frames[2] = {{0x1, data, 1, false}, {0x2, data, 1, true}};
+    EXPECT_EQ(2u, encoder.transmitBatch(frames, 2));
+
+    const EncoderMetrics& metrics = encoder.encoderMetrics();
+    EXPECT_EQ(6u, metrics.frames());
+    EXPECT_EQ(2u + 10 + (22 * 2 + 14) + (8 + 13), metrics.bytes());
+    EXPECT_EQ(4u, metrics.writes());
+    EXPECT_EQ(58u, metrics.bufferHighWater());
+    EXPECT_EQ(0u, metrics.bufferFailures());
+
+    char small[10];
+    EXPECT_EQ(0u, encoder.transmitBatch(frames + 1, 1, small, sizeof(small)));
+    EXPECT_EQ(1u, metrics.bufferFailures());
+}
+
+TEST(MetricsTest, histogramBuckets)
+{
+    // gtest takes the values by reference, a local copy spares the out of line definition
+    const std::size_t bucketCount = LatencyHistogram::bucketCount;
+    for (uint64_t value : {0ull, 7ull, 8ull, 15ull, 16ull, 17ull, 1000ull, 123456789ull, ~0ull}) {
+        std::size_t index = LatencyHistogram::bucketIndex(value);
+        ASSERT_LT(index, bucketCount);
+        EXPECT_GE(LatencyHistogram::bucketUpperBound(index), value);
+        if (index != 0) {
+            EXPECT_LT(LatencyHistogram::bucketUpperBound(index - 1), value);
+        }
+        // log-linear buckets keep the relative error under 1/8
+        EXPECT_LE(LatencyHistogram::bucketUpperBound(index) - value, value / 8);
+    }
+
+    LatencyHistogram histogram;
+    for (uint64_t i = 1; i <= 1000; i++) {
+        histogram.record(i * 1000);
+    }
+    EXPECT_EQ(1000u, histogram.count());
+    EXPECT_EQ(1000000u, histogram.max());
+    EXPECT_NEAR(500000.0, double(histogram.quantile(0.5)), 500000.0 / 8);
+    EXPECT_NEAR(990000.0, double(histogram.quantile(0.99)), 990000.0 / 8);
+}
+
+TEST(MetricsTest, prometheusText)
+{
+    CountedParser parser;
+    parser.acceptData("t1230\rT000000010\r", 17);
+    std::string text;
+    parser.parserMetrics().appendPrometheus(&text, "port=\"can0\"");
+
+    EXPECT_NE(std::string::npos, text.find("# TYPE dtacan_parser_frames_total counter\n"));
+    EXPECT_NE(std::string::npos, text.find("dtacan_parser_frames_total{port=\"can0\",type=\"std\"} 1\n"));
+    EXPECT_NE(std::string::npos, text.find("dtacan_parser_nacks_total{port=\"can0\"} 0\n"));
+    EXPECT_NE(std::string::npos, text.find("# TYPE dtacan_parser_delivery_latency_ns histogram\n"));
+    EXPECT_NE(std::string::npos, text.find("dtacan_parser_delivery_latency_ns_bucket{port=\"can0\",le=\"+Inf\"} 2\n"));
+    EXPECT_NE(std::string::npos, text.find("dtacan_parser_delivery_latency_ns_count{port=\"can0\"} 2\n"));
+
+    // every sample line has a name, an optional label set and a value
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line[0] != '#') {
+            EXPECT_NE(std::string::npos, line.rfind(' ')) << line;
+        }
+    }
+
+    // the set of buckets doesn't depend on the recorded values
+    CountedParser idle;
+    std::string idleText;
+    idle.parserMetrics().appendPrometheus(&idleText, "port=\"can0\"");
+    auto bucketLabels = [](const std::string& text) {
+        std::string labels;
+        std::istringstream lines(text);
+        std::string line;
+        while (std::getline(lines, line)) {
+            if (line.find("_bucket{") != std::string::npos) {
+                labels += line.substr(0, line.rfind(' ')) + "\n";
+            }
+        }
+        return labels;
+    };
+    EXPECT_EQ(bucketLabels(idleText), bucketLabels(text));
+    EXPECT_NE(std::string::npos, idleText.find("dtacan_parser_delivery_latency_ns_bucket{port=\"can0\",le=\"0\"} 0\n"));
+    EXPECT_NE(std::string::npos,
+              idleText.find("dtacan_parser_delivery_latency_ns_bucket{port=\"can0\",le=\"9223372036854775807\"} 0\n"));
+
+    std::string path = ::testing::TempDir() + "dtacan_metrics.prom";
+    ASSERT_TRUE(writePrometheusFile(path.c_str(), text));
+    std::ifstream file(path);
+    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    EXPECT_EQ(text, content);
+    std::remove(path.c_str());
+}
+
+class PlainParser : public Parser<PlainParser> {
+};
+
+// With the default policy the counters are empty classes and every call is inlined away
+TEST(MetricsTest, disabledByDefault)
+{
+    EXPECT_TRUE(std::is_empty<DefaultConfig::ParserInstrumentation>::value);
+    EXPECT_TRUE(std::is_empty<DefaultConfig::EncoderInstrumentation>::value);
+    EXPECT_TRUE(std::is_empty<StaticConfig::ParserInstrumentation>::value);
+}
@@ -0,0 +1,271 @@
+#include "dtacan/Config.h"
+#include "dtacan/Encoder.h"
+#include "dtacan/IsoTp.h"
+#include "dtacan/Parser.h"
+
+#include "DtaCanTest.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define DTACAN_ASAN
+#endif
+#elif defined(__SANITIZE_ADDRESS__)
+#define DTACAN_ASAN
+#endif
+
+static bool countAllocations = false;
+static std::size_t allocationNum = 0;
+
+#ifdef DTACAN_ASAN
+// from sanitizer/allocator_interface.h, which not every toolchain installs
+extern "C" int __sanitizer_install_malloc_and_free_hooks(void (*mallocHook)(const volatile void*, std::size_t),
+                                                         void (*freeHook)(const volatile void*));
+
+// ASan owns malloc, replacing it would hand glibc blocks to the ASan free, its hooks see every allocation
+static void mallocHook(const volatile void*, std::size_t)
+{
+    allocationNum += countAllocations;
+}
+
+static void freeHook(const volatile void*)
+{
+}
+
+static int installedHooks = __sanitizer_install_malloc_and_free_hooks(mallocHook, freeHook);
+#else
+extern "C" {
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t num, std::size_t size);
+void* __libc_realloc(void* ptr, std::size_t size);
+}
+
+extern "C" void* malloc(std::size_t size)
+{
+    allocationNum += countAllocations;
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(std::size_t num, std::size_t size)
+{
+    allocationNum += countAllocations;
+    return __libc_calloc(num, size);
+}
+
+extern "C" void* realloc(void* ptr, std::size_t size)
+{
+    allocationNum += countAllocations;
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+using namespace dtacan;
+
+class AllocationCounter {
+public:
+    AllocationCounter()
+    {
+        allocationNum = 0;
+        countAllocations = true;
+    }
+
+    ~AllocationCounter()
+    {
+        countAllocations = false;
+    }
+
+    std::size_t count() const
+    {
+        return allocationNum;
+    }
+};
+
+// Collects output in a fixed array so the test itself doesn't allocate
+template <typename C>
+class FixedEncoder : public Encoder<FixedEncoder<C>, C> {
+public:
+    void handleEncodedData(const char* str, std::size_t size)
+    {
+        ASSERT_LE(outputSize + size, sizeof(output));
+        std::memcpy(output + outputSize, str, size);
+        outputSize += size;
+        writes++;
+    }
+
+    char output[16384];
+    std::size_t outputSize = 0;
+    std::size_t writes = 0;
+};
+
+class FixedParser : public Parser<FixedParser> {
+public:
+    static const std::size_t frameBatchSize = 4;
+
+    void handleFrames(const Frame* frames, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; i++) {
+            checksum += frames[i].address + frames[i].size;
+        }
+        frameNum += count;
+    }
+
+    void handleJunk(const uint8_t*, std::size_t size)
+    {
+        junkSize += size;
+    }
+
+    std::size_t frameNum = 0;
+    std::size_t junkSize = 0;
+    uint64_t checksum = 0;
+};
+
+TEST(NoAllocTest, interpositionWorks)
+{
+    FixedEncoder<DefaultConfig> encoder;
+    uint8_t data[64] = {};
+    AllocationCounter counter;
+    ASSERT_TRUE(encoder.transmitData(0x123, data, sizeof(data)));
+    EXPECT_NE(0u, counter.count());
+}
+
+TEST(NoAllocTest, staticEncoder)
+{
+    FixedEncoder<StaticConfig> encoder;
+    char buffer[50];
+    uint8_t data[4096];
+    for (std::size_t i = 0; i < sizeof(data); i++) {
+        data[i] = i;
+    }
+    TransmitFrame frames[4] = {
+        {0x123, data, 8, false},
+        {0x1234567, data, 8, true},
+        {0x456, data, 0, false},
+        {0x7ff, data, 3, false},
+    };
+
+    std::size_t allocations;
+    {
+        AllocationCounter counter;
+        EXPECT_FALSE(encoder.transmitData(0x123, data, 9));
+        encoder.setBuffer(buffer, sizeof(buffer));
+        EXPECT_TRUE(encoder.transmitData(0x123, data, 8));
+        EXPECT_TRUE(encoder.transmitData(0x123, data, 4095));
+        EXPECT_TRUE(encoder.transmitData(0x1234567, data, 17));
+        EXPECT_EQ(2u, encoder.transmitBatch(frames, 4));
+        EXPECT_TRUE(encoder.transmitStdFrame(0x1, data, 1));
+        encoder.openCanChannel();
+        allocations = counter.count();
+    }
+    EXPECT_EQ(0u, allocations);
+
+    // streams longer than the buffer are split at frame boundaries: 512 std frames take 256 writes, 3 ext frames
+    // take 2 as the short last one fits next to the second and the batch is cut after the first two frames
+    EXPECT_EQ(1u + 256u + 2u + 1u + 1u + 1u, encoder.writes);
+    EXPECT_EQ(22u + 511u * 22u + 20u + 27u * 2u + 13u + 49u + 8u + 2u, encoder.outputSize);
+    EXPECT_EQ(0, std::memcmp(encoder.output, "t12380001020304050607\r", 22));
+    EXPECT_EQ(0, std::memcmp(encoder.output + encoder.outputSize - 59,
+                             "t12380001020304050607\rT0123456780001020304050607\r"
+                             "t001100\rO\r", 59));
+}
+
+TEST(NoAllocTest, parser)
+{
+    const char msg[] = "t1238AABBCCDDEEFF0011\rT123456784AABBCCDD\rjunk\rz\rt0010\r";
+    char stream[sizeof(msg) * 100];
+    for (int i = 0; i < 100; i++) {
+        std::memcpy(stream + i * (sizeof(msg) - 1), msg, sizeof(msg) - 1);
+    }
+    std::size_t streamSize = (sizeof(msg) - 1) * 100;
+
+    FixedParser parser;
+    std::size_t allocations;
+    {
+        AllocationCounter counter;
+        for (std::size_t chunk : {1, 7, 64, 4096}) {
+            for (std::size_t offset = 0; offset < streamSize; offset += chunk) {
+                parser.acceptData(stream + offset, std::min(chunk, streamSize - offset));
+            }
+        }
+        allocations = counter.count();
+    }
+    EXPECT_EQ(0u, allocations);
+    EXPECT_EQ(3u * 400u, parser.frameNum);
+    EXPECT_EQ(4u * 400u, parser.junkSize);
+}
+
+class FixedIsoTp : public IsoTp<FixedIsoTp, 4, 8192> {
+public:
+    void handleEncodedData(const char* str, std::size_t size)
+    {
+        ASSERT_LE(outputSize + size, sizeof(output));
+        std::memcpy(output + outputSize, str, size);
+        outputSize += size;
+    }
+
+    void handleMessage(const IsoTpAddress&, const uint8_t* data, std::size_t size)
+    {
+        messageSize = size;
+        messageChecksum = 0;
+        for (std::size_t i = 0; i < size; i++) {
+            messageChecksum += data[i];
+        }
+    }
+
+    char output[32768];
+    std::size_t outputSize = 0;
+    std::size_t messageSize = 0;
+    uint64_t messageChecksum = 0;
+};
+
+class IsoTpLink : public Parser<IsoTpLink> {
+public:
+    void handleData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        target->acceptFrame(address, isExtendedFrame(), data, size, 0);
+    }
+
+    void deliver(FixedIsoTp* from)
+    {
+        acceptData(from->output, from->outputSize);
+        from->outputSize = 0;
+    }
+
+    FixedIsoTp* target = nullptr;
+};
+
+TEST(NoAllocTest, isoTp)
+{
+    static FixedIsoTp tester;
+    static FixedIsoTp ecu;
+    IsoTpAddress testerAddress = {0x7e0, 0x7e8, false};
+    IsoTpAddress ecuAddress = {0x7e8, 0x7e0, false};
+    tester.openSession(testerAddress);
+    ecu.openSession(ecuAddress);
+    ecu.setFlowControl(8, 0);
+    uint8_t data[4000];
+    uint64_t checksum = 0;
+    for (std::size_t i = 0; i < sizeof(data); i++) {
+        data[i] = i * 13;
+        checksum += data[i];
+    }
+    IsoTpLink toEcu;
+    toEcu.target = &ecu;
+    IsoTpLink toTester;
+    toTester.target = &tester;
+
+    std::size_t allocations;
+    {
+        AllocationCounter counter;
+        EXPECT_TRUE(tester.send(testerAddress, data, sizeof(data), 0));
+        while (tester.outputSize != 0) {
+            toEcu.deliver(&tester);
+            toTester.deliver(&ecu);
+        }
+        allocations = counter.count();
+    }
+    EXPECT_EQ(0u, allocations);
+    EXPECT_EQ(sizeof(data), ecu.messageSize);
+    EXPECT_EQ(checksum, ecu.messageChecksum);
+}
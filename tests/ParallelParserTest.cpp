@@ -0,0 +1,232 @@
+#include "dtacan/ParallelParser.h"
+#include "dtacan/Parser.h"
+
+#include "DtaCanTest.h"
+
+#include <atomic>
+#include <mutex>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace dtacan;
+
+static std::string frameEvent(const char* kind, uint32_t address, const uint8_t* data, std::size_t size)
+{
+    return kind + std::to_string(address) + ":" + std::string((const char*)data, size) + ";";
+}
+
+// Junk pieces are recorded as reported, chunks must not cut them
+class SerialParser : public Parser<SerialParser> {
+public:
+    void handleData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        events += frameEvent(isExtendedFrame() ? "X" : "S", address, data, size);
+    }
+
+    void handleFdData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        events += frameEvent(isExtendedFrame() ? "FX" : "FS", address, data, size);
+    }
+
+    void handleJunk(const uint8_t* junk, std::size_t size)
+    {
+        events += "J" + std::string((const char*)junk, size) + ";";
+    }
+
+    void handleReceipt()
+    {
+        events += "R;";
+    }
+
+    void handleExtReceipt()
+    {
+        events += "Z;";
+    }
+
+    void handleNack()
+    {
+        events += "N;";
+    }
+
+    std::string events;
+};
+
+class MergingParser : public ParallelParser<MergingParser> {
+public:
+    void handleFrames(const Frame* frames, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; i++) {
+            std::string frame = frameEvent(frames[i].isExtended ? "X" : "S", frames[i].address, frames[i].data,
+                                           frames[i].size);
+            events += frame;
+            classicFrames += frame;
+        }
+    }
+
+    void handleFdData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        events += frameEvent(isExtendedFrame() ? "FX" : "FS", address, data, size);
+    }
+
+    void handleJunk(const uint8_t* junk, std::size_t size)
+    {
+        events += "J" + std::string((const char*)junk, size) + ";";
+    }
+
+    void handleReceipt()
+    {
+        events += "R;";
+    }
+
+    void handleExtReceipt()
+    {
+        events += "Z;";
+    }
+
+    void handleNack()
+    {
+        events += "N;";
+    }
+
+    std::string events;
+    std::string classicFrames;
+};
+
+class ChunkCollector : public ParallelParser<ChunkCollector> {
+public:
+    static const bool ordered = false;
+
+    void handleChunk(std::size_t worker, const ParsedChunk& chunk)
+    {
+        EXPECT_LT(worker, 4u);
+        std::string text;
+        for (const Frame& frame : chunk.frames) {
+            text += frameEvent(frame.isExtended ? "X" : "S", frame.address, frame.data, frame.size);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (chunks.size() <= chunk.index) {
+            chunks.resize(chunk.index + 1);
+        }
+        chunks[chunk.index] = text;
+    }
+
+    std::mutex mutex;
+    std::vector<std::string> chunks;
+};
+
+class FilteringParser : public ParallelParser<FilteringParser> {
+public:
+    static const bool filterAddresses = true;
+
+    bool acceptAddress(uint32_t address, bool isExtended)
+    {
+        asked++;
+        return !isExtended && address < 0x100;
+    }
+
+    void handleFrames(const Frame* frames, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; i++) {
+            EXPECT_LT(frames[i].address, 0x100u);
+        }
+        this->frames += count;
+    }
+
+    std::atomic<std::size_t> asked{0};
+    std::size_t frames = 0;
+};
+
+static std::string makeStream(unsigned seed, std::size_t count)
+{
+    std::string longJunk(300, 'q');
+    std::string fd64 = "D1FFFFFFFF" + std::string(128, 'C') + "\r";
+    const char* pieces[] = {"t1111AA\r", "T0987654381234567890ABCDEF\r", "z\r", "t8FF0\r", "xyq\r", "t0010\r",
+                            "zq\r", "\r", "t1232ABXD\r", "Z\r", "\a", "t12\a", "Zq\a", "d1230\r",
+                            fd64.c_str(), longJunk.c_str(), "b7FFA0102030405060708090A0B0C0D0E0F10\r"};
+    std::srand(seed);
+    std::string stream;
+    for (std::size_t i = 0; i < count; i++) {
+        stream += pieces[std::rand() % (sizeof(pieces) / sizeof(pieces[0]))];
+    }
+    return stream;
+}
+
+TEST(ParallelParserTest, sameEventsAsSerialParser)
+{
+    std::string stream = makeStream(3, 3000);
+    SerialParser serial;
+    serial.acceptData(stream.data(), stream.size());
+
+    for (std::size_t chunkSize : {1, 7, 64, 1000, 1 << 20}) {
+        for (std::size_t workers : {1, 3, 4}) {
+            MergingParser parallel;
+            parallel.setChunkSize(chunkSize);
+            parallel.parse(stream.data(), stream.size(), workers);
+            EXPECT_EQ(serial.events, parallel.events) << "chunk " << chunkSize << " workers " << workers;
+            if (chunkSize == 64) {
+                EXPECT_GT(parallel.chunkCount(), stream.size() / 500);
+            }
+        }
+    }
+}
+
+TEST(ParallelParserTest, junkRunLongerThanChunk)
+{
+    std::string stream = "t1232AABB\r" + std::string(5000, 'x') + "\rt1230\r";
+    MergingParser parallel;
+    parallel.setChunkSize(100);
+    parallel.parse(stream.data(), stream.size(), 2);
+    EXPECT_EQ("S291:\xAA\xBB;J" + std::string(5000, 'x') + ";S291:;", parallel.events);
+    EXPECT_EQ(2u, parallel.chunkCount());
+}
+
+TEST(ParallelParserTest, incompleteTail)
+{
+    std::string stream = "t1230\rt12";
+    MergingParser parallel;
+    parallel.setChunkSize(4);
+    parallel.parse(stream.data(), stream.size(), 2);
+    EXPECT_EQ("S291:;", parallel.events);
+
+    parallel.events.clear();
+    parallel.parse(stream.data(), 0, 2);
+    EXPECT_EQ("", parallel.events);
+    EXPECT_EQ(0u, parallel.chunkCount());
+}
+
+TEST(ParallelParserTest, unorderedChunks)
+{
+    std::string stream = makeStream(5, 2000);
+    MergingParser merged;
+    merged.setChunkSize(256);
+    merged.parse(stream.data(), stream.size(), 4);
+
+    ChunkCollector collector;
+    collector.setChunkSize(256);
+    collector.parse(stream.data(), stream.size(), 4);
+    ASSERT_EQ(collector.chunkCount(), collector.chunks.size());
+
+    std::string frames;
+    for (const std::string& chunk : collector.chunks) {
+        frames += chunk;
+    }
+    EXPECT_EQ(merged.classicFrames, frames);
+}
+
+TEST(ParallelParserTest, filterInWorkers)
+{
+    std::string stream;
+    for (int i = 0; i < 0x800; i++) {
+        char frame[16];
+        std::snprintf(frame, sizeof(frame), "t%03X1AA\r", i);
+        stream += frame;
+    }
+    stream += "T000000011BB\r";
+    FilteringParser parallel;
+    parallel.setChunkSize(512);
+    parallel.parse(stream.data(), stream.size(), 3);
+    EXPECT_EQ(0x100u, parallel.frames);
+    EXPECT_EQ(0x801u, parallel.asked.load());
+}
@@ -2,8 +2,12 @@
 
 #include "DtaCanTest.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
 #include <deque>
+#include <string>
+#include <vector>
 
 using namespace dtacan;
 
@@ -243,3 +247,242 @@ TEST_F(ParserTest, extFrameJunkPlusOne)
     expectJunk("xxxxxxxxx");
     expectData(0x00008800, data2);
 }
+
+TEST_F(ParserTest, frameSplitAtEveryPosition)
+{
+    const char* stream = "t1111AA\rT0987654381234567890ABCDEF\r";
+    std::size_t size = std::strlen(stream);
+    for (std::size_t split = 1; split < size; split++) {
+        acceptData(stream, split);
+        acceptData(stream + split, size - split);
+        uint8_t data1[] = {0xaa};
+        uint8_t data2[] = {0x12, 0x34, 0x56, 0x78, 0x90, 0xab, 0xcd, 0xef};
+        expectData(0x111, data1);
+        expectData(0x09876543, data2);
+        EXPECT_TRUE(_data.empty());
+        expectJunk("");
+    }
+}
+
+TEST_F(ParserTest, carriedFrameFollowedBySeveral)
+{
+    acceptString("t12");
+    acceptString("32AABB\rt0010\rT0000");
+    acceptString("00020\r");
+    uint8_t data1[] = {0xaa, 0xbb};
+    expectData(0x123, data1);
+    expectEmptyData(0x001);
+    _data.pop_front();
+    expectEmptyData(0x00000002);
+}
+
+TEST_F(ParserTest, carriedFrameTurnsIntoLongJunk)
+{
+    acceptString("t1232AB");
+    acceptString("CDxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx\rt0010\r");
+    expectJunk("t1232ABCDxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx");
+    expectEmptyData(0x001);
+}
+
+class BatchParserTest : public ::testing::Test, public Parser<BatchParserTest> {
+public:
+    static const std::size_t frameBatchSize = 2;
+
+    void handleFrames(const Frame* frames, std::size_t count)
+    {
+        _batches.push_back(std::vector<Frame>(frames, frames + count));
+        _events.push_back('F');
+    }
+
+    void handleJunk(const uint8_t*, std::size_t)
+    {
+        _events.push_back('J');
+    }
+
+    void handleReceipt()
+    {
+        _events.push_back('R');
+    }
+
+    void acceptString(const char* str)
+    {
+        acceptData(str, std::strlen(str));
+    }
+
+protected:
+    std::vector<std::vector<Frame>> _batches;
+    std::string _events;
+};
+
+TEST_F(BatchParserTest, batches)
+{
+    acceptString("t1111AA\rT0000000220102\rt0030\r");
+    ASSERT_EQ(2u, _batches.size());
+    ASSERT_EQ(2u, _batches[0].size());
+    EXPECT_EQ(0x111u, _batches[0][0].address);
+    EXPECT_FALSE(_batches[0][0].isExtended);
+    EXPECT_EQ(1u, _batches[0][0].size);
+    EXPECT_EQ(0xaa, _batches[0][0].data[0]);
+    EXPECT_EQ(0x2u, _batches[0][1].address);
+    EXPECT_TRUE(_batches[0][1].isExtended);
+    ASSERT_EQ(2u, _batches[0][1].size);
+    EXPECT_EQ(0x01, _batches[0][1].data[0]);
+    EXPECT_EQ(0x02, _batches[0][1].data[1]);
+    ASSERT_EQ(1u, _batches[1].size());
+    EXPECT_EQ(0x3u, _batches[1][0].address);
+    EXPECT_EQ("FF", _events);
+}
+
+TEST_F(BatchParserTest, flushedBeforeJunkAndReceipts)
+{
+    acceptString("t1111AA\rxx\rt1111AA\rz\rt1111AA\r");
+    EXPECT_EQ("FJFRF", _events);
+}
+
+class RecordingParser : public Parser<RecordingParser> {
+public:
+    void handleData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        events.append("D" + std::to_string(address) + ":" + std::string((const char*)data, size) + ";");
+    }
+
+    void handleJunk(const uint8_t* junk, std::size_t size)
+    {
+        // junk may be reported in several pieces depending on chunking, glue them together
+        if (!events.empty() && events.back() != ';') {
+            events.append((const char*)junk, size);
+        } else {
+            events.append("J");
+            events.append((const char*)junk, size);
+        }
+    }
+
+    void handleReceipt()
+    {
+        events.append(";R;");
+    }
+
+    void handleExtReceipt()
+    {
+        events.append(";X;");
+    }
+
+    void handleNack()
+    {
+        events.append(";N;");
+    }
+
+    void handleFdData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        events.append(std::string(isBitRateSwitch() ? "B" : "F") + (isExtendedFrame() ? "X" : "S")
+                      + std::to_string(address) + ":" + std::string((const char*)data, size) + ";");
+    }
+
+    std::string events;
+};
+
+TEST(ParserReplyTest, receiptsAndNacks)
+{
+    RecordingParser parser;
+    const char* stream = "z\rZ\r\at12\aT123\r\a";
+    parser.acceptData(stream, std::strlen(stream));
+    EXPECT_EQ(";R;;X;;N;Jt12;N;JT123;N;", parser.events);
+}
+
+TEST(ParserChunkingTest, sameEventsForAnyChunking)
+{
+    const char* pieces[] = {"t1111AA\r", "T0987654381234567890ABCDEF\r", "z\r", "t8FF0\r", "t7FF9123\r",
+                            "T11111111a123\r", "xyq\r", "t12321\r", "t0010\r", "T1FFFFFFF0\r", "zq\r", "\r",
+                            "t1232ABXD\r", "t0018AABBCCDDEEFF0011\r", "Z\r", "\a",
+                            "t12\a", "Zq\a"};
+    std::srand(7);
+    std::string stream;
+    for (int i = 0; i < 2000; i++) {
+        stream += pieces[std::rand() % (sizeof(pieces) / sizeof(pieces[0]))];
+    }
+
+    RecordingParser whole;
+    whole.acceptData(stream.data(), stream.size());
+
+    for (std::size_t maxChunk : {1, 2, 3, 5, 8, 13, 30, 64}) {
+        RecordingParser chunked;
+        std::size_t offset = 0;
+        while (offset < stream.size()) {
+            std::size_t chunk = std::min(stream.size() - offset, 1 + std::rand() % maxChunk);
+            chunked.acceptData(stream.data() + offset, chunk);
+            offset += chunk;
+        }
+        EXPECT_EQ(whole.events, chunked.events) << "max chunk " << maxChunk;
+    }
+}
+
+TEST(ParserChunkingTest, junkCarriedOverAnySplit)
+{
+    // messages turning into junk right before a chunk boundary, the junk goes on up to the next '\r' or BELL
+    const char* streams[] = {"tE8Ct7FF81122334455667788\r", "TFFFFFFFFt1232ABCD\r", "t1239t1232ABCD\r",
+                             "xt1232ABCD\at1232ABCD\r", "zqt1232ABCD\rz\r", "Zqq\aZ\r", "dFFF0\r",
+                             "t7FF1AAt1232ABCD\r"};
+    for (const char* stream : streams) {
+        std::size_t size = std::strlen(stream);
+        RecordingParser whole;
+        whole.acceptData(stream, size);
+        for (std::size_t split = 1; split < size; split++) {
+            RecordingParser chunked;
+            chunked.acceptData(stream, split);
+            chunked.acceptData(stream + split, size - split);
+            EXPECT_EQ(whole.events, chunked.events) << stream << " split at " << split;
+        }
+    }
+
+    RecordingParser parser;
+    parser.acceptData("tE8C", 4);
+    parser.acceptData("t7FF81122334455667788\r", 22);
+    EXPECT_EQ("JtE8Ct7FF81122334455667788", parser.events);
+}
+
+TEST(ParserFdTest, frames)
+{
+    RecordingParser parser;
+    std::string stream = "d1232AABB\rB123456780\rb7FF9" + std::string(24, '4') + "\rD00000001F" + std::string(128, 'A')
+                         + "\r";
+    parser.acceptData(stream.data(), stream.size());
+    EXPECT_EQ("FS291:\xAA\xBB;BX305419896:;BS2047:" + std::string(12, '\x44') + ";FX1:" + std::string(64, '\xAA') + ";",
+              parser.events);
+}
+
+TEST(ParserFdTest, invalidFrames)
+{
+    RecordingParser parser;
+    // address too long for a std id, missing payload, lowercase hex and a classic frame with an FD length
+    std::string stream = "d8000\rd1239AA\rD000000011aa\rt1239" + std::string(24, '0') + "\r";
+    parser.acceptData(stream.data(), stream.size());
+    // junk pieces with no event in between are glued together
+    EXPECT_EQ("Jd8000d1239AAD000000011aat1239" + std::string(24, '0'), parser.events);
+}
+
+TEST(ParserFdTest, sameEventsForAnyChunking)
+{
+    std::string fd64 = "B1FFFFFFFF" + std::string(126, 'B') + "0D\r";
+    const char* pieces[] = {"t1111AA\r", "d1230\r", "b7FFA" "0102030405060708090A0B0C0D0E0F10\r", fd64.c_str(),
+                            "D1234567F00\r", "z\r", "dB\r", "BD\r", "T0987654381234567890ABCDEF\r", "\a"};
+    std::srand(11);
+    std::string stream;
+    for (int i = 0; i < 1000; i++) {
+        stream += pieces[std::rand() % (sizeof(pieces) / sizeof(pieces[0]))];
+    }
+
+    RecordingParser whole;
+    whole.acceptData(stream.data(), stream.size());
+    EXPECT_NE(std::string::npos, whole.events.find("BX536870911:"));
+
+    for (std::size_t maxChunk : {1, 2, 7, 30, 64, 200}) {
+        RecordingParser chunked;
+        std::size_t offset = 0;
+        while (offset < stream.size()) {
+            std::size_t chunk = std::min(stream.size() - offset, 1 + std::rand() % maxChunk);
+            chunked.acceptData(stream.data() + offset, chunk);
+            offset += chunk;
+        }
+        EXPECT_EQ(whole.events, chunked.events) << "max chunk " << maxChunk;
+    }
+}
@@ -0,0 +1,167 @@
+#include "dtacan/SerialReactor.h"
+
+#include "DtaCanTest.h"
+
+#include <pty.h>
+
+#include <string>
+#include <vector>
+
+using namespace dtacan;
+
+class TestPort : public SerialPort<TestPort, 256> {
+public:
+    void handleData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        events += "D" + std::to_string(address) + ":" + std::to_string(size) + ";";
+        (void)data;
+    }
+
+    void handleJunk(const uint8_t* junk, std::size_t size)
+    {
+        events += "J" + std::string((const char*)junk, size) + ";";
+    }
+
+    void handleReceipt()
+    {
+        events += "R;";
+    }
+
+    void handleClosed(int error)
+    {
+        closedError = error;
+        closed++;
+    }
+
+    void handleOutputDrained()
+    {
+        drained++;
+    }
+
+    std::string events;
+    int closed = 0;
+    int closedError = -1;
+    int drained = 0;
+};
+
+// The port under test serves the slave side of a pty, the test plays the adapter on the master side
+class SerialReactorTest : public ::testing::Test {
+public:
+    void SetUp() override
+    {
+        ASSERT_TRUE(_reactor.isValid());
+        for (std::size_t i = 0; i < portNum; i++) {
+            int slave;
+            ASSERT_EQ(0, openpty(&_master[i], &slave, nullptr, nullptr, nullptr));
+            ASSERT_EQ(0, fcntl(_master[i], F_SETFL, fcntl(_master[i], F_GETFL) | O_NONBLOCK));
+            ASSERT_TRUE(_ports[i].attach(&_reactor, slave, SerialOptions()));
+        }
+    }
+
+    void TearDown() override
+    {
+        for (std::size_t i = 0; i < portNum; i++) {
+            _ports[i].close();
+            if (_master[i] >= 0) {
+                close(_master[i]);
+            }
+        }
+    }
+
+    void adapterWrite(std::size_t port, const std::string& data)
+    {
+        ASSERT_EQ(ssize_t(data.size()), write(_master[port], data.data(), data.size()));
+    }
+
+    std::string adapterRead(std::size_t port)
+    {
+        std::string result;
+        char buffer[4096];
+        ssize_t size;
+        while ((size = read(_master[port], buffer, sizeof(buffer))) > 0) {
+            result.append(buffer, size);
+        }
+        return result;
+    }
+
+    // Polls until port got expected events or nothing happens for a while
+    void pollFor(std::size_t port, const std::string& events)
+    {
+        while (_ports[port].events.size() < events.size() && _reactor.poll(1000) > 0) {
+        }
+        EXPECT_EQ(events, _ports[port].events);
+    }
+
+protected:
+    static const std::size_t portNum = 3;
+
+    SerialReactor _reactor;
+    TestPort _ports[portNum];
+    int _master[portNum];
+};
+
+TEST_F(SerialReactorTest, receivesFromSeveralPorts)
+{
+    adapterWrite(0, "t1231AA\rz\r");
+    adapterWrite(2, "T000001002AABB\rxx\r");
+    pollFor(0, "D291:1;R;");
+    pollFor(2, "D256:2;Jxx;");
+    EXPECT_EQ("", _ports[1].events);
+}
+
+TEST_F(SerialReactorTest, messageSplitBetweenReads)
+{
+    adapterWrite(1, "t12");
+    _reactor.poll(1000);
+    adapterWrite(1, "31AA\r");
+    pollFor(1, "D291:1;");
+}
+
+TEST_F(SerialReactorTest, transmitsInRawMode)
+{
+    uint8_t data[2] = {0x0d, 0x0a};
+    ASSERT_TRUE(_ports[0].transmitStdFrame(0x123, data, 2));
+    _ports[1].openCanChannel();
+    EXPECT_EQ("t12320D0A\r", adapterRead(0));
+    EXPECT_EQ("O\r", adapterRead(1));
+    EXPECT_EQ(0u, _ports[0].outputSize());
+}
+
+TEST_F(SerialReactorTest, waitsForWritableWhenTtyIsFull)
+{
+    uint8_t data[8] = {};
+    std::size_t sent = 0;
+    while (_ports[0].outputSize() == 0) {
+        ASSERT_TRUE(_ports[0].transmitStdFrame(0x1, data, 8));
+        sent += 22;
+    }
+    // the buffer is bounded, streams that don't fit are dropped whole
+    while (_ports[0].outputFree() >= 22) {
+        ASSERT_TRUE(_ports[0].transmitStdFrame(0x1, data, 8));
+        sent += 22;
+    }
+    ASSERT_TRUE(_ports[0].transmitStdFrame(0x1, data, 8));
+    EXPECT_EQ(22u, _ports[0].droppedBytes());
+
+    std::string received = adapterRead(0);
+    while (received.size() < sent) {
+        ASSERT_GT(_reactor.poll(1000), 0);
+        received += adapterRead(0);
+    }
+    EXPECT_EQ(sent, received.size());
+    EXPECT_EQ(0u, _ports[0].outputSize());
+    EXPECT_EQ(1, _ports[0].drained);
+    EXPECT_EQ(0, _ports[0].closed);
+}
+
+TEST_F(SerialReactorTest, hangup)
+{
+    adapterWrite(2, "z\r");
+    close(_master[2]);
+    _master[2] = -1;
+    while (_ports[2].isOpen() && _reactor.poll(1000) > 0) {
+    }
+    EXPECT_FALSE(_ports[2].isOpen());
+    EXPECT_EQ(1, _ports[2].closed);
+    EXPECT_TRUE(_ports[0].isOpen());
+}
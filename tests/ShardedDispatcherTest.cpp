@@ -0,0 +1,186 @@
+#include "dtacan/Parser.h"
+#include "dtacan/ShardedDispatcher.h"
+
+#include "DtaCanTest.h"
+
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace dtacan;
+
+// Checks that every id arrives in order, the payload holds a per-id counter
+class OrderChecker : public ShardedDispatcher<OrderChecker, 16, 64, 4> {
+public:
+    OrderChecker()
+        : errors(0)
+        , total(0)
+        , slowAddress(0xffffffff)
+    {
+        for (auto& count : next) {
+            count.store(0);
+        }
+    }
+
+    ~OrderChecker()
+    {
+        stop();
+    }
+
+    void handleFrame(std::size_t worker, const Frame& frame)
+    {
+        (void)worker;
+        if (frame.address == slowAddress) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        uint32_t expected = next[frame.address].load(std::memory_order_relaxed);
+        uint32_t value = frame.data[0] | (frame.data[1] << 8) | (frame.data[2] << 16);
+        if (value != expected) {
+            errors++;
+        }
+        next[frame.address].store(expected + 1, std::memory_order_relaxed);
+        total++;
+    }
+
+    std::atomic<uint32_t> next[2048];
+    std::atomic<uint64_t> errors;
+    std::atomic<uint64_t> total;
+    uint32_t slowAddress;
+};
+
+static Frame makeFrame(uint32_t address, uint32_t counter)
+{
+    Frame frame;
+    frame.address = address;
+    frame.isExtended = false;
+    frame.size = 3;
+    frame.data[0] = counter;
+    frame.data[1] = counter >> 8;
+    frame.data[2] = counter >> 16;
+    return frame;
+}
+
+TEST(ShardedDispatcherTest, keepsOrderPerId)
+{
+    std::unique_ptr<OrderChecker> dispatcher(new OrderChecker);
+    EXPECT_FALSE(dispatcher->start(0));
+    EXPECT_FALSE(dispatcher->start(5));
+    ASSERT_TRUE(dispatcher->start(4));
+    EXPECT_FALSE(dispatcher->start(2));
+    EXPECT_EQ(4u, dispatcher->workerCount());
+
+    uint32_t counters[2048] = {};
+    for (int i = 0; i < 200000; i++) {
+        uint32_t address = (i * 7919) % 100;
+        dispatcher->dispatch(makeFrame(address, counters[address]++));
+    }
+    dispatcher->stop();
+    EXPECT_EQ(200000u, dispatcher->total.load());
+    EXPECT_EQ(0u, dispatcher->errors.load());
+    uint64_t handled = 0;
+    for (std::size_t i = 0; i < 4; i++) {
+        handled += dispatcher->handled(i);
+        EXPECT_EQ(0u, dispatcher->depth(i));
+    }
+    EXPECT_EQ(200000u, handled);
+}
+
+TEST(ShardedDispatcherTest, idleWorkersTakeShards)
+{
+    std::unique_ptr<OrderChecker> dispatcher(new OrderChecker);
+    dispatcher->setStealThreshold(4);
+    ASSERT_TRUE(dispatcher->start(2));
+    // let both workers go idle
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    // the slow id keeps its owner busy, other ids of that owner should move to the idle worker
+    uint32_t slow = 0;
+    std::size_t slowOwner = dispatcher->shardOwner(OrderChecker::shardOf(slow, false));
+    dispatcher->slowAddress = slow;
+    uint32_t counters[2048] = {};
+    for (int i = 0; i < 32; i++) {
+        dispatcher->dispatch(makeFrame(slow, counters[slow]++));
+    }
+    std::vector<uint32_t> moved;
+    for (uint32_t address = 1; address < 200; address++) {
+        std::size_t shard = OrderChecker::shardOf(address, false);
+        if (shard != OrderChecker::shardOf(slow, false) && dispatcher->shardOwner(shard) == slowOwner) {
+            moved.push_back(address);
+            dispatcher->dispatch(makeFrame(address, counters[address]++));
+        }
+    }
+    ASSERT_FALSE(moved.empty());
+    // the first one goes to the idle worker for sure, the rest depend on whether it went idle again
+    EXPECT_GT(dispatcher->migrations(), 0u);
+    EXPECT_NE(slowOwner, dispatcher->shardOwner(OrderChecker::shardOf(moved[0], false)));
+    dispatcher->stop();
+    EXPECT_EQ(0u, dispatcher->errors.load());
+}
+
+class ParsingDispatcher : public Parser<ParsingDispatcher>, public ShardedDispatcher<ParsingDispatcher> {
+public:
+    ~ParsingDispatcher()
+    {
+        stop();
+    }
+
+    static const std::size_t frameBatchSize = 16;
+
+    void handleFrames(const Frame* frames, std::size_t count)
+    {
+        dispatch(frames, count);
+    }
+
+    void handleFrame(std::size_t worker, const Frame& frame)
+    {
+        (void)worker;
+        sum += frame.data[0];
+    }
+
+    std::atomic<uint64_t> sum{0};
+};
+
+TEST(ShardedDispatcherTest, idleWorkersSleep)
+{
+    std::unique_ptr<OrderChecker> dispatcher(new OrderChecker);
+    ASSERT_TRUE(dispatcher->start(4));
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::clock_t start = std::clock();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    // the process used well under the 4 * 200 ms of spinning workers
+    EXPECT_LT(std::clock() - start, CLOCKS_PER_SEC / 20);
+
+    // sleeping workers wake up for new frames, the producer sleeps on the full ring of the slow one
+    uint32_t slow = 0;
+    dispatcher->slowAddress = slow;
+    uint32_t counters[2048] = {};
+    auto wallStart = std::chrono::steady_clock::now();
+    start = std::clock();
+    for (int i = 0; i < 500; i++) {
+        dispatcher->dispatch(makeFrame(slow, counters[slow]++));
+        dispatcher->dispatch(makeFrame(i % 100 + 1, counters[i % 100 + 1]++));
+    }
+    dispatcher->stop();
+    double cpu = double(std::clock() - start) / CLOCKS_PER_SEC;
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    EXPECT_LT(cpu, wall / 2);
+    EXPECT_EQ(1000u, dispatcher->total.load());
+    EXPECT_EQ(0u, dispatcher->errors.load());
+}
+
+TEST(ShardedDispatcherTest, fedByParser)
+{
+    std::unique_ptr<ParsingDispatcher> dispatcher(new ParsingDispatcher);
+    ASSERT_TRUE(dispatcher->start(3));
+    std::string stream;
+    for (int i = 0; i < 1000; i++) {
+        stream += "t123105\rT00000456102\r";
+    }
+    dispatcher->acceptData(stream.data(), stream.size());
+    dispatcher->stop();
+    EXPECT_EQ(1000u * (5 + 2), dispatcher->sum.load());
+}
@@ -0,0 +1,132 @@
+#include "dtacan/Parser.h"
+#include "dtacan/SubmitQueue.h"
+
+#include "DtaCanTest.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace dtacan;
+
+class TestQueue : public SubmitQueue<TestQueue, 8, 4> {
+public:
+    void handleEncodedData(const char* str, std::size_t size)
+    {
+        writes.emplace_back(str, size);
+    }
+
+    std::vector<std::string> writes;
+};
+
+TEST(SubmitQueueTest, drainsInBatches)
+{
+    TestQueue queue;
+    uint8_t data[2] = {0x12, 0x34};
+    for (uint32_t address = 1; address <= 6; address++) {
+        EXPECT_TRUE(queue.trySubmit(address, data, 2, false));
+    }
+    EXPECT_EQ(6u, queue.depth());
+    EXPECT_EQ(6u, queue.drain());
+    EXPECT_EQ(0u, queue.depth());
+    ASSERT_EQ(2u, queue.writes.size());
+    EXPECT_EQ("t00121234\rt00221234\rt00321234\rt00421234\r", queue.writes[0]);
+    EXPECT_EQ("t00521234\rt00621234\r", queue.writes[1]);
+    EXPECT_EQ(0u, queue.drain());
+}
+
+TEST(SubmitQueueTest, fullAndInvalid)
+{
+    TestQueue queue;
+    uint8_t data[9] = {};
+    EXPECT_FALSE(queue.trySubmit(0x800, data, 1, false));
+    EXPECT_FALSE(queue.submit(0x800, data, 1, false));
+    EXPECT_FALSE(queue.trySubmit(0x1, data, 9, true));
+    for (int i = 0; i < 8; i++) {
+        EXPECT_TRUE(queue.trySubmit(0x1, data, 0, true));
+    }
+    EXPECT_FALSE(queue.trySubmit(0x1, data, 0, true));
+    EXPECT_EQ(8u, queue.depth());
+    EXPECT_EQ(8u, queue.drain());
+    EXPECT_TRUE(queue.trySubmit(0x1, data, 0, true));
+    EXPECT_EQ(1u, queue.depth());
+}
+
+TEST(SubmitQueueTest, emptyFrameWithoutData)
+{
+    TestQueue queue;
+    EXPECT_TRUE(queue.trySubmit(0x123, nullptr, 0, false));
+    EXPECT_TRUE(queue.submit(0x1234567, nullptr, 0, true));
+    EXPECT_EQ(2u, queue.drain());
+    ASSERT_EQ(1u, queue.writes.size());
+    EXPECT_EQ("t1230\rT012345670\r", queue.writes[0]);
+}
+
+class ThreadedQueue : public SubmitQueue<ThreadedQueue, 64, 16>, public Parser<ThreadedQueue> {
+public:
+    void handleEncodedData(const char* str, std::size_t size)
+    {
+        acceptData(str, size);
+    }
+
+    void handleData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        // address is the producer, payload is the per producer sequence number
+        ASSERT_EQ(4u, size);
+        uint32_t sequence = data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+        ASSERT_LT(address, next.size());
+        EXPECT_EQ(next[address], sequence);
+        next[address] = sequence + 1;
+        frames++;
+    }
+
+    void handleJunk(const uint8_t*, std::size_t)
+    {
+        junk++;
+    }
+
+    std::vector<uint32_t> next = std::vector<uint32_t>(4, 0);
+    std::size_t frames = 0;
+    std::size_t junk = 0;
+};
+
+TEST(SubmitQueueTest, concurrentProducersKeepPerProducerOrder)
+{
+    const std::size_t producerNum = 4;
+    const uint32_t frameNum = 20000;
+    ThreadedQueue queue;
+    std::atomic<std::size_t> running(producerNum);
+    std::vector<std::thread> producers;
+    for (std::size_t p = 0; p < producerNum; p++) {
+        producers.emplace_back([&queue, &running, p, frameNum]() {
+            for (uint32_t i = 0; i < frameNum; i++) {
+                uint8_t data[4] = {uint8_t(i), uint8_t(i >> 8), uint8_t(i >> 16), uint8_t(i >> 24)};
+                if (i & 1) {
+                    queue.submit(p, data, 4, false);
+                } else {
+                    while (!queue.trySubmit(p, data, 4, true)) {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+            running--;
+        });
+    }
+    std::size_t drained = 0;
+    while (running != 0) {
+        std::size_t count = queue.drain();
+        if (count == 0) {
+            std::this_thread::yield();
+        }
+        drained += count;
+    }
+    for (std::thread& t : producers) {
+        t.join();
+    }
+    drained += queue.drain();
+    EXPECT_EQ(producerNum * frameNum, drained);
+    EXPECT_EQ(producerNum * frameNum, queue.frames);
+    EXPECT_EQ(0u, queue.junk);
+    EXPECT_EQ(0u, queue.depth());
+}
@@ -0,0 +1,121 @@
+#include "dtacan/Parser.h"
+#include "dtacan/TrafficStats.h"
+
+#include "DtaCanTest.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+using namespace dtacan;
+
+class StatsParser : public Parser<StatsParser> {
+public:
+    void handleData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        (void)data;
+        stats.record(address, isExtendedFrame(), size, now);
+    }
+
+    TrafficStats<4> stats;
+    uint64_t now = 0;
+};
+
+TEST(TrafficStatsTest, perIdCounters)
+{
+    StatsParser parser;
+    const uint64_t gaps[] = {0, 1000, 3000, 2000};
+    for (uint64_t gap : gaps) {
+        parser.now += gap;
+        parser.acceptData("t1232AABB\rT000004561CC\r", 23);
+    }
+
+    IdStats stats;
+    ASSERT_TRUE(parser.stats.find(0x123, false, &stats));
+    EXPECT_EQ(0x123u, stats.address);
+    EXPECT_FALSE(stats.isExtended);
+    EXPECT_EQ(4u, stats.frames);
+    EXPECT_EQ(8u, stats.bytes);
+    EXPECT_EQ(6000u, stats.lastNs);
+    EXPECT_EQ(1000u, stats.minGapNs);
+    EXPECT_EQ(3000u, stats.maxGapNs);
+    EXPECT_EQ(2000u, stats.meanGapNs);
+    // deviations of 2000 and 1000 smoothed by 1/16: 125 + (1000 - 125) / 16
+    EXPECT_EQ(179u, stats.jitterNs);
+
+    ASSERT_TRUE(parser.stats.find(0x456, true, &stats));
+    EXPECT_TRUE(stats.isExtended);
+    EXPECT_EQ(4u, stats.bytes);
+    EXPECT_FALSE(parser.stats.find(0x456, false, &stats));
+    EXPECT_EQ(2u, parser.stats.size());
+
+    IdStats all[4];
+    EXPECT_EQ(2u, parser.stats.snapshot(all, 4));
+    EXPECT_EQ(1u, parser.stats.snapshot(all, 1));
+}
+
+TEST(TrafficStatsTest, fullTable)
+{
+    TrafficStats<2> stats;
+    stats.record(1, false, 0, 0);
+    stats.record(2, false, 0, 0);
+    stats.record(3, false, 0, 0);
+    stats.record(1, false, 0, 10);
+    IdStats id;
+    EXPECT_FALSE(stats.find(3, false, &id));
+    ASSERT_TRUE(stats.find(1, false, &id));
+    EXPECT_EQ(2u, id.frames);
+    BusStats bus = stats.busStats();
+    EXPECT_EQ(4u, bus.frames);
+    EXPECT_EQ(1u, bus.untracked);
+    EXPECT_EQ(4u * frameBits(0, false), bus.bits);
+}
+
+TEST(TrafficStatsTest, busLoad)
+{
+    TrafficStats<> stats;
+    stats.setBaudRate(BaudRate::Baud125k);
+    stats.setWindow(10000000);
+    EXPECT_EQ(0, stats.busStats().load);
+    // an 8 byte std frame every 4320 us takes a quarter of the bus at 125k
+    uint64_t period = 4 * frameDurationNs(BaudRate::Baud125k, 8, false);
+    uint64_t now = 0;
+    for (int i = 0; i < 10; i++) {
+        stats.record(0x100, false, 8, now);
+        now += period;
+    }
+    EXPECT_NEAR(0.25, stats.busStats().load, 0.001);
+    // windows close at frames 3, 6 and 9, the last one holds only the 9th frame
+    stats.tick(now + 20000000);
+    EXPECT_NEAR(0.25 * period / (period + 20000000), stats.busStats().load, 0.001);
+    stats.tick(now + 40000000);
+    EXPECT_EQ(0, stats.busStats().load);
+}
+
+// Every frame of the id has 8 bytes, a torn read would show bytes out of step with frames
+TEST(TrafficStatsTest, concurrentReaders)
+{
+    TrafficStats<16> stats;
+    std::atomic<bool> done(false);
+    std::atomic<uint64_t> reads(0);
+    std::thread reader([&] {
+        IdStats id;
+        while (!done.load()) {
+            if (stats.find(0x10, true, &id)) {
+                ASSERT_EQ(id.frames * 8, id.bytes);
+                ASSERT_EQ(id.frames - 1, id.lastNs);
+                reads++;
+            }
+        }
+    });
+    for (uint64_t i = 0; i < 2000000; i++) {
+        stats.record(0x10, true, 8, i);
+        stats.record(0x20, false, 1, i);
+    }
+    done = true;
+    reader.join();
+    IdStats id;
+    ASSERT_TRUE(stats.find(0x10, true, &id));
+    EXPECT_EQ(2000000u, id.frames);
+    EXPECT_EQ(1u, id.maxGapNs);
+}
@@ -0,0 +1,179 @@
+#include "dtacan/TransmitPipeline.h"
+
+#include "DtaCanTest.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace dtacan;
+
+class TransmitPipelineTest : public ::testing::Test, public TransmitPipeline<TransmitPipelineTest, 4, 8> {
+public:
+    void handleEncodedData(const char* str, std::size_t size)
+    {
+        _writes.emplace_back(str, size);
+    }
+
+    void handleTransmitted(const Frame& frame)
+    {
+        _results += "ok:" + std::to_string(frame.address) + ";";
+    }
+
+    void handleTransmitFailed(const Frame& frame)
+    {
+        _results += "fail:" + std::to_string(frame.address) + ";";
+    }
+
+    void acceptString(const char* str)
+    {
+        acceptData(str, std::strlen(str));
+    }
+
+    void submitStd(uint32_t address)
+    {
+        uint8_t data = address;
+        ASSERT_TRUE(submit(address, &data, 1, false));
+    }
+
+protected:
+    std::vector<std::string> _writes;
+    std::string _results;
+};
+
+TEST_F(TransmitPipelineTest, coalescesWhileWindowIsOpen)
+{
+    for (uint32_t address = 1; address <= 6; address++) {
+        submitStd(address);
+    }
+    EXPECT_TRUE(_writes.empty());
+    flush();
+    ASSERT_EQ(1u, _writes.size());
+    EXPECT_EQ("t001101\rt002102\rt003103\rt004104\r", _writes[0]);
+    EXPECT_EQ(4u, inFlight());
+    EXPECT_EQ(2u, pending());
+
+    acceptString("z\rz\r");
+    EXPECT_EQ("ok:1;ok:2;", _results);
+    ASSERT_EQ(2u, _writes.size());
+    EXPECT_EQ("t005105\rt006106\r", _writes[1]);
+    EXPECT_EQ(4u, inFlight());
+    EXPECT_EQ(0u, pending());
+
+    acceptString("z\rz\rz\rz\r");
+    EXPECT_EQ("ok:1;ok:2;ok:3;ok:4;ok:5;ok:6;", _results);
+    EXPECT_EQ(0u, inFlight());
+    EXPECT_EQ(2u, _writes.size());
+}
+
+TEST_F(TransmitPipelineTest, windowSize)
+{
+    EXPECT_FALSE(setWindowSize(0));
+    EXPECT_FALSE(setWindowSize(5));
+    EXPECT_TRUE(setWindowSize(1));
+    submitStd(1);
+    submitStd(2);
+    flush();
+    flush();
+    ASSERT_EQ(1u, _writes.size());
+    EXPECT_EQ("t001101\r", _writes[0]);
+    acceptString("z\r");
+    ASSERT_EQ(2u, _writes.size());
+    EXPECT_EQ("t002102\r", _writes[1]);
+}
+
+TEST_F(TransmitPipelineTest, extReceipt)
+{
+    uint8_t data[2] = {0xAB, 0xCD};
+    ASSERT_TRUE(submit(0x1234567, data, 2, true));
+    flush();
+    ASSERT_EQ(1u, _writes.size());
+    EXPECT_EQ("T012345672ABCD\r", _writes[0]);
+    acceptString("Z\r");
+    EXPECT_EQ("ok:19088743;", _results);
+}
+
+TEST_F(TransmitPipelineTest, receiptTypeMismatch)
+{
+    uint8_t data = 0;
+    submitStd(1);
+    ASSERT_TRUE(submit(0x2, &data, 1, true));
+    submitStd(3);
+    flush();
+    // the receipt of frame 1 is missing, 'Z' can't be matched to it
+    acceptString("Z\r");
+    EXPECT_EQ("fail:1;fail:2;fail:3;", _results);
+    EXPECT_EQ(1u, receiptMismatches());
+    EXPECT_EQ(0u, inFlight());
+
+    // replies to frames no longer in flight are ignored
+    acceptString("z\r");
+    EXPECT_EQ(1u, receiptMismatches());
+}
+
+TEST_F(TransmitPipelineTest, emptyFrameWithoutData)
+{
+    ASSERT_TRUE(submit(0x123, nullptr, 0, false));
+    flush();
+    ASSERT_EQ(1u, _writes.size());
+    EXPECT_EQ("t1230\r", _writes[0]);
+    acceptString("z\r");
+    EXPECT_EQ("ok:291;", _results);
+    EXPECT_EQ(0u, receiptMismatches());
+}
+
+TEST_F(TransmitPipelineTest, nackRetransmitsThenFails)
+{
+    setMaxRetries(1);
+    submitStd(1);
+    submitStd(2);
+    flush();
+    acceptString("\a");
+    ASSERT_EQ(2u, _writes.size());
+    EXPECT_EQ("t001101\r", _writes[1]);
+    EXPECT_EQ(2u, inFlight());
+
+    acceptString("z\r");
+    EXPECT_EQ("ok:2;", _results);
+    acceptString("\a");
+    EXPECT_EQ("ok:2;fail:1;", _results);
+    EXPECT_EQ(0u, inFlight());
+    EXPECT_EQ(2u, _writes.size());
+}
+
+TEST_F(TransmitPipelineTest, repliesSplitBetweenCalls)
+{
+    submitStd(1);
+    submitStd(2);
+    flush();
+    acceptString("z");
+    EXPECT_EQ("", _results);
+    acceptString("\r\a");
+    EXPECT_EQ("ok:1;fail:2;", _results);
+}
+
+TEST_F(TransmitPipelineTest, rejectsInvalidFramesAndFullQueue)
+{
+    uint8_t data[9] = {};
+    EXPECT_FALSE(submit(0x800, data, 1, false));
+    EXPECT_FALSE(submit(0x20000000, data, 1, true));
+    EXPECT_FALSE(submit(0x1, data, 9, false));
+    for (int i = 0; i < 8; i++) {
+        EXPECT_TRUE(submit(0x1, data, 1, false));
+    }
+    EXPECT_FALSE(submit(0x1, data, 1, false));
+    EXPECT_EQ(8u, pending());
+}
+
+TEST_F(TransmitPipelineTest, abortInFlight)
+{
+    setMaxRetries(3);
+    submitStd(1);
+    submitStd(2);
+    submitStd(3);
+    flush();
+    acceptString("z\r\a");
+    abortInFlight();
+    EXPECT_EQ("ok:1;fail:3;fail:2;", _results);
+    EXPECT_EQ(0u, inFlight());
+}
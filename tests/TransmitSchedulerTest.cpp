@@ -0,0 +1,152 @@
+#include "dtacan/AdapterEmulator.h"
+#include "dtacan/TransmitScheduler.h"
+
+#include "DtaCanTest.h"
+
+#include <string>
+#include <vector>
+
+using namespace dtacan;
+
+class TestScheduler : public TransmitScheduler<TestScheduler, 16, 4> {
+public:
+    void handleEncodedData(const char* str, std::size_t size)
+    {
+        writes.emplace_back(str, size);
+    }
+
+    std::vector<std::string> writes;
+};
+
+TEST(TransmitSchedulerTest, arbitrationOrder)
+{
+    TestScheduler scheduler;
+    uint8_t data[1] = {0xAA};
+    EXPECT_TRUE(scheduler.schedule(0x300, data, 1, false, 0));
+    EXPECT_TRUE(scheduler.schedule(0x00100000, data, 1, true, 0));
+    EXPECT_TRUE(scheduler.schedule(0x004, data, 1, false, 0));
+    EXPECT_TRUE(scheduler.schedule(0x300, data, 0, false, 0));
+    EXPECT_FALSE(scheduler.schedule(0x800, data, 1, false, 0));
+    EXPECT_EQ(4u, scheduler.pending());
+    EXPECT_EQ(4u, scheduler.poll(0));
+    ASSERT_EQ(1u, scheduler.writes.size());
+    // ext 0x00100000 has base id 0x004 and loses to the std frame with the same one
+    EXPECT_EQ("t0041AA\rT001000001AA\rt3001AA\rt3000\r", scheduler.writes[0]);
+    EXPECT_EQ(0u, scheduler.pending());
+    EXPECT_EQ(UINT64_MAX, scheduler.nextPollTime(0));
+}
+
+TEST(TransmitSchedulerTest, pacing)
+{
+    TestScheduler scheduler;
+    scheduler.setBusRate(BaudRate::Baud125k);
+    scheduler.setUtilization(0.5);
+    uint8_t data[8] = {};
+    // std frame with 8 bytes is 135 bits, 1080 us at 125k, burst fits 4 ext frames of 160 bits
+    uint64_t cost = frameDurationNs(BaudRate::Baud125k, 8, false);
+    EXPECT_EQ(1080000u, cost);
+    for (int i = 0; i < 10; i++) {
+        EXPECT_TRUE(scheduler.schedule(0x100, data, 8, false, 0));
+    }
+    EXPECT_EQ(4u, scheduler.poll(0));
+    uint64_t next = scheduler.nextPollTime(0);
+    EXPECT_GT(next, 0u);
+    EXPECT_EQ(0u, scheduler.poll(next - 2));
+    EXPECT_EQ(1u, scheduler.poll(next));
+
+    // in the long run frames leave at half of the bus rate
+    uint64_t now = next;
+    std::size_t sent = 5;
+    while (scheduler.pending() != 0) {
+        now = scheduler.nextPollTime(now);
+        sent += scheduler.poll(now);
+    }
+    EXPECT_EQ(10u, sent);
+    EXPECT_NEAR(double(now), 2.0 * (10 * cost - 4 * 1280000), 1000);
+}
+
+TEST(TransmitSchedulerTest, rateLimit)
+{
+    TestScheduler scheduler;
+    uint8_t data[1] = {};
+    EXPECT_TRUE(scheduler.setRateLimit(0x100, false, 1000000));
+    for (int i = 0; i < 3; i++) {
+        EXPECT_TRUE(scheduler.schedule(0x100, data, 1, false, 0));
+    }
+    EXPECT_TRUE(scheduler.schedule(0x200, data, 1, false, 0));
+    EXPECT_EQ(2u, scheduler.poll(0));
+    EXPECT_EQ("t1001" "00\rt2001" "00\r", scheduler.writes[0]);
+    EXPECT_EQ(1000000u, scheduler.nextPollTime(0));
+    EXPECT_EQ(0u, scheduler.poll(999999));
+    EXPECT_EQ(1u, scheduler.poll(1000000));
+    EXPECT_EQ(1u, scheduler.poll(2000000));
+    EXPECT_EQ(0u, scheduler.pending());
+}
+
+TEST(TransmitSchedulerTest, scheduleData)
+{
+    TestScheduler scheduler;
+    uint8_t data[20] = {};
+    uint8_t urgent[1] = {0x11};
+    EXPECT_FALSE(scheduler.scheduleData(0x700, data, 16 * 8 + 1, 0));
+    EXPECT_TRUE(scheduler.scheduleData(0x700, data, 20, 0));
+    EXPECT_TRUE(scheduler.schedule(0x010, urgent, 1, false, 0));
+    EXPECT_EQ(4u, scheduler.pending());
+    EXPECT_EQ(4u, scheduler.poll(0));
+    EXPECT_EQ("t010111\rt70080000000000000000\rt70080000000000000000\rt700400000000\r", scheduler.writes[0]);
+}
+
+class Host;
+
+class Adapter : public AdapterEmulator<Adapter, 8> {
+public:
+    explicit Adapter(const EmulatorOptions& options)
+        : AdapterEmulator<Adapter, 8>(options)
+    {
+    }
+
+    void handleOutput(const char* data, std::size_t size)
+    {
+        output.append(data, size);
+    }
+
+    std::string output;
+};
+
+class Host : public TransmitScheduler<Host, 1024> {
+public:
+    void handleEncodedData(const char* str, std::size_t size)
+    {
+        adapter->acceptData(str, size);
+    }
+
+    Adapter* adapter;
+};
+
+// 500 frames queued at once reach the adapter with an 8 frame FIFO at 125k without a single NACK
+TEST(TransmitSchedulerTest, neverOverrunsAdapter)
+{
+    EmulatorOptions options;
+    options.baudRate = BaudRate::Baud125k;
+    Adapter adapter(options);
+    adapter.acceptData("O\r", 2);
+    Host host;
+    host.adapter = &adapter;
+    host.setBusRate(BaudRate::Baud125k);
+    host.setUtilization(0.95);
+    uint8_t data[8] = {};
+    for (uint32_t i = 0; i < 500; i++) {
+        ASSERT_TRUE(host.schedule(i & 0x7ff, data, i % 9, (i & 3) == 0, 0));
+    }
+    uint64_t now = 0;
+    while (host.pending() != 0 || adapter.nextEventTime() != UINT64_MAX) {
+        host.poll(now);
+        adapter.advance(now);
+        now = std::min(host.nextPollTime(now), adapter.nextEventTime());
+    }
+    now = adapter.now();
+    EXPECT_EQ(0u, adapter.stats().nacks);
+    EXPECT_EQ(0u, adapter.stats().droppedReplies);
+    EXPECT_EQ(500u, adapter.stats().hostFrames);
+    EXPECT_GT(double(adapter.stats().busyNs) / now, 0.9);
+}
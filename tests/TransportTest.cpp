@@ -0,0 +1,122 @@
+#include "dtacan/UringPort.h"
+
+#include "DtaCanTest.h"
+
+#include <pty.h>
+
+#include <string>
+
+using namespace dtacan;
+
+// template template arguments must match the parameter list exactly
+template <typename B>
+using DefaultReadWritePort = ReadWritePort<B>;
+
+#ifdef DTACAN_HAS_LIBURING
+template <typename B>
+using DefaultUringPort = UringPort<B>;
+#endif
+
+template <template <typename> class Port>
+class TestPort : public Port<TestPort<Port>> {
+public:
+    void handleData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        events += "D" + std::to_string(address) + ":" + std::to_string(size) + ";";
+        (void)data;
+    }
+
+    void handleReceipt()
+    {
+        events += "R;";
+    }
+
+    void handleClosed(int error)
+    {
+        (void)error;
+        closed++;
+    }
+
+    std::string events;
+    int closed = 0;
+};
+
+// The port serves the slave side of a pty, the test plays the adapter on the master side
+template <typename P>
+class TransportTest : public ::testing::Test {
+public:
+    void SetUp() override
+    {
+        int slave;
+        ASSERT_EQ(0, openpty(&_master, &slave, nullptr, nullptr, nullptr));
+        ASSERT_TRUE(_port.attach(slave, SerialOptions()));
+    }
+
+    void TearDown() override
+    {
+        _port.close();
+        if (_master >= 0) {
+            close(_master);
+        }
+    }
+
+    void adapterWrite(const std::string& data)
+    {
+        ASSERT_EQ(ssize_t(data.size()), write(_master, data.data(), data.size()));
+    }
+
+    std::string adapterRead(std::size_t size)
+    {
+        std::string result;
+        char buffer[4096];
+        while (result.size() < size) {
+            ssize_t n = read(_master, buffer, sizeof(buffer));
+            if (n <= 0) {
+                break;
+            }
+            result.append(buffer, n);
+        }
+        return result;
+    }
+
+protected:
+    P _port;
+    int _master;
+};
+
+#ifdef DTACAN_HAS_LIBURING
+typedef ::testing::Types<TestPort<DefaultReadWritePort>, TestPort<DefaultUringPort>> PortTypes;
+#else
+typedef ::testing::Types<TestPort<DefaultReadWritePort>> PortTypes;
+#endif
+TYPED_TEST_SUITE(TransportTest, PortTypes);
+
+TYPED_TEST(TransportTest, receives)
+{
+    this->adapterWrite("t1231AA\rz\rT000001002AA");
+    while (this->_port.events.size() < 9 && this->_port.poll(true)) {
+    }
+    this->adapterWrite("BB\r");
+    while (this->_port.events.size() < 16 && this->_port.poll(true)) {
+    }
+    EXPECT_EQ("D291:1;R;D256:2;", this->_port.events);
+}
+
+TYPED_TEST(TransportTest, transmits)
+{
+    uint8_t data[2] = {0x0d, 0x0a};
+    ASSERT_TRUE(this->_port.transmitStdFrame(0x123, data, 2));
+    this->_port.openCanChannel();
+    this->_port.flush();
+    EXPECT_EQ("t12320D0A\rO\r", this->adapterRead(12));
+}
+
+TYPED_TEST(TransportTest, hangup)
+{
+    close(this->_master);
+    this->_master = -1;
+    while (this->_port.poll(true)) {
+    }
+    EXPECT_FALSE(this->_port.isOpen());
+    EXPECT_EQ(1, this->_port.closed);
+}
@@ -0,0 +1,475 @@
+#include "dtacan/Encoder.h"
+#include "dtacan/LogFormat.h"
+#include "dtacan/MappedFile.h"
+#include "dtacan/Parser.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace dtacan;
+
+namespace {
+
+enum class Format { Slcan, Candump, Asc };
+
+bool parseFormat(const char* name, Format* format)
+{
+    if (!std::strcmp(name, "slcan")) {
+        *format = Format::Slcan;
+    } else if (!std::strcmp(name, "candump")) {
+        *format = Format::Candump;
+    } else if (!std::strcmp(name, "asc")) {
+        *format = Format::Asc;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Lines are formatted straight into one large buffer which goes to the file descriptor with a single write when full
+class Output {
+public:
+    static const std::size_t capacity = 1 << 20;
+
+    explicit Output(int fd)
+        : _fd(fd)
+        , _data(new char[capacity])
+        , _size(0)
+        , _failed(false)
+    {
+    }
+
+    ~Output()
+    {
+        delete[] _data;
+    }
+
+    Output(const Output&) = delete;
+    Output& operator=(const Output&) = delete;
+
+    // Room for size chars at cursor, size must not exceed capacity
+    char* reserve(std::size_t size)
+    {
+        if (capacity - _size < size) {
+            flush();
+        }
+        return _data + _size;
+    }
+
+    void commit(std::size_t size)
+    {
+        _size += size;
+    }
+
+    char* cursor()
+    {
+        return _data + _size;
+    }
+
+    void append(const char* data, std::size_t size)
+    {
+        while (size != 0) {
+            std::size_t chunk = std::min(size, std::size_t(capacity));
+            std::memcpy(reserve(chunk), data, chunk);
+            commit(chunk);
+            data += chunk;
+            size -= chunk;
+        }
+    }
+
+    void flush()
+    {
+        const char* it = _data;
+        while (_size != 0 && !_failed) {
+            ssize_t written = ::write(_fd, it, _size);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                std::perror("write");
+                _failed = true;
+                break;
+            }
+            it += written;
+            _size -= written;
+        }
+        _size = 0;
+    }
+
+    bool failed() const
+    {
+        return _failed;
+    }
+
+private:
+    int _fd;
+    char* _data;
+    std::size_t _size;
+    bool _failed;
+};
+
+struct Options {
+    Format from = Format::Slcan;
+    Format to = Format::Candump;
+    std::string iface = "can0";
+    uint64_t startUs = 0;
+    uint64_t stepUs = 1000;
+};
+
+// Writes log frames in the target text format, the ASC header goes out with the first frame
+class LogWriter {
+public:
+    LogWriter(const Options& options, Output* out)
+        : _options(options)
+        , _out(out)
+        , _started(false)
+        , _startUs(0)
+    {
+    }
+
+    void write(const LogFrame& frame)
+    {
+        if (!_started) {
+            start(frame.timestampUs);
+        }
+        if (_options.to == Format::Candump) {
+            std::size_t lineSize = maxCandumpLineSize(_options.iface.size());
+            _out->commit(writeCandumpLine(_out->reserve(lineSize), frame, _options.iface.data(), _options.iface.size()));
+        } else {
+            _out->commit(writeAscLine(_out->reserve(maxAscLineSize), frame, _startUs, 1));
+        }
+    }
+
+    void finish()
+    {
+        if (_options.to == Format::Asc) {
+            if (!_started) {
+                start(_options.startUs);
+            }
+            _out->append(ascFooter, sizeof(ascFooter) - 1);
+        }
+    }
+
+private:
+    void start(uint64_t timestampUs)
+    {
+        _started = true;
+        _startUs = timestampUs;
+        if (_options.to == Format::Asc) {
+            _out->commit(writeAscHeader(_out->reserve(256), std::time_t(timestampUs / 1000000)));
+        }
+    }
+
+    const Options& _options;
+    Output* _out;
+    bool _started;
+    uint64_t _startUs;
+};
+
+// Raw SLCAN has no time, frames get startUs + index * stepUs
+class SlcanInput : public Parser<SlcanInput> {
+public:
+    static const std::size_t frameBatchSize = 256;
+
+    SlcanInput(const Options& options, LogWriter* writer)
+        : _writer(writer)
+        , _nextUs(options.startUs)
+        , _stepUs(options.stepUs)
+    {
+        _frame.isFd = false;
+        _frame.isBitRateSwitch = false;
+    }
+
+    void handleFrames(const Frame* frames, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; i++) {
+            _frame.timestampUs = next();
+            _frame.address = frames[i].address;
+            _frame.isExtended = frames[i].isExtended;
+            _frame.size = frames[i].size;
+            std::memcpy(_frame.data, frames[i].data, 8);
+            _writer->write(_frame);
+        }
+    }
+
+    void handleFdData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        LogFrame frame;
+        frame.timestampUs = next();
+        frame.address = address;
+        frame.isExtended = isExtendedFrame();
+        frame.isFd = true;
+        frame.isBitRateSwitch = isBitRateSwitch();
+        frame.size = size;
+        std::memcpy(frame.data, data, size);
+        _writer->write(frame);
+    }
+
+    void handleJunk(const uint8_t* junk, std::size_t size)
+    {
+        (void)junk;
+        junkBytes += size;
+    }
+
+    uint64_t junkBytes = 0;
+
+private:
+    uint64_t next()
+    {
+        uint64_t timestampUs = _nextUs;
+        _nextUs += _stepUs;
+        return timestampUs;
+    }
+
+    LogWriter* _writer;
+    LogFrame _frame;
+    uint64_t _nextUs;
+    uint64_t _stepUs;
+};
+
+// Splits candump -L text into lines, classic frames bound for SLCAN are encoded in batches
+class CandumpInput : public Encoder<CandumpInput> {
+public:
+    static const std::size_t batchSize = 256;
+
+    CandumpInput(const Options& options, LogWriter* writer, Output* out)
+        : _options(options)
+        , _writer(writer)
+        , _out(out)
+        , _batchNum(0)
+    {
+    }
+
+    // Encoded stream lands in the output buffer already when the batch was encoded there
+    void handleEncodedData(const char* str, std::size_t size)
+    {
+        if (str == _out->cursor()) {
+            _out->commit(size);
+        } else {
+            _out->append(str, size);
+        }
+    }
+
+    // Returns the number of chars consumed, the tail after the last '\n' is left unless last is set
+    std::size_t acceptText(const char* data, std::size_t size, bool last)
+    {
+        const char* it = data;
+        const char* end = data + size;
+        while (it != end) {
+            const char* lineEnd = (const char*)std::memchr(it, '\n', end - it);
+            if (!lineEnd) {
+                if (!last) {
+                    break;
+                }
+                lineEnd = end;
+            }
+            acceptLine(it, lineEnd - it);
+            it = lineEnd == end ? end : lineEnd + 1;
+        }
+        flushBatch();
+        return it - data;
+    }
+
+    uint64_t badLines = 0;
+
+private:
+    void acceptLine(const char* line, std::size_t size)
+    {
+        if (size == 0) {
+            return;
+        }
+        LogFrame* frame = &_batch[_batchNum];
+        if (!parseCandumpLine(line, size, frame)) {
+            badLines++;
+            return;
+        }
+        if (_options.to != Format::Slcan) {
+            _writer->write(*frame);
+        } else if (frame->isFd) {
+            flushBatch();
+            transmitFdFrame(frame->address, frame->data, frame->size, frame->isExtended, frame->isBitRateSwitch);
+        } else {
+            _transmit[_batchNum].address = frame->address;
+            _transmit[_batchNum].data = frame->data;
+            _transmit[_batchNum].size = frame->size;
+            _transmit[_batchNum].isExtended = frame->isExtended;
+            if (++_batchNum == batchSize) {
+                flushBatch();
+            }
+        }
+    }
+
+    void flushBatch()
+    {
+        // 'T', 8 address chars, dlc, 16 data chars and '\r' per frame at most
+        static const std::size_t maxSize = batchSize * 27;
+        const TransmitFrame* it = _transmit;
+        while (_batchNum != 0) {
+            std::size_t encoded = transmitBatch(it, _batchNum, _out->reserve(maxSize), maxSize);
+            if (encoded == 0) {
+                break;
+            }
+            it += encoded;
+            _batchNum -= encoded;
+        }
+        _batchNum = 0;
+    }
+
+    const Options& _options;
+    LogWriter* _writer;
+    Output* _out;
+    LogFrame _batch[batchSize];
+    TransmitFrame _transmit[batchSize];
+    std::size_t _batchNum;
+};
+
+// Whole input at once for files, chunks for pipes. Returns false on read errors
+template <typename F>
+bool readInput(const char* path, F feed)
+{
+    if (path) {
+        MappedFile file;
+        if (file.open(path)) {
+            file.advise(0, file.size(), MADV_SEQUENTIAL);
+            feed(file.data(), file.size(), true);
+            return true;
+        }
+        if (errno != ENODEV && errno != EINVAL) {
+            std::perror(path);
+            return false;
+        }
+    }
+    int fd = path ? ::open(path, O_RDONLY | O_CLOEXEC) : 0;
+    if (fd < 0) {
+        std::perror(path);
+        return false;
+    }
+    static const std::size_t chunkSize = 1 << 20;
+    std::string buffer(2 * chunkSize, '\0');
+    std::size_t kept = 0;
+    bool ok = true;
+    while (true) {
+        ssize_t got = ::read(fd, &buffer[kept], chunkSize);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            std::perror(path ? path : "stdin");
+            ok = false;
+        }
+        bool last = got <= 0;
+        std::size_t size = kept + (got > 0 ? got : 0);
+        std::size_t consumed = feed(buffer.data(), size, last);
+        if (size - consumed > chunkSize) {
+            // a line longer than a chunk is junk anyway, it is fed as it is to make room
+            consumed += feed(buffer.data() + consumed, size - consumed, true);
+        }
+        kept = size - consumed;
+        std::memmove(&buffer[0], buffer.data() + consumed, kept);
+        if (last) {
+            break;
+        }
+    }
+    if (path) {
+        ::close(fd);
+    }
+    return ok;
+}
+
+void usage(const char* name)
+{
+    std::printf("usage: %s [--from slcan|candump] [--to candump|asc|slcan] [--iface NAME] [--start SEC] [--step-us N]\n"
+                "       [INPUT [OUTPUT]]\n"
+                "Converts raw SLCAN captures to candump -L or Vector ASC logs and candump -L logs back to SLCAN.\n"
+                "SLCAN carries no time, its frames are stamped from --start in steps of --step-us. Standard input\n"
+                "and output are used when no files are given\n",
+                name);
+}
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    const char* paths[2] = {nullptr, nullptr};
+    std::size_t pathNum = 0;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (!std::strcmp(arg, "--from") && hasValue) {
+            if (!parseFormat(argv[++i], &options.from) || options.from == Format::Asc) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (!std::strcmp(arg, "--to") && hasValue) {
+            if (!parseFormat(argv[++i], &options.to)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (!std::strcmp(arg, "--iface") && hasValue) {
+            options.iface = argv[++i];
+        } else if (!std::strcmp(arg, "--start") && hasValue) {
+            options.startUs = uint64_t(std::strtod(argv[++i], nullptr) * 1e6);
+        } else if (!std::strcmp(arg, "--step-us") && hasValue) {
+            options.stepUs = std::strtoull(argv[++i], nullptr, 0);
+        } else if ((arg[0] != '-' || !arg[1]) && pathNum < 2) {
+            paths[pathNum++] = std::strcmp(arg, "-") ? arg : nullptr;
+        } else {
+            usage(argv[0]);
+            return arg == std::string("--help") ? 0 : 1;
+        }
+    }
+    if (options.from == Format::Slcan && options.to == Format::Slcan) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (options.iface.empty() || options.iface.size() > 64 || options.iface.find(' ') != std::string::npos) {
+        std::fprintf(stderr, "bad interface name\n");
+        return 1;
+    }
+
+    int outFd = 1;
+    if (paths[1]) {
+        outFd = ::open(paths[1], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (outFd < 0) {
+            std::perror(paths[1]);
+            return 1;
+        }
+    }
+    Output out(outFd);
+    LogWriter writer(options, &out);
+    bool ok;
+    if (options.from == Format::Slcan) {
+        SlcanInput parser(options, &writer);
+        ok = readInput(paths[0], [&](const char* data, std::size_t size, bool last) {
+            (void)last;
+            parser.acceptData(data, size);
+            return size;
+        });
+        if (parser.junkBytes != 0) {
+            std::fprintf(stderr, "skipped %llu bytes of junk\n", (unsigned long long)parser.junkBytes);
+        }
+    } else {
+        CandumpInput input(options, &writer, &out);
+        ok = readInput(paths[0], [&](const char* data, std::size_t size, bool last) {
+            return input.acceptText(data, size, last);
+        });
+        if (input.badLines != 0) {
+            std::fprintf(stderr, "skipped %llu malformed lines\n", (unsigned long long)input.badLines);
+        }
+    }
+    writer.finish();
+    out.flush();
+    if (paths[1] && ::close(outFd) != 0) {
+        std::perror(paths[1]);
+        return 1;
+    }
+    return ok && !out.failed() ? 0 : 1;
+}
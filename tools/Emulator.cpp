@@ -0,0 +1,178 @@
+#include "dtacan/AdapterEmulator.h"
+#include "dtacan/Tty.h"
+
+#include <pty.h>
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+using namespace dtacan;
+
+namespace {
+
+volatile std::sig_atomic_t stopRequested = 0;
+
+void requestStop(int)
+{
+    stopRequested = 1;
+}
+
+// Output is collected and written to the pty master in one go after every advance
+class PtyEmulator : public AdapterEmulator<PtyEmulator, 256> {
+public:
+    explicit PtyEmulator(const EmulatorOptions& options)
+        : AdapterEmulator<PtyEmulator, 256>(options)
+    {
+    }
+
+    void handleOutput(const char* data, std::size_t size)
+    {
+        output.append(data, size);
+    }
+
+    std::string output;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+uint64_t nanosecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+}
+
+void usage(const char* name)
+{
+    std::printf("usage: %s [--baud 0-8] [--load 0-1] [--ext-permille N] [--size -1|0-8] [--junk-permille N]\n"
+                "          [--latency-us N] [--seed N] [--open]\n"
+                "Emulates a DTA adapter on a pseudo terminal, its path is printed on start\n",
+                name);
+}
+}
+
+int main(int argc, char** argv)
+{
+    EmulatorOptions options;
+    bool openAtStart = false;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (!std::strcmp(arg, "--baud") && hasValue) {
+            if (!baudRateFromChar(argv[++i][0], &options.baudRate)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (!std::strcmp(arg, "--load") && hasValue) {
+            options.busLoad = std::atof(argv[++i]);
+        } else if (!std::strcmp(arg, "--ext-permille") && hasValue) {
+            options.extPermille = std::atoi(argv[++i]);
+        } else if (!std::strcmp(arg, "--size") && hasValue) {
+            options.frameSize = std::atoi(argv[++i]);
+        } else if (!std::strcmp(arg, "--junk-permille") && hasValue) {
+            options.junkPermille = std::atoi(argv[++i]);
+        } else if (!std::strcmp(arg, "--latency-us") && hasValue) {
+            options.replyLatencyNs = std::strtoull(argv[++i], nullptr, 0) * 1000;
+        } else if (!std::strcmp(arg, "--seed") && hasValue) {
+            options.seed = std::strtoull(argv[++i], nullptr, 0);
+        } else if (!std::strcmp(arg, "--open")) {
+            openAtStart = true;
+        } else {
+            usage(argv[0]);
+            return arg == std::string("--help") ? 0 : 1;
+        }
+    }
+
+    int master;
+    int slave;
+    if (openpty(&master, &slave, nullptr, nullptr, nullptr) != 0) {
+        std::perror("openpty");
+        return 1;
+    }
+    // the slave stays open here so the master doesn't hang up between host sessions
+    if (!configureSerialPort(slave, SerialOptions())) {
+        std::perror("tcsetattr");
+        return 1;
+    }
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    std::printf("%s\n", ttyname(slave));
+    std::fflush(stdout);
+
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+
+    PtyEmulator emulator(options);
+    if (openAtStart) {
+        emulator.acceptData("O\r", 2);
+        emulator.output.clear();
+    }
+    Clock::time_point start = Clock::now();
+    uint64_t nextReport = 1000000000;
+    EmulatorStats reported;
+    std::size_t pending = 0;
+    char buffer[4096];
+
+    while (!stopRequested) {
+        uint64_t now = nanosecondsSince(start);
+        emulator.advance(now);
+
+        // output the host doesn't read is dropped from the front, like a full adapter buffer would
+        if (emulator.output.size() > 1024 * 1024) {
+            emulator.output.erase(0, emulator.output.size() - 1024 * 1024);
+            pending = 0;
+        }
+        while (pending < emulator.output.size()) {
+            ssize_t written = write(master, emulator.output.data() + pending, emulator.output.size() - pending);
+            if (written <= 0) {
+                break;
+            }
+            pending += written;
+        }
+        if (pending == emulator.output.size()) {
+            emulator.output.clear();
+            pending = 0;
+        }
+
+        if (now >= nextReport) {
+            const EmulatorStats& stats = emulator.stats();
+            std::fprintf(stderr, "load %5.1f%%  rx %8llu  tx %8llu  junk %6llu  nacks %6llu  dropped %6llu\n",
+                         100.0 * (stats.busyNs - reported.busyNs) / 1e9,
+                         (unsigned long long)(stats.generatedFrames - reported.generatedFrames),
+                         (unsigned long long)(stats.hostFrames - reported.hostFrames),
+                         (unsigned long long)(stats.junkFrames - reported.junkFrames),
+                         (unsigned long long)(stats.nacks - reported.nacks),
+                         (unsigned long long)(stats.droppedReplies - reported.droppedReplies));
+            reported = stats;
+            nextReport += 1000000000;
+        }
+
+        uint64_t wakeup = emulator.nextEventTime();
+        if (wakeup > nextReport) {
+            wakeup = nextReport;
+        }
+        uint64_t wait = wakeup > now ? wakeup - now : 0;
+        timespec timeout = {time_t(wait / 1000000000), long(wait % 1000000000)};
+        pollfd pfd = {master, short(POLLIN | (emulator.output.empty() ? 0 : POLLOUT)), 0};
+        if (ppoll(&pfd, 1, &timeout, nullptr) < 0 && errno != EINTR) {
+            std::perror("ppoll");
+            return 1;
+        }
+        if (pfd.revents & POLLIN) {
+            ssize_t size = read(master, buffer, sizeof(buffer));
+            if (size > 0) {
+                emulator.advance(nanosecondsSince(start));
+                emulator.acceptData(buffer, size);
+            }
+        }
+    }
+    close(master);
+    close(slave);
+    return 0;
+}
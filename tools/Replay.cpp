@@ -0,0 +1,157 @@
+#include "dtacan/CaptureReplay.h"
+#include "dtacan/Parser.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace dtacan;
+
+namespace {
+
+// Counts what the capture holds, frames are batched as a real consumer would take them
+class CountingParser : public Parser<CountingParser> {
+public:
+    static const std::size_t frameBatchSize = 256;
+
+    void handleFrames(const Frame* frames, std::size_t count)
+    {
+        (void)frames;
+        this->frames += count;
+    }
+
+    void handleFdData(uint32_t address, const uint8_t* data, std::size_t size)
+    {
+        (void)address;
+        (void)data;
+        (void)size;
+        fdFrames++;
+    }
+
+    void handleJunk(const uint8_t* junk, std::size_t size)
+    {
+        (void)junk;
+        junkBytes += size;
+    }
+
+    void handleReceipt()
+    {
+        receipts++;
+    }
+
+    void handleNack()
+    {
+        nacks++;
+    }
+
+    uint64_t frames = 0;
+    uint64_t fdFrames = 0;
+    uint64_t junkBytes = 0;
+    uint64_t receipts = 0;
+    uint64_t nacks = 0;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Evicts the file from the page cache, so the replay measures the disk rather than memory
+bool dropPageCache(const char* path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = fdatasync(fd) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return ok;
+}
+
+void usage(const char* name)
+{
+    std::printf("usage: %s [--window-mb N] [--repeat N] [--no-hugepages] [--keep-mapped] [--drop-cache] CAPTURE\n"
+                "Replays a raw SLCAN capture through the Parser from a memory mapping and reports throughput\n",
+                name);
+}
+}
+
+int main(int argc, char** argv)
+{
+    ReplayOptions options;
+    int repeat = 1;
+    bool dropCache = false;
+    const char* path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (!std::strcmp(arg, "--window-mb") && hasValue) {
+            options.windowSize = std::strtoull(argv[++i], nullptr, 0) * 1024 * 1024;
+        } else if (!std::strcmp(arg, "--repeat") && hasValue) {
+            repeat = std::atoi(argv[++i]);
+        } else if (!std::strcmp(arg, "--no-hugepages")) {
+            options.hugePages = false;
+        } else if (!std::strcmp(arg, "--keep-mapped")) {
+            options.dropBehind = false;
+        } else if (!std::strcmp(arg, "--drop-cache")) {
+            dropCache = true;
+        } else if (arg[0] != '-' && !path) {
+            path = arg;
+        } else {
+            usage(argv[0]);
+            return arg == std::string("--help") ? 0 : 1;
+        }
+    }
+    if (!path || repeat < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (dropCache && !dropPageCache(path)) {
+        std::perror("posix_fadvise");
+    }
+
+    CaptureReplay capture;
+    if (!capture.open(path, options)) {
+        std::perror(path);
+        return 1;
+    }
+
+    CountingParser parser;
+    Clock::time_point start = Clock::now();
+    double nextReport = 1.0;
+    for (int run = 0; run < repeat; run++) {
+        capture.rewind();
+        while (capture.replayWindow(parser)) {
+            double elapsed = secondsSince(start);
+            if (elapsed >= nextReport) {
+                double done = double(run) * capture.size() + capture.offset();
+                std::fprintf(stderr, "%8.2f GB  %7.2f GB/s\n", done / 1e9, done / 1e9 / elapsed);
+                nextReport = elapsed + 1.0;
+            }
+        }
+    }
+    double seconds = secondsSince(start);
+
+    double bytes = double(capture.size()) * repeat;
+    double frames = double(parser.frames + parser.fdFrames);
+    std::printf("bytes     %.0f\n"
+                "frames    %llu\n"
+                "fd frames %llu\n"
+                "receipts  %llu\n"
+                "nacks     %llu\n"
+                "junk      %llu bytes\n"
+                "time      %.3f s\n"
+                "rate      %.3f GB/s  %.2f Mframes/s\n",
+                bytes, (unsigned long long)parser.frames, (unsigned long long)parser.fdFrames,
+                (unsigned long long)parser.receipts, (unsigned long long)parser.nacks,
+                (unsigned long long)parser.junkBytes, seconds, seconds > 0 ? bytes / 1e9 / seconds : 0.0,
+                seconds > 0 ? frames / 1e6 / seconds : 0.0);
+    return 0;
+}